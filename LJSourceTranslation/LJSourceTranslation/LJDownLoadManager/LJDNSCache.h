@@ -0,0 +1,52 @@
+//
+//  LJDNSCache.h
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/19.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+typedef void(^LJDNSResolveBlock)(NSArray<NSData *> *addresses);
+
+/**
+ 域名解析结果的缓存，在后台队列调用getaddrinfo，结果按TTL缓存
+ 同一个host:port同时只有一次解析，后来的调用等同一个结果
+ 线程安全
+ */
+@interface LJDNSCache : NSObject
+
+/** 共享的缓存 */
++ (instancetype)sharedCache;
+
+/** 解析成功的结果缓存的时间，getaddrinfo拿不到记录本身的TTL，默认60秒 */
+@property (nonatomic, assign) NSTimeInterval ttl;
+
+/** 解析失败的结果缓存的时间，避免连续请求一个解析不了的域名，默认5秒 */
+@property (nonatomic, assign) NSTimeInterval negativeTTL;
+
+/**
+ 取缓存中还没过期的解析结果
+
+ @param host 域名
+ @param port 端口
+ @return sockaddr数组，没有缓存或者已经过期返回nil，缓存的是解析失败返回空数组
+ */
+- (NSArray<NSData *> *)cachedAddressesForHost:(NSString *)host port:(NSUInteger)port;
+
+/**
+ 解析域名，缓存中有没过期的结果时直接在调用线程回调
+
+ @param host 域名
+ @param port 端口
+ @param completion 回调，解析失败时addresses是空数组；不在主线程时可能在任意后台线程
+ */
+- (void)resolveHost:(NSString *)host port:(NSUInteger)port completion:(LJDNSResolveBlock)completion;
+
+/**
+ 清空缓存，网络切换后调用
+ */
+- (void)removeAllAddresses;
+
+@end
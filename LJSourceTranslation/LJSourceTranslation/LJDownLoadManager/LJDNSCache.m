@@ -0,0 +1,140 @@
+//
+//  LJDNSCache.m
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/19.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import "LJDNSCache.h"
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <netdb.h>
+
+@interface LJDNSCacheEntry : NSObject
+@property (nonatomic, strong) NSArray<NSData *> *addresses;
+@property (nonatomic, assign) CFAbsoluteTime expireTime;
+@end
+
+@implementation LJDNSCacheEntry
+@end
+
+@interface LJDNSCache()
+// host:port -> 解析结果
+@property (nonatomic, strong) NSMutableDictionary<NSString *, LJDNSCacheEntry *> *entries;
+// host:port -> 等待解析结果的回调
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSMutableArray<LJDNSResolveBlock> *> *pendingBlocks;
+@end
+
+@implementation LJDNSCache
++ (instancetype)sharedCache {
+    static LJDNSCache *_cache;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _cache = [[self alloc] init];
+    });
+    return _cache;
+}
+
+- (instancetype)init {
+    if (self = [super init]) {
+        _ttl = 60;
+        _negativeTTL = 5;
+        _entries = [NSMutableDictionary dictionary];
+        _pendingBlocks = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (NSString *)keyForHost:(NSString *)host port:(NSUInteger)port {
+    return [NSString stringWithFormat:@"%@:%lu", [host lowercaseString], (unsigned long)port];
+}
+
+- (NSArray<NSData *> *)cachedAddressesForHost:(NSString *)host port:(NSUInteger)port {
+    NSString *key = [self keyForHost:host port:port];
+    @synchronized (self) {
+        LJDNSCacheEntry *entry = self.entries[key];
+        if (!entry) {
+            return nil;
+        }
+        if (entry.expireTime <= CFAbsoluteTimeGetCurrent()) {
+            [self.entries removeObjectForKey:key];
+            return nil;
+        }
+        return entry.addresses;
+    }
+}
+
+- (void)resolveHost:(NSString *)host port:(NSUInteger)port completion:(LJDNSResolveBlock)completion {
+    if (host.length == 0) {
+        if (completion) {
+            completion(@[]);
+        }
+        return;
+    }
+    NSArray<NSData *> *cached = [self cachedAddressesForHost:host port:port];
+    if (cached) {
+        if (completion) {
+            completion(cached);
+        }
+        return;
+    }
+    NSString *key = [self keyForHost:host port:port];
+    @synchronized (self) {
+        NSMutableArray *blocks = self.pendingBlocks[key];
+        if (blocks) {
+            // 已经在解析了，等同一个结果
+            if (completion) {
+                [blocks addObject:completion];
+            }
+            return;
+        }
+        blocks = [NSMutableArray array];
+        if (completion) {
+            [blocks addObject:completion];
+        }
+        self.pendingBlocks[key] = blocks;
+    }
+    // getaddrinfo是阻塞的，放到后台队列
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        NSArray<NSData *> *addresses = [self addressesByResolvingHost:host port:port];
+        NSArray<LJDNSResolveBlock> *blocks = nil;
+        @synchronized (self) {
+            LJDNSCacheEntry *entry = [[LJDNSCacheEntry alloc] init];
+            entry.addresses = addresses;
+            entry.expireTime = CFAbsoluteTimeGetCurrent() + (addresses.count > 0 ? self.ttl : self.negativeTTL);
+            self.entries[key] = entry;
+            blocks = self.pendingBlocks[key];
+            [self.pendingBlocks removeObjectForKey:key];
+        }
+        for (LJDNSResolveBlock block in blocks) {
+            block(addresses);
+        }
+    });
+}
+
+- (NSArray<NSData *> *)addressesByResolvingHost:(NSString *)host port:(NSUInteger)port {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_protocol = IPPROTO_TCP;
+    struct addrinfo *result = NULL;
+    NSString *service = [NSString stringWithFormat:@"%lu", (unsigned long)port];
+    int status = getaddrinfo(host.UTF8String, service.UTF8String, &hints, &result);
+    NSMutableArray<NSData *> *addresses = [NSMutableArray array];
+    for (struct addrinfo *info = result; status == 0 && info; info = info->ai_next) {
+        [addresses addObject:[NSData dataWithBytes:info->ai_addr length:info->ai_addrlen]];
+    }
+    if (result) {
+        freeaddrinfo(result);
+    }
+    return addresses;
+}
+
+- (void)removeAllAddresses {
+    @synchronized (self) {
+        [self.entries removeAllObjects];
+    }
+}
+@end
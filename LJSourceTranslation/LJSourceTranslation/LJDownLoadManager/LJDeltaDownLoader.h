@@ -0,0 +1,75 @@
+//
+//  LJDeltaDownLoader.h
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/16.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "LJDownLoader.h"
+#import "LJDownLoadTransport.h"
+
+extern NSString * const LJDeltaDownLoadErrorDomain;
+
+typedef NS_ENUM(NSInteger, LJDeltaDownLoadError) {
+    /** 校验清单下载失败或格式不对 */
+    LJDeltaDownLoadErrorInvalidManifest = 1,
+    /** 服务器的Range响应无法解析 */
+    LJDeltaDownLoadErrorBadResponse,
+    /** 拼好的文件和清单中的md5不一致 */
+    LJDeltaDownLoadErrorDigestMismatch,
+    /** 临时文件写入失败 */
+    LJDeltaDownLoadErrorWriteFailed
+};
+
+/**
+ 增量下载(zsync方式)
+ 服务器在文件旁边发布一份分块校验清单(JSON)：
+ {"length": 文件长度, "blockSize": 块大小, "md5": 整个文件的md5, "blocks": [[弱校验, "块的md5"], ...]}
+ 下载时用滚动校验在旧版本文件中查找没有变化的块，直接拷贝到新文件，
+ 只用多段Range请求下载变化的块，拼好后校验整个文件的md5，成功后替换旧版本
+ */
+@interface LJDeltaDownLoader : NSObject
+
+@property (nonatomic, copy) LJDownLoadProgressBlock progressBlock;
+@property (nonatomic, copy) LJDownLoadSucessBlock successBlock;
+@property (nonatomic, copy) LJDownLoadFailBlock failBlock;
+
+/** 收发数据使用的传输层，默认是共享的LJURLSessionTransport */
+@property (nonatomic, strong) id<LJDownLoadTransport> transport;
+
+/** 旧版本文件的路径，默认是同一个url之前下载好的缓存文件 */
+@property (nonatomic, copy) NSString *basePath;
+
+@property (nonatomic, assign, readonly) LJDownLoadStatus downLoadStatus;
+
+/** 从旧版本中复用的字节数 */
+@property (nonatomic, assign, readonly) long long reusedLength;
+
+/** 实际从网络下载的字节数(不含清单) */
+@property (nonatomic, assign, readonly) long long transferredLength;
+
+/**
+ 生成文件的分块校验清单，发布新版本时使用
+
+ @param path 文件路径
+ @param blockSize 块大小，一般取4KB到64KB
+ @return 可以直接序列化成JSON的字典，文件读取失败时返回nil
+ */
++ (NSDictionary *)manifestForFileAtPath:(NSString *)path blockSize:(NSUInteger)blockSize;
+
+/**
+ 增量下载
+
+ @param url 新版本文件的url
+ @param manifestURL 新版本的分块校验清单
+ @param success 成功回调，参数是新版本文件的路径
+ @param fail 失败回调
+ */
+- (void)downLoadWithURL:(NSURL *)url manifestURL:(NSURL *)manifestURL success:(LJDownLoadSucessBlock)success fail:(LJDownLoadFailBlock)fail;
+
+// 取消
+- (void)cancel;
+
+@end
@@ -0,0 +1,661 @@
+//
+//  LJDeltaDownLoader.m
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/16.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import "LJDeltaDownLoader.h"
+#import "LJDownLoadFileTool.h"
+#import "LJDownLoadFileWriter.h"
+#import "LJDownLoadRangeSet.h"
+#import "LJURLSessionTransport.h"
+#import "NSString+LJMD5.h"
+#import <CommonCrypto/CommonDigest.h>
+
+NSString * const LJDeltaDownLoadErrorDomain = @"LJDeltaDownLoadErrorDomain";
+
+// 一个请求最多带32段Range，避免请求头过长
+static const NSUInteger kLJDeltaMaxRangesPerRequest = 32;
+
+// rsync的弱校验：a是字节和，b是加权和，都只保留低16位
+static uint32_t LJDeltaWeakChecksum(const uint8_t *bytes, size_t length, uint32_t *outA, uint32_t *outB) {
+    uint32_t a = 0;
+    uint32_t b = 0;
+    for (size_t i = 0; i < length; i++) {
+        a += bytes[i];
+        b += (uint32_t)(length - i) * bytes[i];
+    }
+    a &= 0xffff;
+    b &= 0xffff;
+    if (outA) {
+        *outA = a;
+    }
+    if (outB) {
+        *outB = b;
+    }
+    return (b << 16) | a;
+}
+
+// 窗口向后滑动一个字节，O(1)更新弱校验
+static inline uint32_t LJDeltaRollChecksum(uint32_t *a, uint32_t *b, uint8_t outByte, uint8_t inByte, size_t length) {
+    *a = (*a - outByte + inByte) & 0xffff;
+    *b = (*b - (uint32_t)(length * outByte) + *a) & 0xffff;
+    return (*b << 16) | *a;
+}
+
+static NSString *LJDeltaHexString(const unsigned char *bytes, NSUInteger length) {
+    NSMutableString *result = [NSMutableString stringWithCapacity:length * 2];
+    for (NSUInteger i = 0; i < length; i++) {
+        [result appendFormat:@"%02x", bytes[i]];
+    }
+    return result;
+}
+
+static NSData *LJDeltaDataFromHexString(NSString *string) {
+    if (![string isKindOfClass:[NSString class]] || string.length != CC_MD5_DIGEST_LENGTH * 2) {
+        return nil;
+    }
+    NSMutableData *data = [NSMutableData dataWithLength:CC_MD5_DIGEST_LENGTH];
+    unsigned char *bytes = data.mutableBytes;
+    const char *hex = string.UTF8String;
+    for (NSUInteger i = 0; i < CC_MD5_DIGEST_LENGTH; i++) {
+        unsigned int value = 0;
+        if (sscanf(hex + i * 2, "%2x", &value) != 1) {
+            return nil;
+        }
+        bytes[i] = (unsigned char)value;
+    }
+    return data;
+}
+
+// Content-Range: bytes 100-199/1000
+static BOOL LJDeltaParseContentRange(NSString *value, long long *start) {
+    NSString *bytes = [[value stringByReplacingOccurrencesOfString:@"bytes" withString:@""] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+    NSArray<NSString *> *parts = [bytes componentsSeparatedByString:@"-"];
+    if (parts.count < 2 || parts.firstObject.length == 0) {
+        return NO;
+    }
+    *start = parts.firstObject.longLongValue;
+    return YES;
+}
+
+// 引用data的一部分，不拷贝
+static dispatch_data_t LJDeltaDispatchData(NSData *data, NSUInteger offset, NSUInteger length) {
+    return dispatch_data_create((const char *)data.bytes + offset, length, NULL, ^{
+        (void)data;
+    });
+}
+
+typedef NS_ENUM(NSInteger, LJDeltaMultipartState) {
+    /** 第一个分隔符之前的内容 */
+    LJDeltaMultipartStatePreamble,
+    /** 分隔符之后，判断是结束还是下一段 */
+    LJDeltaMultipartStateAfterDelimiter,
+    /** 读每一段的头 */
+    LJDeltaMultipartStateHeaders,
+    /** 读每一段的数据 */
+    LJDeltaMultipartStateBody,
+    /** 读到了结束分隔符 */
+    LJDeltaMultipartStateDone
+};
+
+/**
+ multipart/byteranges响应的流式解析，每一段的数据按Content-Range中的偏移交出去
+ */
+@interface LJDeltaMultipartParser : NSObject
+@property (nonatomic, assign, readonly) BOOL finished;
+- (instancetype)initWithBoundary:(NSString *)boundary;
+// 格式错误时返回NO
+- (BOOL)consumeData:(NSData *)data partHandler:(void(^)(long long offset, NSData *data))handler;
+@end
+
+@interface LJDeltaMultipartParser()
+@property (nonatomic, strong) NSData *delimiter;
+@property (nonatomic, strong) NSMutableData *pending;
+@property (nonatomic, assign) LJDeltaMultipartState state;
+@property (nonatomic, assign) long long partOffset;
+@end
+
+@implementation LJDeltaMultipartParser
+- (instancetype)initWithBoundary:(NSString *)boundary {
+    if (self = [super init]) {
+        _delimiter = [[NSString stringWithFormat:@"\r\n--%@", boundary] dataUsingEncoding:NSUTF8StringEncoding];
+        // 第一个分隔符前面可能没有\r\n，补上之后所有分隔符的形式都一样
+        _pending = [NSMutableData dataWithBytes:"\r\n" length:2];
+        _state = LJDeltaMultipartStatePreamble;
+    }
+    return self;
+}
+
+- (BOOL)finished {
+    return self.state == LJDeltaMultipartStateDone;
+}
+
+- (void)removeBytes:(NSUInteger)length {
+    [self.pending replaceBytesInRange:NSMakeRange(0, length) withBytes:NULL length:0];
+}
+
+- (NSRange)rangeOfData:(NSData *)data {
+    return [self.pending rangeOfData:data options:0 range:NSMakeRange(0, self.pending.length)];
+}
+
+- (BOOL)consumeData:(NSData *)data partHandler:(void(^)(long long offset, NSData *data))handler {
+    [self.pending appendData:data];
+    // 分隔符可能被拆在两次数据中，末尾保留分隔符长度-1个字节
+    NSUInteger keep = self.delimiter.length - 1;
+    while (YES) {
+        switch (self.state) {
+            case LJDeltaMultipartStatePreamble:
+            case LJDeltaMultipartStateBody: {
+                NSRange range = [self rangeOfData:self.delimiter];
+                NSUInteger length = range.location != NSNotFound ? range.location : (self.pending.length > keep ? self.pending.length - keep : 0);
+                if (self.state == LJDeltaMultipartStateBody && length > 0) {
+                    handler(self.partOffset, [self.pending subdataWithRange:NSMakeRange(0, length)]);
+                    self.partOffset += length;
+                }
+                if (range.location == NSNotFound) {
+                    [self removeBytes:length];
+                    return YES;
+                }
+                [self removeBytes:NSMaxRange(range)];
+                self.state = LJDeltaMultipartStateAfterDelimiter;
+                break;
+            }
+            case LJDeltaMultipartStateAfterDelimiter: {
+                if (self.pending.length < 2) {
+                    return YES;
+                }
+                if (memcmp(self.pending.bytes, "--", 2) == 0) {
+                    self.state = LJDeltaMultipartStateDone;
+                    break;
+                }
+                // 分隔符这一行后面允许有空白
+                NSRange range = [self rangeOfData:[NSData dataWithBytes:"\r\n" length:2]];
+                if (range.location == NSNotFound) {
+                    return self.pending.length < 1024;
+                }
+                [self removeBytes:NSMaxRange(range)];
+                self.state = LJDeltaMultipartStateHeaders;
+                break;
+            }
+            case LJDeltaMultipartStateHeaders: {
+                NSRange range = [self rangeOfData:[NSData dataWithBytes:"\r\n\r\n" length:4]];
+                if (range.location == NSNotFound) {
+                    return self.pending.length < 8192;
+                }
+                NSString *headers = [[NSString alloc] initWithData:[self.pending subdataWithRange:NSMakeRange(0, range.location)] encoding:NSISOLatin1StringEncoding];
+                [self removeBytes:NSMaxRange(range)];
+                BOOL found = NO;
+                for (NSString *line in [headers componentsSeparatedByString:@"\r\n"]) {
+                    NSRange colon = [line rangeOfString:@":"];
+                    if (colon.location == NSNotFound) {
+                        continue;
+                    }
+                    NSString *name = [[line substringToIndex:colon.location] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+                    if ([name caseInsensitiveCompare:@"Content-Range"] != NSOrderedSame) {
+                        continue;
+                    }
+                    long long start = 0;
+                    found = LJDeltaParseContentRange([line substringFromIndex:NSMaxRange(colon)], &start);
+                    self.partOffset = start;
+                }
+                if (!found) {
+                    return NO;
+                }
+                self.state = LJDeltaMultipartStateBody;
+                break;
+            }
+            case LJDeltaMultipartStateDone:
+                [self.pending setLength:0];
+                return YES;
+        }
+    }
+}
+@end
+
+typedef NS_ENUM(NSInteger, LJDeltaPhase) {
+    /** 下载校验清单 */
+    LJDeltaPhaseManifest,
+    /** 下载变化的块 */
+    LJDeltaPhaseRanges
+};
+
+@interface LJDeltaDownLoader()<LJDownLoadTransportDelegate>
+@property (nonatomic, strong) NSURL *url;
+@property (nonatomic, strong) NSURL *manifestURL;
+@property (nonatomic, copy) NSString *cacheFilePath;
+@property (nonatomic, copy) NSString *tempFilePath;
+@property (nonatomic, assign, readwrite) LJDownLoadStatus downLoadStatus;
+@property (nonatomic, assign, readwrite) long long reusedLength;
+@property (nonatomic, assign, readwrite) long long transferredLength;
+
+// 以下只在代理队列中使用
+@property (nonatomic, strong) NSOperationQueue *queue;
+@property (nonatomic, strong) id<LJDownLoadTransportTask> dataTask;
+@property (nonatomic, assign) LJDeltaPhase phase;
+@property (nonatomic, strong) NSMutableData *manifestData;
+@property (nonatomic, assign) long long fileLength;
+@property (nonatomic, assign) NSUInteger blockSize;
+@property (nonatomic, copy) NSString *digest;
+// 每块的弱校验(uint32_t数组)和md5(每块16字节)
+@property (nonatomic, strong) NSData *weakSums;
+@property (nonatomic, strong) NSData *strongSums;
+// 还没下载的范围
+@property (nonatomic, strong) NSMutableArray<NSValue *> *pendingRanges;
+@property (nonatomic, strong) LJDownLoadFileWriter *writer;
+@property (nonatomic, assign) int writeError;
+// 当前响应
+@property (nonatomic, strong) LJDeltaMultipartParser *multipartParser;
+@property (nonatomic, assign) long long responseOffset;
+@property (nonatomic, assign) BOOL fullResponse;
+@property (nonatomic, assign) BOOL finished;
+@end
+
+@implementation LJDeltaDownLoader
+- (instancetype)init {
+    if (self = [super init]) {
+        _queue = [[NSOperationQueue alloc] init];
+        _queue.maxConcurrentOperationCount = 1;
+        _pendingRanges = [NSMutableArray array];
+    }
+    return self;
+}
+
+- (id<LJDownLoadTransport>)transport {
+    if (!_transport) {
+        _transport = [LJURLSessionTransport defaultTransport];
+    }
+    return _transport;
+}
+
++ (NSDictionary *)manifestForFileAtPath:(NSString *)path blockSize:(NSUInteger)blockSize {
+    NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:nil];
+    if (!data || blockSize == 0) {
+        return nil;
+    }
+    const uint8_t *bytes = data.bytes;
+    NSMutableArray *blocks = [NSMutableArray arrayWithCapacity:(data.length + blockSize - 1) / blockSize];
+    for (NSUInteger offset = 0; offset < data.length; offset += blockSize) {
+        NSUInteger length = MIN(blockSize, data.length - offset);
+        unsigned char digest[CC_MD5_DIGEST_LENGTH];
+        CC_MD5(bytes + offset, (CC_LONG)length, digest);
+        [blocks addObject:@[@(LJDeltaWeakChecksum(bytes + offset, length, NULL, NULL)), LJDeltaHexString(digest, CC_MD5_DIGEST_LENGTH)]];
+    }
+    return @{@"length" : @(data.length),
+             @"blockSize" : @(blockSize),
+             @"md5" : [LJDownLoadFileTool md5WithPath:path] ?: @"",
+             @"blocks" : blocks};
+}
+
+- (void)downLoadWithURL:(NSURL *)url manifestURL:(NSURL *)manifestURL success:(LJDownLoadSucessBlock)success fail:(LJDownLoadFailBlock)fail {
+    self.successBlock = success;
+    self.failBlock = fail;
+    self.url = url;
+    self.manifestURL = manifestURL;
+    // 和LJDownLoader的缓存路径一致，新版本下载好后替换旧版本
+    if (![LJDownLoadFileTool isLegacyLayoutMigrated]) {
+        [LJDownLoadFileTool migrateLegacyFilesForURL:url];
+    }
+    self.cacheFilePath = [LJDownLoadFileTool cacheFilePathForURL:url];
+    self.tempFilePath = [[LJDownLoadFileTool tempFilePathForURL:url] stringByAppendingString:@".delta"];
+    if (!self.basePath) {
+        self.basePath = self.cacheFilePath;
+    }
+    self.downLoadStatus = LJDownLoadStatusDownLoading;
+    [self.queue addOperationWithBlock:^{
+        [self requestManifest];
+    }];
+}
+
+- (void)cancel {
+    [self.queue addOperationWithBlock:^{
+        [self.dataTask cancel];
+    }];
+}
+
+#pragma mark - 下载流程
+// 以下方法都在代理队列中调用
+- (void)requestManifest {
+    self.phase = LJDeltaPhaseManifest;
+    self.manifestData = [NSMutableData data];
+    self.dataTask = [self.transport dataTaskWithRequest:[NSURLRequest requestWithURL:self.manifestURL] delegate:self delegateQueue:self.queue];
+    [self.dataTask resume];
+}
+
+- (BOOL)parseManifest:(NSData *)data {
+    NSDictionary *manifest = [NSJSONSerialization JSONObjectWithData:data options:0 error:nil];
+    if (![manifest isKindOfClass:[NSDictionary class]]) {
+        return NO;
+    }
+    long long length = [manifest[@"length"] longLongValue];
+    NSUInteger blockSize = [manifest[@"blockSize"] unsignedIntegerValue];
+    NSArray *blocks = manifest[@"blocks"];
+    NSString *digest = manifest[@"md5"];
+    if (length <= 0 || blockSize == 0 || ![blocks isKindOfClass:[NSArray class]] || ![digest isKindOfClass:[NSString class]]) {
+        return NO;
+    }
+    if ((long long)blocks.count != (length + blockSize - 1) / blockSize) {
+        return NO;
+    }
+    NSMutableData *weakSums = [NSMutableData dataWithLength:blocks.count * sizeof(uint32_t)];
+    NSMutableData *strongSums = [NSMutableData dataWithCapacity:blocks.count * CC_MD5_DIGEST_LENGTH];
+    uint32_t *weak = weakSums.mutableBytes;
+    for (NSUInteger i = 0; i < blocks.count; i++) {
+        NSArray *block = blocks[i];
+        if (![block isKindOfClass:[NSArray class]] || block.count != 2) {
+            return NO;
+        }
+        NSData *strong = LJDeltaDataFromHexString(block[1]);
+        if (!strong) {
+            return NO;
+        }
+        weak[i] = (uint32_t)[block[0] unsignedIntValue];
+        [strongSums appendData:strong];
+    }
+    self.fileLength = length;
+    self.blockSize = blockSize;
+    self.digest = [digest lowercaseString];
+    self.weakSums = weakSums;
+    self.strongSums = strongSums;
+    return YES;
+}
+
+// 在旧版本中查找没变的块，拷贝到新文件，剩下的合并成需要下载的范围
+- (void)planTransfer {
+    NSUInteger count = self.weakSums.length / sizeof(uint32_t);
+    NSUInteger blockSize = self.blockSize;
+    const uint32_t *weak = self.weakSums.bytes;
+    const unsigned char *strong = self.strongSums.bytes;
+    // 每块在旧版本中的位置，-1表示没找到
+    NSMutableData *sourceData = [NSMutableData dataWithLength:count * sizeof(long long)];
+    long long *sources = sourceData.mutableBytes;
+    for (NSUInteger i = 0; i < count; i++) {
+        sources[i] = -1;
+    }
+
+    NSData *base = [NSData dataWithContentsOfFile:self.basePath options:NSDataReadingMappedIfSafe error:nil];
+    if (base.length >= blockSize) {
+        // 弱校验 -> 块的序号，最后一块不满blockSize时不参与滚动匹配
+        NSMutableDictionary<NSNumber *, NSMutableArray<NSNumber *> *> *index = [NSMutableDictionary dictionary];
+        for (NSUInteger i = 0; i < count; i++) {
+            if ((long long)(i + 1) * blockSize > self.fileLength) {
+                break;
+            }
+            NSMutableArray *indexes = index[@(weak[i])];
+            if (!indexes) {
+                indexes = [NSMutableArray array];
+                index[@(weak[i])] = indexes;
+            }
+            [indexes addObject:@(i)];
+        }
+        const uint8_t *bytes = base.bytes;
+        NSUInteger baseLength = base.length;
+        NSUInteger position = 0;
+        uint32_t a = 0;
+        uint32_t b = 0;
+        uint32_t checksum = LJDeltaWeakChecksum(bytes, blockSize, &a, &b);
+        while (position + blockSize <= baseLength) {
+            BOOL matched = NO;
+            NSArray<NSNumber *> *candidates = index[@(checksum)];
+            if (candidates) {
+                // 弱校验命中后再比较md5
+                unsigned char digest[CC_MD5_DIGEST_LENGTH];
+                CC_MD5(bytes + position, (CC_LONG)blockSize, digest);
+                for (NSNumber *candidate in candidates) {
+                    NSUInteger i = candidate.unsignedIntegerValue;
+                    if (sources[i] < 0 && memcmp(strong + i * CC_MD5_DIGEST_LENGTH, digest, CC_MD5_DIGEST_LENGTH) == 0) {
+                        // 内容相同的块都可以从这里拷贝
+                        sources[i] = position;
+                        matched = YES;
+                    }
+                }
+            }
+            if (matched) {
+                position += blockSize;
+                if (position + blockSize <= baseLength) {
+                    checksum = LJDeltaWeakChecksum(bytes + position, blockSize, &a, &b);
+                }
+                continue;
+            }
+            if (position + blockSize >= baseLength) {
+                break;
+            }
+            checksum = LJDeltaRollChecksum(&a, &b, bytes[position], bytes[position + blockSize], blockSize);
+            position++;
+        }
+    }
+
+    [LJDownLoadFileTool removeFileAtPath:self.tempFilePath];
+    [LJDownLoadFileTool createDirectoryForFilePath:self.tempFilePath];
+    self.writer = [LJDownLoadFileWriter writerWithPath:self.tempFilePath];
+    if (!self.writer) {
+        [self failWithCode:LJDeltaDownLoadErrorWriteFailed];
+        return;
+    }
+    LJDownLoadRangeSet *missing = [[LJDownLoadRangeSet alloc] init];
+    NSUInteger i = 0;
+    while (i < count) {
+        long long offset = (long long)i * blockSize;
+        if (sources[i] < 0) {
+            [missing addRange:LJMakeByteRange(offset, MIN((long long)blockSize, self.fileLength - offset))];
+            i++;
+            continue;
+        }
+        // 在旧版本中也连续的块合并成一次写入
+        NSUInteger j = i + 1;
+        while (j < count && sources[j] == sources[j - 1] + (long long)blockSize) {
+            j++;
+        }
+        long long length = MIN((long long)(j - i) * blockSize, self.fileLength - offset);
+        [self writeData:LJDeltaDispatchData(base, (NSUInteger)sources[i], (NSUInteger)length) atOffset:offset];
+        self.reusedLength += length;
+        i = j;
+    }
+    [self.pendingRanges removeAllObjects];
+    [missing enumerateRangesUsingBlock:^(LJByteRange range, BOOL *stop) {
+        [self.pendingRanges addObject:[NSValue valueWithBytes:&range objCType:@encode(LJByteRange)]];
+    }];
+    NSLog(@"增量下载：复用%lld字节，需要下载%lld字节", self.reusedLength, missing.coveredLength);
+    [self updateProgress];
+    [self requestNextRanges];
+}
+
+- (void)requestNextRanges {
+    if (self.pendingRanges.count == 0) {
+        [self finishTransfer];
+        return;
+    }
+    NSUInteger count = MIN(kLJDeltaMaxRangesPerRequest, self.pendingRanges.count);
+    NSMutableArray<NSString *> *specs = [NSMutableArray arrayWithCapacity:count];
+    for (NSUInteger i = 0; i < count; i++) {
+        LJByteRange range;
+        [self.pendingRanges[i] getValue:&range];
+        [specs addObject:[NSString stringWithFormat:@"%lld-%lld", range.location, LJMaxByteRange(range) - 1]];
+    }
+    [self.pendingRanges removeObjectsInRange:NSMakeRange(0, count)];
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:self.url];
+    [request setValue:[@"bytes=" stringByAppendingString:[specs componentsJoinedByString:@","]] forHTTPHeaderField:@"Range"];
+    self.phase = LJDeltaPhaseRanges;
+    self.multipartParser = nil;
+    self.fullResponse = NO;
+    self.dataTask = [self.transport dataTaskWithRequest:request delegate:self delegateQueue:self.queue];
+    [self.dataTask resume];
+}
+
+- (BOOL)prepareForRangeResponse:(NSHTTPURLResponse *)response {
+    if (response.statusCode == 200) {
+        // 服务器不支持Range，返回的就是整个新文件
+        // 整个文件重新下载，之前的请求收到的和从旧版本拷贝的都会被覆盖，进度从0开始算
+        self.fullResponse = YES;
+        self.responseOffset = 0;
+        self.transferredLength = 0;
+        self.reusedLength = 0;
+        return YES;
+    }
+    if (response.statusCode != 206) {
+        return NO;
+    }
+    NSString *contentType = response.allHeaderFields[@"Content-Type"];
+    if ([[contentType lowercaseString] hasPrefix:@"multipart/byteranges"]) {
+        NSRange range = [contentType rangeOfString:@"boundary=" options:NSCaseInsensitiveSearch];
+        if (range.location == NSNotFound) {
+            return NO;
+        }
+        NSString *boundary = [[contentType substringFromIndex:NSMaxRange(range)] componentsSeparatedByString:@";"].firstObject;
+        boundary = [boundary stringByTrimmingCharactersInSet:[NSCharacterSet characterSetWithCharactersInString:@"\" "]];
+        if (boundary.length == 0) {
+            return NO;
+        }
+        self.multipartParser = [[LJDeltaMultipartParser alloc] initWithBoundary:boundary];
+        return YES;
+    }
+    // 只请求了一段，或者服务器把多段合并成了一段
+    long long start = 0;
+    if (!LJDeltaParseContentRange(response.allHeaderFields[@"Content-Range"], &start)) {
+        return NO;
+    }
+    self.responseOffset = start;
+    return YES;
+}
+
+- (void)finishTransfer {
+    LJDownLoadFileWriter *writer = self.writer;
+    self.writer = nil;
+    [writer closeWithCompletion:^(int error) {
+        [self.queue addOperationWithBlock:^{
+            if (self.writeError || error) {
+                [self failWithCode:LJDeltaDownLoadErrorWriteFailed];
+                return;
+            }
+            NSString *md5 = [LJDownLoadFileTool md5WithPath:self.tempFilePath];
+            if (![md5 isEqualToString:self.digest]) {
+                NSLog(@"增量下载校验失败 %@ != %@", md5, self.digest);
+                [self failWithCode:LJDeltaDownLoadErrorDigestMismatch];
+                return;
+            }
+            self.finished = YES;
+            [LJDownLoadFileTool removeFileAtPath:self.cacheFilePath];
+            [LJDownLoadFileTool moveFile:self.tempFilePath toPath:self.cacheFilePath];
+            dispatch_async(dispatch_get_main_queue(), ^{
+                self.downLoadStatus = LJDownLoadStatusSuccess;
+                if (self.successBlock) {
+                    self.successBlock(self.cacheFilePath);
+                }
+            });
+        }];
+    }];
+}
+
+- (void)failWithCode:(LJDeltaDownLoadError)code {
+    [self failWithError:[NSError errorWithDomain:LJDeltaDownLoadErrorDomain code:code userInfo:@{NSURLErrorFailingURLErrorKey : self.url ?: [NSNull null]}]];
+}
+
+- (void)failWithError:(NSError *)error {
+    if (self.finished) {
+        return;
+    }
+    self.finished = YES;
+    [self.dataTask cancel];
+    [self.writer closeWithCompletion:nil];
+    self.writer = nil;
+    [LJDownLoadFileTool removeFileAtPath:self.tempFilePath];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        self.downLoadStatus = LJDownLoadStatusFailed;
+        if (self.failBlock) {
+            self.failBlock(error);
+        }
+    });
+}
+
+- (void)writeData:(dispatch_data_t)data atOffset:(long long)offset {
+    [self.writer writeData:data atOffset:offset completion:^(int error) {
+        if (error) {
+            [self.queue addOperationWithBlock:^{
+                self.writeError = error;
+            }];
+        }
+    }];
+}
+
+- (void)updateProgress {
+    long long received = self.reusedLength + self.transferredLength;
+    long long total = self.fileLength;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (self.progressBlock && total > 0) {
+            self.progressBlock(1.0 * received / total);
+        }
+    });
+}
+
+#pragma mark - LJDownLoadTransportDelegate
+- (void)transportTask:(id<LJDownLoadTransportTask>)task didReceiveResponse:(NSHTTPURLResponse *)response completionHandler:(void (^)(BOOL allow))completionHandler {
+    if (task != self.dataTask || self.finished) {
+        completionHandler(NO);
+        return;
+    }
+    if (self.phase == LJDeltaPhaseManifest) {
+        completionHandler(response.statusCode == 200);
+        return;
+    }
+    if (![self prepareForRangeResponse:response]) {
+        completionHandler(NO);
+        [self failWithCode:LJDeltaDownLoadErrorBadResponse];
+        return;
+    }
+    completionHandler(YES);
+}
+
+- (void)transportTask:(id<LJDownLoadTransportTask>)task didReceiveData:(NSData *)data {
+    if (task != self.dataTask || self.finished) {
+        return;
+    }
+    if (self.phase == LJDeltaPhaseManifest) {
+        [self.manifestData appendData:data];
+        return;
+    }
+    self.transferredLength += data.length;
+    if (self.multipartParser) {
+        BOOL valid = [self.multipartParser consumeData:data partHandler:^(long long offset, NSData *part) {
+            [self writeData:LJDeltaDispatchData(part, 0, part.length) atOffset:offset];
+        }];
+        if (!valid) {
+            [self failWithCode:LJDeltaDownLoadErrorBadResponse];
+            return;
+        }
+    } else {
+        [self writeData:LJDeltaDispatchData(data, 0, data.length) atOffset:self.responseOffset];
+        self.responseOffset += data.length;
+    }
+    [self updateProgress];
+}
+
+- (void)transportTask:(id<LJDownLoadTransportTask>)task didCompleteWithError:(NSError *)error {
+    if (task != self.dataTask || self.finished) {
+        return;
+    }
+    if (error) {
+        [self failWithError:error];
+        return;
+    }
+    if (self.phase == LJDeltaPhaseManifest) {
+        if (![self parseManifest:self.manifestData]) {
+            [self failWithCode:LJDeltaDownLoadErrorInvalidManifest];
+            return;
+        }
+        self.manifestData = nil;
+        [self planTransfer];
+        return;
+    }
+    if (self.multipartParser && !self.multipartParser.finished) {
+        [self failWithCode:LJDeltaDownLoadErrorBadResponse];
+        return;
+    }
+    if (self.fullResponse) {
+        // 已经拿到了整个文件，剩下的范围不用再请求
+        [self.pendingRanges removeAllObjects];
+    }
+    [self requestNextRanges];
+}
+@end
@@ -0,0 +1,105 @@
+//
+//  LJDownLoadArchiveExtractor.h
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/21.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+extern NSString * const LJDownLoadArchiveErrorDomain;
+
+typedef NS_ENUM(NSInteger, LJDownLoadArchiveError) {
+    /** 不支持的格式或者压缩方式(加密、zip中未知长度的stored等) */
+    LJDownLoadArchiveErrorUnsupported = 1,
+    /** 数据损坏，头部校验或者CRC不对 */
+    LJDownLoadArchiveErrorCorrupted,
+    /** 成员路径是绝对路径或者包含..，会写到目标目录之外 */
+    LJDownLoadArchiveErrorUnsafePath,
+    /** 写文件失败 */
+    LJDownLoadArchiveErrorWriteFailed,
+    /** 数据在归档结束之前就没有了 */
+    LJDownLoadArchiveErrorTruncated
+};
+
+typedef NS_ENUM(NSInteger, LJDownLoadArchiveFormat) {
+    /** 根据开头的字节自动判断 */
+    LJDownLoadArchiveFormatAutomatic,
+    LJDownLoadArchiveFormatTar,
+    /** 支持stored和deflate */
+    LJDownLoadArchiveFormatZip
+};
+
+/**
+ 边下边解压，按顺序接收归档的数据，每个成员的数据收完就写到目标目录，不保存归档本身
+ 一边解压一边在进度文件中记录检查点(归档偏移、成员序号、成员内已写的长度)，暂停、失败或者进程被杀掉后从检查点继续下载和解压
+ deflate的成员只在成员边界记录检查点，stored和tar的成员在成员中间也可以记录
+ 非线程安全，LJDownLoader在代理队列中调用
+ */
+@interface LJDownLoadArchiveExtractor : NSObject
+
+/**
+ 创建解压器
+
+ @param directory 解压到的目录
+ @return 解压器
+ */
+- (instancetype)initWithDestinationDirectory:(NSString *)directory;
+
+@property (nonatomic, copy, readonly) NSString *destinationDirectory;
+
+/** 归档格式，默认自动判断 */
+@property (nonatomic, assign) LJDownLoadArchiveFormat format;
+
+/** 检查点保存的位置，LJDownLoader开始下载时设置成临时文件旁边的.extract文件 */
+@property (nonatomic, copy) NSString *checkpointPath;
+
+/** 已经处理的归档字节数，也是继续下载的起点 */
+@property (nonatomic, assign, readonly) long long consumedLength;
+
+/** 已经解压完成的成员个数 */
+@property (nonatomic, assign, readonly) NSUInteger extractedCount;
+
+/** 归档已经全部解压 */
+@property (nonatomic, assign, readonly, getter=isFinished) BOOL finished;
+
+/** 每个文件解压完成时回调，参数是文件的完整路径，在调用consumeData的队列中 */
+@property (nonatomic, copy) void(^memberBlock)(NSString *path);
+
+/**
+ 读取检查点，恢复到上次记录的状态
+
+ @return 继续下载的归档偏移，没有检查点时为0
+ */
+- (long long)loadCheckpoint;
+
+/**
+ 按顺序处理下一段归档数据
+
+ @param data 数据
+ @param error 失败时的错误
+ @return 是否成功
+ */
+- (BOOL)consumeData:(NSData *)data error:(NSError **)error;
+
+/**
+ 数据已经全部收到，检查归档是否完整
+ tar缺少末尾的空块、zip缺少中央目录时只要停在成员边界也算完整
+
+ @param error 不完整时的错误
+ @return 是否完整
+ */
+- (BOOL)finishWithError:(NSError **)error;
+
+/**
+ 记录检查点，当前状态不能记录时(deflate成员中间)保留上一个检查点
+ */
+- (void)checkpoint;
+
+/**
+ 从头开始，删除检查点和没有写完的成员，已经解压完成的文件保留
+ */
+- (void)reset;
+
+@end
@@ -0,0 +1,918 @@
+//
+//  LJDownLoadArchiveExtractor.m
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/21.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import "LJDownLoadArchiveExtractor.h"
+#import <zlib.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import <errno.h>
+
+NSString * const LJDownLoadArchiveErrorDomain = @"LJDownLoadArchiveErrorDomain";
+
+static const NSUInteger kLJTarBlockSize = 512;
+static const NSUInteger kLJZipLocalHeaderLength = 30;
+static const uint32_t kLJZipLocalHeaderSignature = 0x04034b50;
+static const uint32_t kLJZipCentralDirectorySignature = 0x02014b50;
+static const uint32_t kLJZipEndSignature = 0x06054b50;
+static const uint32_t kLJZipDescriptorSignature = 0x08074b50;
+// zip的通用标志位
+static const uint16_t kLJZipFlagEncrypted = 1 << 0;
+static const uint16_t kLJZipFlagDescriptor = 1 << 3;
+static const uint16_t kLJZipMethodStored = 0;
+static const uint16_t kLJZipMethodDeflate = 8;
+// 长文件名、pax扩展头最多在内存中收这么多
+static const long long kLJMaxMetaLength = 1024 * 1024;
+// 每处理这么多归档数据记录一次检查点
+static const long long kLJCheckpointInterval = 4 * 1024 * 1024;
+static const size_t kLJInflateBufferSize = 64 * 1024;
+// 没写完的成员先写到这个后缀的文件，写完再改名
+static NSString * const kLJPartialSuffix = @".ljpart";
+
+typedef NS_ENUM(NSInteger, LJArchiveState) {
+    /** 收集头部(tar的512字节块、zip的本地文件头) */
+    LJArchiveStateHeader,
+    /** 成员的数据，写到目标文件 */
+    LJArchiveStateData,
+    /** tar的长文件名、pax扩展头，收到内存里解析 */
+    LJArchiveStateMeta,
+    /** 跳过不需要的数据和填充 */
+    LJArchiveStateSkip,
+    /** zip成员后面的数据描述符 */
+    LJArchiveStateDescriptor,
+    /** 归档结束 */
+    LJArchiveStateDone
+};
+
+static NSError *LJArchiveError(LJDownLoadArchiveError code, NSString *description) {
+    return [NSError errorWithDomain:LJDownLoadArchiveErrorDomain code:code userInfo:@{NSLocalizedDescriptionKey : description}];
+}
+
+static uint16_t LJReadUInt16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t LJReadUInt32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t LJReadUInt64(const uint8_t *p) {
+    return (uint64_t)LJReadUInt32(p) | ((uint64_t)LJReadUInt32(p + 4) << 32);
+}
+
+// tar的数字字段，一般是八进制字符串，超过8GB的文件用最高位置1的大端二进制
+static long long LJTarNumber(const uint8_t *field, size_t length) {
+    long long value = 0;
+    if (field[0] & 0x80) {
+        for (size_t i = 1; i < length; i++) {
+            value = (value << 8) | field[i];
+        }
+        return value;
+    }
+    // 前面的空格跳过，数字后面的空格或者\0结束
+    size_t i = 0;
+    while (i < length && field[i] == ' ') {
+        i++;
+    }
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; i++) {
+        value = value * 8 + (field[i] - '0');
+    }
+    return value;
+}
+
+// 定长、不一定以\0结尾的字符串字段
+static NSString *LJTarString(const uint8_t *field, size_t length) {
+    size_t end = strnlen((const char *)field, length);
+    return [[NSString alloc] initWithBytes:field length:end encoding:NSUTF8StringEncoding] ?: [[NSString alloc] initWithBytes:field length:end encoding:NSISOLatin1StringEncoding];
+}
+
+@interface LJDownLoadArchiveExtractor()
+{
+    LJArchiveState _state;
+    // 这次解压实际使用的格式，自动判断后保存在检查点里
+    LJDownLoadArchiveFormat _archiveFormat;
+    NSMutableData *_header;
+    NSUInteger _headerLength;
+    // 当前阶段(数据、扩展头、跳过)还剩的归档字节数
+    long long _remaining;
+    // tar成员数据后面的填充
+    long long _padding;
+    NSMutableData *_meta;
+    uint8_t _metaType;
+    // 长文件名、pax扩展头给下一个成员指定的名字
+    NSString *_pendingName;
+
+    // 当前成员，相对于目标目录的路径
+    NSString *_memberName;
+    int _fd;
+    long long _memberWritten;
+    uint16_t _method;
+    uint16_t _flags;
+    BOOL _zip64;
+    uint32_t _expectedCrc;
+    uLong _crc;
+    z_stream _zstream;
+    BOOL _inflating;
+    BOOL _streamEnded;
+    uint8_t *_inflateBuffer;
+
+    long long _lastCheckpointLength;
+    // 最近一次创建过的目录，同一个目录下的大量小文件不用反复创建
+    NSString *_lastDirectory;
+}
+@property (nonatomic, copy, readwrite) NSString *destinationDirectory;
+@property (nonatomic, assign, readwrite) long long consumedLength;
+@property (nonatomic, assign, readwrite) NSUInteger extractedCount;
+@end
+
+@implementation LJDownLoadArchiveExtractor
+- (instancetype)initWithDestinationDirectory:(NSString *)directory {
+    if (self = [super init]) {
+        _destinationDirectory = [directory copy];
+        _header = [NSMutableData dataWithCapacity:kLJTarBlockSize];
+        _fd = -1;
+        [self resetState];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self closeMember];
+    free(_inflateBuffer);
+}
+
+- (BOOL)isFinished {
+    return _state == LJArchiveStateDone;
+}
+
+- (NSUInteger)headerLengthForFormat:(LJDownLoadArchiveFormat)format {
+    switch (format) {
+        case LJDownLoadArchiveFormatTar:
+            return kLJTarBlockSize;
+        case LJDownLoadArchiveFormatZip:
+            return kLJZipLocalHeaderLength;
+        default:
+            // 先收4个字节判断格式
+            return 4;
+    }
+}
+
+- (void)resetState {
+    _state = LJArchiveStateHeader;
+    _archiveFormat = self.format;
+    [_header setLength:0];
+    _headerLength = [self headerLengthForFormat:_archiveFormat];
+    _remaining = 0;
+    _padding = 0;
+    _meta = nil;
+    _pendingName = nil;
+    _memberName = nil;
+    _lastDirectory = nil;
+    _consumedLength = 0;
+    _extractedCount = 0;
+    _lastCheckpointLength = 0;
+}
+
+- (void)setFormat:(LJDownLoadArchiveFormat)format {
+    _format = format;
+    if (_consumedLength == 0) {
+        _archiveFormat = format;
+        _headerLength = [self headerLengthForFormat:format];
+    }
+}
+
+#pragma mark - 检查点
+- (long long)loadCheckpoint {
+    [self closeMember];
+    [self resetState];
+    NSData *data = self.checkpointPath ? [NSData dataWithContentsOfFile:self.checkpointPath] : nil;
+    NSDictionary *info = data ? [NSPropertyListSerialization propertyListWithData:data options:NSPropertyListImmutable format:NULL error:nil] : nil;
+    if (![info isKindOfClass:[NSDictionary class]]) {
+        return 0;
+    }
+    _archiveFormat = [info[@"format"] integerValue];
+    _headerLength = [self headerLengthForFormat:_archiveFormat];
+    _consumedLength = [info[@"offset"] longLongValue];
+    _extractedCount = [info[@"count"] unsignedIntegerValue];
+    if ([info[@"finished"] boolValue]) {
+        _state = LJArchiveStateDone;
+        return _consumedLength;
+    }
+    NSString *member = info[@"member"];
+    if (member) {
+        // 停在成员中间：打开写了一半的文件，截掉检查点之后写的部分
+        long long written = [info[@"written"] longLongValue];
+        NSString *partialPath = [[self.destinationDirectory stringByAppendingPathComponent:member] stringByAppendingString:kLJPartialSuffix];
+        int fd = open(partialPath.fileSystemRepresentation, O_WRONLY | O_CLOEXEC);
+        if (fd < 0 || ftruncate(fd, written) != 0 || lseek(fd, written, SEEK_SET) < 0) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            [self reset];
+            return 0;
+        }
+        _fd = fd;
+        _memberName = member;
+        _memberWritten = written;
+        _remaining = [info[@"remaining"] longLongValue];
+        _padding = [info[@"padding"] longLongValue];
+        _flags = [info[@"flags"] unsignedShortValue];
+        _expectedCrc = [info[@"expectedCrc"] unsignedIntValue];
+        _crc = [info[@"crc"] unsignedLongValue];
+        _method = kLJZipMethodStored;
+        _streamEnded = NO;
+        _state = LJArchiveStateData;
+    }
+    _lastCheckpointLength = _consumedLength;
+    return _consumedLength;
+}
+
+// 成员边界、stored成员中间和归档结束时可以记录，deflate的解压状态没法保存
+- (BOOL)canCheckpoint {
+    switch (_state) {
+        case LJArchiveStateDone:
+            return YES;
+        case LJArchiveStateHeader:
+            return _header.length == 0 && !_pendingName;
+        case LJArchiveStateData:
+            return _method == kLJZipMethodStored;
+        default:
+            return NO;
+    }
+}
+
+- (void)checkpoint {
+    if (!self.checkpointPath || ![self canCheckpoint]) {
+        return;
+    }
+    NSMutableDictionary *info = [NSMutableDictionary dictionary];
+    info[@"offset"] = @(_consumedLength);
+    info[@"count"] = @(_extractedCount);
+    info[@"format"] = @(_archiveFormat);
+    info[@"finished"] = @(_state == LJArchiveStateDone);
+    if (_state == LJArchiveStateData) {
+        // 检查点不能记录还没落盘的数据
+        if (_fd >= 0) {
+            fsync(_fd);
+        }
+        info[@"member"] = _memberName;
+        info[@"written"] = @(_memberWritten);
+        info[@"remaining"] = @(_remaining);
+        info[@"padding"] = @(_padding);
+        info[@"flags"] = @(_flags);
+        info[@"expectedCrc"] = @(_expectedCrc);
+        info[@"crc"] = @(_crc);
+    }
+    NSData *data = [NSPropertyListSerialization dataWithPropertyList:info format:NSPropertyListBinaryFormat_v1_0 options:0 error:nil];
+    [data writeToFile:self.checkpointPath atomically:YES];
+    _lastCheckpointLength = _consumedLength;
+}
+
+- (void)checkpointIfNeeded {
+    if (_consumedLength - _lastCheckpointLength >= kLJCheckpointInterval && [self canCheckpoint]) {
+        [self checkpoint];
+    }
+}
+
+- (void)reset {
+    if (_memberName) {
+        NSString *partialPath = [[self.destinationDirectory stringByAppendingPathComponent:_memberName] stringByAppendingString:kLJPartialSuffix];
+        [self closeMember];
+        unlink(partialPath.fileSystemRepresentation);
+    }
+    [self closeMember];
+    if (self.checkpointPath) {
+        unlink(self.checkpointPath.fileSystemRepresentation);
+    }
+    [self resetState];
+}
+
+#pragma mark - 解析
+- (BOOL)consumeData:(NSData *)data error:(NSError **)error {
+    __block BOOL success = YES;
+    __block NSError *blockError = nil;
+    [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+        NSError *localError = nil;
+        if (![self consumeBytes:bytes length:byteRange.length error:&localError]) {
+            blockError = localError;
+            success = NO;
+            *stop = YES;
+        }
+    }];
+    if (!success) {
+        // 出错的成员不保留
+        [self closeMember];
+        if (error) {
+            *error = blockError;
+        }
+    }
+    return success;
+}
+
+- (BOOL)consumeBytes:(const uint8_t *)bytes length:(size_t)length error:(NSError **)error {
+    while (length > 0) {
+        if (_state == LJArchiveStateDone) {
+            // 归档结束之后的数据(zip的中央目录、tar末尾的填充块)不需要
+            _consumedLength += length;
+            return YES;
+        }
+        size_t used = 0;
+        switch (_state) {
+            case LJArchiveStateHeader:
+            case LJArchiveStateDescriptor:
+                used = MIN(length, _headerLength - _header.length);
+                [_header appendBytes:bytes length:used];
+                break;
+            case LJArchiveStateData: {
+                size_t available = (size_t)MIN((long long)length, _remaining);
+                if (![self writeMemberBytes:bytes length:available used:&used error:error]) {
+                    return NO;
+                }
+                _remaining -= used;
+                break;
+            }
+            case LJArchiveStateMeta:
+                used = (size_t)MIN((long long)length, _remaining);
+                [_meta appendBytes:bytes length:used];
+                _remaining -= used;
+                break;
+            case LJArchiveStateSkip:
+                used = (size_t)MIN((long long)length, _remaining);
+                _remaining -= used;
+                break;
+            default:
+                break;
+        }
+        bytes += used;
+        length -= used;
+        _consumedLength += used;
+        if (![self advanceStateWithError:error]) {
+            return NO;
+        }
+        [self checkpointIfNeeded];
+    }
+    return YES;
+}
+
+// 当前阶段的数据收完后进入下一个阶段
+- (BOOL)advanceStateWithError:(NSError **)error {
+    switch (_state) {
+        case LJArchiveStateHeader:
+            if (_header.length < _headerLength) {
+                return YES;
+            }
+            return [self parseHeaderWithError:error];
+        case LJArchiveStateDescriptor:
+            if (_header.length < _headerLength) {
+                return YES;
+            }
+            return [self parseDescriptorWithError:error];
+        case LJArchiveStateData:
+            if (_remaining > 0 && !_streamEnded) {
+                return YES;
+            }
+            return [self finishMemberWithError:error];
+        case LJArchiveStateMeta:
+            if (_remaining > 0) {
+                return YES;
+            }
+            [self parseMeta];
+            [self skipLength:_padding];
+            return YES;
+        case LJArchiveStateSkip:
+            if (_remaining > 0) {
+                return YES;
+            }
+            [self beginHeader];
+            return YES;
+        default:
+            return YES;
+    }
+}
+
+- (void)beginHeader {
+    _state = LJArchiveStateHeader;
+    [_header setLength:0];
+    _headerLength = [self headerLengthForFormat:_archiveFormat];
+}
+
+- (void)skipLength:(long long)length {
+    if (length <= 0) {
+        [self beginHeader];
+        return;
+    }
+    _state = LJArchiveStateSkip;
+    _remaining = length;
+}
+
+- (void)finishArchive {
+    [self closeMember];
+    _state = LJArchiveStateDone;
+    [self checkpoint];
+}
+
+- (BOOL)parseHeaderWithError:(NSError **)error {
+    const uint8_t *header = _header.bytes;
+    if (_archiveFormat == LJDownLoadArchiveFormatAutomatic) {
+        _archiveFormat = (header[0] == 'P' && header[1] == 'K') ? LJDownLoadArchiveFormatZip : LJDownLoadArchiveFormatTar;
+        // 已经收到的4个字节留着，继续收完整个头部
+        _headerLength = [self headerLengthForFormat:_archiveFormat];
+        return YES;
+    }
+    if (_archiveFormat == LJDownLoadArchiveFormatZip) {
+        return [self parseZipHeaderWithError:error];
+    }
+    return [self parseTarHeaderWithError:error];
+}
+
+#pragma mark - tar
+- (BOOL)parseTarHeaderWithError:(NSError **)error {
+    const uint8_t *header = _header.bytes;
+    BOOL empty = YES;
+    for (NSUInteger i = 0; i < kLJTarBlockSize; i++) {
+        if (header[i]) {
+            empty = NO;
+            break;
+        }
+    }
+    // 全0的块表示归档结束
+    if (empty) {
+        [self finishArchive];
+        return YES;
+    }
+    // 校验和是头部所有字节之和，校验和字段本身按空格计算
+    unsigned long long sum = 0;
+    for (NSUInteger i = 0; i < kLJTarBlockSize; i++) {
+        sum += (i >= 148 && i < 156) ? ' ' : header[i];
+    }
+    if (sum != (unsigned long long)LJTarNumber(header + 148, 8)) {
+        if (error) {
+            *error = LJArchiveError(LJDownLoadArchiveErrorCorrupted, @"tar头部校验和不对");
+        }
+        return NO;
+    }
+    long long size = LJTarNumber(header + 124, 12);
+    long long padding = (kLJTarBlockSize - size % kLJTarBlockSize) % kLJTarBlockSize;
+    uint8_t type = header[156];
+    if (type == 'L' || type == 'x') {
+        // GNU长文件名、pax扩展头，内容是下一个成员的属性
+        if (size > kLJMaxMetaLength) {
+            if (error) {
+                *error = LJArchiveError(LJDownLoadArchiveErrorCorrupted, @"tar扩展头太大");
+            }
+            return NO;
+        }
+        _metaType = type;
+        _meta = [NSMutableData dataWithCapacity:(NSUInteger)size];
+        _remaining = size;
+        _padding = padding;
+        _state = LJArchiveStateMeta;
+        if (size == 0) {
+            [self parseMeta];
+            [self skipLength:padding];
+        }
+        return YES;
+    }
+    NSString *name = _pendingName;
+    _pendingName = nil;
+    if (!name) {
+        name = LJTarString(header, 100);
+        // ustar格式的长路径拆成前缀和名字
+        if (memcmp(header + 257, "ustar", 5) == 0 && header[345]) {
+            name = [NSString stringWithFormat:@"%@/%@", LJTarString(header + 345, 155), name];
+        }
+    }
+    switch (type) {
+        case '0':
+        case '\0':
+        case '7':
+            _method = kLJZipMethodStored;
+            _flags = 0;
+            return [self beginMemberWithName:name size:size padding:padding error:error];
+        case '5':
+            if (![self createDirectoryWithName:name error:error]) {
+                return NO;
+            }
+            [self skipLength:size + padding];
+            return YES;
+        default:
+            // 链接、设备文件等不解压
+            NSLog(@"跳过tar成员:%@ 类型:%c", name, type);
+            [self skipLength:size + padding];
+            return YES;
+    }
+}
+
+- (void)parseMeta {
+    if (_metaType == 'L') {
+        _pendingName = LJTarString(_meta.bytes, _meta.length);
+    } else {
+        // pax记录的格式：长度 key=value\n，只用到path
+        const char *bytes = _meta.bytes;
+        NSUInteger offset = 0;
+        while (offset < _meta.length) {
+            // _meta不以0结尾，不能用strtoll，在_meta.length之内逐个读数字
+            NSUInteger recordLength = 0;
+            NSUInteger cursor = offset;
+            while (cursor < _meta.length && isdigit((unsigned char)bytes[cursor]) && recordLength <= _meta.length) {
+                recordLength = recordLength * 10 + (bytes[cursor] - '0');
+                cursor++;
+            }
+            if (cursor == offset || recordLength == 0 || recordLength > _meta.length - offset) {
+                break;
+            }
+            NSString *record = [[NSString alloc] initWithBytes:bytes + offset length:recordLength encoding:NSUTF8StringEncoding];
+            NSRange space = [record rangeOfString:@" "];
+            if (space.location != NSNotFound) {
+                NSString *pair = [[record substringFromIndex:NSMaxRange(space)] stringByTrimmingCharactersInSet:[NSCharacterSet newlineCharacterSet]];
+                if ([pair hasPrefix:@"path="]) {
+                    _pendingName = [pair substringFromIndex:5];
+                }
+            }
+            offset += recordLength;
+        }
+    }
+    _meta = nil;
+}
+
+#pragma mark - zip
+- (BOOL)parseZipHeaderWithError:(NSError **)error {
+    const uint8_t *header = _header.bytes;
+    uint32_t signature = LJReadUInt32(header);
+    // 成员都在中央目录之前，到这里就结束了
+    if (signature == kLJZipCentralDirectorySignature || signature == kLJZipEndSignature) {
+        [self finishArchive];
+        return YES;
+    }
+    if (signature != kLJZipLocalHeaderSignature) {
+        if (error) {
+            *error = LJArchiveError(LJDownLoadArchiveErrorCorrupted, @"zip本地文件头签名不对");
+        }
+        return NO;
+    }
+    uint16_t nameLength = LJReadUInt16(header + 26);
+    uint16_t extraLength = LJReadUInt16(header + 28);
+    NSUInteger totalLength = kLJZipLocalHeaderLength + nameLength + extraLength;
+    if (_header.length < totalLength) {
+        // 接着收文件名和扩展字段
+        _headerLength = totalLength;
+        return YES;
+    }
+    uint16_t flags = LJReadUInt16(header + 6);
+    uint16_t method = LJReadUInt16(header + 8);
+    uint32_t crc = LJReadUInt32(header + 14);
+    long long compressedSize = LJReadUInt32(header + 18);
+    long long uncompressedSize = LJReadUInt32(header + 22);
+    // 没有UTF-8标志的老zip一般也是UTF-8，解不出来时按Latin1
+    NSString *name = [[NSString alloc] initWithBytes:header + kLJZipLocalHeaderLength length:nameLength encoding:NSUTF8StringEncoding] ?: [[NSString alloc] initWithBytes:header + kLJZipLocalHeaderLength length:nameLength encoding:NSISOLatin1StringEncoding];
+
+    // zip64的扩展字段：原来的长度是0xFFFFFFFF时，真正的长度按未压缩、压缩的顺序放在这里
+    _zip64 = NO;
+    const uint8_t *extra = header + kLJZipLocalHeaderLength + nameLength;
+    NSUInteger extraOffset = 0;
+    while (extraOffset + 4 <= extraLength) {
+        uint16_t extraId = LJReadUInt16(extra + extraOffset);
+        uint16_t extraSize = LJReadUInt16(extra + extraOffset + 2);
+        if (extraOffset + 4 + extraSize > extraLength) {
+            break;
+        }
+        if (extraId == 0x0001) {
+            _zip64 = YES;
+            const uint8_t *field = extra + extraOffset + 4;
+            const uint8_t *fieldEnd = field + extraSize;
+            if (uncompressedSize == 0xFFFFFFFF && field + 8 <= fieldEnd) {
+                uncompressedSize = (long long)LJReadUInt64(field);
+                field += 8;
+            }
+            if (compressedSize == 0xFFFFFFFF && field + 8 <= fieldEnd) {
+                compressedSize = (long long)LJReadUInt64(field);
+            }
+        }
+        extraOffset += 4 + extraSize;
+    }
+
+    if (flags & kLJZipFlagEncrypted) {
+        if (error) {
+            *error = LJArchiveError(LJDownLoadArchiveErrorUnsupported, @"不支持加密的zip");
+        }
+        return NO;
+    }
+    BOOL hasDescriptor = (flags & kLJZipFlagDescriptor) != 0;
+    _flags = flags;
+    _method = method;
+    _expectedCrc = crc;
+    if ([name hasSuffix:@"/"]) {
+        if (![self createDirectoryWithName:name error:error]) {
+            return NO;
+        }
+        if (hasDescriptor) {
+            [self beginDescriptor];
+        } else {
+            [self skipLength:compressedSize];
+        }
+        return YES;
+    }
+    // stored的成员长度未知时找不到结尾
+    if ((method != kLJZipMethodStored && method != kLJZipMethodDeflate) || (method == kLJZipMethodStored && hasDescriptor)) {
+        if (error) {
+            *error = LJArchiveError(LJDownLoadArchiveErrorUnsupported, [NSString stringWithFormat:@"不支持的zip压缩方式:%d", method]);
+        }
+        return NO;
+    }
+    long long size = (hasDescriptor && method == kLJZipMethodDeflate) ? LLONG_MAX : compressedSize;
+    return [self beginMemberWithName:name size:size padding:0 error:error];
+}
+
+- (void)beginDescriptor {
+    _state = LJArchiveStateDescriptor;
+    [_header setLength:0];
+    // 先收4个字节判断有没有签名
+    _headerLength = 4;
+}
+
+- (BOOL)parseDescriptorWithError:(NSError **)error {
+    const uint8_t *bytes = _header.bytes;
+    // 描述符：[签名] crc32 压缩长度 未压缩长度，zip64时长度是8字节
+    NSUInteger bodyLength = _zip64 ? 20 : 12;
+    if (_headerLength == 4) {
+        _headerLength = LJReadUInt32(bytes) == kLJZipDescriptorSignature ? 4 + bodyLength : bodyLength;
+        if (_header.length < _headerLength) {
+            return YES;
+        }
+    }
+    NSUInteger base = _headerLength == bodyLength ? 0 : 4;
+    uint32_t crc = LJReadUInt32(bytes + base);
+    if (_memberName) {
+        if (crc != _crc) {
+            [self discardMember];
+            if (error) {
+                *error = LJArchiveError(LJDownLoadArchiveErrorCorrupted, @"zip成员CRC不对");
+            }
+            return NO;
+        }
+        if (![self completeMemberWithError:error]) {
+            return NO;
+        }
+    }
+    [self beginHeader];
+    return YES;
+}
+
+#pragma mark - 成员
+- (NSString *)relativePathForName:(NSString *)name error:(NSError **)error {
+    if ([name hasPrefix:@"/"]) {
+        if (error) {
+            *error = LJArchiveError(LJDownLoadArchiveErrorUnsafePath, [NSString stringWithFormat:@"成员使用了绝对路径:%@", name]);
+        }
+        return nil;
+    }
+    NSMutableArray<NSString *> *components = [NSMutableArray array];
+    for (NSString *component in [name componentsSeparatedByString:@"/"]) {
+        if (component.length == 0 || [component isEqualToString:@"."]) {
+            continue;
+        }
+        if ([component isEqualToString:@".."]) {
+            if (error) {
+                *error = LJArchiveError(LJDownLoadArchiveErrorUnsafePath, [NSString stringWithFormat:@"成员路径超出目标目录:%@", name]);
+            }
+            return nil;
+        }
+        [components addObject:component];
+    }
+    return [components componentsJoinedByString:@"/"];
+}
+
+- (BOOL)createDirectoryAtPath:(NSString *)directory error:(NSError **)error {
+    if ([directory isEqualToString:_lastDirectory]) {
+        return YES;
+    }
+    if (![[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:error]) {
+        return NO;
+    }
+    _lastDirectory = directory;
+    return YES;
+}
+
+- (BOOL)createDirectoryWithName:(NSString *)name error:(NSError **)error {
+    NSString *relativePath = [self relativePathForName:name error:error];
+    if (!relativePath) {
+        return NO;
+    }
+    return [self createDirectoryAtPath:[self.destinationDirectory stringByAppendingPathComponent:relativePath] error:error];
+}
+
+- (BOOL)beginMemberWithName:(NSString *)name size:(long long)size padding:(long long)padding error:(NSError **)error {
+    NSString *relativePath = [self relativePathForName:name error:error];
+    if (!relativePath) {
+        return NO;
+    }
+    if (relativePath.length == 0) {
+        [self skipLength:size + padding];
+        return YES;
+    }
+    NSString *path = [self.destinationDirectory stringByAppendingPathComponent:relativePath];
+    if (![self createDirectoryAtPath:[path stringByDeletingLastPathComponent] error:error]) {
+        return NO;
+    }
+    NSString *partialPath = [path stringByAppendingString:kLJPartialSuffix];
+    _fd = open(partialPath.fileSystemRepresentation, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+        if (error) {
+            *error = LJArchiveError(LJDownLoadArchiveErrorWriteFailed, [NSString stringWithFormat:@"创建文件失败:%s", strerror(errno)]);
+        }
+        return NO;
+    }
+    _memberName = relativePath;
+    _memberWritten = 0;
+    _remaining = size;
+    _padding = padding;
+    _crc = crc32(0, Z_NULL, 0);
+    _streamEnded = NO;
+    if (_method == kLJZipMethodDeflate) {
+        memset(&_zstream, 0, sizeof(_zstream));
+        // zip里是不带头部的原始deflate流
+        if (inflateInit2(&_zstream, -MAX_WBITS) != Z_OK) {
+            [self discardMember];
+            if (error) {
+                *error = LJArchiveError(LJDownLoadArchiveErrorCorrupted, @"初始化解压失败");
+            }
+            return NO;
+        }
+        _inflating = YES;
+        if (!_inflateBuffer) {
+            _inflateBuffer = malloc(kLJInflateBufferSize);
+        }
+    }
+    _state = LJArchiveStateData;
+    if (_remaining == 0 && _method == kLJZipMethodStored) {
+        return [self finishMemberWithError:error];
+    }
+    return YES;
+}
+
+- (BOOL)writeBytes:(const uint8_t *)bytes length:(size_t)length error:(NSError **)error {
+    while (length > 0) {
+        ssize_t written = write(_fd, bytes, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (error) {
+                *error = LJArchiveError(LJDownLoadArchiveErrorWriteFailed, [NSString stringWithFormat:@"写文件失败:%s", strerror(errno)]);
+            }
+            return NO;
+        }
+        if (_archiveFormat == LJDownLoadArchiveFormatZip) {
+            _crc = crc32(_crc, bytes, (uInt)written);
+        }
+        _memberWritten += written;
+        bytes += written;
+        length -= written;
+    }
+    return YES;
+}
+
+- (BOOL)writeMemberBytes:(const uint8_t *)bytes length:(size_t)length used:(size_t *)used error:(NSError **)error {
+    if (_method == kLJZipMethodStored) {
+        *used = length;
+        return [self writeBytes:bytes length:length error:error];
+    }
+    uInt inputLength = (uInt)MIN(length, (size_t)UINT_MAX);
+    _zstream.next_in = (Bytef *)bytes;
+    _zstream.avail_in = inputLength;
+    do {
+        _zstream.next_out = _inflateBuffer;
+        _zstream.avail_out = (uInt)kLJInflateBufferSize;
+        int ret = inflate(&_zstream, Z_NO_FLUSH);
+        size_t produced = kLJInflateBufferSize - _zstream.avail_out;
+        if (produced > 0 && ![self writeBytes:_inflateBuffer length:produced error:error]) {
+            return NO;
+        }
+        if (ret == Z_STREAM_END) {
+            _streamEnded = YES;
+            break;
+        }
+        // 输出缓冲区刚好用完又没有新的输入时返回Z_BUF_ERROR，不是错误
+        if (ret == Z_BUF_ERROR) {
+            break;
+        }
+        if (ret != Z_OK) {
+            if (error) {
+                *error = LJArchiveError(LJDownLoadArchiveErrorCorrupted, [NSString stringWithFormat:@"deflate数据损坏:%d", ret]);
+            }
+            return NO;
+        }
+    } while (_zstream.avail_in > 0 || _zstream.avail_out == 0);
+    *used = inputLength - _zstream.avail_in;
+    if (*used == 0 && length > 0 && !_streamEnded) {
+        if (error) {
+            *error = LJArchiveError(LJDownLoadArchiveErrorCorrupted, @"deflate数据无法继续解压");
+        }
+        return NO;
+    }
+    return YES;
+}
+
+- (BOOL)finishMemberWithError:(NSError **)error {
+    BOOL hasDescriptor = _archiveFormat == LJDownLoadArchiveFormatZip && (_flags & kLJZipFlagDescriptor);
+    if (_method == kLJZipMethodDeflate) {
+        inflateEnd(&_zstream);
+        _inflating = NO;
+        // 压缩数据用完了解压还没结束，或者解压结束了还剩压缩数据
+        if (!_streamEnded || (!hasDescriptor && _remaining > 0)) {
+            [self discardMember];
+            if (error) {
+                *error = LJArchiveError(LJDownLoadArchiveErrorCorrupted, @"deflate数据长度不对");
+            }
+            return NO;
+        }
+    }
+    if (hasDescriptor) {
+        // 描述符里的CRC校验通过后才算完成
+        [self beginDescriptor];
+        return YES;
+    }
+    if (_archiveFormat == LJDownLoadArchiveFormatZip && _crc != _expectedCrc) {
+        [self discardMember];
+        if (error) {
+            *error = LJArchiveError(LJDownLoadArchiveErrorCorrupted, @"zip成员CRC不对");
+        }
+        return NO;
+    }
+    if (![self completeMemberWithError:error]) {
+        return NO;
+    }
+    [self skipLength:_padding];
+    return YES;
+}
+
+// 写完的成员改成最终的名字，同名文件直接替换
+- (BOOL)completeMemberWithError:(NSError **)error {
+    NSString *path = [self.destinationDirectory stringByAppendingPathComponent:_memberName];
+    NSString *partialPath = [path stringByAppendingString:kLJPartialSuffix];
+    int fd = _fd;
+    _fd = -1;
+    if ((fd >= 0 && close(fd) != 0) || rename(partialPath.fileSystemRepresentation, path.fileSystemRepresentation) != 0) {
+        unlink(partialPath.fileSystemRepresentation);
+        _memberName = nil;
+        if (error) {
+            *error = LJArchiveError(LJDownLoadArchiveErrorWriteFailed, [NSString stringWithFormat:@"保存文件失败:%s", strerror(errno)]);
+        }
+        return NO;
+    }
+    _memberName = nil;
+    _extractedCount++;
+    if (self.memberBlock) {
+        self.memberBlock(path);
+    }
+    return YES;
+}
+
+- (void)discardMember {
+    if (!_memberName) {
+        return;
+    }
+    NSString *partialPath = [[self.destinationDirectory stringByAppendingPathComponent:_memberName] stringByAppendingString:kLJPartialSuffix];
+    [self closeMember];
+    unlink(partialPath.fileSystemRepresentation);
+    _memberName = nil;
+}
+
+// 只关闭文件，写了一半的文件留着，从检查点继续时接着写
+- (void)closeMember {
+    if (_inflating) {
+        inflateEnd(&_zstream);
+        _inflating = NO;
+    }
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+}
+
+- (BOOL)finishWithError:(NSError **)error {
+    if (_state == LJArchiveStateDone) {
+        return YES;
+    }
+    // 缺少tar末尾的空块，或者zip只剩不完整的中央目录，停在成员边界就算完整
+    if (_state == LJArchiveStateHeader && _consumedLength > 0 && !_pendingName) {
+        BOOL atBoundary = _header.length == 0;
+        if (!atBoundary && _archiveFormat == LJDownLoadArchiveFormatZip && _header.length >= 4) {
+            uint32_t signature = LJReadUInt32(_header.bytes);
+            atBoundary = signature == kLJZipCentralDirectorySignature || signature == kLJZipEndSignature;
+        }
+        if (atBoundary) {
+            [self finishArchive];
+            return YES;
+        }
+    }
+    if (error) {
+        *error = LJArchiveError(LJDownLoadArchiveErrorTruncated, @"归档数据不完整");
+    }
+    return NO;
+}
+@end
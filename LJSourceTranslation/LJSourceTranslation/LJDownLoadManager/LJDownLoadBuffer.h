@@ -0,0 +1,46 @@
+//
+//  LJDownLoadBuffer.h
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/10.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ 引用计数的非连续缓冲链(基于dispatch_data)
+ 收到的每一段NSData只会被持有，不会被拷贝，写文件时把整个dispatch_data交给dispatch_io
+ */
+@interface LJDownLoadBuffer : NSObject
+
+/** 缓冲链中的总字节数 */
+@property (nonatomic, assign, readonly) size_t length;
+
+/**
+ 追加一段数据，只持有不拷贝
+
+ @param data 收到的数据
+ */
+- (void)appendData:(NSData *)data;
+
+/**
+ 底层的dispatch_data，可以直接交给dispatch_io
+
+ @return 不可变的dispatch_data
+ */
+- (dispatch_data_t)dispatchData;
+
+/**
+ 拿到连续内存的数据，只有一个分段时不拷贝
+
+ @return 连续的数据
+ */
+- (NSData *)data;
+
+/**
+ 清空缓冲链
+ */
+- (void)removeAllSegments;
+
+@end
@@ -0,0 +1,55 @@
+//
+//  LJDownLoadBuffer.m
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/10.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import "LJDownLoadBuffer.h"
+
+@interface LJDownLoadBuffer()
+@property (nonatomic, strong) dispatch_data_t chain;
+@end
+
+@implementation LJDownLoadBuffer
+- (instancetype)init {
+    if (self = [super init]) {
+        _chain = dispatch_data_empty;
+    }
+    return self;
+}
+
+- (size_t)length {
+    return dispatch_data_get_size(self.chain);
+}
+
+- (void)appendData:(NSData *)data {
+    if (data.length == 0) {
+        return;
+    }
+    // NSURLSession给的data可能本身就不连续，data.bytes会把它拼成一块
+    // 按原来的分段逐个包装，销毁block持有data，分段释放时data才跟着释放，整个过程不拷贝
+    __block dispatch_data_t chain = self.chain;
+    [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+        dispatch_data_t segment = dispatch_data_create(bytes, byteRange.length, NULL, ^{
+            (void)data;
+        });
+        chain = dispatch_data_create_concat(chain, segment);
+    }];
+    self.chain = chain;
+}
+
+- (dispatch_data_t)dispatchData {
+    return self.chain;
+}
+
+- (NSData *)data {
+    // dispatch_data_t可以直接当NSData使用，只有一个分段时map不会拷贝
+    return (NSData *)dispatch_data_create_map(self.chain, NULL, NULL);
+}
+
+- (void)removeAllSegments {
+    self.chain = dispatch_data_empty;
+}
+@end
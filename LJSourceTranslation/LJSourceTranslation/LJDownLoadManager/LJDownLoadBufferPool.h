@@ -0,0 +1,59 @@
+//
+//  LJDownLoadBufferPool.h
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/17.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/**
+ 按大小分级(4KB到256KB，每级翻倍)缓存空闲内存块，小文件下载反复使用同一批内存，不用每次malloc/free
+ 超过最大一级的请求直接malloc，不进池子
+ 线程安全
+ */
+@interface LJDownLoadBufferPool : NSObject
+
+/** 共享的内存池，收到内存警告时清空空闲块 */
++ (instancetype)sharedPool;
+
+/** 池子能管理的最大块，256KB */
+@property (nonatomic, assign, readonly) size_t maxPooledSize;
+
+/** 当前缓存的空闲块占用的字节数 */
+@property (nonatomic, assign, readonly) size_t freeBytes;
+
+/**
+ 取一块至少length字节的内存
+
+ @param length 需要的长度
+ @param capacity 实际的容量，归还时需要传回来
+ @return 内存块，失败返回NULL
+ */
+- (void *)allocateBufferWithLength:(size_t)length capacity:(size_t *)capacity;
+
+/**
+ 归还内存块
+
+ @param buffer allocateBufferWithLength:capacity:返回的内存块
+ @param capacity 分配时拿到的容量
+ */
+- (void)recycleBuffer:(void *)buffer capacity:(size_t)capacity;
+
+/**
+ 把内存块包装成NSData交给调用方，不拷贝，NSData释放时内存块自动归还
+
+ @param buffer 内存块
+ @param length 有效数据的长度
+ @param capacity 分配时拿到的容量
+ @return NSData
+ */
+- (NSData *)dataWithBuffer:(void *)buffer length:(size_t)length capacity:(size_t)capacity;
+
+/**
+ 释放所有空闲块
+ */
+- (void)removeAllFreeBuffers;
+
+@end
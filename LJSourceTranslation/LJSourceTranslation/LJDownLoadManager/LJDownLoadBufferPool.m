@@ -0,0 +1,136 @@
+//
+//  LJDownLoadBufferPool.m
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/17.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import "LJDownLoadBufferPool.h"
+#import <os/lock.h>
+#if TARGET_OS_IPHONE
+#import <UIKit/UIKit.h>
+#endif
+
+// 最小一级4KB，共7级，最大256KB
+static const size_t kLJBufferPoolMinSize = 4 * 1024;
+#define kLJBufferPoolClassCount 7
+// 每一级最多缓存的空闲块数
+#define kLJBufferPoolMaxFreePerClass 8
+
+@interface LJDownLoadBufferPool()
+{
+    os_unfair_lock _lock;
+    void *_freeBuffers[kLJBufferPoolClassCount][kLJBufferPoolMaxFreePerClass];
+    NSUInteger _freeCounts[kLJBufferPoolClassCount];
+}
+@end
+
+@implementation LJDownLoadBufferPool
++ (instancetype)sharedPool {
+    static LJDownLoadBufferPool *_pool;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _pool = [[self alloc] init];
+    });
+    return _pool;
+}
+
+- (instancetype)init {
+    if (self = [super init]) {
+        _lock = OS_UNFAIR_LOCK_INIT;
+#if TARGET_OS_IPHONE
+        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(removeAllFreeBuffers) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
+#endif
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    [self removeAllFreeBuffers];
+}
+
+- (size_t)maxPooledSize {
+    return kLJBufferPoolMinSize << (kLJBufferPoolClassCount - 1);
+}
+
+// length所在的级别，超过最大一级返回-1
+static NSInteger LJBufferPoolClassForLength(size_t length) {
+    size_t size = kLJBufferPoolMinSize;
+    for (NSInteger i = 0; i < kLJBufferPoolClassCount; i++) {
+        if (length <= size) {
+            return i;
+        }
+        size <<= 1;
+    }
+    return -1;
+}
+
+- (size_t)freeBytes {
+    size_t bytes = 0;
+    os_unfair_lock_lock(&_lock);
+    for (NSInteger i = 0; i < kLJBufferPoolClassCount; i++) {
+        bytes += _freeCounts[i] * (kLJBufferPoolMinSize << i);
+    }
+    os_unfair_lock_unlock(&_lock);
+    return bytes;
+}
+
+- (void *)allocateBufferWithLength:(size_t)length capacity:(size_t *)capacity {
+    NSInteger sizeClass = LJBufferPoolClassForLength(MAX(length, 1));
+    if (sizeClass < 0) {
+        if (capacity) {
+            *capacity = length;
+        }
+        return malloc(length);
+    }
+    size_t size = kLJBufferPoolMinSize << sizeClass;
+    if (capacity) {
+        *capacity = size;
+    }
+    void *buffer = NULL;
+    os_unfair_lock_lock(&_lock);
+    if (_freeCounts[sizeClass] > 0) {
+        buffer = _freeBuffers[sizeClass][--_freeCounts[sizeClass]];
+    }
+    os_unfair_lock_unlock(&_lock);
+    return buffer ?: malloc(size);
+}
+
+- (void)recycleBuffer:(void *)buffer capacity:(size_t)capacity {
+    if (!buffer) {
+        return;
+    }
+    NSInteger sizeClass = LJBufferPoolClassForLength(capacity);
+    // 不是池子分出去的大小直接释放
+    if (sizeClass < 0 || (kLJBufferPoolMinSize << sizeClass) != capacity) {
+        free(buffer);
+        return;
+    }
+    os_unfair_lock_lock(&_lock);
+    if (_freeCounts[sizeClass] < kLJBufferPoolMaxFreePerClass) {
+        _freeBuffers[sizeClass][_freeCounts[sizeClass]++] = buffer;
+        buffer = NULL;
+    }
+    os_unfair_lock_unlock(&_lock);
+    free(buffer);
+}
+
+- (NSData *)dataWithBuffer:(void *)buffer length:(size_t)length capacity:(size_t)capacity {
+    return [[NSData alloc] initWithBytesNoCopy:buffer length:length deallocator:^(void *bytes, NSUInteger ignored) {
+        [self recycleBuffer:bytes capacity:capacity];
+    }];
+}
+
+- (void)removeAllFreeBuffers {
+    os_unfair_lock_lock(&_lock);
+    for (NSInteger i = 0; i < kLJBufferPoolClassCount; i++) {
+        for (NSUInteger j = 0; j < _freeCounts[i]; j++) {
+            free(_freeBuffers[i][j]);
+        }
+        _freeCounts[i] = 0;
+    }
+    os_unfair_lock_unlock(&_lock);
+}
+@end
@@ -41,4 +41,96 @@
  */
 + (void)removeFileAtPath:(NSString *)path;
 
+/**
+ 计算文件内容的md5，按块读取，不会把整个文件读进内存
+
+ @param path 文件地址
+ @return 小写的md5字符串，文件不存在时返回nil
+ */
++ (NSString *)md5WithPath:(NSString *)path;
+
+/**
+ 计算文件内容的sha256，按块读取
+
+ @param path 文件地址
+ @return 小写的sha256字符串，文件不存在时返回nil
+ */
++ (NSString *)sha256WithPath:(NSString *)path;
+
+/**
+ 按digest的长度选择算法计算文件摘要，32位为md5，64位为sha256
+
+ @param path 文件地址
+ @param digest 期望的摘要，只用来决定算法
+ @return 小写的摘要字符串，文件不存在时返回nil
+ */
++ (NSString *)digestWithPath:(NSString *)path matchingDigest:(NSString *)digest;
+
+#pragma mark - 目录分片
+/**
+ 分片后的路径，directory/k/ey/fileName，第一级取key的第1个字符，第二级取第2、3个字符
+ 一共16 * 256个目录，几十万个文件时每个目录里也只有几十个文件，查找和遍历不会变慢
+
+ @param directory 根目录
+ @param key 十六进制的md5，决定文件放在哪个分片
+ @param fileName 文件名
+ @return 文件路径，不会创建目录
+ */
++ (NSString *)shardedPathInDirectory:(NSString *)directory key:(NSString *)key fileName:(NSString *)fileName;
+
+/**
+ 创建文件所在的目录
+
+ @param path 文件路径
+ */
++ (void)createDirectoryForFilePath:(NSString *)path;
+
+/**
+ 下载完成的文件路径，只算路径，不访问文件系统
+
+ @param url 下载地址
+ @return 文件路径
+ */
++ (NSString *)cacheFilePathForURL:(NSURL *)url;
+
+/**
+ 下载中的临时文件路径，只算路径，不访问文件系统
+
+ @param url 下载地址
+ @return 文件路径
+ */
++ (NSString *)tempFilePathForURL:(NSURL *)url;
+
+/**
+ 旧版本不分片，把这个url的完成文件和临时文件移到分片目录，分片目录已经有文件时不做任何事
+
+ @param url 下载地址
+ */
++ (void)migrateLegacyFilesForURL:(NSURL *)url;
+
+/**
+ 把旧版本直接放在临时目录下的临时文件全部移到分片目录
+ 完成的文件是按url最后一段命名的，算不出分片，只能在migrateLegacyFilesForURL:里逐个迁移
+
+ @return 移动的文件个数
+ */
++ (NSUInteger)migrateLegacyTempFiles;
+
+/**
+ Library目录下是否还有旧版本的完成文件，它们的文件名以Caches开头
+
+ @return 还有没迁移的完成文件时返回YES
+ */
++ (BOOL)hasLegacyCacheFiles;
+
+/**
+ 旧版本的文件是否已经全部迁移，为YES时不用再对每个url调用migrateLegacyFilesForURL:
+ */
++ (BOOL)isLegacyLayoutMigrated;
+
+/**
+ 记录旧版本的文件已经全部迁移，保存在NSUserDefaults中
+ */
++ (void)markLegacyLayoutMigrated;
+
 @end
@@ -7,6 +7,21 @@
 //
 
 #import "LJDownLoadFileTool.h"
+#import "NSString+LJMD5.h"
+#import <CommonCrypto/CommonDigest.h>
+
+#define LJCacheDir NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES).firstObject
+#define LJTempDir NSTemporaryDirectory()
+
+// 计算md5时每次读1MB
+static const NSUInteger kLJDownLoadDigestChunkSize = 1024 * 1024;
+// 分片目录的根目录名
+static NSString * const kLJDownLoadCacheDirName = @"LJDownLoadCache";
+static NSString * const kLJDownLoadTempDirName = @"LJDownLoadTemp";
+// 流式下载记录已下载范围的文件后缀，和LJDownLoader一致
+static NSString * const kLJDownLoadRangesExtension = @".ranges";
+// 旧版本的文件已经全部迁移
+static NSString * const kLJDownLoadLegacyLayoutMigratedKey = @"LJDownLoadLegacyLayoutMigrated";
 
 @implementation LJDownLoadFileTool
 + (BOOL)isFileExists:(NSString *)path {
@@ -27,7 +42,11 @@
     if (![self isFileExists:fromPath]) {
         return;
     }
-    [[NSFileManager defaultManager] moveItemAtPath:fromPath toPath:toPath error:nil];
+    // 分片目录不存在时先创建再移一次
+    if (![[NSFileManager defaultManager] moveItemAtPath:fromPath toPath:toPath error:nil]) {
+        [self createDirectoryForFilePath:toPath];
+        [[NSFileManager defaultManager] moveItemAtPath:fromPath toPath:toPath error:nil];
+    }
 }
 
 + (void)removeFileAtPath:(NSString *)path {
@@ -36,4 +55,146 @@
     }
     [[NSFileManager defaultManager] removeItemAtPath:path error:nil];
 }
+
+static NSString *LJDownLoadHexString(const unsigned char *bytes, NSUInteger length) {
+    NSMutableString *result = [NSMutableString stringWithCapacity:length * 2];
+    for (NSUInteger i = 0; i < length; i ++) {
+        [result appendFormat:@"%02x", bytes[i]];
+    }
+    return result;
+}
+
++ (NSString *)md5WithPath:(NSString *)path {
+    // 映射到内存按块计算，不会一次性读入
+    NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:nil];
+    if (!data) {
+        return nil;
+    }
+    CC_MD5_CTX context;
+    CC_MD5_Init(&context);
+    for (NSUInteger offset = 0; offset < data.length; offset += kLJDownLoadDigestChunkSize) {
+        NSUInteger length = MIN(kLJDownLoadDigestChunkSize, data.length - offset);
+        CC_MD5_Update(&context, (const char *)data.bytes + offset, (CC_LONG)length);
+    }
+    unsigned char digest[CC_MD5_DIGEST_LENGTH];
+    CC_MD5_Final(digest, &context);
+    return LJDownLoadHexString(digest, CC_MD5_DIGEST_LENGTH);
+}
+
++ (NSString *)sha256WithPath:(NSString *)path {
+    NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:nil];
+    if (!data) {
+        return nil;
+    }
+    CC_SHA256_CTX context;
+    CC_SHA256_Init(&context);
+    for (NSUInteger offset = 0; offset < data.length; offset += kLJDownLoadDigestChunkSize) {
+        NSUInteger length = MIN(kLJDownLoadDigestChunkSize, data.length - offset);
+        CC_SHA256_Update(&context, (const char *)data.bytes + offset, (CC_LONG)length);
+    }
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_Final(digest, &context);
+    return LJDownLoadHexString(digest, CC_SHA256_DIGEST_LENGTH);
+}
+
++ (NSString *)digestWithPath:(NSString *)path matchingDigest:(NSString *)digest {
+    if (digest.length == CC_SHA256_DIGEST_LENGTH * 2) {
+        return [self sha256WithPath:path];
+    }
+    return [self md5WithPath:path];
+}
+
+#pragma mark - 目录分片
+// 32位十六进制
+static BOOL LJIsHexKey(NSString *key) {
+    if (key.length < 32) {
+        return NO;
+    }
+    for (NSUInteger i = 0; i < 32; i++) {
+        if (!isxdigit([key characterAtIndex:i])) {
+            return NO;
+        }
+    }
+    return YES;
+}
+
++ (NSString *)shardedPathInDirectory:(NSString *)directory key:(NSString *)key fileName:(NSString *)fileName {
+    NSString *first = [key substringWithRange:NSMakeRange(0, 1)];
+    NSString *second = [key substringWithRange:NSMakeRange(1, 2)];
+    return [NSString pathWithComponents:@[directory, first, second, fileName]];
+}
+
++ (void)createDirectoryForFilePath:(NSString *)path {
+    [[NSFileManager defaultManager] createDirectoryAtPath:[path stringByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:nil];
+}
+
++ (NSString *)cacheFilePathForURL:(NSURL *)url {
+    return [self shardedPathInDirectory:[LJCacheDir stringByAppendingPathComponent:kLJDownLoadCacheDirName] key:[url.absoluteString md5Str] fileName:url.lastPathComponent];
+}
+
++ (NSString *)tempFilePathForURL:(NSURL *)url {
+    NSString *md5 = [url.absoluteString md5Str];
+    return [self shardedPathInDirectory:[LJTempDir stringByAppendingPathComponent:kLJDownLoadTempDirName] key:md5 fileName:md5];
+}
+
++ (void)migrateLegacyFilesForURL:(NSURL *)url {
+    NSString *cacheFilePath = [self cacheFilePathForURL:url];
+    if (![self isFileExists:cacheFilePath]) {
+        // 旧版本的路径没有加/，文件实际在Library目录下
+        [self moveFile:[LJCacheDir stringByAppendingString:url.lastPathComponent] toPath:cacheFilePath];
+    }
+    NSString *tempFilePath = [self tempFilePathForURL:url];
+    if (![self isFileExists:tempFilePath]) {
+        NSString *legacyPath = [LJTempDir stringByAppendingString:[url.absoluteString md5Str]];
+        [self moveFile:legacyPath toPath:tempFilePath];
+        [self moveFile:[legacyPath stringByAppendingString:kLJDownLoadRangesExtension] toPath:[tempFilePath stringByAppendingString:kLJDownLoadRangesExtension]];
+    }
+}
+
++ (NSUInteger)migrateLegacyTempFiles {
+    NSString *directory = LJTempDir;
+    NSString *shardDirectory = [directory stringByAppendingPathComponent:kLJDownLoadTempDirName];
+    NSUInteger count = 0;
+    // 只看第一层，只移md5命名的临时文件和它的.ranges，临时目录里的其他文件不动
+    for (NSString *fileName in [[NSFileManager defaultManager] contentsOfDirectoryAtPath:directory error:nil]) {
+        if (!LJIsHexKey(fileName)) {
+            continue;
+        }
+        NSString *suffix = [fileName substringFromIndex:32];
+        if (suffix.length > 0 && ![suffix isEqualToString:kLJDownLoadRangesExtension]) {
+            continue;
+        }
+        NSString *toPath = [self shardedPathInDirectory:shardDirectory key:fileName fileName:fileName];
+        if ([self isFileExists:toPath]) {
+            continue;
+        }
+        [self moveFile:[directory stringByAppendingPathComponent:fileName] toPath:toPath];
+        count++;
+    }
+    return count;
+}
+
++ (BOOL)hasLegacyCacheFiles {
+    // 旧版本的路径没有加/，Caches目录本身不算
+    NSString *libraryDir = [LJCacheDir stringByDeletingLastPathComponent];
+    NSString *prefix = [LJCacheDir lastPathComponent];
+    for (NSString *fileName in [[NSFileManager defaultManager] contentsOfDirectoryAtPath:libraryDir error:nil]) {
+        if (fileName.length <= prefix.length || ![fileName hasPrefix:prefix]) {
+            continue;
+        }
+        BOOL isDirectory = NO;
+        if ([[NSFileManager defaultManager] fileExistsAtPath:[libraryDir stringByAppendingPathComponent:fileName] isDirectory:&isDirectory] && !isDirectory) {
+            return YES;
+        }
+    }
+    return NO;
+}
+
++ (BOOL)isLegacyLayoutMigrated {
+    return [[NSUserDefaults standardUserDefaults] boolForKey:kLJDownLoadLegacyLayoutMigratedKey];
+}
+
++ (void)markLegacyLayoutMigrated {
+    [[NSUserDefaults standardUserDefaults] setBool:YES forKey:kLJDownLoadLegacyLayoutMigratedKey];
+}
 @end
@@ -0,0 +1,86 @@
+//
+//  LJDownLoadFileWriter.h
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/15.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+typedef NS_ENUM(NSInteger, LJDownLoadFileWriterBackend) {
+    /** dispatch_io随机读写通道，由系统合并提交，不占用等待I/O的线程 */
+    LJDownLoadFileWriterBackendDispatchIO,
+    /** 共享的串行队列池中同步调用pwrite，dispatch_io不可用时使用 */
+    LJDownLoadFileWriterBackendPwrite
+};
+
+/**
+ 写入完成的回调，在writer内部的队列中调用
+
+ @param error 成功为0，失败为errno
+ */
+typedef void(^LJDownLoadFileWriteCompletion)(int error);
+
+/**
+ 临时文件的异步写入器，按偏移写入，调用方的队列不会阻塞在磁盘上
+ 同一个writer提交的写入、同步和关闭按提交顺序执行
+ */
+@interface LJDownLoadFileWriter : NSObject
+
+/**
+ 打开文件(不存在时创建)，优先使用dispatch_io，不可用时自动回退到pwrite
+
+ @param path 文件路径
+ @return 写入器，文件打不开时返回nil
+ */
++ (instancetype)writerWithPath:(NSString *)path;
+
+/**
+ 使用指定的后端打开文件
+
+ @param path 文件路径
+ @param backend 后端
+ @return 写入器，文件打不开时返回nil
+ */
++ (instancetype)writerWithPath:(NSString *)path backend:(LJDownLoadFileWriterBackend)backend;
+
+/** 文件路径 */
+@property (nonatomic, copy, readonly) NSString *path;
+
+/** 实际使用的后端 */
+@property (nonatomic, assign, readonly) LJDownLoadFileWriterBackend backend;
+
+/**
+ 把数据写到文件的指定偏移，数据只持有不拷贝
+
+ @param data 要写入的数据，可以是LJDownLoadBuffer的dispatchData
+ @param offset 文件偏移
+ @param completion 写完后回调，可以为nil
+ */
+- (void)writeData:(dispatch_data_t)data atOffset:(long long)offset completion:(LJDownLoadFileWriteCompletion)completion;
+
+/**
+ 预留磁盘空间，在之前提交的写入之后执行
+ 只分配磁盘块，不改变文件长度，断点续传按文件长度计算偏移不受影响
+ 只在支持F_PREALLOCATE的系统上生效，其他系统什么都不做
+
+ @param length 预留到的总长度
+ */
+- (void)preallocateLength:(long long)length;
+
+/**
+ 检查点：之前提交的写入全部完成后fsync
+
+ @param completion fsync完成后回调，可以为nil
+ */
+- (void)synchronizeWithCompletion:(LJDownLoadFileWriteCompletion)completion;
+
+/**
+ 之前提交的写入全部完成并fsync后关闭文件，之后不能再写入
+
+ @param completion 关闭后回调，可以为nil
+ */
+- (void)closeWithCompletion:(LJDownLoadFileWriteCompletion)completion;
+
+@end
@@ -0,0 +1,319 @@
+//
+//  LJDownLoadFileWriter.m
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/15.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import "LJDownLoadFileWriter.h"
+#import <fcntl.h>
+#import <unistd.h>
+#import <errno.h>
+#import <sys/stat.h>
+
+// pwrite队列池的大小，所有下载共用，线程数不随下载数增长
+static const NSUInteger kLJDownLoadFileWriterMaxPoolSize = 4;
+
+static int LJOpenFileForWriting(NSString *path) {
+    return open(path.fileSystemRepresentation, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+}
+
+// 把dispatch_data的每个分段pwrite到对应位置，处理EINTR和部分写入
+static int LJPwriteData(int fd, dispatch_data_t data, off_t offset) {
+    __block int result = 0;
+    dispatch_data_apply(data, ^bool(dispatch_data_t region, size_t regionOffset, const void *buffer, size_t size) {
+        const char *bytes = buffer;
+        off_t position = offset + regionOffset;
+        while (size > 0) {
+            ssize_t written = pwrite(fd, bytes, size, position);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                result = errno;
+                return false;
+            }
+            bytes += written;
+            position += written;
+            size -= written;
+        }
+        return true;
+    });
+    return result;
+}
+
+// 预留到length，已经分配的部分不重复分配，失败不影响写入
+static void LJPreallocateFile(int fd, long long length) {
+#ifdef F_PREALLOCATE
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return;
+    }
+    long long allocated = (long long)st.st_blocks * 512;
+    if (length <= allocated) {
+        return;
+    }
+    // 先要连续的空间，不行再接受不连续的
+    fstore_t store = {F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, length - allocated, 0};
+    if (fcntl(fd, F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        fcntl(fd, F_PREALLOCATE, &store);
+    }
+#endif
+}
+
+@interface LJDownLoadFileWriter()
+@property (nonatomic, copy, readwrite) NSString *path;
+@property (nonatomic, assign, readwrite) LJDownLoadFileWriterBackend backend;
+- (instancetype)initWithPath:(NSString *)path;
+@end
+
+#pragma mark - dispatch_io
+@interface LJDispatchIOFileWriter : LJDownLoadFileWriter
+@property (nonatomic, strong) dispatch_io_t channel;
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, assign) int fd;
+@end
+
+@implementation LJDispatchIOFileWriter
+- (instancetype)initWithPath:(NSString *)path {
+    if (self = [super initWithPath:path]) {
+        self.backend = LJDownLoadFileWriterBackendDispatchIO;
+        int fd = LJOpenFileForWriting(path);
+        if (fd < 0) {
+            return nil;
+        }
+        _fd = fd;
+        _queue = dispatch_queue_create("com.liang.LJDownLoadFileWriter", DISPATCH_QUEUE_SERIAL);
+        // 通道关闭并且所有操作完成后才关闭fd
+        _channel = dispatch_io_create(DISPATCH_IO_RANDOM, fd, _queue, ^(int error) {
+            close(fd);
+        });
+        if (!_channel) {
+            close(fd);
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_channel) {
+        dispatch_io_close(_channel, 0);
+    }
+}
+
+- (void)writeData:(dispatch_data_t)data atOffset:(long long)offset completion:(LJDownLoadFileWriteCompletion)completion {
+    if (!self.channel) {
+        if (completion) {
+            completion(EBADF);
+        }
+        return;
+    }
+    // 一次写入的handler可能被调用多次，done为YES时才是最终结果
+    dispatch_io_write(self.channel, offset, data, self.queue, ^(bool done, dispatch_data_t remaining, int error) {
+        if (done && completion) {
+            completion(error);
+        }
+    });
+}
+
+- (void)preallocateLength:(long long)length {
+    if (!self.channel) {
+        return;
+    }
+    int fd = self.fd;
+    dispatch_io_barrier(self.channel, ^{
+        LJPreallocateFile(fd, length);
+    });
+}
+
+- (void)synchronizeWithCompletion:(LJDownLoadFileWriteCompletion)completion {
+    if (!self.channel) {
+        if (completion) {
+            completion(EBADF);
+        }
+        return;
+    }
+    int fd = self.fd;
+    // barrier在之前提交的写入全部完成后才执行，相当于写入后面链接一个fsync
+    dispatch_io_barrier(self.channel, ^{
+        int error = fsync(fd) == 0 ? 0 : errno;
+        if (completion) {
+            completion(error);
+        }
+    });
+}
+
+- (void)closeWithCompletion:(LJDownLoadFileWriteCompletion)completion {
+    dispatch_io_t channel = self.channel;
+    self.channel = nil;
+    if (!channel) {
+        if (completion) {
+            completion(0);
+        }
+        return;
+    }
+    int fd = self.fd;
+    dispatch_io_barrier(channel, ^{
+        int error = fsync(fd) == 0 ? 0 : errno;
+        dispatch_io_close(channel, 0);
+        if (completion) {
+            completion(error);
+        }
+    });
+}
+@end
+
+#pragma mark - pwrite
+@interface LJPwriteFileWriter : LJDownLoadFileWriter
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, assign) int fd;
+@end
+
+@implementation LJPwriteFileWriter
+// 所有文件共用几个串行队列，同一个文件固定在一个队列上，保证写入、同步和关闭的顺序
++ (dispatch_queue_t)queueForPath:(NSString *)path {
+    static NSArray<dispatch_queue_t> *_queues;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSUInteger count = MIN(MAX([NSProcessInfo processInfo].activeProcessorCount, 2), kLJDownLoadFileWriterMaxPoolSize);
+        NSMutableArray *queues = [NSMutableArray arrayWithCapacity:count];
+        for (NSUInteger i = 0; i < count; i++) {
+            dispatch_queue_attr_t attr = dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_UTILITY, 0);
+            [queues addObject:dispatch_queue_create("com.liang.LJDownLoadFileWriter.pwrite", attr)];
+        }
+        _queues = queues;
+    });
+    return _queues[path.hash % _queues.count];
+}
+
+- (instancetype)initWithPath:(NSString *)path {
+    if (self = [super initWithPath:path]) {
+        self.backend = LJDownLoadFileWriterBackendPwrite;
+        _fd = LJOpenFileForWriting(path);
+        if (_fd < 0) {
+            return nil;
+        }
+        _queue = [[self class] queueForPath:path];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    int fd = _fd;
+    if (fd >= 0) {
+        dispatch_async(_queue, ^{
+            close(fd);
+        });
+    }
+}
+
+- (void)writeData:(dispatch_data_t)data atOffset:(long long)offset completion:(LJDownLoadFileWriteCompletion)completion {
+    int fd = self.fd;
+    if (fd < 0) {
+        if (completion) {
+            completion(EBADF);
+        }
+        return;
+    }
+    dispatch_async(self.queue, ^{
+        int error = LJPwriteData(fd, data, offset);
+        if (completion) {
+            completion(error);
+        }
+    });
+}
+
+- (void)preallocateLength:(long long)length {
+    int fd = self.fd;
+    if (fd < 0) {
+        return;
+    }
+    dispatch_async(self.queue, ^{
+        LJPreallocateFile(fd, length);
+    });
+}
+
+- (void)synchronizeWithCompletion:(LJDownLoadFileWriteCompletion)completion {
+    int fd = self.fd;
+    if (fd < 0) {
+        if (completion) {
+            completion(EBADF);
+        }
+        return;
+    }
+    dispatch_async(self.queue, ^{
+        int error = fsync(fd) == 0 ? 0 : errno;
+        if (completion) {
+            completion(error);
+        }
+    });
+}
+
+- (void)closeWithCompletion:(LJDownLoadFileWriteCompletion)completion {
+    int fd = self.fd;
+    self.fd = -1;
+    if (fd < 0) {
+        if (completion) {
+            completion(0);
+        }
+        return;
+    }
+    dispatch_async(self.queue, ^{
+        int error = fsync(fd) == 0 ? 0 : errno;
+        close(fd);
+        if (completion) {
+            completion(error);
+        }
+    });
+}
+@end
+
+#pragma mark - LJDownLoadFileWriter
+@implementation LJDownLoadFileWriter
++ (instancetype)writerWithPath:(NSString *)path {
+    LJDownLoadFileWriter *writer = [self writerWithPath:path backend:LJDownLoadFileWriterBackendDispatchIO];
+    if (!writer) {
+        writer = [self writerWithPath:path backend:LJDownLoadFileWriterBackendPwrite];
+    }
+    return writer;
+}
+
++ (instancetype)writerWithPath:(NSString *)path backend:(LJDownLoadFileWriterBackend)backend {
+    if (path.length == 0) {
+        return nil;
+    }
+    switch (backend) {
+        case LJDownLoadFileWriterBackendDispatchIO:
+            return [[LJDispatchIOFileWriter alloc] initWithPath:path];
+        case LJDownLoadFileWriterBackendPwrite:
+            return [[LJPwriteFileWriter alloc] initWithPath:path];
+    }
+    return nil;
+}
+
+- (instancetype)initWithPath:(NSString *)path {
+    if (self = [super init]) {
+        _path = [path copy];
+    }
+    return self;
+}
+
+- (void)writeData:(dispatch_data_t)data atOffset:(long long)offset completion:(LJDownLoadFileWriteCompletion)completion {
+    NSAssert(NO, @"子类实现");
+}
+
+- (void)preallocateLength:(long long)length {
+    NSAssert(NO, @"子类实现");
+}
+
+- (void)synchronizeWithCompletion:(LJDownLoadFileWriteCompletion)completion {
+    NSAssert(NO, @"子类实现");
+}
+
+- (void)closeWithCompletion:(LJDownLoadFileWriteCompletion)completion {
+    NSAssert(NO, @"子类实现");
+}
+@end
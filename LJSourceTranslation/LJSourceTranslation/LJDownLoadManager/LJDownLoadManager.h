@@ -8,6 +8,32 @@
 
 #import <Foundation/Foundation.h>
 #import "LJDownLoader.h"
+#import "LJDownLoadScheduler.h"
+#import "LJDownLoadSync.h"
+
+@class LJDownLoadManager;
+
+/**
+ 一次下载请求的订阅，同一个url同时只有一个下载，每个调用者都是它的一个订阅者
+ 每个订阅者有自己的回调和回调队列，取消订阅不影响其他订阅者
+ */
+@interface LJDownLoadSubscription : NSObject
+
+@property (nonatomic, strong, readonly) NSURL *url;
+
+/** 订阅的下载器 */
+@property (nonatomic, weak, readonly) LJDownLoader *downLoader;
+
+/** 下载成功时还有其他订阅者拿到了同一个文件，这时不能移动或者删除这个文件，在成功回调中读取 */
+@property (atomic, assign, readonly) BOOL sharesFile;
+
+/**
+ 取消订阅，之后不会再收到任何回调，最后一个订阅者取消时才会取消下载
+ */
+- (void)cancel;
+
+@end
+
 @interface LJDownLoadManager : NSObject
 /** 创建单例*/
 /**
@@ -17,6 +43,30 @@
  */
 + (instancetype)shareInstance;
 
+/**
+ 新建的下载器使用的传输层，默认是共享的LJURLSessionTransport
+ 换成LJSocketTransport后下载不再依赖NSURLSession
+ */
+@property (nonatomic, strong) id<LJDownLoadTransport> transport;
+
+/**
+ 下载调度器，新的下载在这里排队，可以设置每个host的连接上限和分组的权重
+ */
+@property (nonatomic, strong, readonly) LJDownLoadScheduler *scheduler;
+
+/**
+ 新的下载排队时，给排在最前面的几个host提前建立连接，默认2，设为0关闭
+ */
+@property (nonatomic, assign) NSUInteger upcomingPreconnectCount;
+
+/**
+ 提前解析域名并建立空闲连接，之后这些host的下载不用再等DNS和握手
+ 已经有空闲连接的host不会重复建立
+
+ @param urls 只用到scheme、host和port
+ */
+- (void)preconnectToHosts:(NSArray<NSURL *> *)urls;
+
 /**
  从指定url下载文件
 
@@ -25,34 +75,179 @@
 - (void)downLoadWithURL:(NSURL *)url;
 
 /**
- 从指定url下载文件
+ 从指定url下载文件，回调在主线程
 
  @param url url地址
  @param success 成功回调
  @param fail 失败回调
+ @return 订阅
  */
-- (void)downLoadWithURL:(NSURL *)url success:(LJDownLoadSucessBlock)success fail:(LJDownLoadFailBlock)fail;
+- (LJDownLoadSubscription *)downLoadWithURL:(NSURL *)url success:(LJDownLoadSucessBlock)success fail:(LJDownLoadFailBlock)fail;
 
 /**
- 从指定url下载文件
+ 从指定url下载文件，回调在主线程
+ 这个url已经在下载时不会重复下载，调用者作为订阅者加入，同样会收到进度和结果
+
+ @param url url地址
+ @param success 成功回调
+ @param progress 进程回调
+ @param fail 失败回调
+ @return 订阅，可以单独取消
+ */
+- (LJDownLoadSubscription *)downLoadWithURL:(NSURL *)url success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail;
+
+/**
+ 订阅指定url的下载，没有在下载时开始下载
 
  @param url url地址
+ @param queue 回调所在的队列，传nil为主队列
  @param success 成功回调
  @param progress 进程回调
  @param fail 失败回调
+ @return 订阅，可以单独取消
  */
-- (void)downLoadWithURL:(NSURL *)url success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail;
+- (LJDownLoadSubscription *)subscribeWithURL:(NSURL *)url queue:(dispatch_queue_t)queue success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail;
 
 /**
- 暂停对应url的下载
+ 在指定分组里下载，分组之间按scheduler中设置的权重公平分配连接
+ 一大批下载放到单独的分组，不会占满所有连接
+
+ @param url url地址
+ @param group 分组，传nil为LJDownLoadDefaultGroup，url已经在下载时不改变原来的分组
+ @param success 成功回调
+ @param progress 进程回调
+ @param fail 失败回调
+ @return 订阅，可以单独取消
+ */
+- (LJDownLoadSubscription *)downLoadWithURL:(NSURL *)url group:(NSString *)group success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail;
+
+/**
+ 指定分组和回调队列订阅
+
+ @param url url地址
+ @param group 分组，传nil为LJDownLoadDefaultGroup
+ @param queue 回调所在的队列，传nil为主队列
+ @param success 成功回调
+ @param progress 进程回调
+ @param fail 失败回调
+ @return 订阅，可以单独取消
+ */
+- (LJDownLoadSubscription *)subscribeWithURL:(NSURL *)url group:(NSString *)group queue:(dispatch_queue_t)queue success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail;
+
+/**
+ 按优先级下载，LJDownLoadPriorityUrgent的下载没有空位时会暂停正在进行的低优先级下载(保留临时文件)，
+ 结束后被暂停的下载自动恢复；url已经在下载或排队时只会提高它的优先级
+
+ @param url url地址
+ @param group 分组，传nil为LJDownLoadDefaultGroup
+ @param priority 优先级
+ @param success 成功回调
+ @param progress 进程回调
+ @param fail 失败回调
+ @return 订阅，可以单独取消
+ */
+- (LJDownLoadSubscription *)downLoadWithURL:(NSURL *)url group:(NSString *)group priority:(LJDownLoadPriority)priority success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail;
+
+/**
+ 指定分组、优先级和回调队列订阅
+
+ @param url url地址
+ @param group 分组，传nil为LJDownLoadDefaultGroup
+ @param priority 优先级
+ @param queue 回调所在的队列，传nil为主队列
+ @param success 成功回调
+ @param progress 进程回调
+ @param fail 失败回调
+ @return 订阅，可以单独取消
+ */
+- (LJDownLoadSubscription *)subscribeWithURL:(NSURL *)url group:(NSString *)group priority:(LJDownLoadPriority)priority queue:(dispatch_queue_t)queue success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail;
+
+/**
+ 取消订阅，和[subscription cancel]相同
+
+ @param subscription 订阅
+ */
+- (void)unsubscribe:(LJDownLoadSubscription *)subscription;
+
+/**
+ 下载小文件到内存，不经过临时文件，超过LJDownLoader的memoryThreshold时自动改为下载到文件
+
+ @param url url地址
+ @param success 成功回调，直接拿到数据
+ @param fail 失败回调
+ @return 订阅
+ */
+- (LJDownLoadSubscription *)downLoadDataWithURL:(NSURL *)url success:(LJDownLoadDataSuccessBlock)success fail:(LJDownLoadFailBlock)fail;
+
+/**
+ 以流式播放模式下载，优先下载播放位置附近的数据，适合音视频边下边播
+
+ @param url url地址
+ @param success 成功回调
+ @param progress 进程回调
+ @param fail 失败回调
+ @return 对应的下载器，通过它拖动播放位置和等待数据
+ */
+- (LJDownLoader *)streamWithURL:(NSURL *)url success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail;
+
+/**
+ 移动对应url的播放位置
+
+ @param url url地址
+ @param offset 新的播放位置
+ */
+- (void)seekWithURL:(NSURL *)url toOffset:(long long)offset;
+
+/**
+ 增量下载，旧版本是同一个url之前下载好的缓存文件，见deltaDownLoadWithURL:manifestURL:basePath:success:progress:fail:
+ */
+- (LJDownLoadSubscription *)deltaDownLoadWithURL:(NSURL *)url manifestURL:(NSURL *)manifestURL success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail;
+
+/**
+ 增量下载，只下载和旧版本不同的块，清单格式见LJDeltaDownLoader
+ 缓存文件按url的md5分片存放，新版本的url和旧版本不同时(一般带版本号)要传入旧版本的路径，
+ 比如[LJDownLoadFileTool cacheFilePathForURL:旧版本的url]
+
+ @param url 新版本文件的url
+ @param manifestURL 新版本的分块校验清单
+ @param basePath 旧版本文件的路径，nil时使用同一个url的缓存文件
+ @param success 成功回调
+ @param progress 进程回调
+ @param fail 失败回调
+ @return 订阅，可以单独取消；同一个url正在增量下载时作为订阅者加入
+ */
+- (LJDownLoadSubscription *)deltaDownLoadWithURL:(NSURL *)url manifestURL:(NSURL *)manifestURL basePath:(NSString *)basePath success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail;
+
+/**
+ 下载tar或zip归档并边下边解压到指定目录，不保存归档文件，占用的磁盘只有解压后的大小
+ 暂停、失败或者进程被杀掉后，再次调用从检查点继续下载和解压
+
+ @param url 归档的url
+ @param directory 解压到的目录
+ @param success 成功回调，filePath是解压的目录
+ @param progress 进程回调，按归档的下载进度
+ @param fail 失败回调
+ @return 订阅，可以单独取消
+ */
+- (LJDownLoadSubscription *)extractWithURL:(NSURL *)url toDirectory:(NSString *)directory success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail;
+
+/**
+ 暂停对应url的下载，暂停期间不占用调度器的位置，排队的下载可以开始
 
  @param url url地址
  */
 - (void)pauseWithURL:(NSURL *)url;
 
+/**
+ 恢复pauseWithURL:暂停的下载，重新排队，有空位时先于排队的下载恢复
+
+ @param url url地址
+ */
+- (void)resumeWithURL:(NSURL *)url;
+
 
 /**
- 取消对应url的下载
+ 取消对应url的下载，所有订阅者都会收到失败回调
 
  @param url url地址
  */
@@ -62,4 +257,45 @@
  暂停所有下载
  */
 - (void)pauseAll;
+
+/**
+ 恢复所有暂停的下载，按调度器的上限陆续恢复
+ */
+- (void)resumeAll;
+
+/**
+ 对应url的进度快照，没有在下载时各字段为0、totalBytes为-1
+
+ @param url url地址
+ @return 进度快照
+ */
+- (LJDownLoadProgressSnapshot)progressSnapshotForURL:(NSURL *)url;
+
+/**
+ 所有正在进行的下载的进度之和，不经过主线程，可以在任意线程高频调用
+ 有一个正在接收数据的下载长度未知时totalBytes为-1，还在排队的下载不计入totalBytes
+
+ @param count 参与汇总的下载个数，可以传NULL
+ @return 汇总的进度快照
+ */
+- (LJDownLoadProgressSnapshot)aggregateProgressSnapshotWithCount:(NSUInteger *)count;
+
+/**
+ 按清单同步整个目录，只下载缺少或者过期的文件，详见LJDownLoadSync
+
+ @param entries 清单
+ @param directory 同步的根目录
+ @param progress 进度回调，在主线程
+ @param completion 完成回调，在主线程
+ @return 同步任务，可以取消
+ */
+- (LJDownLoadSync *)syncManifestEntries:(NSArray<LJDownLoadSyncEntry *> *)entries toDirectory:(NSString *)directory progress:(LJDownLoadSyncProgressBlock)progress completion:(LJDownLoadSyncCompletionBlock)completion;
+
+/**
+ 把旧版本直接放在临时目录下的临时文件移到分片目录，在后台队列执行
+ 完成的文件在下次下载同一个url时自动迁移，全部迁移完之后下载时不再检查旧路径
+
+ @param completion 在主线程回调，count是移动的文件个数
+ */
+- (void)migrateLegacyFilesWithCompletion:(void(^)(NSUInteger count))completion;
 @end
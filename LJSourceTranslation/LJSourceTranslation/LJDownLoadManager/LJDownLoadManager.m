@@ -9,8 +9,49 @@
 #import "LJDownLoadManager.h"
 #import "LJDownLoader.h"
 #import "NSString+LJMD5.h"
+#import "LJURLSessionTransport.h"
+#import "LJDeltaDownLoader.h"
+#import "LJDownLoadScheduler.h"
+#import "LJDNSCache.h"
+#import "LJDownLoadFileTool.h"
+
+@interface LJDownLoadSubscription()
+@property (nonatomic, strong, readwrite) NSURL *url;
+@property (nonatomic, weak, readwrite) LJDownLoader *downLoader;
+@property (atomic, assign, readwrite) BOOL sharesFile;
+// 对应下载在downLoadInfoDic中的key
+@property (nonatomic, copy) NSString *key;
+@property (nonatomic, weak) LJDownLoadManager *manager;
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, copy) LJDownLoadProgressBlock progressBlock;
+@property (nonatomic, copy) LJDownLoadSucessBlock successBlock;
+@property (nonatomic, copy) LJDownLoadDataSuccessBlock dataSuccessBlock;
+@property (nonatomic, copy) LJDownLoadFailBlock failBlock;
+// 取消之后已经派发出去的回调也不再执行
+@property (atomic, assign) BOOL cancelled;
+@end
+
+@implementation LJDownLoadSubscription
+- (void)cancel {
+    [self.manager unsubscribe:self];
+}
+
+- (void)deliver:(dispatch_block_t)block {
+    dispatch_async(self.queue ?: dispatch_get_main_queue(), ^{
+        if (!self.cancelled) {
+            block();
+        }
+    });
+}
+@end
+
 @interface LJDownLoadManager()
 @property (nonatomic, strong) NSMutableDictionary <NSString *, LJDownLoader *>*downLoadInfoDic;
+// 每个下载的订阅者，和downLoadInfoDic使用相同的key，都在@synchronized(self)中访问
+@property (nonatomic, strong) NSMutableDictionary <NSString *, NSMutableArray<LJDownLoadSubscription *> *>*subscriberDic;
+// 增量下载，key是delta-加url的md5，订阅者同样放在subscriberDic中，都在@synchronized(self)中访问
+@property (nonatomic, strong) NSMutableDictionary <NSString *, LJDeltaDownLoader *>*deltaDownLoaderDic;
+@property (nonatomic, strong, readwrite) LJDownLoadScheduler *scheduler;
 @end
 
 @implementation LJDownLoadManager
@@ -32,6 +73,16 @@ static LJDownLoadManager *_shareInstance;
     return _shareInstance;
 }
 
+- (instancetype)init {
+    static dispatch_once_t onceToken;
+    // 单例，init可能被调用多次，默认值只设一次
+    dispatch_once(&onceToken, ^{
+        _shareInstance = [super init];
+        _shareInstance.upcomingPreconnectCount = 2;
+    });
+    return _shareInstance;
+}
+
 - (NSMutableDictionary *)downLoadInfoDic {
     if (!_downLoadInfoDic) {
         _downLoadInfoDic = [NSMutableDictionary dictionary];
@@ -39,56 +90,550 @@ static LJDownLoadManager *_shareInstance;
     return _downLoadInfoDic;
 }
 
+- (NSMutableDictionary *)subscriberDic {
+    if (!_subscriberDic) {
+        _subscriberDic = [NSMutableDictionary dictionary];
+    }
+    return _subscriberDic;
+}
+
+- (NSMutableDictionary *)deltaDownLoaderDic {
+    if (!_deltaDownLoaderDic) {
+        _deltaDownLoaderDic = [NSMutableDictionary dictionary];
+    }
+    return _deltaDownLoaderDic;
+}
+
+- (LJDownLoadScheduler *)scheduler {
+    if (!_scheduler) {
+        _scheduler = [[LJDownLoadScheduler alloc] init];
+    }
+    return _scheduler;
+}
+
+- (id<LJDownLoadTransport>)transport {
+    if (!_transport) {
+        _transport = [LJURLSessionTransport defaultTransport];
+    }
+    return _transport;
+}
+
 - (void)downLoadWithURL:(NSURL *)url {
     [self downLoadWithURL:url success:nil fail:nil];
 }
 
-- (void)downLoadWithURL:(NSURL *)url success:(LJDownLoadSucessBlock)success fail:(LJDownLoadFailBlock)fail {
-    [self downLoadWithURL:url success:success progress:nil fail:fail];
+- (LJDownLoadSubscription *)downLoadWithURL:(NSURL *)url success:(LJDownLoadSucessBlock)success fail:(LJDownLoadFailBlock)fail {
+    return [self downLoadWithURL:url success:success progress:nil fail:fail];
 }
 
-- (void)downLoadWithURL:(NSURL *)url success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail {
-    NSString *md5 = [url.absoluteString md5Str];
-    LJDownLoader *downLoader = self.downLoadInfoDic[md5];
-    if (downLoader) {
-        [downLoader resume];
-        return;
+- (LJDownLoadSubscription *)downLoadWithURL:(NSURL *)url success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail {
+    return [self subscribeWithURL:url queue:nil success:success progress:progress fail:fail];
+}
+
+- (LJDownLoadSubscription *)downLoadWithURL:(NSURL *)url group:(NSString *)group success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail {
+    return [self subscribeWithURL:url group:group queue:nil success:success progress:progress fail:fail];
+}
+
+- (LJDownLoadSubscription *)subscribeWithURL:(NSURL *)url queue:(dispatch_queue_t)queue success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail {
+    return [self subscribeWithURL:url group:nil queue:queue success:success progress:progress fail:fail];
+}
+
+- (LJDownLoadSubscription *)subscribeWithURL:(NSURL *)url group:(NSString *)group queue:(dispatch_queue_t)queue success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail {
+    return [self subscribeWithURL:url group:group priority:LJDownLoadPriorityNormal queue:queue success:success progress:progress fail:fail];
+}
+
+- (LJDownLoadSubscription *)downLoadWithURL:(NSURL *)url group:(NSString *)group priority:(LJDownLoadPriority)priority success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail {
+    return [self subscribeWithURL:url group:group priority:priority queue:nil success:success progress:progress fail:fail];
+}
+
+- (LJDownLoadSubscription *)subscribeWithURL:(NSURL *)url group:(NSString *)group priority:(LJDownLoadPriority)priority queue:(dispatch_queue_t)queue success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail {
+    LJDownLoadSubscription *subscription = [self subscriptionWithURL:url queue:queue];
+    subscription.successBlock = success;
+    subscription.progressBlock = progress;
+    subscription.failBlock = fail;
+    [self addSubscription:subscription key:[url.absoluteString md5Str] group:group priority:priority streaming:NO memory:NO extractor:nil];
+    return subscription;
+}
+
+- (LJDownLoadSubscription *)downLoadDataWithURL:(NSURL *)url success:(LJDownLoadDataSuccessBlock)success fail:(LJDownLoadFailBlock)fail {
+    LJDownLoadSubscription *subscription = [self subscriptionWithURL:url queue:nil];
+    subscription.dataSuccessBlock = success;
+    subscription.failBlock = fail;
+    // 内存下载和文件下载的回调不一样，分开合并
+    [self addSubscription:subscription key:[@"data-" stringByAppendingString:[url.absoluteString md5Str]] group:nil priority:LJDownLoadPriorityNormal streaming:NO memory:YES extractor:nil];
+    return subscription;
+}
+
+- (LJDownLoader *)streamWithURL:(NSURL *)url success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail {
+    LJDownLoadSubscription *subscription = [self subscriptionWithURL:url queue:nil];
+    subscription.successBlock = success;
+    subscription.progressBlock = progress;
+    subscription.failBlock = fail;
+    // 边下边播和普通下载的回调、写文件的方式都不一样，分开合并
+    return [self addSubscription:subscription key:[@"stream-" stringByAppendingString:[url.absoluteString md5Str]] group:nil priority:LJDownLoadPriorityNormal streaming:YES memory:NO extractor:nil];
+}
+
+- (LJDownLoadSubscription *)extractWithURL:(NSURL *)url toDirectory:(NSString *)directory success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail {
+    LJDownLoadSubscription *subscription = [self subscriptionWithURL:url queue:nil];
+    subscription.successBlock = success;
+    subscription.progressBlock = progress;
+    subscription.failBlock = fail;
+    // 解压到不同目录是不同的下载
+    NSString *key = [NSString stringWithFormat:@"extract-%@", [[url.absoluteString stringByAppendingString:directory] md5Str]];
+    LJDownLoadArchiveExtractor *extractor = [[LJDownLoadArchiveExtractor alloc] initWithDestinationDirectory:directory];
+    [self addSubscription:subscription key:key group:nil priority:LJDownLoadPriorityNormal streaming:NO memory:NO extractor:extractor];
+    return subscription;
+}
+
+- (LJDownLoadSubscription *)subscriptionWithURL:(NSURL *)url queue:(dispatch_queue_t)queue {
+    LJDownLoadSubscription *subscription = [[LJDownLoadSubscription alloc] init];
+    subscription.url = url;
+    subscription.manager = self;
+    subscription.queue = queue;
+    return subscription;
+}
+
+#pragma mark - 订阅
+// 同一个url只有一个下载，后来的调用者作为订阅者加入
+- (LJDownLoader *)addSubscription:(LJDownLoadSubscription *)subscription key:(NSString *)key group:(NSString *)group priority:(LJDownLoadPriority)priority streaming:(BOOL)streaming memory:(BOOL)memory extractor:(LJDownLoadArchiveExtractor *)extractor {
+    subscription.key = key;
+    LJDownLoader *downLoader = nil;
+    BOOL isNew = NO;
+    @synchronized (self) {
+        downLoader = self.downLoadInfoDic[key];
+        if (!downLoader) {
+            downLoader = [[LJDownLoader alloc] init];
+            downLoader.streamingMode = streaming;
+            downLoader.extractor = extractor;
+            downLoader.transport = self.transport;
+            self.downLoadInfoDic[key] = downLoader;
+            self.subscriberDic[key] = [NSMutableArray array];
+            isNew = YES;
+        }
+        [self.subscriberDic[key] addObject:subscription];
+    }
+    subscription.downLoader = downLoader;
+    NSString *taskIdentifier = [self taskIdentifierForDownLoader:downLoader];
+    if (!isNew) {
+        // 后来的调用者更着急时提高优先级
+        [self.scheduler raisePriority:priority forTaskWithIdentifier:taskIdentifier];
+        [self resumeDownLoader:downLoader];
+        return downLoader;
+    }
+
+    // 交给调度器排队，轮到时才真正开始
+    NSURL *url = subscription.url;
+    __weak __typeof(self)wself = self;
+    dispatch_block_t suspendBlock = nil;
+    dispatch_block_t resumeBlock = nil;
+    // 只有文件下载可以被抢占，暂停时临时文件保留，恢复后接着下载
+    // 所有下载都可以被用户暂停，恢复时都由调度器在有空位时调用resumeBlock
+    __weak LJDownLoader *wDownLoader = downLoader;
+    if (!streaming && !memory) {
+        suspendBlock = ^{
+            dispatch_async(dispatch_get_main_queue(), ^{
+                [wDownLoader pause];
+            });
+        };
+    }
+    resumeBlock = ^{
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [wDownLoader resume];
+        });
+    };
+    // 调度器在调用scheduleTasks的线程上执行这些block(其他下载的代理队列、定时器的全局队列或者主线程)，下载器的状态都在主线程修改
+    [self.scheduler enqueueTaskWithIdentifier:taskIdentifier url:url group:group priority:priority startBlock:^{
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [wself startDownLoader:downLoader url:url key:key memory:memory];
+        });
+    } suspendBlock:suspendBlock resumeBlock:resumeBlock];
+    [self preconnectUpcomingDownLoads];
+    return downLoader;
+}
+
+// 调度器里的标识，同一个url取消后重新下载是另一个任务，不能用key
+- (NSString *)taskIdentifierForDownLoader:(LJDownLoader *)downLoader {
+    return [NSString stringWithFormat:@"%p", downLoader];
+}
+
+- (void)startDownLoader:(LJDownLoader *)downLoader url:(NSURL *)url key:(NSString *)key memory:(BOOL)memory {
+    NSString *taskIdentifier = [self taskIdentifierForDownLoader:downLoader];
+    @synchronized (self) {
+        // 排队期间已经被取消
+        if (self.downLoadInfoDic[key] != downLoader) {
+            [self.scheduler finishTaskWithIdentifier:taskIdentifier];
+            return;
+        }
     }
-    downLoader = [[LJDownLoader alloc] init];
-    self.downLoadInfoDic[md5] = downLoader;
+    // 这个下载出队了，给排在后面的提前建连接
+    [self preconnectUpcomingDownLoads];
     __weak __typeof(self)wself = self;
+    __weak LJDownLoader *wDownLoader = downLoader;
+    LJDownLoadFailBlock failBlock = ^(NSError *error) {
+        [wself.scheduler finishTaskWithIdentifier:taskIdentifier];
+        for (LJDownLoadSubscription *item in [wself removeDownLoader:wDownLoader key:key]) {
+            [item deliver:^{
+                if (item.failBlock) {
+                    item.failBlock(error);
+                }
+            }];
+        }
+    };
+    if (memory) {
+        [downLoader downLoadDataWithURL:url success:^(NSData *data) {
+            [wself.scheduler finishTaskWithIdentifier:taskIdentifier];
+            for (LJDownLoadSubscription *item in [wself removeDownLoader:wDownLoader key:key]) {
+                [item deliver:^{
+                    if (item.dataSuccessBlock) {
+                        item.dataSuccessBlock(data);
+                    }
+                }];
+            }
+        } fail:failBlock];
+        return;
+    }
     [downLoader downLoadWithURL:url downLoadInfo:nil progress:^(float progressFloat) {
-        if (progress) {
-            progress(progressFloat);
+        for (LJDownLoadSubscription *item in [wself subscribersForKey:key]) {
+            [item deliver:^{
+                if (item.progressBlock) {
+                    item.progressBlock(progressFloat);
+                }
+            }];
         }
     } downLoadSuccess:^(NSString *filePath) {
         NSLog(@"infodic----%@", [NSThread currentThread]);
-        [wself.downLoadInfoDic removeObjectForKey:md5];
-        if (success) {
-            success(filePath);
+        [wself.scheduler finishTaskWithIdentifier:taskIdentifier];
+        NSArray<LJDownLoadSubscription *> *subscribers = [wself removeDownLoader:wDownLoader key:key];
+        for (LJDownLoadSubscription *item in subscribers) {
+            item.sharesFile = subscribers.count > 1;
+            [item deliver:^{
+                if (item.successBlock) {
+                    item.successBlock(filePath);
+                }
+            }];
+        }
+    } downLoadFail:failBlock];
+}
+
+- (NSArray<LJDownLoadSubscription *> *)subscribersForKey:(NSString *)key {
+    @synchronized (self) {
+        return [self.subscriberDic[key] copy];
+    }
+}
+
+// 下载结束，返回需要通知的订阅者；下载已经被替换或者取消时返回空数组
+- (NSArray<LJDownLoadSubscription *> *)removeDownLoader:(LJDownLoader *)downLoader key:(NSString *)key {
+    @synchronized (self) {
+        if (!downLoader || self.downLoadInfoDic[key] != downLoader) {
+            return @[];
+        }
+        NSArray *subscribers = [self.subscriberDic[key] copy];
+        [self.downLoadInfoDic removeObjectForKey:key];
+        [self.subscriberDic removeObjectForKey:key];
+        return subscribers;
+    }
+}
+
+- (void)unsubscribe:(LJDownLoadSubscription *)subscription {
+    LJDownLoader *downLoader = nil;
+    LJDeltaDownLoader *deltaDownLoader = nil;
+    @synchronized (self) {
+        subscription.cancelled = YES;
+        NSMutableArray *subscribers = self.subscriberDic[subscription.key];
+        if (![subscribers containsObject:subscription]) {
+            return;
+        }
+        [subscribers removeObject:subscription];
+        // 最后一个订阅者离开才取消下载
+        if (subscribers.count == 0) {
+            downLoader = self.downLoadInfoDic[subscription.key];
+            deltaDownLoader = self.deltaDownLoaderDic[subscription.key];
+            [self.downLoadInfoDic removeObjectForKey:subscription.key];
+            [self.deltaDownLoaderDic removeObjectForKey:subscription.key];
+            [self.subscriberDic removeObjectForKey:subscription.key];
+        }
+    }
+    [deltaDownLoader cancel];
+    if (downLoader) {
+        [self.scheduler finishTaskWithIdentifier:[self taskIdentifierForDownLoader:downLoader]];
+        [downLoader cancel];
+    }
+}
+
+// 先找普通下载，没有时再找边下边播的下载
+- (LJDownLoader *)downLoaderForURL:(NSURL *)url {
+    NSString *md5 = [url.absoluteString md5Str];
+    @synchronized (self) {
+        return self.downLoadInfoDic[md5] ?: self.downLoadInfoDic[[@"stream-" stringByAppendingString:md5]];
+    }
+}
+
+#pragma mark - 预连接
+- (void)preconnectToHosts:(NSArray<NSURL *> *)urls {
+    for (NSURL *url in urls) {
+        if (url.host.length == 0) {
+            continue;
+        }
+        NSNumber *port = url.port ?: ([[url.scheme lowercaseString] isEqualToString:@"https"] ? @443 : @80);
+        [[LJDNSCache sharedCache] resolveHost:url.host port:port.unsignedIntegerValue completion:nil];
+        if ([self.transport respondsToSelector:@selector(preconnectToURL:)]) {
+            [self.transport preconnectToURL:url];
+        }
+    }
+}
+
+- (void)preconnectUpcomingDownLoads {
+    if (self.upcomingPreconnectCount == 0) {
+        return;
+    }
+    [self preconnectToHosts:[self.scheduler upcomingURLsWithLimit:self.upcomingPreconnectCount]];
+}
+
+#pragma mark - 增量下载
+- (LJDownLoadSubscription *)deltaDownLoadWithURL:(NSURL *)url manifestURL:(NSURL *)manifestURL success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail {
+    return [self deltaDownLoadWithURL:url manifestURL:manifestURL basePath:nil success:success progress:progress fail:fail];
+}
+
+- (LJDownLoadSubscription *)deltaDownLoadWithURL:(NSURL *)url manifestURL:(NSURL *)manifestURL basePath:(NSString *)basePath success:(LJDownLoadSucessBlock)success progress:(LJDownLoadProgressBlock)progress fail:(LJDownLoadFailBlock)fail {
+    LJDownLoadSubscription *subscription = [self subscriptionWithURL:url queue:nil];
+    subscription.successBlock = success;
+    subscription.progressBlock = progress;
+    subscription.failBlock = fail;
+    [self addDeltaSubscription:subscription key:[@"delta-" stringByAppendingString:[url.absoluteString md5Str]] manifestURL:manifestURL basePath:basePath];
+    return subscription;
+}
+
+// 和addSubscription一样，同一个url只有一个增量下载，后来的调用者作为订阅者加入
+- (void)addDeltaSubscription:(LJDownLoadSubscription *)subscription key:(NSString *)key manifestURL:(NSURL *)manifestURL basePath:(NSString *)basePath {
+    subscription.key = key;
+    LJDeltaDownLoader *downLoader = nil;
+    @synchronized (self) {
+        if (self.deltaDownLoaderDic[key]) {
+            [self.subscriberDic[key] addObject:subscription];
+            return;
+        }
+        downLoader = [[LJDeltaDownLoader alloc] init];
+        downLoader.transport = self.transport;
+        downLoader.basePath = basePath;
+        self.deltaDownLoaderDic[key] = downLoader;
+        self.subscriberDic[key] = [NSMutableArray arrayWithObject:subscription];
+    }
+    __weak __typeof(self)wself = self;
+    __weak LJDeltaDownLoader *wDownLoader = downLoader;
+    downLoader.progressBlock = ^(float progressFloat) {
+        for (LJDownLoadSubscription *item in [wself subscribersForKey:key]) {
+            [item deliver:^{
+                if (item.progressBlock) {
+                    item.progressBlock(progressFloat);
+                }
+            }];
+        }
+    };
+    [downLoader downLoadWithURL:subscription.url manifestURL:manifestURL success:^(NSString *filePath) {
+        for (LJDownLoadSubscription *item in [wself removeDeltaDownLoader:wDownLoader key:key]) {
+            [item deliver:^{
+                if (item.successBlock) {
+                    item.successBlock(filePath);
+                }
+            }];
         }
-    } downLoadFail:^(NSError *error){
-        [wself.downLoadInfoDic removeObjectForKey:md5];
-        if (fail) {
-            fail(error);
+    } fail:^(NSError *error) {
+        for (LJDownLoadSubscription *item in [wself removeDeltaDownLoader:wDownLoader key:key]) {
+            [item deliver:^{
+                if (item.failBlock) {
+                    item.failBlock(error);
+                }
+            }];
         }
     }];
 }
 
+// 增量下载结束，返回需要通知的订阅者；已经被取消时返回空数组
+- (NSArray<LJDownLoadSubscription *> *)removeDeltaDownLoader:(LJDeltaDownLoader *)downLoader key:(NSString *)key {
+    @synchronized (self) {
+        if (!downLoader || self.deltaDownLoaderDic[key] != downLoader) {
+            return @[];
+        }
+        NSArray *subscribers = [self.subscriberDic[key] copy];
+        [self.deltaDownLoaderDic removeObjectForKey:key];
+        [self.subscriberDic removeObjectForKey:key];
+        return subscribers;
+    }
+}
+
+- (void)seekWithURL:(NSURL *)url toOffset:(long long)offset {
+    LJDownLoader *downLoader = nil;
+    @synchronized (self) {
+        downLoader = self.downLoadInfoDic[[@"stream-" stringByAppendingString:[url.absoluteString md5Str]]];
+    }
+    [downLoader seekToOffset:offset];
+}
+
 - (void)pauseWithURL:(NSURL *)url {
-    NSString *md5 = [url.absoluteString md5Str];
-    LJDownLoader *downLoader = self.downLoadInfoDic[md5];
+    [self pauseDownLoader:[self downLoaderForURL:url]];
+}
+
+- (void)resumeWithURL:(NSURL *)url {
+    [self resumeDownLoader:[self downLoaderForURL:url]];
+}
+
+// 暂停的下载不占调度器的位置，空出来给排队的下载
+- (void)pauseDownLoader:(LJDownLoader *)downLoader {
+    if (!downLoader) {
+        return;
+    }
+    [self.scheduler pauseTaskWithIdentifier:[self taskIdentifierForDownLoader:downLoader]];
     [downLoader pause];
 }
 
+// 用户暂停的重新排队，有空位时由调度器恢复；被紧急下载暂停的等紧急下载结束后由调度器恢复
+- (void)resumeDownLoader:(LJDownLoader *)downLoader {
+    if (!downLoader) {
+        return;
+    }
+    NSString *taskIdentifier = [self taskIdentifierForDownLoader:downLoader];
+    if ([self.scheduler resumeTaskWithIdentifier:taskIdentifier] || [self.scheduler isTaskSuspendedWithIdentifier:taskIdentifier]) {
+        return;
+    }
+    [downLoader resume];
+}
+
 - (void)cancelWithURL:(NSURL *)url {
+    // 取消整个下载，所有订阅者都会收到失败回调
     NSString *md5 = [url.absoluteString md5Str];
-    LJDownLoader *downLoader = self.downLoadInfoDic[md5];
+    [self cancelDownLoaderForKey:md5];
+    [self cancelDownLoaderForKey:[@"data-" stringByAppendingString:md5]];
+    [self cancelDownLoaderForKey:[@"stream-" stringByAppendingString:md5]];
+    [self cancelDeltaDownLoaderForKey:[@"delta-" stringByAppendingString:md5]];
+}
+
+- (void)cancelDeltaDownLoaderForKey:(NSString *)key {
+    LJDeltaDownLoader *downLoader = nil;
+    NSArray<LJDownLoadSubscription *> *subscribers = nil;
+    @synchronized (self) {
+        downLoader = self.deltaDownLoaderDic[key];
+        subscribers = [self removeDeltaDownLoader:downLoader key:key];
+    }
+    if (!downLoader) {
+        return;
+    }
+    [downLoader cancel];
+    NSError *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil];
+    for (LJDownLoadSubscription *item in subscribers) {
+        [item deliver:^{
+            if (item.failBlock) {
+                item.failBlock(error);
+            }
+        }];
+    }
+}
+
+- (void)cancelDownLoaderForKey:(NSString *)key {
+    LJDownLoader *downLoader = nil;
+    NSArray<LJDownLoadSubscription *> *subscribers = nil;
+    @synchronized (self) {
+        downLoader = self.downLoadInfoDic[key];
+        subscribers = [self removeDownLoader:downLoader key:key];
+    }
+    if (!downLoader) {
+        return;
+    }
+    // 还在排队的下载不会有回调，这里直接通知订阅者
+    [self.scheduler finishTaskWithIdentifier:[self taskIdentifierForDownLoader:downLoader]];
     [downLoader cancel];
+    NSError *error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorCancelled userInfo:nil];
+    for (LJDownLoadSubscription *item in subscribers) {
+        [item deliver:^{
+            if (item.failBlock) {
+                item.failBlock(error);
+            }
+        }];
+    }
 }
 
 - (void)pauseAll {
-    [[self.downLoadInfoDic allValues] performSelector:@selector(pause)];
+    NSArray *downLoaders = nil;
+    @synchronized (self) {
+        downLoaders = [self.downLoadInfoDic allValues];
+    }
+    for (LJDownLoader *downLoader in downLoaders) {
+        [self pauseDownLoader:downLoader];
+    }
+}
+
+- (void)resumeAll {
+    NSArray *downLoaders = nil;
+    @synchronized (self) {
+        downLoaders = [self.downLoadInfoDic allValues];
+    }
+    for (LJDownLoader *downLoader in downLoaders) {
+        [self resumeDownLoader:downLoader];
+    }
+}
+
+#pragma mark - 进度快照
+- (LJDownLoadProgressSnapshot)progressSnapshotForURL:(NSURL *)url {
+    LJDownLoader *downLoader = [self downLoaderForURL:url];
+    if (!downLoader) {
+        @synchronized (self) {
+            downLoader = self.downLoadInfoDic[[@"data-" stringByAppendingString:[url.absoluteString md5Str]]];
+        }
+    }
+    if (!downLoader) {
+        LJDownLoadProgressSnapshot snapshot = {0, -1, 0, 0};
+        return snapshot;
+    }
+    return [downLoader progressSnapshot];
+}
+
+- (LJDownLoadProgressSnapshot)aggregateProgressSnapshotWithCount:(NSUInteger *)count {
+    NSArray<LJDownLoader *> *downLoaders = nil;
+    @synchronized (self) {
+        downLoaders = [self.downLoadInfoDic allValues];
+    }
+    LJDownLoadProgressSnapshot total = {0, 0, 0, 0};
+    BOOL unknownLength = NO;
+    for (LJDownLoader *downLoader in downLoaders) {
+        LJDownLoadProgressSnapshot snapshot = [downLoader progressSnapshot];
+        total.receivedBytes += snapshot.receivedBytes;
+        total.verifiedBytes += snapshot.verifiedBytes;
+        total.bytesPerSecond += snapshot.bytesPerSecond;
+        // 还在排队、没收到响应的下载不影响总长度
+        if (snapshot.totalBytes >= 0) {
+            total.totalBytes += snapshot.totalBytes;
+        } else if (snapshot.receivedBytes > 0) {
+            unknownLength = YES;
+        }
+    }
+    if (unknownLength) {
+        total.totalBytes = -1;
+    }
+    if (count) {
+        *count = downLoaders.count;
+    }
+    return total;
+}
+
+- (LJDownLoadSync *)syncManifestEntries:(NSArray<LJDownLoadSyncEntry *> *)entries toDirectory:(NSString *)directory progress:(LJDownLoadSyncProgressBlock)progress completion:(LJDownLoadSyncCompletionBlock)completion {
+    LJDownLoadSync *sync = [[LJDownLoadSync alloc] initWithDirectory:directory];
+    sync.manager = self;
+    [sync syncWithEntries:entries progress:progress completion:completion];
+    return sync;
+}
+
+- (void)migrateLegacyFilesWithCompletion:(void(^)(NSUInteger count))completion {
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+        NSUInteger count = [LJDownLoadFileTool migrateLegacyTempFiles];
+        // 完成文件只能按url逐个迁移，都迁移完之后每次下载不用再检查
+        if (![LJDownLoadFileTool hasLegacyCacheFiles]) {
+            [LJDownLoadFileTool markLegacyLayoutMigrated];
+        }
+        if (completion) {
+            dispatch_async(dispatch_get_main_queue(), ^{
+                completion(count);
+            });
+        }
+    });
 }
 
 
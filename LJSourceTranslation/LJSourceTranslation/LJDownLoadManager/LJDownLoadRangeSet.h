@@ -0,0 +1,107 @@
+//
+//  LJDownLoadRangeSet.h
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/12.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/** 文件中的一段字节范围，NSRange在32位设备上放不下大文件的偏移 */
+typedef struct {
+    long long location;
+    long long length;
+} LJByteRange;
+
+NS_INLINE LJByteRange LJMakeByteRange(long long location, long long length) {
+    LJByteRange range;
+    range.location = location;
+    range.length = length;
+    return range;
+}
+
+NS_INLINE long long LJMaxByteRange(LJByteRange range) {
+    return range.location + range.length;
+}
+
+/**
+ 记录已经下载好的字节范围，相邻或重叠的范围会自动合并
+ 非线程安全，调用方需要在同一个队列中使用
+ */
+@interface LJDownLoadRangeSet : NSObject
+
+/** 已经下载好的总字节数 */
+@property (nonatomic, assign, readonly) long long coveredLength;
+
+/** 合并后的范围个数 */
+@property (nonatomic, assign, readonly) NSUInteger rangeCount;
+
+/**
+ 从持久化的数组恢复
+
+ @param array rangesArray返回的数组
+ @return 范围集合
+ */
++ (instancetype)rangeSetWithArray:(NSArray<NSArray<NSNumber *> *> *)array;
+
+/**
+ 添加一段已经下载好的范围
+
+ @param range 字节范围
+ */
+- (void)addRange:(LJByteRange)range;
+
+/**
+ 范围是否已经全部下载好
+
+ @param range 字节范围
+ @return 是否全部包含
+ */
+- (BOOL)containsRange:(LJByteRange)range;
+
+/**
+ 从offset开始连续可用的字节数
+
+ @param offset 文件偏移
+ @return 连续可用的长度，offset本身不可用时返回0
+ */
+- (long long)availableLengthFromOffset:(long long)offset;
+
+/**
+ offset之后(包含offset)第一段缺失的范围
+
+ @param offset 文件偏移
+ @param totalLength 文件总长度
+ @return 缺失的范围，没有缺失时length为0
+ */
+- (LJByteRange)firstMissingRangeFromOffset:(long long)offset totalLength:(long long)totalLength;
+
+/**
+ [0, totalLength)是否已经全部下载好
+
+ @param totalLength 文件总长度
+ @return 是否完整
+ */
+- (BOOL)isCompleteForLength:(long long)totalLength;
+
+/**
+ 遍历所有已下载的范围
+
+ @param block 每段范围调用一次
+ */
+- (void)enumerateRangesUsingBlock:(void(^)(LJByteRange range, BOOL *stop))block;
+
+/**
+ 用于持久化的数组，每个元素是@[location, length]
+
+ @return 数组
+ */
+- (NSArray<NSArray<NSNumber *> *> *)rangesArray;
+
+/**
+ 清空所有范围
+ */
+- (void)removeAllRanges;
+
+@end
@@ -0,0 +1,145 @@
+//
+//  LJDownLoadRangeSet.m
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/12.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import "LJDownLoadRangeSet.h"
+
+@interface LJDownLoadRangeSet()
+// 按location排序，互不相邻也不重叠
+@property (nonatomic, strong) NSMutableArray<NSValue *> *ranges;
+@end
+
+@implementation LJDownLoadRangeSet
+- (instancetype)init {
+    if (self = [super init]) {
+        _ranges = [NSMutableArray array];
+    }
+    return self;
+}
+
++ (instancetype)rangeSetWithArray:(NSArray<NSArray<NSNumber *> *> *)array {
+    LJDownLoadRangeSet *set = [[self alloc] init];
+    for (NSArray<NSNumber *> *item in array) {
+        if (![item isKindOfClass:[NSArray class]] || item.count != 2) {
+            continue;
+        }
+        [set addRange:LJMakeByteRange(item[0].longLongValue, item[1].longLongValue)];
+    }
+    return set;
+}
+
+- (LJByteRange)rangeAtIndex:(NSUInteger)index {
+    LJByteRange range;
+    [self.ranges[index] getValue:&range];
+    return range;
+}
+
+- (NSValue *)valueWithRange:(LJByteRange)range {
+    return [NSValue valueWithBytes:&range objCType:@encode(LJByteRange)];
+}
+
+- (long long)coveredLength {
+    long long length = 0;
+    for (NSUInteger i = 0; i < self.ranges.count; i++) {
+        length += [self rangeAtIndex:i].length;
+    }
+    return length;
+}
+
+- (NSUInteger)rangeCount {
+    return self.ranges.count;
+}
+
+- (void)addRange:(LJByteRange)range {
+    if (range.length <= 0) {
+        return;
+    }
+    long long start = range.location;
+    long long end = LJMaxByteRange(range);
+    NSUInteger insertIndex = 0;
+    NSUInteger i = 0;
+    while (i < self.ranges.count) {
+        LJByteRange current = [self rangeAtIndex:i];
+        if (LJMaxByteRange(current) < start) {
+            // 在新范围前面，不相邻
+            insertIndex = ++i;
+            continue;
+        }
+        if (current.location > end) {
+            // 之后的都在新范围后面
+            break;
+        }
+        // 相邻或重叠，合并后移除旧的
+        start = MIN(start, current.location);
+        end = MAX(end, LJMaxByteRange(current));
+        [self.ranges removeObjectAtIndex:i];
+    }
+    [self.ranges insertObject:[self valueWithRange:LJMakeByteRange(start, end - start)] atIndex:insertIndex];
+}
+
+- (BOOL)containsRange:(LJByteRange)range {
+    if (range.length <= 0) {
+        return YES;
+    }
+    return [self availableLengthFromOffset:range.location] >= range.length;
+}
+
+- (long long)availableLengthFromOffset:(long long)offset {
+    for (NSUInteger i = 0; i < self.ranges.count; i++) {
+        LJByteRange current = [self rangeAtIndex:i];
+        if (current.location > offset) {
+            break;
+        }
+        if (LJMaxByteRange(current) > offset) {
+            return LJMaxByteRange(current) - offset;
+        }
+    }
+    return 0;
+}
+
+- (LJByteRange)firstMissingRangeFromOffset:(long long)offset totalLength:(long long)totalLength {
+    long long position = offset;
+    for (NSUInteger i = 0; i < self.ranges.count; i++) {
+        LJByteRange current = [self rangeAtIndex:i];
+        if (LJMaxByteRange(current) <= position) {
+            continue;
+        }
+        if (current.location <= position) {
+            position = LJMaxByteRange(current);
+            continue;
+        }
+        // 找到了position和下一段之间的空洞
+        long long end = MIN(current.location, totalLength);
+        return LJMakeByteRange(position, MAX(end - position, 0));
+    }
+    return LJMakeByteRange(position, MAX(totalLength - position, 0));
+}
+
+- (BOOL)isCompleteForLength:(long long)totalLength {
+    return [self firstMissingRangeFromOffset:0 totalLength:totalLength].length == 0;
+}
+
+- (void)enumerateRangesUsingBlock:(void(^)(LJByteRange range, BOOL *stop))block {
+    BOOL stop = NO;
+    for (NSUInteger i = 0; i < self.ranges.count && !stop; i++) {
+        block([self rangeAtIndex:i], &stop);
+    }
+}
+
+- (NSArray<NSArray<NSNumber *> *> *)rangesArray {
+    NSMutableArray *array = [NSMutableArray arrayWithCapacity:self.ranges.count];
+    for (NSUInteger i = 0; i < self.ranges.count; i++) {
+        LJByteRange range = [self rangeAtIndex:i];
+        [array addObject:@[@(range.location), @(range.length)]];
+    }
+    return array;
+}
+
+- (void)removeAllRanges {
+    [self.ranges removeAllObjects];
+}
+@end
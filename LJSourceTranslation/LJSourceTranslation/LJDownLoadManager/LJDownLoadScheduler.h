@@ -0,0 +1,164 @@
+//
+//  LJDownLoadScheduler.h
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/18.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+/** 没有指定分组时使用的分组 */
+extern NSString * const LJDownLoadDefaultGroup;
+
+typedef NS_ENUM(NSInteger, LJDownLoadPriority) {
+    /** 预取等后台下载，紧急下载优先暂停它们 */
+    LJDownLoadPriorityLow = -1,
+    LJDownLoadPriorityNormal = 0,
+    /** 用户正在等的下载，不参与分组的公平排队，没有空位时暂停优先级更低的下载让出位置 */
+    LJDownLoadPriorityUrgent = 1
+};
+
+/**
+ 下载调度器，决定排队的下载什么时候开始
+ 同一个host同时进行的下载不超过maxConnectionsPerHost，总数不超过maxConcurrentDownLoads
+ 有空位时按分组的权重做加权公平排队，分组内按host轮流，一大批同一个host的下载不会把别的host或者别的分组饿死
+ 紧急下载没有空位时暂停正在进行的优先级最低的下载，紧急下载结束后被暂停的下载先于排队的下载恢复
+ 线程安全，startBlock、suspendBlock和resumeBlock在调用enqueue或finish的线程上执行，不持有锁
+ */
+@interface LJDownLoadScheduler : NSObject
+
+/** 同时进行的下载总数上限，默认6 */
+@property (nonatomic, assign) NSUInteger maxConcurrentDownLoads;
+
+/** 每个host同时进行的下载上限，默认4 */
+@property (nonatomic, assign) NSUInteger maxConnectionsPerHost;
+
+/** 正在进行的下载数 */
+@property (nonatomic, assign, readonly) NSUInteger runningCount;
+
+/** 排队中的下载数 */
+@property (nonatomic, assign, readonly) NSUInteger pendingCount;
+
+/** 被紧急下载暂停、等待恢复的下载数 */
+@property (nonatomic, assign, readonly) NSUInteger suspendedCount;
+
+/** 被用户暂停的下载数 */
+@property (nonatomic, assign, readonly) NSUInteger pausedCount;
+
+/**
+ 开始或者恢复之后至少运行这么久才能被暂停，避免刚开始的下载反复被暂停恢复，默认2秒
+ */
+@property (nonatomic, assign) NSTimeInterval minimumRunInterval;
+
+/**
+ 设置分组的权重，有空位时权重为2的分组开始的下载数是权重为1的两倍，默认1
+
+ @param weight 权重，传0按1处理
+ @param group 分组名
+ */
+- (void)setWeight:(NSUInteger)weight forGroup:(NSString *)group;
+
+/**
+ 加入一个下载，有空位时立刻开始
+
+ @param identifier 下载的唯一标识，finish时传回来
+ @param url 下载地址，按url.host限制连接数
+ @param group 分组，传nil为LJDownLoadDefaultGroup
+ @param startBlock 轮到这个下载时调用
+ */
+- (void)enqueueTaskWithIdentifier:(NSString *)identifier url:(NSURL *)url group:(NSString *)group startBlock:(dispatch_block_t)startBlock;
+
+/**
+ 按优先级加入一个下载
+
+ @param identifier 下载的唯一标识，finish时传回来
+ @param url 下载地址，按url.host限制连接数
+ @param group 分组，传nil为LJDownLoadDefaultGroup
+ @param priority 优先级
+ @param startBlock 轮到这个下载时调用
+ @param suspendBlock 被紧急下载抢占时调用，传nil表示不能被抢占
+ @param resumeBlock 抢占它的紧急下载结束、或者用户暂停后恢复，重新轮到它时调用
+ */
+- (void)enqueueTaskWithIdentifier:(NSString *)identifier url:(NSURL *)url group:(NSString *)group priority:(LJDownLoadPriority)priority startBlock:(dispatch_block_t)startBlock suspendBlock:(dispatch_block_t)suspendBlock resumeBlock:(dispatch_block_t)resumeBlock;
+
+/**
+ 提高下载的优先级，比如排队中的预取变成了用户正在等的下载，比原来低时不变
+
+ @param priority 新的优先级
+ @param identifier 下载的唯一标识
+ */
+- (void)raisePriority:(LJDownLoadPriority)priority forTaskWithIdentifier:(NSString *)identifier;
+
+/**
+ 下载是否被紧急下载暂停了，这时不能从外面恢复
+
+ @param identifier 下载的唯一标识
+ @return 是否被暂停
+ */
+- (BOOL)isTaskSuspendedWithIdentifier:(NSString *)identifier;
+
+/**
+ 用户暂停下载，空出位置给排队的下载，还在排队的先拿出来，resume之前不会开始或恢复
+ 只改调度器的状态，不调用suspendBlock，暂停下载本身由调用方负责
+
+ @param identifier 下载的唯一标识
+ */
+- (void)pauseTaskWithIdentifier:(NSString *)identifier;
+
+/**
+ 恢复用户暂停的下载：还没开始过的重新排队，开始过的有空位时先于排队的下载调用resumeBlock
+
+ @param identifier 下载的唯一标识
+ @return 这个下载被用户暂停过时返回YES，否则不做任何事返回NO
+ */
+- (BOOL)resumeTaskWithIdentifier:(NSString *)identifier;
+
+/**
+ 下载结束(成功、失败或者取消)，空出位置给排队的下载，还在排队的直接移除
+ 重复调用没有影响
+
+ @param identifier 下载的唯一标识
+ */
+- (void)finishTaskWithIdentifier:(NSString *)identifier;
+
+/**
+ 接下来大概会开始的下载，用来提前建立连接
+ 按分组的虚拟时间从小到大，每个host只取排在最前面的一个
+
+ @param limit 最多返回的个数
+ @return 下载地址
+ */
+- (NSArray<NSURL *> *)upcomingURLsWithLimit:(NSUInteger)limit;
+
+#pragma mark - 统计
+/**
+ host正在进行的下载数
+
+ @param host host
+ @return 下载数
+ */
+- (NSUInteger)runningCountForHost:(NSString *)host;
+
+/**
+ 每个分组累计开始的下载数，用来衡量调度是否公平
+
+ @return 分组名到下载数的字典
+ */
+- (NSDictionary<NSString *, NSNumber *> *)startedCountByGroup;
+
+/**
+ 累计被紧急下载暂停的次数
+
+ @return 次数
+ */
+- (NSUInteger)preemptionCount;
+
+/**
+ 利用率，正在进行的下载数 / maxConcurrentDownLoads
+
+ @return 0到1之间
+ */
+- (float)utilization;
+
+@end
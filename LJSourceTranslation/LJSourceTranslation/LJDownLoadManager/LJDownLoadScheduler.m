@@ -0,0 +1,596 @@
+//
+//  LJDownLoadScheduler.m
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/18.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import "LJDownLoadScheduler.h"
+#import <os/lock.h>
+
+NSString * const LJDownLoadDefaultGroup = @"default";
+
+static const NSUInteger kLJDefaultMaxConcurrentDownLoads = 6;
+static const NSUInteger kLJDefaultMaxConnectionsPerHost = 4;
+static const NSTimeInterval kLJDefaultMinimumRunInterval = 2;
+
+@interface LJDownLoadSchedulerTask : NSObject
+@property (nonatomic, copy) NSString *identifier;
+@property (nonatomic, strong) NSURL *url;
+@property (nonatomic, copy) NSString *host;
+@property (nonatomic, copy) NSString *group;
+@property (nonatomic, copy) dispatch_block_t startBlock;
+@property (nonatomic, assign) LJDownLoadPriority priority;
+@property (nonatomic, copy) dispatch_block_t suspendBlock;
+@property (nonatomic, copy) dispatch_block_t resumeBlock;
+// 最近一次开始或者恢复的时间
+@property (nonatomic, assign) CFAbsoluteTime runningSince;
+// 被暂停时记录抢占它的紧急下载，那个下载结束后才恢复
+@property (nonatomic, copy) NSString *preemptedBy;
+@end
+
+@implementation LJDownLoadSchedulerTask
+@end
+
+@interface LJDownLoadSchedulerGroup : NSObject
+@property (nonatomic, assign) NSUInteger weight;
+// 虚拟完成时间，每开始一个下载增加1/weight
+@property (nonatomic, assign) double finishTag;
+@property (nonatomic, assign) NSUInteger startedCount;
+// 有排队任务的host，按轮到的顺序排列
+@property (nonatomic, strong) NSMutableArray<NSString *> *hosts;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSMutableArray<LJDownLoadSchedulerTask *> *> *pendingTasks;
+@end
+
+@implementation LJDownLoadSchedulerGroup
+- (instancetype)init {
+    if (self = [super init]) {
+        _weight = 1;
+        _hosts = [NSMutableArray array];
+        _pendingTasks = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+@end
+
+@interface LJDownLoadScheduler()
+{
+    os_unfair_lock _lock;
+    // 系统的虚拟时间，等于最近开始的下载所在分组的开始时间
+    double _virtualTime;
+    NSUInteger _preemptionCount;
+    // 已经安排了到时间后重新尝试抢占
+    BOOL _preemptRetryScheduled;
+}
+@property (nonatomic, strong) NSMutableDictionary<NSString *, LJDownLoadSchedulerGroup *> *groups;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, LJDownLoadSchedulerTask *> *pendingTasks;
+@property (nonatomic, strong) NSMutableDictionary<NSString *, LJDownLoadSchedulerTask *> *runningTasks;
+@property (nonatomic, strong) NSCountedSet<NSString *> *runningHosts;
+// 排队中的紧急下载，按加入的顺序
+@property (nonatomic, strong) NSMutableArray<LJDownLoadSchedulerTask *> *urgentTasks;
+// 被紧急下载暂停的下载，按暂停的顺序；用户恢复、等待空位的下载也在这里，preemptedBy为nil
+@property (nonatomic, strong) NSMutableArray<LJDownLoadSchedulerTask *> *suspendedTasks;
+// 被用户暂停的下载，不占位置，恢复之前不会开始
+@property (nonatomic, strong) NSMutableDictionary<NSString *, LJDownLoadSchedulerTask *> *pausedTasks;
+@end
+
+@implementation LJDownLoadScheduler
+- (instancetype)init {
+    if (self = [super init]) {
+        _lock = OS_UNFAIR_LOCK_INIT;
+        _maxConcurrentDownLoads = kLJDefaultMaxConcurrentDownLoads;
+        _maxConnectionsPerHost = kLJDefaultMaxConnectionsPerHost;
+        _groups = [NSMutableDictionary dictionary];
+        _pendingTasks = [NSMutableDictionary dictionary];
+        _runningTasks = [NSMutableDictionary dictionary];
+        _runningHosts = [NSCountedSet set];
+        _urgentTasks = [NSMutableArray array];
+        _suspendedTasks = [NSMutableArray array];
+        _pausedTasks = [NSMutableDictionary dictionary];
+        _minimumRunInterval = kLJDefaultMinimumRunInterval;
+    }
+    return self;
+}
+
+- (void)setMaxConcurrentDownLoads:(NSUInteger)maxConcurrentDownLoads {
+    os_unfair_lock_lock(&_lock);
+    _maxConcurrentDownLoads = MAX(maxConcurrentDownLoads, 1);
+    os_unfair_lock_unlock(&_lock);
+    // 上限调大后可能有排队的可以开始了
+    [self scheduleTasks];
+}
+
+- (void)setMaxConnectionsPerHost:(NSUInteger)maxConnectionsPerHost {
+    os_unfair_lock_lock(&_lock);
+    _maxConnectionsPerHost = MAX(maxConnectionsPerHost, 1);
+    os_unfair_lock_unlock(&_lock);
+    [self scheduleTasks];
+}
+
+- (NSUInteger)runningCount {
+    os_unfair_lock_lock(&_lock);
+    NSUInteger count = self.runningTasks.count;
+    os_unfair_lock_unlock(&_lock);
+    return count;
+}
+
+- (NSUInteger)pendingCount {
+    os_unfair_lock_lock(&_lock);
+    NSUInteger count = self.pendingTasks.count;
+    os_unfair_lock_unlock(&_lock);
+    return count;
+}
+
+- (NSUInteger)suspendedCount {
+    os_unfair_lock_lock(&_lock);
+    NSUInteger count = self.suspendedTasks.count;
+    os_unfair_lock_unlock(&_lock);
+    return count;
+}
+
+- (NSUInteger)pausedCount {
+    os_unfair_lock_lock(&_lock);
+    NSUInteger count = self.pausedTasks.count;
+    os_unfair_lock_unlock(&_lock);
+    return count;
+}
+
+// 调用方持有锁
+- (LJDownLoadSchedulerGroup *)groupNamed:(NSString *)name {
+    LJDownLoadSchedulerGroup *group = self.groups[name];
+    if (!group) {
+        group = [[LJDownLoadSchedulerGroup alloc] init];
+        // 新分组从当前虚拟时间开始，不能用之前空闲的时间攒额度
+        group.finishTag = _virtualTime;
+        self.groups[name] = group;
+    }
+    return group;
+}
+
+- (void)setWeight:(NSUInteger)weight forGroup:(NSString *)group {
+    os_unfair_lock_lock(&_lock);
+    [self groupNamed:group ?: LJDownLoadDefaultGroup].weight = MAX(weight, 1);
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (void)enqueueTaskWithIdentifier:(NSString *)identifier url:(NSURL *)url group:(NSString *)group startBlock:(dispatch_block_t)startBlock {
+    [self enqueueTaskWithIdentifier:identifier url:url group:group priority:LJDownLoadPriorityNormal startBlock:startBlock suspendBlock:nil resumeBlock:nil];
+}
+
+- (void)enqueueTaskWithIdentifier:(NSString *)identifier url:(NSURL *)url group:(NSString *)group priority:(LJDownLoadPriority)priority startBlock:(dispatch_block_t)startBlock suspendBlock:(dispatch_block_t)suspendBlock resumeBlock:(dispatch_block_t)resumeBlock {
+    LJDownLoadSchedulerTask *task = [[LJDownLoadSchedulerTask alloc] init];
+    task.identifier = identifier;
+    task.url = url;
+    task.host = url.host.lowercaseString ?: @"";
+    task.group = group ?: LJDownLoadDefaultGroup;
+    task.startBlock = startBlock;
+    task.priority = priority;
+    task.suspendBlock = suspendBlock;
+    task.resumeBlock = resumeBlock;
+
+    os_unfair_lock_lock(&_lock);
+    if (self.pendingTasks[identifier] || self.runningTasks[identifier] || self.pausedTasks[identifier]) {
+        os_unfair_lock_unlock(&_lock);
+        return;
+    }
+    [self addPendingTask:task];
+    os_unfair_lock_unlock(&_lock);
+
+    [self scheduleTasks];
+}
+
+// 调用方持有锁
+- (void)addPendingTask:(LJDownLoadSchedulerTask *)task {
+    self.pendingTasks[task.identifier] = task;
+    LJDownLoadSchedulerGroup *schedulerGroup = [self groupNamed:task.group];
+    NSMutableArray *hostTasks = schedulerGroup.pendingTasks[task.host];
+    if (!hostTasks) {
+        hostTasks = [NSMutableArray array];
+        schedulerGroup.pendingTasks[task.host] = hostTasks;
+        [schedulerGroup.hosts addObject:task.host];
+    }
+    [hostTasks addObject:task];
+    if (task.priority >= LJDownLoadPriorityUrgent) {
+        [self.urgentTasks addObject:task];
+    }
+}
+
+// 调用方持有锁，从被紧急下载暂停的下载中移除
+- (LJDownLoadSchedulerTask *)removeSuspendedTaskWithIdentifier:(NSString *)identifier {
+    LJDownLoadSchedulerTask *task = nil;
+    for (LJDownLoadSchedulerTask *suspendedTask in [self.suspendedTasks copy]) {
+        if ([suspendedTask.identifier isEqualToString:identifier]) {
+            [self.suspendedTasks removeObject:suspendedTask];
+            task = suspendedTask;
+        }
+    }
+    return task;
+}
+
+- (void)pauseTaskWithIdentifier:(NSString *)identifier {
+    if (!identifier) {
+        return;
+    }
+    os_unfair_lock_lock(&_lock);
+    LJDownLoadSchedulerTask *task = self.runningTasks[identifier];
+    if (task) {
+        [self.runningTasks removeObjectForKey:identifier];
+        [self.runningHosts removeObject:task.host];
+    } else if ((task = self.pendingTasks[identifier])) {
+        [self removePendingTask:task];
+    } else {
+        task = [self removeSuspendedTaskWithIdentifier:identifier];
+    }
+    if (task) {
+        task.preemptedBy = nil;
+        self.pausedTasks[identifier] = task;
+    }
+    os_unfair_lock_unlock(&_lock);
+
+    // 空出来的位置给排队的下载
+    if (task) {
+        [self scheduleTasks];
+    }
+}
+
+- (BOOL)resumeTaskWithIdentifier:(NSString *)identifier {
+    if (!identifier) {
+        return NO;
+    }
+    os_unfair_lock_lock(&_lock);
+    LJDownLoadSchedulerTask *task = self.pausedTasks[identifier];
+    if (!task) {
+        os_unfair_lock_unlock(&_lock);
+        return NO;
+    }
+    [self.pausedTasks removeObjectForKey:identifier];
+    if (task.startBlock) {
+        // 还没开始过，重新排队
+        [self addPendingTask:task];
+    } else {
+        // 已经开始过，和被紧急下载暂停的一样，有空位时先于排队的下载调用resumeBlock
+        [self.suspendedTasks addObject:task];
+    }
+    os_unfair_lock_unlock(&_lock);
+
+    [self scheduleTasks];
+    return YES;
+}
+
+- (void)finishTaskWithIdentifier:(NSString *)identifier {
+    if (!identifier) {
+        return;
+    }
+    os_unfair_lock_lock(&_lock);
+    LJDownLoadSchedulerTask *task = self.runningTasks[identifier];
+    if (task) {
+        [self.runningTasks removeObjectForKey:identifier];
+        [self.runningHosts removeObject:task.host];
+    } else {
+        task = self.pendingTasks[identifier];
+        if (task) {
+            [self removePendingTask:task];
+        }
+    }
+    [self removeSuspendedTaskWithIdentifier:identifier];
+    [self.pausedTasks removeObjectForKey:identifier];
+    os_unfair_lock_unlock(&_lock);
+
+    [self scheduleTasks];
+}
+
+- (void)raisePriority:(LJDownLoadPriority)priority forTaskWithIdentifier:(NSString *)identifier {
+    if (!identifier) {
+        return;
+    }
+    os_unfair_lock_lock(&_lock);
+    LJDownLoadSchedulerTask *task = self.pendingTasks[identifier] ?: self.runningTasks[identifier] ?: self.pausedTasks[identifier];
+    for (LJDownLoadSchedulerTask *suspendedTask in self.suspendedTasks) {
+        if (!task && [suspendedTask.identifier isEqualToString:identifier]) {
+            task = suspendedTask;
+        }
+    }
+    if (!task || priority <= task.priority) {
+        os_unfair_lock_unlock(&_lock);
+        return;
+    }
+    task.priority = priority;
+    if (self.pendingTasks[identifier] && priority >= LJDownLoadPriorityUrgent) {
+        [self.urgentTasks addObject:task];
+    }
+    os_unfair_lock_unlock(&_lock);
+
+    [self scheduleTasks];
+}
+
+- (BOOL)isTaskSuspendedWithIdentifier:(NSString *)identifier {
+    BOOL suspended = NO;
+    os_unfair_lock_lock(&_lock);
+    for (LJDownLoadSchedulerTask *task in self.suspendedTasks) {
+        if ([task.identifier isEqualToString:identifier]) {
+            suspended = YES;
+            break;
+        }
+    }
+    os_unfair_lock_unlock(&_lock);
+    return suspended;
+}
+
+// 调用方持有锁
+- (void)removePendingTask:(LJDownLoadSchedulerTask *)task {
+    [self.pendingTasks removeObjectForKey:task.identifier];
+    [self.urgentTasks removeObject:task];
+    LJDownLoadSchedulerGroup *group = self.groups[task.group];
+    NSMutableArray *hostTasks = group.pendingTasks[task.host];
+    [hostTasks removeObject:task];
+    if (hostTasks.count == 0) {
+        [group.pendingTasks removeObjectForKey:task.host];
+        [group.hosts removeObject:task.host];
+    }
+}
+
+// 调用方持有锁
+- (BOOL)hostHasCapacity:(NSString *)host {
+    return [self.runningHosts countForObject:host] < _maxConnectionsPerHost;
+}
+
+// 调用方持有锁
+- (void)markTaskRunning:(LJDownLoadSchedulerTask *)task {
+    task.runningSince = CFAbsoluteTimeGetCurrent();
+    self.runningTasks[task.identifier] = task;
+    [self.runningHosts addObject:task.host];
+}
+
+// 调用方持有锁，排在最前面、host还有空位的紧急下载
+- (LJDownLoadSchedulerTask *)nextUrgentTask {
+    for (LJDownLoadSchedulerTask *task in self.urgentTasks) {
+        if ([self hostHasCapacity:task.host]) {
+            return task;
+        }
+    }
+    return nil;
+}
+
+// 调用方持有锁，抢占它的紧急下载已经结束(或者是用户恢复的)、可以恢复的下载
+- (LJDownLoadSchedulerTask *)nextResumableTask {
+    for (LJDownLoadSchedulerTask *task in self.suspendedTasks) {
+        if (task.preemptedBy && (self.runningTasks[task.preemptedBy] || self.pendingTasks[task.preemptedBy])) {
+            continue;
+        }
+        if ([self hostHasCapacity:task.host]) {
+            return task;
+        }
+    }
+    return nil;
+}
+
+/**
+ 调用方持有锁，给排队中的紧急下载暂停优先级更低的下载
+ host满了只能暂停同一个host的下载，否则暂停任何host的；优先暂停优先级最低、最晚开始的
+ 运行不到minimumRunInterval的下载不会被暂停
+
+ @param blocks 需要在锁外执行的暂停和开始
+ @return 有下载还没到可以暂停的时间时返回最早可以重试的时间，否则返回0
+ */
+- (CFAbsoluteTime)preemptForUrgentTasks:(NSMutableArray<dispatch_block_t> *)blocks {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    CFAbsoluteTime retryTime = 0;
+    for (LJDownLoadSchedulerTask *urgentTask in [self.urgentTasks copy]) {
+        BOOL hostFull = ![self hostHasCapacity:urgentTask.host];
+        LJDownLoadSchedulerTask *victim = nil;
+        for (LJDownLoadSchedulerTask *task in self.runningTasks.allValues) {
+            if (!task.suspendBlock || task.priority >= urgentTask.priority) {
+                continue;
+            }
+            if (hostFull && ![task.host isEqualToString:urgentTask.host]) {
+                continue;
+            }
+            CFAbsoluteTime eligibleTime = task.runningSince + _minimumRunInterval;
+            if (eligibleTime > now) {
+                retryTime = retryTime > 0 ? MIN(retryTime, eligibleTime) : eligibleTime;
+                continue;
+            }
+            if (!victim || task.priority < victim.priority || (task.priority == victim.priority && task.runningSince > victim.runningSince)) {
+                victim = task;
+            }
+        }
+        if (!victim) {
+            continue;
+        }
+        [self.runningTasks removeObjectForKey:victim.identifier];
+        [self.runningHosts removeObject:victim.host];
+        victim.preemptedBy = urgentTask.identifier;
+        [self.suspendedTasks addObject:victim];
+        [blocks addObject:victim.suspendBlock];
+        _preemptionCount++;
+        // 空出来的位置直接给紧急下载，不再经过公平排队
+        [self removePendingTask:urgentTask];
+        [self markTaskRunning:urgentTask];
+        if (urgentTask.startBlock) {
+            [blocks addObject:urgentTask.startBlock];
+            urgentTask.startBlock = nil;
+        }
+    }
+    return retryTime;
+}
+
+// 调用方持有锁，分组里第一个没有达到连接上限的host
+- (NSString *)runnableHostInGroup:(LJDownLoadSchedulerGroup *)group {
+    for (NSString *host in group.hosts) {
+        if ([self hostHasCapacity:host]) {
+            return host;
+        }
+    }
+    return nil;
+}
+
+/**
+ 取出所有现在可以开始或恢复的任务：先是紧急下载，再是被暂停的下载，最后按加权公平排队的顺序
+ 空位不够时紧急下载抢占优先级更低的下载
+
+ @param retryTime 需要稍后重新尝试抢占的时间，不需要时为0
+ @return 需要在锁外执行的开始、暂停和恢复
+ */
+- (NSArray<dispatch_block_t> *)dequeueRunnableBlocksWithRetryTime:(CFAbsoluteTime *)retryTime {
+    NSMutableArray<dispatch_block_t> *blocks = [NSMutableArray array];
+    os_unfair_lock_lock(&_lock);
+    while (self.runningTasks.count < _maxConcurrentDownLoads) {
+        LJDownLoadSchedulerTask *urgentTask = [self nextUrgentTask];
+        if (urgentTask) {
+            [self removePendingTask:urgentTask];
+            [self markTaskRunning:urgentTask];
+            if (urgentTask.startBlock) {
+                [blocks addObject:urgentTask.startBlock];
+                urgentTask.startBlock = nil;
+            }
+            continue;
+        }
+        LJDownLoadSchedulerTask *suspendedTask = [self nextResumableTask];
+        if (suspendedTask) {
+            [self.suspendedTasks removeObject:suspendedTask];
+            suspendedTask.preemptedBy = nil;
+            [self markTaskRunning:suspendedTask];
+            if (suspendedTask.resumeBlock) {
+                [blocks addObject:suspendedTask.resumeBlock];
+            }
+            continue;
+        }
+        if (self.pendingTasks.count == 0) {
+            break;
+        }
+        // 虚拟开始时间最小的分组先走，开始时间 = max(上次完成时间, 系统虚拟时间)
+        LJDownLoadSchedulerGroup *selectedGroup = nil;
+        NSString *selectedHost = nil;
+        double selectedStart = 0;
+        for (LJDownLoadSchedulerGroup *group in self.groups.allValues) {
+            if (group.hosts.count == 0) {
+                continue;
+            }
+            double start = MAX(group.finishTag, _virtualTime);
+            if (selectedGroup && start >= selectedStart) {
+                continue;
+            }
+            NSString *host = [self runnableHostInGroup:group];
+            if (!host) {
+                continue;
+            }
+            selectedGroup = group;
+            selectedHost = host;
+            selectedStart = start;
+        }
+        if (!selectedGroup) {
+            // 排队的都被host上限挡住了
+            break;
+        }
+        _virtualTime = selectedStart;
+        selectedGroup.finishTag = selectedStart + 1.0 / selectedGroup.weight;
+        selectedGroup.startedCount++;
+
+        LJDownLoadSchedulerTask *task = selectedGroup.pendingTasks[selectedHost].firstObject;
+        [self removePendingTask:task];
+        // 分组内host轮流，刚用过的host排到最后
+        if (selectedGroup.pendingTasks[selectedHost]) {
+            [selectedGroup.hosts removeObject:selectedHost];
+            [selectedGroup.hosts addObject:selectedHost];
+        }
+        [self markTaskRunning:task];
+        if (task.startBlock) {
+            [blocks addObject:task.startBlock];
+            task.startBlock = nil;
+        }
+    }
+    CFAbsoluteTime time = 0;
+    if (self.urgentTasks.count > 0) {
+        time = [self preemptForUrgentTasks:blocks];
+    }
+    if (time > 0 && _preemptRetryScheduled) {
+        time = 0;
+    }
+    _preemptRetryScheduled = _preemptRetryScheduled || time > 0;
+    os_unfair_lock_unlock(&_lock);
+    if (retryTime) {
+        *retryTime = time;
+    }
+    return blocks;
+}
+
+- (void)scheduleTasks {
+    CFAbsoluteTime retryTime = 0;
+    NSArray<dispatch_block_t> *blocks = [self dequeueRunnableBlocksWithRetryTime:&retryTime];
+    for (dispatch_block_t block in blocks) {
+        block();
+    }
+    if (retryTime <= 0) {
+        return;
+    }
+    // 被挡住的紧急下载到时间后再试一次
+    __weak __typeof(self)wself = self;
+    int64_t delay = (int64_t)((retryTime - CFAbsoluteTimeGetCurrent()) * NSEC_PER_SEC);
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, MAX(delay, 0)), dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        __strong __typeof(wself)sself = wself;
+        if (!sself) {
+            return;
+        }
+        os_unfair_lock_lock(&sself->_lock);
+        sself->_preemptRetryScheduled = NO;
+        os_unfair_lock_unlock(&sself->_lock);
+        [sself scheduleTasks];
+    });
+}
+
+- (NSArray<NSURL *> *)upcomingURLsWithLimit:(NSUInteger)limit {
+    NSMutableArray<NSURL *> *urls = [NSMutableArray array];
+    NSMutableSet<NSString *> *hosts = [NSMutableSet set];
+    os_unfair_lock_lock(&_lock);
+    NSArray<LJDownLoadSchedulerGroup *> *groups = [self.groups.allValues sortedArrayUsingComparator:^NSComparisonResult(LJDownLoadSchedulerGroup *group1, LJDownLoadSchedulerGroup *group2) {
+        return [@(group1.finishTag) compare:@(group2.finishTag)];
+    }];
+    for (LJDownLoadSchedulerGroup *group in groups) {
+        for (NSString *host in group.hosts) {
+            if (urls.count >= limit) {
+                break;
+            }
+            LJDownLoadSchedulerTask *task = group.pendingTasks[host].firstObject;
+            if (task.url && ![hosts containsObject:host]) {
+                [hosts addObject:host];
+                [urls addObject:task.url];
+            }
+        }
+    }
+    os_unfair_lock_unlock(&_lock);
+    return urls;
+}
+
+#pragma mark - 统计
+- (NSUInteger)runningCountForHost:(NSString *)host {
+    os_unfair_lock_lock(&_lock);
+    NSUInteger count = [self.runningHosts countForObject:host.lowercaseString ?: @""];
+    os_unfair_lock_unlock(&_lock);
+    return count;
+}
+
+- (NSDictionary<NSString *, NSNumber *> *)startedCountByGroup {
+    NSMutableDictionary *dic = [NSMutableDictionary dictionary];
+    os_unfair_lock_lock(&_lock);
+    [self.groups enumerateKeysAndObjectsUsingBlock:^(NSString *name, LJDownLoadSchedulerGroup *group, BOOL *stop) {
+        dic[name] = @(group.startedCount);
+    }];
+    os_unfair_lock_unlock(&_lock);
+    return dic;
+}
+
+- (NSUInteger)preemptionCount {
+    os_unfair_lock_lock(&_lock);
+    NSUInteger count = _preemptionCount;
+    os_unfair_lock_unlock(&_lock);
+    return count;
+}
+
+- (float)utilization {
+    os_unfair_lock_lock(&_lock);
+    float utilization = (float)self.runningTasks.count / _maxConcurrentDownLoads;
+    os_unfair_lock_unlock(&_lock);
+    return utilization;
+}
+@end
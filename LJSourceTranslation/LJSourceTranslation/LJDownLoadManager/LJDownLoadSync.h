@@ -0,0 +1,93 @@
+//
+//  LJDownLoadSync.h
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/20.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class LJDownLoadManager;
+
+extern NSString * const LJDownLoadSyncErrorDomain;
+
+typedef NS_ENUM(NSInteger, LJDownLoadSyncError) {
+    /** 清单格式不对 */
+    LJDownLoadSyncErrorInvalidManifest = 1,
+    /** 下载好的文件和清单中的摘要或大小不一致 */
+    LJDownLoadSyncErrorDigestMismatch,
+    /** 文件移到目标目录失败 */
+    LJDownLoadSyncErrorMoveFailed
+};
+
+/**
+ 清单中的一个文件
+ */
+@interface LJDownLoadSyncEntry : NSObject
+
+/** 相对于同步目录的路径 */
+@property (nonatomic, copy) NSString *path;
+@property (nonatomic, strong) NSURL *url;
+@property (nonatomic, assign) long long size;
+/** 十六进制的文件摘要，32位为md5，64位为sha256 */
+@property (nonatomic, copy) NSString *digest;
+
+/** 同步失败时的错误 */
+@property (nonatomic, strong, readonly) NSError *error;
+
++ (instancetype)entryWithPath:(NSString *)path url:(NSURL *)url size:(long long)size digest:(NSString *)digest;
+
+/**
+ 解析JSON格式的清单：[{"path": "a/b.png", "url": "http://...", "size": 123, "digest": "..."}, ...]
+
+ @param data JSON数据
+ @param error 格式不对时的错误
+ @return 清单中的文件
+ */
++ (NSArray<LJDownLoadSyncEntry *> *)entriesWithJSONData:(NSData *)data error:(NSError **)error;
+
+@end
+
+typedef void(^LJDownLoadSyncProgressBlock)(NSUInteger finishedCount, NSUInteger totalCount);
+typedef void(^LJDownLoadSyncCompletionBlock)(NSUInteger unchangedCount, NSArray<LJDownLoadSyncEntry *> *failedEntries);
+
+/**
+ 按清单把一整个目录同步成最新版本
+ 目录下保存一份摘要索引(路径、大小、修改时间、摘要)，大小和修改时间没变、摘要和清单一致的文件直接跳过，不重新计算摘要
+ 只下载缺少或者过期的文件，下载完成的文件在所有核上并行校验，校验通过后移到目标路径
+ 清单之外的文件不会删除
+ */
+@interface LJDownLoadSync : NSObject
+
+/**
+ 创建同步任务
+
+ @param directory 同步的根目录
+ @return 同步任务
+ */
+- (instancetype)initWithDirectory:(NSString *)directory;
+
+@property (nonatomic, copy, readonly) NSString *directory;
+
+/** 下载使用的管理器，默认是[LJDownLoadManager shareInstance] */
+@property (nonatomic, weak) LJDownLoadManager *manager;
+
+/** 下载使用的分组，默认"sync"，和普通下载公平分配连接 */
+@property (nonatomic, copy) NSString *group;
+
+/**
+ 开始同步，一个同步任务同时只能有一次同步
+
+ @param entries 清单
+ @param progress 进度回调，在主线程
+ @param completion 完成回调，在主线程，unchangedCount是不需要下载的文件数
+ */
+- (void)syncWithEntries:(NSArray<LJDownLoadSyncEntry *> *)entries progress:(LJDownLoadSyncProgressBlock)progress completion:(LJDownLoadSyncCompletionBlock)completion;
+
+/**
+ 取消同步，已经下载好的文件保留，下次同步时不会再下载
+ */
+- (void)cancel;
+
+@end
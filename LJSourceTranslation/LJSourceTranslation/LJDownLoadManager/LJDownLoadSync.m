@@ -0,0 +1,355 @@
+//
+//  LJDownLoadSync.m
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/20.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import "LJDownLoadSync.h"
+#import "LJDownLoadManager.h"
+#import "LJDownLoadFileTool.h"
+#import <sys/stat.h>
+
+NSString * const LJDownLoadSyncErrorDomain = @"LJDownLoadSyncErrorDomain";
+
+// 摘要索引的文件名，放在同步目录下
+static NSString * const kLJDownLoadSyncIndexFileName = @".ljsync-index.plist";
+static NSString * const kLJDownLoadSyncDefaultGroup = @"sync";
+
+typedef NS_ENUM(uint8_t, LJDownLoadSyncState) {
+    /** 和清单一致，不用下载 */
+    LJDownLoadSyncStateUnchanged,
+    /** 缺少或者过期，需要下载 */
+    LJDownLoadSyncStateDownLoad
+};
+
+// 纳秒精度的修改时间，秒精度在同一秒内覆盖文件时分辨不出来
+static long long LJDownLoadSyncModificationTime(const struct stat *st) {
+#ifdef __APPLE__
+    return (long long)st->st_mtimespec.tv_sec * NSEC_PER_SEC + st->st_mtimespec.tv_nsec;
+#else
+    return (long long)st->st_mtim.tv_sec * NSEC_PER_SEC + st->st_mtim.tv_nsec;
+#endif
+}
+
+// 索引中的一条记录：@[大小, 修改时间, 摘要]
+static NSArray *LJDownLoadSyncRecord(long long size, long long modificationTime, NSString *digest) {
+    return @[@(size), @(modificationTime), digest.lowercaseString];
+}
+
+@interface LJDownLoadSyncEntry()
+@property (nonatomic, strong, readwrite) NSError *error;
+@end
+
+@implementation LJDownLoadSyncEntry
++ (instancetype)entryWithPath:(NSString *)path url:(NSURL *)url size:(long long)size digest:(NSString *)digest {
+    LJDownLoadSyncEntry *entry = [[self alloc] init];
+    entry.path = path;
+    entry.url = url;
+    entry.size = size;
+    entry.digest = digest;
+    return entry;
+}
+
++ (NSArray<LJDownLoadSyncEntry *> *)entriesWithJSONData:(NSData *)data error:(NSError **)error {
+    id json = data ? [NSJSONSerialization JSONObjectWithData:data options:0 error:nil] : nil;
+    if (![json isKindOfClass:[NSArray class]]) {
+        if (error) {
+            *error = [NSError errorWithDomain:LJDownLoadSyncErrorDomain code:LJDownLoadSyncErrorInvalidManifest userInfo:@{NSLocalizedDescriptionKey : @"manifest is not an array"}];
+        }
+        return nil;
+    }
+    NSMutableArray<LJDownLoadSyncEntry *> *entries = [NSMutableArray arrayWithCapacity:[json count]];
+    for (NSDictionary *item in json) {
+        NSString *path = [item isKindOfClass:[NSDictionary class]] ? item[@"path"] : nil;
+        NSString *urlString = [item isKindOfClass:[NSDictionary class]] ? item[@"url"] : nil;
+        NSNumber *size = [item isKindOfClass:[NSDictionary class]] ? item[@"size"] : nil;
+        NSString *digest = [item isKindOfClass:[NSDictionary class]] ? item[@"digest"] : nil;
+        NSURL *url = [urlString isKindOfClass:[NSString class]] ? [NSURL URLWithString:urlString] : nil;
+        // 路径不能跑到同步目录外面
+        BOOL validPath = [path isKindOfClass:[NSString class]] && path.length > 0 && ![path hasPrefix:@"/"] && ![path.pathComponents containsObject:@".."];
+        BOOL validDigest = [digest isKindOfClass:[NSString class]] && (digest.length == 32 || digest.length == 64);
+        if (!validPath || !url || ![size isKindOfClass:[NSNumber class]] || !validDigest) {
+            if (error) {
+                NSString *description = [NSString stringWithFormat:@"invalid manifest entry at index %lu", (unsigned long)entries.count];
+                *error = [NSError errorWithDomain:LJDownLoadSyncErrorDomain code:LJDownLoadSyncErrorInvalidManifest userInfo:@{NSLocalizedDescriptionKey : description}];
+            }
+            return nil;
+        }
+        [entries addObject:[self entryWithPath:path url:url size:size.longLongValue digest:digest]];
+    }
+    return entries;
+}
+@end
+
+@interface LJDownLoadSync()
+@property (nonatomic, copy, readwrite) NSString *directory;
+// 同步状态只在这个串行队列中访问
+@property (nonatomic, strong) dispatch_queue_t queue;
+// 校验下载好的文件，并发数等于核数
+@property (nonatomic, strong) NSOperationQueue *verifyQueue;
+// 路径 -> @[大小, 修改时间, 摘要]
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSArray *> *index;
+@property (nonatomic, strong) NSMutableArray<LJDownLoadSyncEntry *> *failedEntries;
+@property (nonatomic, strong) NSMutableArray<LJDownLoadSubscription *> *subscriptions;
+@property (nonatomic, copy) LJDownLoadSyncProgressBlock progressBlock;
+@property (nonatomic, copy) LJDownLoadSyncCompletionBlock completionBlock;
+@property (nonatomic, assign) NSUInteger totalCount;
+@property (nonatomic, assign) NSUInteger finishedCount;
+@property (nonatomic, assign) NSUInteger unchangedCount;
+// 还没结束的下载数，同一个url的多个文件算一个
+@property (nonatomic, assign) NSUInteger pendingCount;
+@property (nonatomic, assign) BOOL syncing;
+@end
+
+@implementation LJDownLoadSync
+- (instancetype)initWithDirectory:(NSString *)directory {
+    if (self = [super init]) {
+        _directory = [directory copy];
+        _group = kLJDownLoadSyncDefaultGroup;
+        _queue = dispatch_queue_create("com.liang.LJDownLoadSync", DISPATCH_QUEUE_SERIAL);
+        _verifyQueue = [[NSOperationQueue alloc] init];
+        _verifyQueue.maxConcurrentOperationCount = [NSProcessInfo processInfo].activeProcessorCount;
+        _verifyQueue.qualityOfService = NSQualityOfServiceUtility;
+    }
+    return self;
+}
+
+- (LJDownLoadManager *)manager {
+    return _manager ?: [LJDownLoadManager shareInstance];
+}
+
+#pragma mark - 索引
+- (NSString *)indexPath {
+    return [self.directory stringByAppendingPathComponent:kLJDownLoadSyncIndexFileName];
+}
+
+- (NSMutableDictionary<NSString *, NSArray *> *)loadIndex {
+    NSData *data = [NSData dataWithContentsOfFile:[self indexPath]];
+    NSDictionary *index = data ? [NSPropertyListSerialization propertyListWithData:data options:NSPropertyListImmutable format:NULL error:nil] : nil;
+    return [index isKindOfClass:[NSDictionary class]] ? [index mutableCopy] : [NSMutableDictionary dictionary];
+}
+
+// 二进制plist，几万条记录读写都很快
+- (void)saveIndex {
+    NSData *data = [NSPropertyListSerialization dataWithPropertyList:self.index format:NSPropertyListBinaryFormat_v1_0 options:0 error:nil];
+    [[NSFileManager defaultManager] createDirectoryAtPath:self.directory withIntermediateDirectories:YES attributes:nil error:nil];
+    [data writeToFile:[self indexPath] atomically:YES];
+}
+
+#pragma mark - 同步
+- (void)syncWithEntries:(NSArray<LJDownLoadSyncEntry *> *)entries progress:(LJDownLoadSyncProgressBlock)progress completion:(LJDownLoadSyncCompletionBlock)completion {
+    dispatch_async(self.queue, ^{
+        if (self.syncing) {
+            return;
+        }
+        self.syncing = YES;
+        self.progressBlock = progress;
+        self.completionBlock = completion;
+        self.failedEntries = [NSMutableArray array];
+        self.subscriptions = [NSMutableArray array];
+        self.totalCount = entries.count;
+        self.finishedCount = 0;
+        self.unchangedCount = 0;
+        self.pendingCount = 0;
+
+        NSDictionary<NSString *, NSArray *> *oldIndex = [self loadIndex];
+        NSMutableDictionary<NSString *, NSArray *> *newIndex = [NSMutableDictionary dictionaryWithCapacity:entries.count];
+        NSUInteger count = entries.count;
+        LJDownLoadSyncState *states = calloc(MAX(count, 1), sizeof(LJDownLoadSyncState));
+        __strong NSArray **records = (__strong NSArray **)calloc(MAX(count, 1), sizeof(NSArray *));
+        NSString *directory = self.directory;
+
+        // 在所有核上并行stat，大小和修改时间都没变、索引里的摘要和清单一致时不用读文件
+        // 没有索引或者索引过期的文件重新计算摘要，同样是并行的
+        dispatch_apply(count, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^(size_t i) {
+            @autoreleasepool {
+                LJDownLoadSyncEntry *entry = entries[i];
+                NSString *path = [directory stringByAppendingPathComponent:entry.path];
+                struct stat st;
+                if (stat(path.fileSystemRepresentation, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size != entry.size) {
+                    states[i] = LJDownLoadSyncStateDownLoad;
+                    return;
+                }
+                long long modificationTime = LJDownLoadSyncModificationTime(&st);
+                NSArray *record = oldIndex[entry.path];
+                BOOL indexed = [record isKindOfClass:[NSArray class]] && record.count == 3 &&
+                               [record[0] longLongValue] == st.st_size &&
+                               [record[1] longLongValue] == modificationTime &&
+                               [record[2] caseInsensitiveCompare:entry.digest] == NSOrderedSame;
+                if (!indexed) {
+                    NSString *digest = [LJDownLoadFileTool digestWithPath:path matchingDigest:entry.digest];
+                    if (!digest || [digest caseInsensitiveCompare:entry.digest] != NSOrderedSame) {
+                        states[i] = LJDownLoadSyncStateDownLoad;
+                        return;
+                    }
+                    record = LJDownLoadSyncRecord(st.st_size, modificationTime, digest);
+                }
+                states[i] = LJDownLoadSyncStateUnchanged;
+                records[i] = record;
+            }
+        });
+
+        // 同一个url只下载一次，下载好后放到所有用到它的路径
+        NSMutableDictionary<NSURL *, NSMutableArray<LJDownLoadSyncEntry *> *> *downLoads = [NSMutableDictionary dictionary];
+        for (NSUInteger i = 0; i < count; i++) {
+            LJDownLoadSyncEntry *entry = entries[i];
+            entry.error = nil;
+            if (states[i] == LJDownLoadSyncStateUnchanged) {
+                newIndex[entry.path] = records[i];
+                self.unchangedCount++;
+            } else {
+                NSMutableArray *list = downLoads[entry.url];
+                if (!list) {
+                    list = [NSMutableArray array];
+                    downLoads[entry.url] = list;
+                }
+                [list addObject:entry];
+            }
+            records[i] = nil;
+        }
+        free(states);
+        free(records);
+
+        self.index = newIndex;
+        self.finishedCount = self.unchangedCount;
+        if (downLoads.count == 0) {
+            [self finishSync];
+            return;
+        }
+        // 先保存一次，中途取消或者崩溃时没变的文件下次也不用再算摘要
+        [self saveIndex];
+        [self notifyProgress];
+        self.pendingCount = downLoads.count;
+        [downLoads enumerateKeysAndObjectsUsingBlock:^(NSURL *url, NSMutableArray<LJDownLoadSyncEntry *> *list, BOOL *stop) {
+            [self downLoadURL:url entries:list];
+        }];
+    });
+}
+
+// 在queue中调用
+- (void)downLoadURL:(NSURL *)url entries:(NSArray<LJDownLoadSyncEntry *> *)entries {
+    // 缓存目录里同一个url的旧文件是过期的版本，不能直接拿来用
+    [LJDownLoadFileTool removeFileAtPath:[LJDownLoadFileTool cacheFilePathForURL:url]];
+    // 回调强引用self，调用方不持有同步对象时也要活到所有下载结束
+    // self.subscriptions和订阅之间的循环引用在finishSync或者cancel时打破
+    __block __weak LJDownLoadSubscription *wSubscription = nil;
+    LJDownLoadSubscription *subscription = [self.manager subscribeWithURL:url group:self.group queue:self.queue success:^(NSString *filePath) {
+        // 其他订阅者也拿到了这个缓存文件，不能移走
+        BOOL shared = wSubscription.sharesFile;
+        [self.verifyQueue addOperationWithBlock:^{
+            [self verifyFileAtPath:filePath entries:entries shared:shared];
+        }];
+    } progress:nil fail:^(NSError *error) {
+        for (LJDownLoadSyncEntry *entry in entries) {
+            entry.error = error;
+        }
+        [self finishEntries:entries records:nil];
+    }];
+    wSubscription = subscription;
+    [self.subscriptions addObject:subscription];
+}
+
+// 在verifyQueue中并行调用，shared为YES时文件还有其他订阅者在用，只拷贝不移动
+- (void)verifyFileAtPath:(NSString *)filePath entries:(NSArray<LJDownLoadSyncEntry *> *)entries shared:(BOOL)shared {
+    LJDownLoadSyncEntry *first = entries.firstObject;
+    NSString *digest = [LJDownLoadFileTool digestWithPath:filePath matchingDigest:first.digest];
+    if ([LJDownLoadFileTool fileSizeWithPath:filePath] != first.size || !digest || [digest caseInsensitiveCompare:first.digest] != NSOrderedSame) {
+        if (!shared) {
+            [LJDownLoadFileTool removeFileAtPath:filePath];
+        }
+        NSError *error = [NSError errorWithDomain:LJDownLoadSyncErrorDomain code:LJDownLoadSyncErrorDigestMismatch userInfo:@{NSURLErrorKey : first.url}];
+        for (LJDownLoadSyncEntry *entry in entries) {
+            entry.error = error;
+        }
+        dispatch_async(self.queue, ^{
+            [self finishEntries:entries records:nil];
+        });
+        return;
+    }
+    NSFileManager *fileManager = [[NSFileManager alloc] init];
+    NSMutableDictionary<NSString *, NSArray *> *records = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 0; i < entries.count; i++) {
+        LJDownLoadSyncEntry *entry = entries[i];
+        NSString *path = [self.directory stringByAppendingPathComponent:entry.path];
+        [LJDownLoadFileTool createDirectoryForFilePath:path];
+        [fileManager removeItemAtPath:path error:nil];
+        NSError *error = nil;
+        // 最后一个直接移过去，前面的拷贝；文件是共享的时候都拷贝
+        BOOL success = (i == entries.count - 1 && !shared) ? [fileManager moveItemAtPath:filePath toPath:path error:&error] : [fileManager copyItemAtPath:filePath toPath:path error:&error];
+        struct stat st;
+        if (!success || stat(path.fileSystemRepresentation, &st) != 0) {
+            entry.error = [NSError errorWithDomain:LJDownLoadSyncErrorDomain code:LJDownLoadSyncErrorMoveFailed userInfo:error ? @{NSUnderlyingErrorKey : error} : nil];
+            continue;
+        }
+        records[entry.path] = LJDownLoadSyncRecord(st.st_size, LJDownLoadSyncModificationTime(&st), digest);
+    }
+    dispatch_async(self.queue, ^{
+        [self finishEntries:entries records:records];
+    });
+}
+
+// 在queue中调用
+- (void)finishEntries:(NSArray<LJDownLoadSyncEntry *> *)entries records:(NSDictionary<NSString *, NSArray *> *)records {
+    [self.index addEntriesFromDictionary:records];
+    if (!self.syncing) {
+        // 取消之后才下载好的文件也记到索引里
+        [self saveIndex];
+        return;
+    }
+    for (LJDownLoadSyncEntry *entry in entries) {
+        if (entry.error) {
+            [self.failedEntries addObject:entry];
+        }
+    }
+    self.finishedCount += entries.count;
+    [self notifyProgress];
+    if (--self.pendingCount == 0) {
+        [self finishSync];
+    }
+}
+
+- (void)notifyProgress {
+    LJDownLoadSyncProgressBlock progress = self.progressBlock;
+    NSUInteger finishedCount = self.finishedCount;
+    NSUInteger totalCount = self.totalCount;
+    if (progress) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            progress(finishedCount, totalCount);
+        });
+    }
+}
+
+- (void)finishSync {
+    [self saveIndex];
+    self.syncing = NO;
+    self.subscriptions = nil;
+    LJDownLoadSyncCompletionBlock completion = self.completionBlock;
+    NSUInteger unchangedCount = self.unchangedCount;
+    NSArray *failedEntries = [self.failedEntries copy];
+    self.progressBlock = nil;
+    self.completionBlock = nil;
+    if (completion) {
+        dispatch_async(dispatch_get_main_queue(), ^{
+            completion(unchangedCount, failedEntries);
+        });
+    }
+}
+
+- (void)cancel {
+    dispatch_async(self.queue, ^{
+        if (!self.syncing) {
+            return;
+        }
+        for (LJDownLoadSubscription *subscription in self.subscriptions) {
+            [subscription cancel];
+        }
+        self.subscriptions = nil;
+        self.syncing = NO;
+        self.progressBlock = nil;
+        self.completionBlock = nil;
+        [self saveIndex];
+    });
+}
+@end
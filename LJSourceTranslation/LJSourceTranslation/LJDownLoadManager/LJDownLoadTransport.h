@@ -0,0 +1,86 @@
+//
+//  LJDownLoadTransport.h
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/14.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@protocol LJDownLoadTransportTask;
+
+/**
+ 传输层的回调，所有方法都在创建任务时传入的队列中调用
+ */
+@protocol LJDownLoadTransportDelegate <NSObject>
+
+/**
+ 收到响应头
+
+ @param task 对应的任务
+ @param response 响应
+ @param completionHandler 传入YES继续接收数据，传入NO取消任务
+ */
+- (void)transportTask:(id<LJDownLoadTransportTask>)task didReceiveResponse:(NSHTTPURLResponse *)response completionHandler:(void (^)(BOOL allow))completionHandler;
+
+/**
+ 收到一段响应体
+
+ @param task 对应的任务
+ @param data 数据，不会被传输层再修改
+ */
+- (void)transportTask:(id<LJDownLoadTransportTask>)task didReceiveData:(NSData *)data;
+
+/**
+ 任务结束
+
+ @param task 对应的任务
+ @param error 成功时为nil，取消时为NSURLErrorCancelled
+ */
+- (void)transportTask:(id<LJDownLoadTransportTask>)task didCompleteWithError:(NSError *)error;
+
+@end
+
+/**
+ 一次Range请求
+ */
+@protocol LJDownLoadTransportTask <NSObject>
+
+/** 创建任务时的请求 */
+@property (nonatomic, copy, readonly) NSURLRequest *originalRequest;
+
+// 开始或恢复
+- (void)resume;
+// 暂停接收数据
+- (void)suspend;
+// 取消，之后会收到NSURLErrorCancelled
+- (void)cancel;
+
+@end
+
+/**
+ 下载使用的传输层，LJDownLoader只通过这个协议收发数据
+ 默认是基于NSURLSession的LJURLSessionTransport，也可以换成基于socket的LJSocketTransport
+ */
+@protocol LJDownLoadTransport <NSObject>
+
+/**
+ 创建一个任务，和NSURLSession一样创建后处于暂停状态，需要调用resume
+
+ @param request 请求
+ @param delegate 回调对象，任务结束前会被持有
+ @param delegateQueue 回调所在的队列，必须是串行队列
+ @return 任务
+ */
+- (id<LJDownLoadTransportTask>)dataTaskWithRequest:(NSURLRequest *)request delegate:(id<LJDownLoadTransportDelegate>)delegate delegateQueue:(NSOperationQueue *)delegateQueue;
+
+@optional
+/**
+ 提前解析域名并建立一个空闲连接，之后同一个host的请求不用再等握手
+
+ @param url 只用到scheme、host和port
+ */
+- (void)preconnectToURL:(NSURL *)url;
+
+@end
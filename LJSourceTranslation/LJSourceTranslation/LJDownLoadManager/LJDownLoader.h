@@ -7,6 +7,9 @@
 //
 
 #import <Foundation/Foundation.h>
+#import "LJDownLoadRangeSet.h"
+#import "LJDownLoadTransport.h"
+#import "LJDownLoadArchiveExtractor.h"
 typedef NS_ENUM(NSInteger, LJDownLoadStatus) {
     LJDownLoadStatusUnknown,
     /** 下载暂停 */
@@ -21,17 +24,99 @@ typedef NS_ENUM(NSInteger, LJDownLoadStatus) {
 
 typedef void(^LJDownLoadInfoBlock)(long long fileSize);
 typedef void(^LJDownLoadProgressBlock)(float progressFloat);
+/** expectedLength为-1表示服务器没有给出长度 */
+typedef void(^LJDownLoadBytesProgressBlock)(long long receivedLength, long long expectedLength);
 typedef void(^LJDownLoadSucessBlock)(NSString *filePath);
 typedef void(^LJDownLoadFailBlock)(NSError *error);
+typedef void(^LJDownLoadAvailableBlock)(BOOL available);
+typedef void(^LJDownLoadDataSuccessBlock)(NSData *data);
+
+/**
+ 某一时刻的下载进度，全部是64位整数，几GB的文件也不会丢精度
+ 每个字段单独原子读取，任何线程都可以读，不经过主线程
+ */
+typedef struct {
+    /** 已经收到的字节数 */
+    int64_t receivedBytes;
+    /** 总长度，未知时为-1 */
+    int64_t totalBytes;
+    /** 已经写到临时文件(内存下载时为完整收到)的字节数，不超过receivedBytes */
+    int64_t verifiedBytes;
+    /** 最近的下载速度，字节/秒，没有在下载时为0 */
+    int64_t bytesPerSecond;
+} LJDownLoadProgressSnapshot;
+
+/** 完成的比例，总长度未知时返回-1 */
+NS_INLINE double LJDownLoadProgressSnapshotFraction(LJDownLoadProgressSnapshot snapshot) {
+    return snapshot.totalBytes > 0 ? (double)snapshot.receivedBytes / snapshot.totalBytes : -1;
+}
+
 @interface LJDownLoader : NSObject
 @property (nonatomic, copy) LJDownLoadInfoBlock infoBlock;
 @property (nonatomic, copy) LJDownLoadProgressBlock progressBlock;
 @property (nonatomic, copy) LJDownLoadSucessBlock successBlock;
 @property (nonatomic, copy) LJDownLoadFailBlock failBlock;
+@property (nonatomic, copy) LJDownLoadDataSuccessBlock dataSuccessBlock;
+/** 按字节的进度，长度未知时progressBlock不会回调，只能通过它拿到进度 */
+@property (nonatomic, copy) LJDownLoadBytesProgressBlock bytesProgressBlock;
 
 @property (nonatomic, assign, readonly) LJDownLoadStatus downLoadStatus;
 @property (nonatomic, assign, readonly) float progress;
 
+/** 已经收到的字节数(包含之前下载的部分) */
+@property (nonatomic, assign, readonly) long long receivedLength;
+
+/** 文件的总长度，没有Content-Length(chunked、压缩传输)时为-1，以连接正常结束作为下载完成 */
+@property (nonatomic, assign, readonly) long long expectedLength;
+
+/**
+ 无锁读取当前进度，适合监控界面高频轮询大量下载
+
+ @return 进度快照
+ */
+- (LJDownLoadProgressSnapshot)progressSnapshot;
+
+/** 服务器是否支持断点续传(返回206或者Accept-Ranges: bytes)，不支持时下载失败会删掉临时文件 */
+@property (nonatomic, assign, readonly) BOOL resumable;
+
+/**
+ 收发数据使用的传输层，默认是共享的LJURLSessionTransport
+ 必须在开始下载之前设置
+ */
+@property (nonatomic, strong) id<LJDownLoadTransport> transport;
+
+#pragma mark - 内存下载
+/** 内存下载的大小上限，Content-Length不超过它时直接收到内存里，不经过临时文件，默认256KB */
+@property (nonatomic, assign) long long memoryThreshold;
+
+/** 内存下载成功后是否同时写到缓存目录，默认NO */
+@property (nonatomic, assign) BOOL persistsMemoryDownload;
+
+#pragma mark - 流式播放
+/**
+ 流式播放模式，音视频边下边播时使用
+ 开启后优先下载播放位置附近的数据，播放位置之后的数据下完再回头补齐前面的空洞
+ 必须在开始下载之前设置
+ */
+@property (nonatomic, assign) BOOL streamingMode;
+
+/** 播放位置之后需要优先保证的预读长度，默认1MB */
+@property (nonatomic, assign) long long lookAheadLength;
+
+/** 当前的播放位置 */
+@property (nonatomic, assign, readonly) long long playheadOffset;
+
+/** 下载中的临时文件，流式播放时从这里读取已经下载好的数据，下载完成后文件会移到成功回调的路径 */
+@property (nonatomic, copy, readonly) NSString *tempFilePath;
+
+#pragma mark - 边下边解压
+/**
+ 设置后下载的数据不写临时文件，按顺序交给解压器直接解压到它的目标目录，占用的磁盘只有解压后的大小
+ 下载和解压的进度一起记录在检查点里，暂停、失败或者进程被杀掉后再下载同一个url从检查点继续
+ 成功回调的路径是解压的目标目录，必须在开始下载之前设置
+ */
+@property (nonatomic, strong) LJDownLoadArchiveExtractor *extractor;
+
 // 状态改变的block
 @property (nonatomic, copy) void(^downLoadStateChange)(LJDownLoadStatus status);
 // 文件下载进度
@@ -41,6 +126,16 @@ typedef void(^LJDownLoadFailBlock)(NSError *error);
 - (void)downLoadWithURL:(NSURL *)url downLoadInfo:(LJDownLoadInfoBlock)Info downLoadSuccess:(LJDownLoadSucessBlock)success downLoadFail:(LJDownLoadFailBlock)fail;
 - (void)downLoadWithURL:(NSURL *)url downLoadInfo:(LJDownLoadInfoBlock)Info progress:(LJDownLoadProgressBlock)progress downLoadSuccess:(LJDownLoadSucessBlock)success downLoadFail:(LJDownLoadFailBlock)fail;
 
+/**
+ 下载小文件(JSON、图标等)到内存，不检查也不写临时文件
+ Content-Length超过memoryThreshold或者未知时自动改为文件下载，成功后把文件映射成NSData回调
+
+ @param url url地址
+ @param success 成功回调
+ @param fail 失败回调
+ */
+- (void)downLoadDataWithURL:(NSURL *)url success:(LJDownLoadDataSuccessBlock)success fail:(LJDownLoadFailBlock)fail;
+
 // 恢复
 - (void)resume;
 // 暂停
@@ -49,4 +144,27 @@ typedef void(^LJDownLoadFailBlock)(NSError *error);
 - (void)cancel;
 // 取消并清除缓存
 - (void)cancelAndClearCache;
+
+/**
+ 移动播放位置(拖动进度条)，播放位置附近的数据没有下载好时，立刻从播放位置重新请求
+
+ @param offset 新的播放位置
+ */
+- (void)seekToOffset:(long long)offset;
+
+/**
+ 等待指定位置的字节下载完成
+
+ @param offset 文件偏移
+ @param completion 在主线程回调，下载失败或取消时available为NO
+ */
+- (void)waitUntilOffsetAvailable:(long long)offset completion:(LJDownLoadAvailableBlock)completion;
+
+/**
+ 指定范围是否已经下载好，可以从tempFilePath读取
+
+ @param range 字节范围
+ @return 是否可用
+ */
+- (BOOL)isRangeAvailable:(LJByteRange)range;
 @end
@@ -9,38 +9,112 @@
 #import "LJDownLoader.h"
 #import "LJDownLoadFileTool.h"
 #import "NSString+LJMD5.h"
-#define LJCacheDir NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES).firstObject
-#define LJTempDir NSTemporaryDirectory()
+#import "LJDownLoadBuffer.h"
+#import "LJURLSessionTransport.h"
+#import "LJDownLoadFileWriter.h"
+#import "LJDownLoadBufferPool.h"
+#import <errno.h>
+#import <stdatomic.h>
 
-@interface LJDownLoader()<NSURLSessionDelegate, NSURLSessionDataDelegate>
+// 攒够这么多数据才写一次文件，减少系统调用
+static const size_t kLJDownLoadFlushThreshold = 512 * 1024;
+// 流式播放时要尽快让播放器读到数据，写得更勤一些
+static const size_t kLJDownLoadStreamingFlushThreshold = 64 * 1024;
+// 默认预读1MB
+static const long long kLJDownLoadDefaultLookAhead = 1024 * 1024;
+// 默认256KB以内的文件在内存中下载
+static const long long kLJDownLoadDefaultMemoryThreshold = 256 * 1024;
+// 长度未知时第一次预留1MB，之后每次翻倍
+static const long long kLJDownLoadInitialReservation = 1024 * 1024;
+// 至少间隔0.5秒计算一次下载速度
+static const CFTimeInterval kLJDownLoadRateInterval = 0.5;
+
+@interface LJDownLoader()<LJDownLoadTransportDelegate>
 {
     long long _tempFileSize;
     long long _totalFileSize;
+    // 服务器没有给出长度，下载到连接正常结束为止
+    BOOL _unknownLength;
+    // 临时文件已经预留的磁盘空间
+    long long _reservedLength;
+    // 响应本身有问题(比如4xx/5xx)或者解压失败，请求结束时代替传输层的错误回调
+    NSError *_responseError;
+    // buffer中第一个字节对应的文件偏移
+    long long _bufferOffset;
+    // 进度快照，任何线程都可以读
+    _Atomic(int64_t) _snapshotReceived;
+    _Atomic(int64_t) _snapshotTotal;
+    _Atomic(int64_t) _snapshotVerified;
+    _Atomic(int64_t) _snapshotRate;
+    // 上一次计算速度的时间和收到的字节数，只在代理队列中使用
+    CFAbsoluteTime _rateSampleTime;
+    long long _rateSampleLength;
+    // 流式播放：服务器忽略了Range从头返回整个文件，只能顺序下载，不能跳到播放位置
+    BOOL _rangesUnsupported;
+    // 通过downLoadDataWithURL:发起的请求
+    BOOL _memoryRequest;
+    // 内存下载：从内存池取的内存块，为NULL时表示在下载到文件
+    void *_memoryBytes;
+    size_t _memoryLength;
+    size_t _memoryCapacity;
 }
 @property (nonatomic, copy) NSString *cacheFilePath;
 
-@property (nonatomic, copy) NSString *tempFilePath;
+@property (nonatomic, copy, readwrite) NSString *tempFilePath;
 
-@property (nonatomic, strong) NSURLSession *session;
+@property (nonatomic, assign, readwrite) long long receivedLength;
+@property (nonatomic, assign, readwrite) long long expectedLength;
+@property (nonatomic, assign, readwrite) BOOL resumable;
 
-@property (nonatomic, strong) NSOutputStream *outputStream;
+// 还没写到文件的数据，只持有不拷贝
+@property (nonatomic, strong) LJDownLoadBuffer *buffer;
+// 临时文件的异步写入器，只在代理队列中使用
+@property (nonatomic, strong) LJDownLoadFileWriter *writer;
 @property (nonatomic, strong) NSURL *url;
 //@property (nonatomic, strong) NSURL *url;
 //@property (nonatomic, strong) NSOperationQueue *queue;
-@property (nonatomic, weak) NSURLSessionDataTask *dataTask;
+// 当前的请求，取消后的旧请求的回调都会被忽略
+@property (nonatomic, strong) id<LJDownLoadTransportTask> dataTask;
 @property (nonatomic, strong) NSOperationQueue *queue;
+
+// 流式播放：已经写到临时文件、可以读取的范围，只在代理队列中使用
+@property (nonatomic, strong) LJDownLoadRangeSet *availableRanges;
+// 流式播放：已经收到并提交写入的范围，决定下一段请求什么，只在代理队列中使用
+@property (nonatomic, strong) LJDownLoadRangeSet *receivedRanges;
+// 流式播放：等待某个位置可用的回调
+@property (nonatomic, strong) NSMutableArray<NSDictionary *> *offsetWaiters;
 @end
 
 @implementation LJDownLoader
-- (NSURLSession *)session {
-    if (!_session) {
-        NSURLSessionConfiguration *config = [NSURLSessionConfiguration backgroundSessionConfigurationWithIdentifier:[self.url.absoluteString md5Str]];
+- (instancetype)init {
+    if (self = [super init]) {
+        _buffer = [[LJDownLoadBuffer alloc] init];
+        _lookAheadLength = kLJDownLoadDefaultLookAhead;
+        _memoryThreshold = kLJDownLoadDefaultMemoryThreshold;
+        _availableRanges = [[LJDownLoadRangeSet alloc] init];
+        _receivedRanges = [[LJDownLoadRangeSet alloc] init];
+        _offsetWaiters = [NSMutableArray array];
+        _expectedLength = -1;
+        atomic_init(&_snapshotReceived, 0);
+        atomic_init(&_snapshotTotal, -1);
+        atomic_init(&_snapshotVerified, 0);
+        atomic_init(&_snapshotRate, 0);
+        // 代理队列只创建一次，所有请求的回调和流式播放的状态都在这个队列中
         _queue = [[NSOperationQueue alloc] init];
         _queue.maxConcurrentOperationCount = 1;
-        // TODO:队列问题还没解决
-        _session = [NSURLSession sessionWithConfiguration:config delegate:self delegateQueue:_queue];
     }
-    return _session;
+    return self;
+}
+
+- (void)dealloc {
+    [self recycleMemoryBuffer];
+}
+
+- (id<LJDownLoadTransport>)transport {
+    if (!_transport) {
+        _transport = [LJURLSessionTransport defaultTransport];
+    }
+    return _transport;
 }
 
 - (void)setDownLoadStatus:(LJDownLoadStatus)downLoadStatus {
@@ -53,6 +127,15 @@
     }
 }
 
+// 收到响应后在主线程标记为正在下载，响应到达之前已经暂停的保持暂停，恢复时才改为正在下载
+- (void)markDownLoading {
+    dispatch_async(dispatch_get_main_queue(), ^{
+        if (self.downLoadStatus != LJDownLoadStatusPause) {
+            self.downLoadStatus = LJDownLoadStatusDownLoading;
+        }
+    });
+}
+
 - (void)setProgress:(float)progress {
     _progress = progress;
     if (self.progressBlock) {
@@ -60,6 +143,65 @@
     }
 }
 
+// 在主线程调用，长度未知时只报字节数，不计算百分比
+- (void)updateReceivedLength:(long long)received expectedLength:(long long)expected {
+    _tempFileSize = received;
+    self.receivedLength = received;
+    self.expectedLength = expected;
+    if (expected > 0) {
+        self.progress = 1.0 * received / expected;
+    }
+    if (self.bytesProgressBlock) {
+        self.bytesProgressBlock(received, expected);
+    }
+}
+
+#pragma mark - 进度快照
+- (LJDownLoadProgressSnapshot)progressSnapshot {
+    LJDownLoadProgressSnapshot snapshot;
+    // 先读写入的字节数，保证verifiedBytes不超过receivedBytes
+    snapshot.verifiedBytes = atomic_load_explicit(&_snapshotVerified, memory_order_acquire);
+    snapshot.receivedBytes = atomic_load_explicit(&_snapshotReceived, memory_order_acquire);
+    snapshot.totalBytes = atomic_load_explicit(&_snapshotTotal, memory_order_relaxed);
+    snapshot.bytesPerSecond = atomic_load_explicit(&_snapshotRate, memory_order_relaxed);
+    return snapshot;
+}
+
+// 以下方法在代理队列中调用
+- (void)resetSnapshotWithReceivedLength:(long long)received totalLength:(long long)total {
+    atomic_store_explicit(&_snapshotVerified, received, memory_order_release);
+    atomic_store_explicit(&_snapshotReceived, received, memory_order_release);
+    atomic_store_explicit(&_snapshotTotal, total, memory_order_relaxed);
+    _rateSampleTime = CFAbsoluteTimeGetCurrent();
+    _rateSampleLength = received;
+}
+
+- (void)recordReceivedLength:(long long)received {
+    atomic_store_explicit(&_snapshotReceived, received, memory_order_release);
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    CFTimeInterval elapsed = now - _rateSampleTime;
+    if (elapsed < kLJDownLoadRateInterval) {
+        return;
+    }
+    int64_t rate = (int64_t)((received - _rateSampleLength) / elapsed);
+    int64_t lastRate = atomic_load_explicit(&_snapshotRate, memory_order_relaxed);
+    // 和上一次的速度平均，减少抖动
+    if (lastRate > 0) {
+        rate = (lastRate + rate) / 2;
+    }
+    atomic_store_explicit(&_snapshotRate, MAX(rate, 0), memory_order_relaxed);
+    _rateSampleTime = now;
+    _rateSampleLength = received;
+}
+
+- (void)recordVerifiedLength:(long long)verified {
+    atomic_store_explicit(&_snapshotVerified, verified, memory_order_release);
+}
+
+- (void)stopRecordingRate {
+    atomic_store_explicit(&_snapshotRate, 0, memory_order_relaxed);
+}
+
 - (void)downLoadWithURL:(NSURL *)url downLoadInfo:(LJDownLoadInfoBlock)Info downLoadSuccess:(LJDownLoadSucessBlock)success downLoadFail:(LJDownLoadFailBlock)fail {
     self.infoBlock = Info;
     self.successBlock = success;
@@ -77,13 +219,18 @@
 
 - (void)downLoadWithURL:(NSURL *)url {
     _url = url;
+    _memoryRequest = NO;
+    // 旧版本的文件先移到分片目录
+    if (![LJDownLoadFileTool isLegacyLayoutMigrated]) {
+        [LJDownLoadFileTool migrateLegacyFilesForURL:url];
+    }
     // 最终的下载地址
-    self.cacheFilePath = [LJCacheDir stringByAppendingString:url.lastPathComponent];
+    self.cacheFilePath = [LJDownLoadFileTool cacheFilePathForURL:url];
     // 临时文件地址
-    self.tempFilePath = [LJTempDir stringByAppendingString:[url.absoluteString md5Str]];
+    self.tempFilePath = [LJDownLoadFileTool tempFilePathForURL:url];
     
-    // 看文件是否已经下载好
-    if ([LJDownLoadFileTool isFileExists:self.cacheFilePath]) {
+    // 看文件是否已经下载好，解压模式不保存归档文件，以检查点为准
+    if (!self.extractor && [LJDownLoadFileTool isFileExists:self.cacheFilePath]) {
         self.downLoadStatus = LJDownLoadStatusSuccess;
         NSLog(@"该文件已存在");
         
@@ -111,10 +258,42 @@
     }
     
     [self cancel];
-    // 计算临时文件的大小
-    _tempFileSize = [LJDownLoadFileTool fileSizeWithPath:self.tempFilePath];
-    // 开始下载
-    [self downLoadWithURL:url offset:_tempFileSize];
+    if (self.streamingMode) {
+        [self startStreaming];
+        return;
+    }
+    if (self.extractor) {
+        [self startExtracting];
+        return;
+    }
+    // 旧请求可能还有数据在buffer和writer队列中，先在代理队列中写完并关闭临时文件，再计算临时文件的大小
+    [self.queue addOperationWithBlock:^{
+        if (![url isEqual:self.url]) {
+            return;
+        }
+        [self closeTempFileWithCompletion:^{
+            if (![url isEqual:self.url]) {
+                return;
+            }
+            // 连续调用时前一次排进来的请求可能已经发出，只保留最后一个
+            [self.dataTask cancel];
+            _tempFileSize = [LJDownLoadFileTool fileSizeWithPath:self.tempFilePath];
+            // 开始下载
+            [self downLoadWithURL:url offset:_tempFileSize];
+        }];
+    }];
+}
+
+- (void)downLoadDataWithURL:(NSURL *)url success:(LJDownLoadDataSuccessBlock)success fail:(LJDownLoadFailBlock)fail {
+    self.dataSuccessBlock = success;
+    self.failBlock = fail;
+    _url = url;
+    _memoryRequest = YES;
+    // 只算路径，不访问文件系统
+    self.cacheFilePath = [LJDownLoadFileTool cacheFilePathForURL:url];
+    self.tempFilePath = [LJDownLoadFileTool tempFilePathForURL:url];
+    [self cancel];
+    [self downLoadWithURL:url offset:0];
 }
 
 // 恢复
@@ -129,110 +308,904 @@
 // 暂停
 // 如果你调用了两次resume，就需要调用两次suspend来暂停
 - (void)pause {
-    if (self.downLoadStatus == LJDownLoadStatusDownLoading) {
+    // 请求已经发出、还没收到响应时状态仍是Unknown，这时也要能暂停，否则调度器抢占时空出的名额并没有真正空出来
+    BOOL requesting = self.downLoadStatus == LJDownLoadStatusUnknown && self.dataTask;
+    if (self.downLoadStatus == LJDownLoadStatusDownLoading || requesting) {
         [self.dataTask suspend];
         self.downLoadStatus = LJDownLoadStatusPause;
+        // 暂停时把攒着的数据写到临时文件并落盘
+        [self.queue addOperationWithBlock:^{
+            if (self.extractor) {
+                [self.extractor checkpoint];
+                return;
+            }
+            [self checkpointWithCompletion:nil];
+        }];
     }
 }
 
 // 取消
 - (void)cancel {
-    [self.session invalidateAndCancel];
-    self.session = nil;
+    [self.dataTask cancel];
 }
 
 // 取消并清除缓存
 - (void)cancelAndClearCache {
     [self cancel];
     [LJDownLoadFileTool removeFileAtPath:self.tempFilePath];
+    [LJDownLoadFileTool removeFileAtPath:[self rangesFilePath]];
+    if (self.extractor) {
+        [self.queue addOperationWithBlock:^{
+            [self.extractor reset];
+        }];
+    }
+}
+
+#pragma mark - 文件写入
+// 以下方法都在代理队列中调用
+- (BOOL)openTempFile {
+    // 同一个临时文件继续用原来的writer，之前提交的写入保证先完成
+    if (self.writer && [self.writer.path isEqualToString:self.tempFilePath]) {
+        return YES;
+    }
+    [self closeTempFileWithCompletion:nil];
+    [LJDownLoadFileTool createDirectoryForFilePath:self.tempFilePath];
+    self.writer = [LJDownLoadFileWriter writerWithPath:self.tempFilePath];
+    _reservedLength = 0;
+    return self.writer != nil;
+}
+
+// 在写到length之前预留好磁盘空间，长度已知时一次预留到总长度，未知时按倍数增长，减少文件碎片
+- (void)reserveTempFileLength:(long long)length {
+    if (!self.writer || length <= _reservedLength) {
+        return;
+    }
+    long long reserved = length;
+    if (_unknownLength) {
+        reserved = MAX(MAX(_reservedLength * 2, kLJDownLoadInitialReservation), length);
+    }
+    [self.writer preallocateLength:reserved];
+    _reservedLength = reserved;
+}
+
+// 把攒着的数据交给writer按偏移写入，不等待磁盘
+- (void)flushBuffer {
+    if (!self.writer || self.buffer.length == 0) {
+        return;
+    }
+    LJByteRange range = LJMakeByteRange(_bufferOffset, self.buffer.length);
+    BOOL streaming = self.streamingMode;
+    [self reserveTempFileLength:LJMaxByteRange(range)];
+    [self.writer writeData:self.buffer.dispatchData atOffset:range.location completion:^(int error) {
+        if (error) {
+            [self.queue addOperationWithBlock:^{
+                [self writeDidFailWithError:error];
+            }];
+            return;
+        }
+        if (!streaming) {
+            // 同一个writer按顺序写完，写到哪里就验证到哪里
+            [self recordVerifiedLength:LJMaxByteRange(range)];
+            return;
+        }
+        // 真正写到文件之后播放器才能读
+        [self.queue addOperationWithBlock:^{
+            [self.availableRanges addRange:range];
+            [self recordVerifiedLength:self.availableRanges.coveredLength];
+            [self notifyOffsetWaiters];
+        }];
+    }];
+    if (streaming) {
+        [self.receivedRanges addRange:range];
+    }
+    _bufferOffset = LJMaxByteRange(range);
+    [self.buffer removeAllSegments];
+}
+
+// 写入临时文件失败，在代理队列中调用。记下第一个错误并取消请求，请求结束时走失败回调
+- (void)writeDidFailWithError:(int)error {
+    NSLog(@"写入临时文件失败:%s", strerror(error));
+    if (_responseError) {
+        return;
+    }
+    _responseError = [NSError errorWithDomain:NSPOSIXErrorDomain code:error userInfo:@{NSURLErrorFailingURLErrorKey : self.url}];
+    [self.dataTask cancel];
+}
+
+// 检查点：之前的写入全部fsync之后再保存已下载的范围，范围文件不会记录没落盘的数据
+- (void)checkpointWithCompletion:(void(^)(void))completion {
+    [self flushBuffer];
+    LJDownLoadFileWriter *writer = self.writer;
+    if (!writer) {
+        [self saveAvailableRanges];
+        if (completion) {
+            completion();
+        }
+        return;
+    }
+    [writer synchronizeWithCompletion:^(int error) {
+        [self.queue addOperationWithBlock:^{
+            // fsync失败时数据不一定在磁盘上，不能记到范围文件里
+            if (error) {
+                [self writeDidFailWithError:error];
+            } else {
+                [self saveAvailableRanges];
+            }
+            if (completion) {
+                completion();
+            }
+        }];
+    }];
+}
+
+// 写入全部完成并关闭文件后在代理队列中回调
+- (void)closeTempFileWithCompletion:(void(^)(void))completion {
+    [self flushBuffer];
+    [self.buffer removeAllSegments];
+    LJDownLoadFileWriter *writer = self.writer;
+    self.writer = nil;
+    if (!writer) {
+        if (completion) {
+            completion();
+        }
+        return;
+    }
+    [writer closeWithCompletion:^(int error) {
+        // 在completion之前进入代理队列，completion中可以通过_responseError知道写入失败
+        if (error) {
+            [self.queue addOperationWithBlock:^{
+                [self writeDidFailWithError:error];
+            }];
+        }
+        if (completion) {
+            [self.queue addOperationWithBlock:completion];
+        }
+    }];
 }
 
 - (void)downLoadWithURL:(NSURL *)url offset:(long long)offset {
+    [self downLoadWithURL:url range:LJMakeByteRange(offset, 0)];
+}
+
+// range.length为0表示一直下载到文件末尾
+- (void)downLoadWithURL:(NSURL *)url range:(LJByteRange)range {
     NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:url];
-    [request setValue:[NSString stringWithFormat:@"bytes=%lld-", offset] forHTTPHeaderField:@"Range"];
-    NSURLSessionDataTask *dataTask = [self.session dataTaskWithRequest:request];
-    [dataTask resume];
+    NSString *rangeStr = range.length > 0 ? [NSString stringWithFormat:@"bytes=%lld-%lld", range.location, LJMaxByteRange(range) - 1] : [NSString stringWithFormat:@"bytes=%lld-", range.location];
+    [request setValue:rangeStr forHTTPHeaderField:@"Range"];
+    id<LJDownLoadTransportTask> dataTask = [self.transport dataTaskWithRequest:request delegate:self delegateQueue:self.queue];
     self.dataTask = dataTask;
+    [dataTask resume];
+}
+
+#pragma mark - 内存下载
+// 以下方法都在代理队列中调用
+- (void)recycleMemoryBuffer {
+    if (_memoryBytes) {
+        [[LJDownLoadBufferPool sharedPool] recycleBuffer:_memoryBytes capacity:_memoryCapacity];
+        _memoryBytes = NULL;
+    }
+    _memoryLength = 0;
+    _memoryCapacity = 0;
+}
+
+// 响应的长度已知并且足够小时改为在内存中接收
+- (BOOL)prepareMemoryDownLoadWithResponse:(NSHTTPURLResponse *)response {
+    [self recycleMemoryBuffer];
+    long long length = [response.allHeaderFields[@"Content-Length"] longLongValue];
+    if (length <= 0 || length > self.memoryThreshold) {
+        return NO;
+    }
+    _memoryBytes = [[LJDownLoadBufferPool sharedPool] allocateBufferWithLength:(size_t)length capacity:&_memoryCapacity];
+    return _memoryBytes != NULL;
+}
+
+- (void)memoryDidReceiveData:(NSData *)data {
+    // 已经分配失败，等请求取消
+    if (_responseError) {
+        return;
+    }
+    // 服务器给的长度不准时换一块更大的
+    if (_memoryLength + data.length > _memoryCapacity) {
+        size_t capacity = 0;
+        void *bytes = [[LJDownLoadBufferPool sharedPool] allocateBufferWithLength:MAX(_memoryCapacity * 2, _memoryLength + data.length) capacity:&capacity];
+        if (!bytes) {
+            // 分配不出更大的内存块，取消请求，请求结束时走失败回调
+            _responseError = [NSError errorWithDomain:NSPOSIXErrorDomain code:ENOMEM userInfo:@{NSURLErrorFailingURLErrorKey : self.url}];
+            [self.dataTask cancel];
+            return;
+        }
+        memcpy(bytes, _memoryBytes, _memoryLength);
+        [[LJDownLoadBufferPool sharedPool] recycleBuffer:_memoryBytes capacity:_memoryCapacity];
+        _memoryBytes = bytes;
+        _memoryCapacity = capacity;
+    }
+    [data enumerateByteRangesUsingBlock:^(const void *bytes, NSRange byteRange, BOOL *stop) {
+        memcpy((char *)_memoryBytes + _memoryLength + byteRange.location, bytes, byteRange.length);
+    }];
+    _memoryLength += data.length;
+    long long received = _memoryLength;
+    [self recordReceivedLength:received];
+    long long totalFileSize = _totalFileSize;
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [self updateReceivedLength:received expectedLength:totalFileSize];
+    });
+}
+
+- (void)memoryDidCompleteWithError:(NSError *)error {
+    [self stopRecordingRate];
+    // 连接提前正常关闭，数据不完整，和文件下载一样算失败
+    if (!error && (long long)_memoryLength < _totalFileSize) {
+        error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:@{NSURLErrorFailingURLErrorKey : self.url}];
+    }
+    if (error) {
+        [self recycleMemoryBuffer];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            self.downLoadStatus = LJDownLoadStatusFailed;
+            if (self.failBlock) {
+                self.failBlock(error);
+            }
+        });
+        return;
+    }
+    [self recordVerifiedLength:_memoryLength];
+    // 内存块交给NSData，NSData释放时回到内存池
+    NSData *data = [[LJDownLoadBufferPool sharedPool] dataWithBuffer:_memoryBytes length:_memoryLength capacity:_memoryCapacity];
+    _memoryBytes = NULL;
+    _memoryLength = 0;
+    _memoryCapacity = 0;
+    if (self.persistsMemoryDownload) {
+        [LJDownLoadFileTool createDirectoryForFilePath:self.cacheFilePath];
+        [data writeToFile:self.cacheFilePath atomically:YES];
+    }
+    dispatch_async(dispatch_get_main_queue(), ^{
+        self.downLoadStatus = LJDownLoadStatusSuccess;
+        if (self.dataSuccessBlock) {
+            self.dataSuccessBlock(data);
+        }
+        if (self.persistsMemoryDownload && self.successBlock) {
+            self.successBlock(self.cacheFilePath);
+        }
+    });
+}
+
+#pragma mark - 流式播放
+- (NSString *)rangesFilePath {
+    return [self.tempFilePath stringByAppendingString:@".ranges"];
+}
+
+// 以下方法都在代理队列中调用
+- (void)loadAvailableRanges {
+    NSDictionary *info = [NSDictionary dictionaryWithContentsOfFile:[self rangesFilePath]];
+    if (info) {
+        self.availableRanges = [LJDownLoadRangeSet rangeSetWithArray:info[@"ranges"]];
+        self.receivedRanges = [LJDownLoadRangeSet rangeSetWithArray:info[@"ranges"]];
+        _totalFileSize = [info[@"total"] longLongValue];
+        return;
+    }
+    // 之前顺序下载留下的临时文件，开头的部分都是可用的
+    long long fileSize = [LJDownLoadFileTool fileSizeWithPath:self.tempFilePath];
+    [self.availableRanges removeAllRanges];
+    [self.availableRanges addRange:LJMakeByteRange(0, fileSize)];
+    [self.receivedRanges removeAllRanges];
+    [self.receivedRanges addRange:LJMakeByteRange(0, fileSize)];
+    _totalFileSize = 0;
+}
+
+- (void)saveAvailableRanges {
+    if (!self.streamingMode || !self.tempFilePath) {
+        return;
+    }
+    NSDictionary *info = @{@"total" : @(_totalFileSize), @"ranges" : [self.availableRanges rangesArray]};
+    [info writeToFile:[self rangesFilePath] atomically:YES];
+}
+
+- (void)startStreaming {
+    NSURL *url = self.url;
+    [self.queue addOperationWithBlock:^{
+        if (![url isEqual:self.url]) {
+            return;
+        }
+        [self loadAvailableRanges];
+        [self scheduleStreamingRequest];
+    }];
+}
+
+// 优先下载播放位置之后第一段缺失的数据，播放位置之后都下完了再回头补前面的空洞
+- (void)scheduleStreamingRequest {
+    long long totalLength = _totalFileSize > 0 ? _totalFileSize : LLONG_MAX;
+    if (_totalFileSize > 0 && [self.receivedRanges isCompleteForLength:_totalFileSize]) {
+        [self finishStreaming];
+        return;
+    }
+    LJByteRange missing = [self.receivedRanges firstMissingRangeFromOffset:_playheadOffset totalLength:totalLength];
+    if (missing.length == 0) {
+        missing = [self.receivedRanges firstMissingRangeFromOffset:0 totalLength:totalLength];
+    }
+    if (missing.length == 0) {
+        [self finishStreaming];
+        return;
+    }
+    // 还不知道文件大小时请求到末尾，收到响应后再按空洞的大小请求
+    if (_totalFileSize <= 0) {
+        missing.length = 0;
+    }
+    [self downLoadWithURL:self.url range:missing];
+}
+
+- (void)finishStreaming {
+    // 所有数据落盘后才能移动文件
+    [self closeTempFileWithCompletion:^{
+        // 最后几次写入失败了
+        if (_responseError) {
+            NSError *error = _responseError;
+            _responseError = nil;
+            [self failStreamingWithError:error];
+            return;
+        }
+        [LJDownLoadFileTool removeFileAtPath:[self rangesFilePath]];
+        [LJDownLoadFileTool moveFile:self.tempFilePath toPath:self.cacheFilePath];
+        [self notifyOffsetWaiters];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            self.downLoadStatus = LJDownLoadStatusSuccess;
+            if (self.successBlock) {
+                self.successBlock(self.cacheFilePath);
+            }
+        });
+    }];
+}
+
+- (void)notifyOffsetWaiters {
+    if (self.offsetWaiters.count == 0) {
+        return;
+    }
+    BOOL finished = _totalFileSize > 0 && [self.availableRanges isCompleteForLength:_totalFileSize];
+    NSMutableArray *fired = [NSMutableArray array];
+    for (NSDictionary *waiter in self.offsetWaiters) {
+        long long offset = [waiter[@"offset"] longLongValue];
+        if (finished || [self.availableRanges containsRange:LJMakeByteRange(offset, 1)]) {
+            [fired addObject:waiter];
+        }
+    }
+    [self.offsetWaiters removeObjectsInArray:fired];
+    [self callOffsetWaiters:fired available:YES];
+}
+
+- (void)callOffsetWaiters:(NSArray<NSDictionary *> *)waiters available:(BOOL)available {
+    if (waiters.count == 0) {
+        return;
+    }
+    dispatch_async(dispatch_get_main_queue(), ^{
+        for (NSDictionary *waiter in waiters) {
+            LJDownLoadAvailableBlock block = waiter[@"block"];
+            block(available);
+        }
+    });
+}
+
+- (void)seekToOffset:(long long)offset {
+    [self.queue addOperationWithBlock:^{
+        _playheadOffset = MAX(offset, 0);
+        // 不支持Range时重新请求也是从头返回，只能等顺序下载到播放位置
+        if (!self.streamingMode || !self.dataTask || self.downLoadStatus != LJDownLoadStatusDownLoading || _rangesUnsupported) {
+            return;
+        }
+        long long totalLength = _totalFileSize > 0 ? _totalFileSize : LLONG_MAX;
+        LJByteRange missing = [self.receivedRanges firstMissingRangeFromOffset:_playheadOffset totalLength:totalLength];
+        if (missing.length == 0) {
+            return;
+        }
+        // 预读范围内的数据都已经有了，不着急
+        if (missing.location >= _playheadOffset + self.lookAheadLength) {
+            return;
+        }
+        // 当前连接马上就能下到播放位置，不用重新请求
+        long long writePosition = _bufferOffset + self.buffer.length;
+        if (missing.location >= writePosition && missing.location <= writePosition + self.lookAheadLength) {
+            return;
+        }
+        NSLog(@"播放位置附近没有数据，从%lld重新请求", missing.location);
+        [self flushBuffer];
+        [self.dataTask cancel];
+        [self scheduleStreamingRequest];
+    }];
+}
+
+- (void)waitUntilOffsetAvailable:(long long)offset completion:(LJDownLoadAvailableBlock)completion {
+    if (!completion) {
+        return;
+    }
+    [self.queue addOperationWithBlock:^{
+        if ([self.availableRanges containsRange:LJMakeByteRange(offset, 1)] || self.downLoadStatus == LJDownLoadStatusSuccess) {
+            [self callOffsetWaiters:@[@{@"offset" : @(offset), @"block" : [completion copy]}] available:YES];
+            return;
+        }
+        if (self.downLoadStatus == LJDownLoadStatusFailed) {
+            [self callOffsetWaiters:@[@{@"offset" : @(offset), @"block" : [completion copy]}] available:NO];
+            return;
+        }
+        [self.offsetWaiters addObject:@{@"offset" : @(offset), @"block" : [completion copy]}];
+    }];
+}
+
+- (BOOL)isRangeAvailable:(LJByteRange)range {
+    __block BOOL available = NO;
+    NSOperation *operation = [NSBlockOperation blockOperationWithBlock:^{
+        available = [self.availableRanges containsRange:range];
+    }];
+    if ([NSOperationQueue currentQueue] == self.queue) {
+        [operation start];
+    } else {
+        [self.queue addOperations:@[operation] waitUntilFinished:YES];
+    }
+    return available;
+}
+
+- (void)streamingDidReceiveResponse:(NSHTTPURLResponse *)response completionHandler:(void (^)(BOOL allow))completionHandler {
+    // 服务器支持Range时返回206和Content-Range: bytes start-end/total，不支持时从头返回整个文件
+    long long start = 0;
+    NSString *rangeStr = response.allHeaderFields[@"Content-Range"];
+    if (response.statusCode == 206 && rangeStr) {
+        NSString *bytes = [[rangeStr stringByReplacingOccurrencesOfString:@"bytes" withString:@""] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+        start = [[bytes componentsSeparatedByString:@"-"].firstObject longLongValue];
+        _totalFileSize = [[rangeStr componentsSeparatedByString:@"/"].lastObject longLongValue];
+    } else {
+        _totalFileSize = [response.allHeaderFields[@"Content-Length"] longLongValue];
+    }
+    // 返回200时从0开始顺序写，已经有的数据覆盖写一遍，不再取消重新请求，否则每次都会从头返回
+    _rangesUnsupported = response.statusCode != 206;
+    if (_rangesUnsupported && self.receivedRanges.coveredLength > 0) {
+        NSLog(@"服务器不支持Range，从头顺序下载");
+    }
+    long long totalFileSize = _totalFileSize;
+    if (self.infoBlock) {
+        self.infoBlock(totalFileSize);
+    }
+    _unknownLength = _totalFileSize <= 0;
+    // 之前请求留下的数据写到它自己的位置
+    [self flushBuffer];
+    if (![self openTempFile]) {
+        NSLog(@"临时文件打开失败:%s", strerror(errno));
+        completionHandler(NO);
+        return;
+    }
+    _bufferOffset = start;
+    [self resetSnapshotWithReceivedLength:self.receivedRanges.coveredLength totalLength:_unknownLength ? -1 : _totalFileSize];
+    atomic_store_explicit(&_snapshotVerified, self.availableRanges.coveredLength, memory_order_release);
+    if (!_unknownLength) {
+        [self reserveTempFileLength:_totalFileSize];
+    }
+    [self markDownLoading];
+    completionHandler(YES);
+}
+
+- (void)streamingDidReceiveData:(NSData *)data dataTask:(id<LJDownLoadTransportTask>)dataTask {
+    // 已经写入失败，等请求取消
+    if (_responseError) {
+        return;
+    }
+    [self.buffer appendData:data];
+    long long writePosition = _bufferOffset + self.buffer.length;
+    if (self.buffer.length >= kLJDownLoadStreamingFlushThreshold) {
+        [self flushBuffer];
+    }
+    long long received = self.receivedRanges.coveredLength + self.buffer.length;
+    long long totalFileSize = _totalFileSize > 0 ? _totalFileSize : -1;
+    [self recordReceivedLength:received];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [self updateReceivedLength:received expectedLength:totalFileSize];
+    });
+    // 下到了已经有的数据(拖动过进度条)，换下一段缺失的数据
+    if (!_rangesUnsupported && [self.receivedRanges availableLengthFromOffset:writePosition] > 0) {
+        [self flushBuffer];
+        [dataTask cancel];
+        [self scheduleStreamingRequest];
+    }
+}
+
+- (void)streamingDidCompleteWithError:(NSError *)error {
+    [self stopRecordingRate];
+    if (!error) {
+        [self checkpointWithCompletion:nil];
+        [self scheduleStreamingRequest];
+        return;
+    }
+    [self failStreamingWithError:error];
+}
+
+- (void)failStreamingWithError:(NSError *)error {
+    [self closeTempFileWithCompletion:^{
+        [self saveAvailableRanges];
+        NSArray *waiters = [self.offsetWaiters copy];
+        [self.offsetWaiters removeAllObjects];
+        [self callOffsetWaiters:waiters available:NO];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            self.downLoadStatus = LJDownLoadStatusFailed;
+            if (self.failBlock) {
+                self.failBlock(error);
+            }
+        });
+    }];
+}
+
+#pragma mark - 边下边解压
+// 同一个url解压到不同目录时检查点分开
+- (NSString *)extractCheckpointPath {
+    return [NSString stringWithFormat:@"%@.%@.extract", self.tempFilePath, [self.extractor.destinationDirectory md5Str]];
+}
+
+// 在代理队列中读取检查点，解压器只在代理队列中使用
+- (void)startExtracting {
+    [self.queue addOperationWithBlock:^{
+        LJDownLoadArchiveExtractor *extractor = self.extractor;
+        extractor.checkpointPath = [self extractCheckpointPath];
+        [LJDownLoadFileTool createDirectoryForFilePath:extractor.checkpointPath];
+        long long offset = [extractor loadCheckpoint];
+        if (extractor.isFinished) {
+            NSLog(@"归档已经解压完毕");
+            dispatch_async(dispatch_get_main_queue(), ^{
+                self.downLoadStatus = LJDownLoadStatusSuccess;
+                if (self.successBlock) {
+                    self.successBlock(extractor.destinationDirectory);
+                }
+            });
+            return;
+        }
+        _tempFileSize = offset;
+        [self downLoadWithURL:self.url offset:offset];
+    }];
+}
+
+- (void)extractingDidReceiveResponse:(NSHTTPURLResponse *)response completionHandler:(void (^)(BOOL allow))completionHandler {
+    NSInteger statusCode = response.statusCode;
+    // 检查点已经超出文件末尾(服务器上的文件变了)，从头解压
+    if (statusCode == 416) {
+        // 已经是从头请求的，再请求还是416，空文件也不是有效的归档
+        if (_tempFileSize == 0) {
+            NSLog(@"归档为空，解压失败");
+            _responseError = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorBadServerResponse userInfo:@{NSURLErrorFailingURLErrorKey : response.URL ?: self.url, NSLocalizedDescriptionKey : [NSHTTPURLResponse localizedStringForStatusCode:statusCode]}];
+            completionHandler(NO);
+            return;
+        }
+        NSLog(@"检查点无效，从头解压");
+        [self.extractor reset];
+        _tempFileSize = 0;
+        completionHandler(NO);
+        [self downLoadWithURL:response.URL offset:0];
+        return;
+    }
+    // 服务器忽略了Range从头返回，解压也从头开始
+    if (statusCode == 200 && _tempFileSize > 0) {
+        NSLog(@"服务器不支持断点续传，从头解压");
+        [self.extractor reset];
+        _tempFileSize = 0;
+    }
+    _totalFileSize = [self expectedLengthWithResponse:response];
+    _unknownLength = _totalFileSize < 0;
+    NSString *acceptRanges = response.allHeaderFields[@"Accept-Ranges"];
+    self.resumable = statusCode == 206 || [acceptRanges.lowercaseString containsString:@"bytes"];
+    if (self.infoBlock) {
+        self.infoBlock(_totalFileSize);
+    }
+    // 解压模式下_bufferOffset是已经交给解压器的归档长度
+    _bufferOffset = _tempFileSize;
+    [self resetSnapshotWithReceivedLength:_tempFileSize totalLength:_totalFileSize];
+    [self markDownLoading];
+    completionHandler(YES);
+}
+
+- (void)extractingDidReceiveData:(NSData *)data dataTask:(id<LJDownLoadTransportTask>)dataTask {
+    // 已经解压失败，等请求取消
+    if (_responseError) {
+        return;
+    }
+    NSError *error = nil;
+    if (![self.extractor consumeData:data error:&error]) {
+        NSLog(@"解压失败:%@", error);
+        _responseError = error;
+        [dataTask cancel];
+        return;
+    }
+    _bufferOffset += data.length;
+    long long received = _bufferOffset;
+    long long totalFileSize = _totalFileSize;
+    [self recordReceivedLength:received];
+    [self recordVerifiedLength:received];
+    dispatch_async(dispatch_get_main_queue(), ^{
+        [self updateReceivedLength:received expectedLength:totalFileSize];
+    });
 }
 
-#pragma mark - NSURLSessionDataDelegate
+- (void)extractingDidCompleteWithError:(NSError *)error {
+    [self stopRecordingRate];
+    LJDownLoadArchiveExtractor *extractor = self.extractor;
+    if (!error && !_unknownLength && _bufferOffset < _totalFileSize) {
+        error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:@{NSURLErrorFailingURLErrorKey : self.url}];
+    }
+    NSError *extractError = nil;
+    if (!error && ![extractor finishWithError:&extractError]) {
+        error = extractError;
+    }
+    if (error) {
+        // 归档本身有问题或者服务器不支持续传时下次从头开始，否则记录检查点下次接着解压
+        if ([error.domain isEqualToString:LJDownLoadArchiveErrorDomain] || !self.resumable) {
+            [extractor reset];
+        } else {
+            [extractor checkpoint];
+        }
+        dispatch_async(dispatch_get_main_queue(), ^{
+            self.downLoadStatus = LJDownLoadStatusFailed;
+            if (self.failBlock) {
+                self.failBlock(error);
+            }
+        });
+        return;
+    }
+    dispatch_async(dispatch_get_main_queue(), ^{
+        self.downLoadStatus = LJDownLoadStatusSuccess;
+        if (self.successBlock) {
+            self.successBlock(extractor.destinationDirectory);
+        }
+    });
+}
+
+#pragma mark - LJDownLoadTransportDelegate
 // 当收到响应的时候调用
 // 如果超时 也会受到响应
-- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveResponse:(NSURLResponse *)response completionHandler:(void (^)(NSURLSessionResponseDisposition))completionHandler {
+- (void)transportTask:(id<LJDownLoadTransportTask>)dataTask didReceiveResponse:(NSHTTPURLResponse *)httpResponse completionHandler:(void (^)(BOOL allow))completionHandler {
 //    NSLog(@"respon==%@", response);
     NSLog(@"tread---%@---url:%@", [NSThread currentThread], dataTask.originalRequest.URL);
     
-    NSHTTPURLResponse *httpResponse = (NSHTTPURLResponse *)response;
-    // 获取到文件的大小
-    _totalFileSize = [httpResponse.allHeaderFields[@"Content-Length"] longLongValue];
-    // 上面获取到的文件可能不准确
-    if (httpResponse.allHeaderFields[@"Content-Range"]) {
-        NSString *rangeStr = httpResponse.allHeaderFields[@"Content-Range"];
-        _totalFileSize = [[rangeStr componentsSeparatedByString:@"/"].lastObject longLongValue];
+    // 已经取消掉的旧请求(重新下载、拖动进度条)
+    if (dataTask != self.dataTask) {
+        completionHandler(NO);
+        return;
+    }
+    _responseError = nil;
+    // 请求出错时服务器返回的错误页面、没有跟随的重定向都不能当成文件内容
+    if ((httpResponse.statusCode < 200 || httpResponse.statusCode >= 300) && httpResponse.statusCode != 416) {
+        NSLog(@"服务器返回错误:%ld", (long)httpResponse.statusCode);
+        _responseError = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorBadServerResponse userInfo:@{NSURLErrorFailingURLErrorKey : httpResponse.URL ?: self.url, NSLocalizedDescriptionKey : [NSHTTPURLResponse localizedStringForStatusCode:httpResponse.statusCode]}];
+        completionHandler(NO);
+        return;
+    }
+    if (self.streamingMode) {
+        [self streamingDidReceiveResponse:httpResponse completionHandler:completionHandler];
+        return;
     }
+    if (self.extractor) {
+        [self extractingDidReceiveResponse:httpResponse completionHandler:completionHandler];
+        return;
+    }
+    if (_memoryRequest) {
+        // 内存下载总是从头请求，416的内容是错误页面，不能当成文件交给dataSuccessBlock
+        if (httpResponse.statusCode < 200 || httpResponse.statusCode >= 300) {
+            NSLog(@"服务器返回错误:%ld", (long)httpResponse.statusCode);
+            _responseError = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorBadServerResponse userInfo:@{NSURLErrorFailingURLErrorKey : httpResponse.URL ?: self.url, NSLocalizedDescriptionKey : [NSHTTPURLResponse localizedStringForStatusCode:httpResponse.statusCode]}];
+            completionHandler(NO);
+            return;
+        }
+        if ([self prepareMemoryDownLoadWithResponse:httpResponse]) {
+            _totalFileSize = [httpResponse.allHeaderFields[@"Content-Length"] longLongValue];
+            [self resetSnapshotWithReceivedLength:0 totalLength:_totalFileSize];
+            if (self.infoBlock) {
+                self.infoBlock(_totalFileSize);
+            }
+            [self markDownLoading];
+            completionHandler(YES);
+            return;
+        }
+        // 太大或者不知道大小，从头下载到文件
+        NSLog(@"文件太大，改为下载到文件");
+        [LJDownLoadFileTool removeFileAtPath:self.tempFilePath];
+        _tempFileSize = 0;
+    }
+    NSInteger statusCode = httpResponse.statusCode;
+    // 服务器忽略了Range，从头返回整个文件，临时文件里的数据不能接着用
+    if (statusCode == 200 && _tempFileSize > 0) {
+        NSLog(@"服务器不支持断点续传，从头下载");
+        [self closeTempFileWithCompletion:nil];
+        [LJDownLoadFileTool removeFileAtPath:self.tempFilePath];
+        _tempFileSize = 0;
+    }
+    // 获取到文件的大小，-1表示未知
+    _totalFileSize = [self expectedLengthWithResponse:httpResponse];
+    _unknownLength = _totalFileSize < 0;
+    NSString *acceptRanges = httpResponse.allHeaderFields[@"Accept-Ranges"];
+    self.resumable = statusCode == 206 || [acceptRanges.lowercaseString containsString:@"bytes"];
     
     if (self.infoBlock) {
         self.infoBlock(_totalFileSize);
     }
     
-    // 文件已经下载完成
-    if (_tempFileSize == _totalFileSize) {
+    // 文件已经下载完成，长度未知时无法判断
+    // 空文件从0开始请求时服务器返回416和Content-Range: bytes */0，也算下载完成
+    if (!_unknownLength && _tempFileSize == _totalFileSize && (_totalFileSize > 0 || statusCode == 416)) {
         NSLog(@"文件下载完毕，移到cache文件");
-        [LJDownLoadFileTool moveFile:self.tempFilePath toPath:self.cacheFilePath];
-        self.downLoadStatus = LJDownLoadStatusSuccess;
-        completionHandler(NSURLSessionResponseCancel);
+        [self resetSnapshotWithReceivedLength:_totalFileSize totalLength:_totalFileSize];
+        // 取消掉的请求不再回调失败
+        self.dataTask = nil;
+        completionHandler(NO);
+        [self closeTempFileWithCompletion:^{
+            // 空文件可能没有临时文件，直接创建空的cache文件
+            if (![LJDownLoadFileTool isFileExists:self.tempFilePath]) {
+                [LJDownLoadFileTool createDirectoryForFilePath:self.cacheFilePath];
+                [[NSFileManager defaultManager] createFileAtPath:self.cacheFilePath contents:nil attributes:nil];
+            }
+            [LJDownLoadFileTool moveFile:self.tempFilePath toPath:self.cacheFilePath];
+            self.downLoadStatus = LJDownLoadStatusSuccess;
+            if (self.successBlock) {
+                self.successBlock(self.cacheFilePath);
+            }
+        }];
         return;
     }
     
-    // 临时文件存在错误
-    if (_tempFileSize > _totalFileSize) {
+    // 临时文件存在错误，或者请求的起点已经超出文件末尾
+    if (statusCode == 416 || (!_unknownLength && _tempFileSize > _totalFileSize)) {
+        // 已经是从头请求的，再请求还是416，不再重试
+        if (statusCode == 416 && _tempFileSize == 0) {
+            NSLog(@"从头请求也返回416，下载失败");
+            _responseError = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorBadServerResponse userInfo:@{NSURLErrorFailingURLErrorKey : httpResponse.URL ?: self.url, NSLocalizedDescriptionKey : [NSHTTPURLResponse localizedStringForStatusCode:statusCode]}];
+            completionHandler(NO);
+            return;
+        }
         NSLog(@"文件有错误，重新下载");
+        [self closeTempFileWithCompletion:nil];
         [LJDownLoadFileTool removeFileAtPath:self.tempFilePath];
-        completionHandler(NSURLSessionResponseCancel);
-        [self downLoadWithURL:response.URL offset:0];
+        _tempFileSize = 0;
+        completionHandler(NO);
+        [self downLoadWithURL:httpResponse.URL offset:0];
         return;
     }
     
     NSLog(@"继续下载文件");
-    self.downLoadStatus = LJDownLoadStatusDownLoading;
-    self.outputStream = [NSOutputStream outputStreamToFileAtPath:self.tempFilePath append:YES];
-    [self.outputStream open];
-    // 传入NSURLSessionResponseAllow，表示允许继续下载，如果不传入将终止下载
-    completionHandler(NSURLSessionResponseAllow);
+    [self markDownLoading];
+    if (![self openTempFile]) {
+        NSLog(@"临时文件打开失败:%s", strerror(errno));
+        completionHandler(NO);
+        return;
+    }
+    // 接着临时文件末尾写，旧请求留在buffer中的数据偏移已经不对，丢掉
+    [self.buffer removeAllSegments];
+    _bufferOffset = _tempFileSize;
+    [self resetSnapshotWithReceivedLength:_tempFileSize totalLength:_totalFileSize];
+    if (!_unknownLength) {
+        [self reserveTempFileLength:_totalFileSize];
+    }
+    // 传入YES，表示允许继续下载，传入NO将终止下载
+    completionHandler(YES);
 }
 
-- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data {
+/**
+ 从响应中解析文件的总长度
+ 206取Content-Range中的总长度，416取Content-Range: bytes * /total，200取Content-Length
+ chunked传输、Content-Range的总长度为*、经过压缩传输(Content-Length是压缩后的长度)时都算未知
+
+ @param response 响应
+ @return 总长度，未知时返回-1
+ */
+- (long long)expectedLengthWithResponse:(NSHTTPURLResponse *)response {
+    NSString *rangeStr = response.allHeaderFields[@"Content-Range"];
+    if (rangeStr) {
+        NSString *total = [[rangeStr componentsSeparatedByString:@"/"].lastObject stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+        if (total.length == 0 || [total isEqualToString:@"*"]) {
+            return -1;
+        }
+        return [total longLongValue];
+    }
+    if (response.statusCode != 200) {
+        return -1;
+    }
+    NSString *encoding = response.allHeaderFields[@"Content-Encoding"];
+    if (encoding.length > 0 && ![encoding.lowercaseString isEqualToString:@"identity"]) {
+        return -1;
+    }
+    NSString *length = response.allHeaderFields[@"Content-Length"];
+    if (length.length == 0) {
+        return -1;
+    }
+    return [length longLongValue];
+}
+
+- (void)transportTask:(id<LJDownLoadTransportTask>)dataTask didReceiveData:(NSData *)data {
     //    NSLog(@"正常接收数据中");
 //    _tempFileSize += data.length;
 //    self.progress = 1.0 * _tempFileSize / _totalFileSize;
     NSLog(@"tread---%@---url:%@", [NSThread currentThread], dataTask.originalRequest.URL);
+    if (dataTask != self.dataTask) {
+        return;
+    }
+    if (self.streamingMode) {
+        [self streamingDidReceiveData:data dataTask:dataTask];
+        return;
+    }
+    if (self.extractor) {
+        [self extractingDidReceiveData:data dataTask:dataTask];
+        return;
+    }
+    if (_memoryBytes) {
+        [self memoryDidReceiveData:data];
+        return;
+    }
+    // 已经写入失败，等请求取消
+    if (_responseError) {
+        return;
+    }
+    long long received = _bufferOffset + self.buffer.length + data.length;
+    long long totalFileSize = _totalFileSize;
+    [self recordReceivedLength:received];
     dispatch_async(dispatch_get_main_queue(), ^{
-        _tempFileSize += data.length;
-        self.progress = 1.0 * _tempFileSize / _totalFileSize;
+        [self updateReceivedLength:received expectedLength:totalFileSize];
     });
     
     //    NSLog(@"tread2222222---%@---%@", [NSThread currentThread], _url);
-    [self.outputStream write:data.bytes maxLength:data.length];
+    // 只持有收到的数据，攒够一批再一次交给writer
+    [self.buffer appendData:data];
+    if (self.buffer.length >= kLJDownLoadFlushThreshold) {
+        [self flushBuffer];
+    }
 }
 
-- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)task didCompleteWithError:(NSError *)error {
+- (void)transportTask:(id<LJDownLoadTransportTask>)task didCompleteWithError:(NSError *)error {
     NSLog(@"tread33333---%@", [NSThread currentThread]);
-    [self.outputStream close];
-    self.outputStream = nil;
-    if (error) {
-        self.downLoadStatus = LJDownLoadStatusFailed;
-        NSLog(@"Error==%@", error.userInfo);
-        if (self.failBlock) {
-            self.failBlock(error);
+    if (task != self.dataTask) {
+        return;
+    }
+    if (_responseError) {
+        error = _responseError;
+        _responseError = nil;
+    }
+    if (self.streamingMode) {
+        [self streamingDidCompleteWithError:error];
+        return;
+    }
+    if (self.extractor) {
+        [self extractingDidCompleteWithError:error];
+        return;
+    }
+    if (_memoryBytes) {
+        [self memoryDidCompleteWithError:error];
+        return;
+    }
+    // 长度已知时连接提前正常关闭，数据不完整，留着临时文件下次续传
+    long long written = _bufferOffset + self.buffer.length;
+    if (!error && !_unknownLength && written < _totalFileSize) {
+        NSLog(@"连接提前关闭，已下载%lld/%lld", written, _totalFileSize);
+        error = [NSError errorWithDomain:NSURLErrorDomain code:NSURLErrorNetworkConnectionLost userInfo:@{NSURLErrorFailingURLErrorKey : self.url}];
+    }
+    BOOL resumable = self.resumable;
+    [self stopRecordingRate];
+    // 写入全部完成后再移动文件和回调
+    [self closeTempFileWithCompletion:^{
+        // 请求结束之后才失败的写入
+        NSError *failure = error;
+        if (_responseError) {
+            failure = failure ?: _responseError;
+            _responseError = nil;
         }
-    } else {
-        NSLog(@"文件正常下载成功了");
-        if (self.successBlock) {
-            self.successBlock(self.cacheFilePath);
+        if (failure) {
+            // 不支持断点续传时临时文件下次也用不上
+            if (!resumable) {
+                [LJDownLoadFileTool removeFileAtPath:self.tempFilePath];
+            }
+            self.downLoadStatus = LJDownLoadStatusFailed;
+            NSLog(@"Error==%@", failure.userInfo);
+            if (self.failBlock) {
+                self.failBlock(failure);
+            }
+        } else {
+            NSLog(@"文件正常下载成功了");
+            [LJDownLoadFileTool moveFile:self.tempFilePath toPath:self.cacheFilePath];
+            self.downLoadStatus = LJDownLoadStatusSuccess;
+            if (self.successBlock) {
+                self.successBlock(self.cacheFilePath);
+            }
+            // 内存下载的文件太大时走到这里，把文件映射成NSData回调
+            if (_memoryRequest && self.dataSuccessBlock) {
+                self.dataSuccessBlock([NSData dataWithContentsOfFile:self.cacheFilePath options:NSDataReadingMappedIfSafe error:nil]);
+            }
         }
-        self.downLoadStatus = LJDownLoadStatusSuccess;
-        [LJDownLoadFileTool moveFile:self.tempFilePath toPath:self.cacheFilePath];
-    }
+    }];
 }
 
 
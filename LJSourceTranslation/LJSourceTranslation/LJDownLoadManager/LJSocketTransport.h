@@ -0,0 +1,47 @@
+//
+//  LJSocketTransport.h
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/14.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "LJDownLoadTransport.h"
+
+/**
+ 直接基于BSD socket的HTTP/1.1传输层，不依赖NSURLSession
+ 非阻塞socket由GCD的dispatch source驱动读写，libdispatch在Darwin上用kqueue，在Linux上用epoll
+ 只用到POSIX和GCD，但工程里只有iOS的target，目前没有在Linux上构建和运行过
+ 同一个host:port的连接用完后放回连接池复用(keep-alive)，响应体支持Content-Length、chunked和读到连接关闭
+ 跟随301/302/303/307/308重定向，最多10次，超过时以NSURLErrorHTTPTooManyRedirects失败
+ 只支持http，https的请求(包括重定向到https)会以NSURLErrorUnsupportedURL失败
+ */
+@interface LJSocketTransport : NSObject <LJDownLoadTransport>
+
+/** 共享的传输层 */
++ (instancetype)sharedTransport;
+
+/** 每个host:port最多保留的空闲连接数，默认6 */
+@property (nonatomic, assign) NSUInteger maxIdleConnectionsPerHost;
+
+/** 空闲连接的保留时间，超过后不再复用，默认30秒 */
+@property (nonatomic, assign) NSTimeInterval idleTimeout;
+
+/** 当前空闲连接的个数 */
+@property (nonatomic, assign, readonly) NSUInteger idleConnectionCount;
+
+/**
+ 关闭所有空闲连接，正在使用的连接不受影响
+ */
+- (void)closeIdleConnections;
+
+/**
+ 解析域名并建立一个空闲连接放进连接池，这个host:port已经有空闲连接或者正在预连接时不做任何事
+ 连接还在握手时开始的任务会直接接过这个连接
+
+ @param url 只用到host和port
+ */
+- (void)preconnectToURL:(NSURL *)url;
+
+@end
@@ -0,0 +1,1014 @@
+//
+//  LJSocketTransport.m
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/14.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import "LJSocketTransport.h"
+#import "LJDNSCache.h"
+#import <sys/socket.h>
+#import <sys/types.h>
+#import <netinet/in.h>
+#import <netinet/tcp.h>
+#import <netdb.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import <errno.h>
+
+// 一次最多读64KB，读到的数据直接交给代理，不再拷贝
+static const size_t kLJSocketReadSize = 64 * 1024;
+// 响应头最多64KB，超过认为服务器有问题
+static const NSUInteger kLJSocketMaxHeaderLength = 64 * 1024;
+// chunk大小那一行最多1KB
+static const NSUInteger kLJSocketMaxLineLength = 1024;
+// 最多跟随10次重定向，超过认为是循环
+static const NSUInteger kLJSocketMaxRedirects = 10;
+// 标记当前是否在ioQueue上，在ioQueue上时不能再dispatch_sync
+static void *kLJSocketIOQueueKey = &kLJSocketIOQueueKey;
+
+#ifdef MSG_NOSIGNAL
+static const int kLJSocketSendFlags = MSG_NOSIGNAL;
+#else
+static const int kLJSocketSendFlags = 0;
+#endif
+
+typedef NS_ENUM(NSInteger, LJSocketParseState) {
+    /** 读响应头 */
+    LJSocketParseStateHeader,
+    /** 响应头已经交给代理，等待代理决定是否继续 */
+    LJSocketParseStateWaitingAllow,
+    /** 按Content-Length读响应体 */
+    LJSocketParseStateIdentity,
+    /** 没有长度，读到连接关闭为止 */
+    LJSocketParseStateUntilClose,
+    /** 读chunk大小那一行 */
+    LJSocketParseStateChunkSize,
+    /** 读chunk数据 */
+    LJSocketParseStateChunkData,
+    /** 跳过chunk数据后面的\r\n */
+    LJSocketParseStateChunkDataEnd,
+    /** 读最后一个chunk之后的trailer */
+    LJSocketParseStateTrailer,
+    /** 响应读完了 */
+    LJSocketParseStateDone
+};
+
+static NSError *LJSocketError(NSInteger code, NSURL *url, int posixError) {
+    NSMutableDictionary *userInfo = [NSMutableDictionary dictionary];
+    if (url) {
+        userInfo[NSURLErrorFailingURLErrorKey] = url;
+    }
+    if (posixError) {
+        userInfo[NSUnderlyingErrorKey] = [NSError errorWithDomain:NSPOSIXErrorDomain code:posixError userInfo:nil];
+    }
+    return [NSError errorWithDomain:NSURLErrorDomain code:code userInfo:userInfo];
+}
+
+// content-length -> Content-Length，LJDownLoader按这种写法取响应头
+static NSString *LJSocketCanonicalHeaderName(NSString *name) {
+    NSArray<NSString *> *parts = [[name lowercaseString] componentsSeparatedByString:@"-"];
+    NSMutableArray<NSString *> *result = [NSMutableArray arrayWithCapacity:parts.count];
+    for (NSString *part in parts) {
+        if (part.length == 0) {
+            [result addObject:part];
+            continue;
+        }
+        [result addObject:[[[part substringToIndex:1] uppercaseString] stringByAppendingString:[part substringFromIndex:1]]];
+    }
+    return [result componentsJoinedByString:@"-"];
+}
+
+@class LJSocketTask;
+
+@interface LJSocketConnection : NSObject
+// host:port
+@property (nonatomic, copy) NSString *key;
+@property (nonatomic, assign) int fd;
+@property (nonatomic, strong) dispatch_source_t readSource;
+@property (nonatomic, strong) dispatch_source_t writeSource;
+@property (nonatomic, assign) BOOL reading;
+@property (nonatomic, assign) BOOL writing;
+// connect还没有完成
+@property (nonatomic, assign) BOOL connecting;
+// 待发送的请求
+@property (nonatomic, strong) NSData *outData;
+@property (nonatomic, assign) NSUInteger outOffset;
+// 在这个连接上发过的请求数，大于1说明是复用的连接
+@property (nonatomic, assign) NSUInteger requestCount;
+@property (nonatomic, assign) CFAbsoluteTime idleSince;
+@property (nonatomic, weak) LJSocketTask *task;
+@end
+
+@implementation LJSocketConnection
+@end
+
+@interface LJSocketTransport()
+// 所有socket和解析状态都只在这个队列中访问
+@property (nonatomic, strong) dispatch_queue_t ioQueue;
+// host:port -> 空闲连接，后放回的在后面
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSMutableArray<LJSocketConnection *> *> *idleConnections;
+// 没有结束的任务，任务结束前由这里持有
+@property (nonatomic, strong) NSMutableSet<LJSocketTask *> *activeTasks;
+// 预连接中还没有任务的连接，连上后放进空闲连接
+@property (nonatomic, strong) NSMutableSet<LJSocketConnection *> *warmingConnections;
+
+- (void)startTask:(LJSocketTask *)task;
+- (void)suspendTask:(LJSocketTask *)task;
+- (void)cancelTask:(LJSocketTask *)task;
+@end
+
+@interface LJSocketTask : NSObject <LJDownLoadTransportTask>
+@property (nonatomic, copy, readwrite) NSURLRequest *originalRequest;
+// 跟随重定向之后实际请求的地址，只在transport的ioQueue中访问
+@property (nonatomic, copy) NSURLRequest *currentRequest;
+@property (nonatomic, weak) LJSocketTransport *transport;
+@property (nonatomic, strong) id<LJDownLoadTransportDelegate> delegate;
+@property (nonatomic, strong) NSOperationQueue *delegateQueue;
+
+// 以下只在transport的ioQueue中访问
+@property (nonatomic, strong) LJSocketConnection *connection;
+@property (nonatomic, assign) BOOL started;
+@property (nonatomic, assign) BOOL suspended;
+@property (nonatomic, assign) BOOL finished;
+@property (nonatomic, assign) LJSocketParseState state;
+// 代理允许之后进入的状态
+@property (nonatomic, assign) LJSocketParseState bodyState;
+@property (nonatomic, strong) NSMutableData *headerBuffer;
+@property (nonatomic, strong) NSMutableData *lineBuffer;
+// 等待代理决定时收到的响应体
+@property (nonatomic, strong) NSMutableData *pendingData;
+// 当前响应体或chunk剩余的字节数
+@property (nonatomic, assign) long long remaining;
+@property (nonatomic, assign) BOOL keepAlive;
+// 复用的连接被服务器关掉时换一个新连接重试一次
+@property (nonatomic, assign) BOOL retried;
+// 已经跟随的重定向次数
+@property (nonatomic, assign) NSUInteger redirectCount;
+@property (nonatomic, strong) NSArray<NSData *> *addresses;
+@property (nonatomic, assign) NSUInteger addressIndex;
+@property (nonatomic, strong) dispatch_source_t timer;
+@property (nonatomic, assign) CFAbsoluteTime lastActivity;
+@end
+
+@implementation LJSocketTask
+- (void)resume {
+    LJSocketTransport *transport = self.transport;
+    dispatch_async(transport.ioQueue, ^{
+        [transport startTask:self];
+    });
+}
+
+- (void)suspend {
+    LJSocketTransport *transport = self.transport;
+    dispatch_async(transport.ioQueue, ^{
+        [transport suspendTask:self];
+    });
+}
+
+- (void)cancel {
+    LJSocketTransport *transport = self.transport;
+    dispatch_async(transport.ioQueue, ^{
+        [transport cancelTask:self];
+    });
+}
+@end
+
+@implementation LJSocketTransport
++ (instancetype)sharedTransport {
+    static LJSocketTransport *_transport;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _transport = [[self alloc] init];
+    });
+    return _transport;
+}
+
+- (instancetype)init {
+    if (self = [super init]) {
+        _ioQueue = dispatch_queue_create("com.liang.LJSocketTransport", DISPATCH_QUEUE_SERIAL);
+        dispatch_queue_set_specific(_ioQueue, kLJSocketIOQueueKey, (__bridge void *)self, NULL);
+        _idleConnections = [NSMutableDictionary dictionary];
+        _activeTasks = [NSMutableSet set];
+        _warmingConnections = [NSMutableSet set];
+        _maxIdleConnectionsPerHost = 6;
+        _idleTimeout = 30;
+    }
+    return self;
+}
+
+- (id<LJDownLoadTransportTask>)dataTaskWithRequest:(NSURLRequest *)request delegate:(id<LJDownLoadTransportDelegate>)delegate delegateQueue:(NSOperationQueue *)delegateQueue {
+    LJSocketTask *task = [[LJSocketTask alloc] init];
+    // originalRequest一直是创建时的请求，重定向只改currentRequest
+    task.originalRequest = request;
+    task.currentRequest = request;
+    task.transport = self;
+    task.delegate = delegate;
+    task.delegateQueue = delegateQueue;
+    return task;
+}
+
+- (NSUInteger)idleConnectionCount {
+    __block NSUInteger count = 0;
+    dispatch_block_t block = ^{
+        for (NSArray *connections in self.idleConnections.allValues) {
+            count += connections.count;
+        }
+    };
+    // 代理回调等已经在ioQueue上的调用直接读
+    if (dispatch_get_specific(kLJSocketIOQueueKey) == (__bridge void *)self) {
+        block();
+    } else {
+        dispatch_sync(self.ioQueue, block);
+    }
+    return count;
+}
+
+- (void)preconnectToURL:(NSURL *)url {
+    if (![[url.scheme lowercaseString] isEqualToString:@"http"] || url.host.length == 0) {
+        return;
+    }
+    NSString *key = [self keyForURL:url];
+    [[LJDNSCache sharedCache] resolveHost:url.host port:(url.port ?: @80).unsignedIntegerValue completion:^(NSArray<NSData *> *addresses) {
+        dispatch_async(self.ioQueue, ^{
+            // 已经有可用的连接就不再建
+            if (self.idleConnections[key].count > 0 || [self warmingConnectionCountForKey:key] > 0) {
+                return;
+            }
+            for (NSData *address in addresses) {
+                int fd = [self openSocketWithAddress:address error:NULL];
+                if (fd < 0) {
+                    continue;
+                }
+                LJSocketConnection *connection = [self connectionWithFileDescriptor:fd key:key];
+                connection.connecting = YES;
+                [self.warmingConnections addObject:connection];
+                [self setConnection:connection writing:YES];
+                return;
+            }
+        });
+    }];
+}
+
+- (void)closeIdleConnections {
+    dispatch_async(self.ioQueue, ^{
+        NSArray *all = [self.idleConnections.allValues valueForKeyPath:@"@unionOfArrays.self"];
+        for (LJSocketConnection *connection in all) {
+            [self closeConnection:connection];
+        }
+    });
+}
+
+#pragma mark - 任务
+// 以下方法都在ioQueue中调用
+- (void)startTask:(LJSocketTask *)task {
+    if (task.finished) {
+        return;
+    }
+    if (task.started) {
+        if (!task.suspended) {
+            return;
+        }
+        // 暂停后恢复
+        task.suspended = NO;
+        task.lastActivity = CFAbsoluteTimeGetCurrent();
+        if (task.connection && !task.connection.connecting && task.state != LJSocketParseStateWaitingAllow) {
+            [self setConnection:task.connection reading:YES];
+        }
+        return;
+    }
+    task.started = YES;
+    task.suspended = NO;
+    [self.activeTasks addObject:task];
+    NSURL *url = task.currentRequest.URL;
+    if (![[url.scheme lowercaseString] isEqualToString:@"http"] || url.host.length == 0) {
+        [self finishTask:task error:LJSocketError(NSURLErrorUnsupportedURL, url, 0)];
+        return;
+    }
+    [self startTimerForTask:task];
+    LJSocketConnection *connection = [self dequeueIdleConnectionForKey:[self keyForURL:url]];
+    if (connection) {
+        [self attachTask:task toConnection:connection];
+        return;
+    }
+    // 预连接还在握手，接过来等它连上，比重新建连接快
+    connection = [self dequeueWarmingConnectionForKey:[self keyForURL:url]];
+    if (connection) {
+        connection.task = task;
+        task.connection = connection;
+        return;
+    }
+    [self resolveAndConnectTask:task];
+}
+
+- (void)suspendTask:(LJSocketTask *)task {
+    if (task.finished || task.suspended) {
+        return;
+    }
+    task.suspended = YES;
+    // 不读socket，TCP窗口满了服务器自然就停了
+    if (task.connection && !task.connection.connecting && task.state != LJSocketParseStateWaitingAllow) {
+        [self setConnection:task.connection reading:NO];
+    }
+}
+
+- (void)cancelTask:(LJSocketTask *)task {
+    if (task.finished) {
+        return;
+    }
+    [self finishTask:task error:LJSocketError(NSURLErrorCancelled, task.currentRequest.URL, 0)];
+}
+
+- (void)startTimerForTask:(LJSocketTask *)task {
+    NSTimeInterval timeout = task.currentRequest.timeoutInterval > 0 ? task.currentRequest.timeoutInterval : 60;
+    NSTimeInterval interval = MAX(timeout / 4, 1);
+    task.lastActivity = CFAbsoluteTimeGetCurrent();
+    task.timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.ioQueue);
+    dispatch_source_set_timer(task.timer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(interval * NSEC_PER_SEC)), (uint64_t)(interval * NSEC_PER_SEC), NSEC_PER_SEC / 10);
+    __weak typeof(task) weakTask = task;
+    dispatch_source_set_event_handler(task.timer, ^{
+        LJSocketTask *strongTask = weakTask;
+        if (!strongTask || strongTask.suspended || strongTask.state == LJSocketParseStateWaitingAllow) {
+            return;
+        }
+        // 一段时间内没有任何读写才算超时，和NSURLRequest的timeoutInterval含义一致
+        if (CFAbsoluteTimeGetCurrent() - strongTask.lastActivity >= timeout) {
+            [self finishTask:strongTask error:LJSocketError(NSURLErrorTimedOut, strongTask.currentRequest.URL, 0)];
+        }
+    });
+    dispatch_resume(task.timer);
+}
+
+- (void)finishTask:(LJSocketTask *)task error:(NSError *)error {
+    if (task.finished) {
+        return;
+    }
+    task.finished = YES;
+    if (task.timer) {
+        dispatch_source_cancel(task.timer);
+        task.timer = nil;
+    }
+    LJSocketConnection *connection = task.connection;
+    task.connection = nil;
+    if (connection) {
+        connection.task = nil;
+        if (!error && task.keepAlive && task.state == LJSocketParseStateDone && !connection.outData) {
+            [self recycleConnection:connection];
+        } else {
+            [self closeConnection:connection];
+        }
+    }
+    [self.activeTasks removeObject:task];
+    [task.delegateQueue addOperationWithBlock:^{
+        [task.delegate transportTask:task didCompleteWithError:error];
+        task.delegate = nil;
+    }];
+}
+
+// 复用的连接在发请求或读响应头之前就被服务器关掉了，换一个新连接再试一次
+- (BOOL)retryTaskIfPossible:(LJSocketTask *)task {
+    LJSocketConnection *connection = task.connection;
+    if (task.retried || !connection || connection.requestCount <= 1 || task.state != LJSocketParseStateHeader || task.headerBuffer.length > 0) {
+        return NO;
+    }
+    task.retried = YES;
+    task.connection = nil;
+    connection.task = nil;
+    [self closeConnection:connection];
+    [self resolveAndConnectTask:task];
+    return YES;
+}
+
+#pragma mark - 连接
+- (NSString *)keyForURL:(NSURL *)url {
+    NSNumber *port = url.port ?: @80;
+    return [NSString stringWithFormat:@"%@:%@", [url.host lowercaseString], port];
+}
+
+- (LJSocketConnection *)dequeueIdleConnectionForKey:(NSString *)key {
+    NSMutableArray<LJSocketConnection *> *connections = self.idleConnections[key];
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    // 优先用最近放回的连接，它被服务器关掉的可能性最小
+    while (connections.count > 0) {
+        LJSocketConnection *connection = connections.lastObject;
+        [connections removeLastObject];
+        if (now - connection.idleSince < self.idleTimeout && [self isConnectionAlive:connection]) {
+            return connection;
+        }
+        [self closeConnection:connection];
+    }
+    return nil;
+}
+
+- (NSUInteger)warmingConnectionCountForKey:(NSString *)key {
+    NSUInteger count = 0;
+    for (LJSocketConnection *connection in self.warmingConnections) {
+        if ([connection.key isEqualToString:key]) {
+            count++;
+        }
+    }
+    return count;
+}
+
+- (LJSocketConnection *)dequeueWarmingConnectionForKey:(NSString *)key {
+    for (LJSocketConnection *connection in self.warmingConnections) {
+        if ([connection.key isEqualToString:key]) {
+            [self.warmingConnections removeObject:connection];
+            return connection;
+        }
+    }
+    return nil;
+}
+
+- (BOOL)isConnectionAlive:(LJSocketConnection *)connection {
+    char byte;
+    ssize_t n = recv(connection.fd, &byte, 1, MSG_PEEK);
+    // 非阻塞socket没有数据可读才是正常的空闲连接
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+- (void)recycleConnection:(LJSocketConnection *)connection {
+    NSMutableArray<LJSocketConnection *> *connections = self.idleConnections[connection.key];
+    if (!connections) {
+        connections = [NSMutableArray array];
+        self.idleConnections[connection.key] = connections;
+    }
+    if (connections.count >= self.maxIdleConnectionsPerHost) {
+        [self closeConnection:connection];
+        return;
+    }
+    connection.idleSince = CFAbsoluteTimeGetCurrent();
+    // 空闲时也要读，这样服务器关闭连接时能马上发现
+    [self setConnection:connection writing:NO];
+    [self setConnection:connection reading:YES];
+    [connections addObject:connection];
+}
+
+- (void)resolveAndConnectTask:(LJSocketTask *)task {
+    NSURL *url = task.currentRequest.URL;
+    task.lastActivity = CFAbsoluteTimeGetCurrent();
+    // getaddrinfo是阻塞的，由LJDNSCache在后台队列解析，结果缓存后下次不用再等
+    [[LJDNSCache sharedCache] resolveHost:url.host port:(url.port ?: @80).unsignedIntegerValue completion:^(NSArray<NSData *> *addresses) {
+        dispatch_async(self.ioQueue, ^{
+            if (task.finished) {
+                return;
+            }
+            if (addresses.count == 0) {
+                [self finishTask:task error:LJSocketError(NSURLErrorCannotFindHost, url, 0)];
+                return;
+            }
+            task.addresses = addresses;
+            task.addressIndex = 0;
+            [self connectTask:task];
+        });
+    }];
+}
+
+// 创建非阻塞socket并发起连接，失败返回-1
+- (int)openSocketWithAddress:(NSData *)address error:(int *)error {
+    const struct sockaddr *addr = address.bytes;
+    int fd = socket(addr->sa_family, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+        if (error) {
+            *error = errno;
+        }
+        return -1;
+    }
+    int on = 1;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+#ifdef SO_NOSIGPIPE
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    if (connect(fd, addr, (socklen_t)address.length) < 0 && errno != EINPROGRESS) {
+        if (error) {
+            *error = errno;
+        }
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 依次尝试解析出来的地址，直到有一个能发起连接
+- (void)connectTask:(LJSocketTask *)task {
+    int lastError = 0;
+    while (task.addressIndex < task.addresses.count) {
+        int fd = [self openSocketWithAddress:task.addresses[task.addressIndex] error:&lastError];
+        if (fd < 0) {
+            task.addressIndex++;
+            continue;
+        }
+        LJSocketConnection *connection = [self connectionWithFileDescriptor:fd key:[self keyForURL:task.currentRequest.URL]];
+        connection.connecting = YES;
+        connection.task = task;
+        task.connection = connection;
+        // 连接完成时socket变为可写
+        [self setConnection:connection writing:YES];
+        return;
+    }
+    [self finishTask:task error:LJSocketError(NSURLErrorCannotConnectToHost, task.currentRequest.URL, lastError)];
+}
+
+- (LJSocketConnection *)connectionWithFileDescriptor:(int)fd key:(NSString *)key {
+    LJSocketConnection *connection = [[LJSocketConnection alloc] init];
+    connection.fd = fd;
+    connection.key = key;
+    connection.readSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, fd, 0, self.ioQueue);
+    connection.writeSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_WRITE, fd, 0, self.ioQueue);
+    __weak typeof(connection) weakConnection = connection;
+    dispatch_source_set_event_handler(connection.readSource, ^{
+        LJSocketConnection *strongConnection = weakConnection;
+        if (strongConnection) {
+            [self connectionReadable:strongConnection];
+        }
+    });
+    dispatch_source_set_event_handler(connection.writeSource, ^{
+        LJSocketConnection *strongConnection = weakConnection;
+        if (strongConnection) {
+            [self connectionWritable:strongConnection];
+        }
+    });
+    // 两个source都取消之后才能关闭fd
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_group_enter(group);
+    dispatch_group_enter(group);
+    dispatch_source_set_cancel_handler(connection.readSource, ^{
+        dispatch_group_leave(group);
+    });
+    dispatch_source_set_cancel_handler(connection.writeSource, ^{
+        dispatch_group_leave(group);
+    });
+    dispatch_group_notify(group, self.ioQueue, ^{
+        close(fd);
+    });
+    return connection;
+}
+
+// dispatch source创建后是挂起的，resume和suspend必须成对，这里记录状态避免重复调用
+- (void)setConnection:(LJSocketConnection *)connection reading:(BOOL)reading {
+    if (connection.fd < 0 || connection.reading == reading) {
+        return;
+    }
+    connection.reading = reading;
+    if (reading) {
+        dispatch_resume(connection.readSource);
+    } else {
+        dispatch_suspend(connection.readSource);
+    }
+}
+
+- (void)setConnection:(LJSocketConnection *)connection writing:(BOOL)writing {
+    if (connection.fd < 0 || connection.writing == writing) {
+        return;
+    }
+    connection.writing = writing;
+    if (writing) {
+        dispatch_resume(connection.writeSource);
+    } else {
+        dispatch_suspend(connection.writeSource);
+    }
+}
+
+- (void)closeConnection:(LJSocketConnection *)connection {
+    if (connection.fd < 0) {
+        return;
+    }
+    [self.idleConnections[connection.key] removeObject:connection];
+    [self.warmingConnections removeObject:connection];
+    // 挂起的source不能直接释放，先恢复再取消
+    if (!connection.reading) {
+        dispatch_resume(connection.readSource);
+    }
+    if (!connection.writing) {
+        dispatch_resume(connection.writeSource);
+    }
+    dispatch_source_cancel(connection.readSource);
+    dispatch_source_cancel(connection.writeSource);
+    connection.reading = NO;
+    connection.writing = NO;
+    connection.fd = -1;
+    connection.outData = nil;
+}
+
+- (void)attachTask:(LJSocketTask *)task toConnection:(LJSocketConnection *)connection {
+    connection.task = task;
+    connection.requestCount++;
+    task.connection = connection;
+    task.state = LJSocketParseStateHeader;
+    task.headerBuffer = [NSMutableData data];
+    task.lastActivity = CFAbsoluteTimeGetCurrent();
+    connection.outData = [self requestDataForTask:task];
+    connection.outOffset = 0;
+    [self setConnection:connection reading:!task.suspended];
+    [self setConnection:connection writing:YES];
+}
+
+- (NSData *)requestDataForTask:(LJSocketTask *)task {
+    NSURLRequest *request = task.currentRequest;
+    NSURL *url = request.URL;
+    NSURLComponents *components = [NSURLComponents componentsWithURL:url resolvingAgainstBaseURL:NO];
+    NSMutableString *target = [NSMutableString stringWithString:components.percentEncodedPath.length > 0 ? components.percentEncodedPath : @"/"];
+    if (components.percentEncodedQuery) {
+        [target appendFormat:@"?%@", components.percentEncodedQuery];
+    }
+    // IPv6地址在Host头里要加方括号
+    NSString *host = [url.host containsString:@":"] ? [NSString stringWithFormat:@"[%@]", url.host] : url.host;
+    if (url.port && url.port.integerValue != 80) {
+        host = [NSString stringWithFormat:@"%@:%@", host, url.port];
+    }
+    NSMutableString *head = [NSMutableString stringWithFormat:@"%@ %@ HTTP/1.1\r\nHost: %@\r\n", request.HTTPMethod ?: @"GET", target, host];
+    BOOL hasAcceptEncoding = NO;
+    for (NSString *name in request.allHTTPHeaderFields) {
+        NSString *lowercaseName = [name lowercaseString];
+        if ([lowercaseName isEqualToString:@"host"] || [lowercaseName isEqualToString:@"connection"] || [lowercaseName isEqualToString:@"content-length"]) {
+            continue;
+        }
+        if ([lowercaseName isEqualToString:@"accept-encoding"]) {
+            hasAcceptEncoding = YES;
+        }
+        [head appendFormat:@"%@: %@\r\n", name, request.allHTTPHeaderFields[name]];
+    }
+    // 不做解压，Range的偏移必须是原始字节
+    if (!hasAcceptEncoding) {
+        [head appendString:@"Accept-Encoding: identity\r\n"];
+    }
+    [head appendString:@"Connection: keep-alive\r\n"];
+    if (request.HTTPBody.length > 0) {
+        [head appendFormat:@"Content-Length: %lu\r\n", (unsigned long)request.HTTPBody.length];
+    }
+    [head appendString:@"\r\n"];
+    NSMutableData *data = [[head dataUsingEncoding:NSUTF8StringEncoding] mutableCopy];
+    if (request.HTTPBody.length > 0) {
+        [data appendData:request.HTTPBody];
+    }
+    return data;
+}
+
+#pragma mark - 读写
+- (void)connectionWritable:(LJSocketConnection *)connection {
+    LJSocketTask *task = connection.task;
+    if (connection.connecting) {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error != 0) {
+            // 这个地址连不上，试下一个
+            [self closeConnection:connection];
+            if (task && !task.finished) {
+                task.connection = nil;
+                if (task.addresses) {
+                    task.addressIndex++;
+                    [self connectTask:task];
+                } else {
+                    // 接过来的预连接失败了，自己解析再连
+                    [self resolveAndConnectTask:task];
+                }
+            }
+            return;
+        }
+        connection.connecting = NO;
+        if (!task) {
+            // 预连接完成，放进空闲连接等任务来用
+            [self.warmingConnections removeObject:connection];
+            [self recycleConnection:connection];
+            return;
+        }
+        if (task.finished) {
+            [self closeConnection:connection];
+            return;
+        }
+        [self attachTask:task toConnection:connection];
+        return;
+    }
+    while (connection.outData && connection.outOffset < connection.outData.length) {
+        ssize_t n = send(connection.fd, (const char *)connection.outData.bytes + connection.outOffset, connection.outData.length - connection.outOffset, kLJSocketSendFlags);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            int error = errno;
+            if (task && ![self retryTaskIfPossible:task]) {
+                [self finishTask:task error:LJSocketError(NSURLErrorNetworkConnectionLost, task.currentRequest.URL, error)];
+            }
+            [self closeConnection:connection];
+            return;
+        }
+        connection.outOffset += n;
+        task.lastActivity = CFAbsoluteTimeGetCurrent();
+    }
+    connection.outData = nil;
+    connection.outOffset = 0;
+    [self setConnection:connection writing:NO];
+}
+
+- (void)connectionReadable:(LJSocketConnection *)connection {
+    size_t available = dispatch_source_get_data(connection.readSource);
+    size_t size = MIN(MAX(available, (size_t)4096), kLJSocketReadSize);
+    NSMutableData *data = [NSMutableData dataWithLength:size];
+    ssize_t n = read(connection.fd, data.mutableBytes, size);
+    if (n < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        }
+        int error = errno;
+        LJSocketTask *task = connection.task;
+        if (task && ![self retryTaskIfPossible:task]) {
+            [self finishTask:task error:LJSocketError(NSURLErrorNetworkConnectionLost, task.currentRequest.URL, error)];
+        }
+        [self closeConnection:connection];
+        return;
+    }
+    LJSocketTask *task = connection.task;
+    if (n == 0) {
+        [self connectionDidReachEOF:connection];
+        return;
+    }
+    if (!task) {
+        // 空闲连接上不应该收到数据
+        [self closeConnection:connection];
+        return;
+    }
+    data.length = n;
+    task.lastActivity = CFAbsoluteTimeGetCurrent();
+    [self task:task consumeData:data];
+}
+
+- (void)connectionDidReachEOF:(LJSocketConnection *)connection {
+    LJSocketTask *task = connection.task;
+    if (!task) {
+        [self closeConnection:connection];
+        return;
+    }
+    if (task.state == LJSocketParseStateUntilClose) {
+        task.state = LJSocketParseStateDone;
+        task.keepAlive = NO;
+        [self finishTask:task error:nil];
+        return;
+    }
+    if (task.state == LJSocketParseStateDone || [self retryTaskIfPossible:task]) {
+        return;
+    }
+    [self finishTask:task error:LJSocketError(NSURLErrorNetworkConnectionLost, task.currentRequest.URL, 0)];
+}
+
+#pragma mark - 解析响应
+- (void)task:(LJSocketTask *)task consumeData:(NSData *)data {
+    NSUInteger offset = 0;
+    // 重定向时换了连接，旧连接上剩下的数据不要了
+    LJSocketConnection *connection = task.connection;
+    while (offset < data.length && !task.finished && task.connection == connection) {
+        const char *bytes = (const char *)data.bytes + offset;
+        NSUInteger length = data.length - offset;
+        switch (task.state) {
+            case LJSocketParseStateHeader: {
+                NSUInteger searchStart = task.headerBuffer.length > 3 ? task.headerBuffer.length - 3 : 0;
+                [task.headerBuffer appendBytes:bytes length:length];
+                NSRange end = [task.headerBuffer rangeOfData:[NSData dataWithBytes:"\r\n\r\n" length:4] options:0 range:NSMakeRange(searchStart, task.headerBuffer.length - searchStart)];
+                if (end.location == NSNotFound) {
+                    if (task.headerBuffer.length > kLJSocketMaxHeaderLength) {
+                        [self finishTask:task error:LJSocketError(NSURLErrorBadServerResponse, task.currentRequest.URL, 0)];
+                    }
+                    return;
+                }
+                NSData *header = [task.headerBuffer subdataWithRange:NSMakeRange(0, end.location)];
+                NSUInteger bodyStart = NSMaxRange(end);
+                data = [task.headerBuffer subdataWithRange:NSMakeRange(bodyStart, task.headerBuffer.length - bodyStart)];
+                offset = 0;
+                task.headerBuffer = [NSMutableData data];
+                if (![self task:task parseHeader:header]) {
+                    [self finishTask:task error:LJSocketError(NSURLErrorBadServerResponse, task.currentRequest.URL, 0)];
+                    return;
+                }
+                break;
+            }
+            case LJSocketParseStateWaitingAllow:
+                [task.pendingData appendBytes:bytes length:length];
+                return;
+            case LJSocketParseStateIdentity:
+            case LJSocketParseStateChunkData: {
+                NSUInteger count = (NSUInteger)MIN((long long)length, task.remaining);
+                // 整块都是响应体时直接交出去，不拷贝
+                [self task:task deliverData:(offset == 0 && count == data.length) ? data : [data subdataWithRange:NSMakeRange(offset, count)]];
+                offset += count;
+                task.remaining -= count;
+                if (task.remaining > 0) {
+                    break;
+                }
+                if (task.state == LJSocketParseStateIdentity) {
+                    task.state = LJSocketParseStateDone;
+                    [self finishTask:task error:nil];
+                    return;
+                }
+                task.state = LJSocketParseStateChunkDataEnd;
+                task.remaining = 2;
+                break;
+            }
+            case LJSocketParseStateUntilClose:
+                [self task:task deliverData:offset == 0 ? data : [data subdataWithRange:NSMakeRange(offset, length)]];
+                return;
+            case LJSocketParseStateChunkDataEnd: {
+                NSUInteger count = (NSUInteger)MIN((long long)length, task.remaining);
+                offset += count;
+                task.remaining -= count;
+                if (task.remaining == 0) {
+                    task.state = LJSocketParseStateChunkSize;
+                }
+                break;
+            }
+            case LJSocketParseStateChunkSize:
+            case LJSocketParseStateTrailer: {
+                const char *newline = memchr(bytes, '\n', length);
+                NSUInteger count = newline ? (NSUInteger)(newline - bytes) + 1 : length;
+                [task.lineBuffer appendBytes:bytes length:count];
+                offset += count;
+                if (task.lineBuffer.length > kLJSocketMaxLineLength) {
+                    [self finishTask:task error:LJSocketError(NSURLErrorBadServerResponse, task.currentRequest.URL, 0)];
+                    return;
+                }
+                if (!newline) {
+                    return;
+                }
+                NSString *line = [[[NSString alloc] initWithData:task.lineBuffer encoding:NSISOLatin1StringEncoding] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceAndNewlineCharacterSet]];
+                task.lineBuffer = [NSMutableData data];
+                if (task.state == LJSocketParseStateTrailer) {
+                    // trailer以空行结束
+                    if (line.length == 0) {
+                        task.state = LJSocketParseStateDone;
+                        [self finishTask:task error:nil];
+                        return;
+                    }
+                    break;
+                }
+                // 忽略chunk扩展 "1a;name=value"
+                NSString *sizeStr = [line componentsSeparatedByString:@";"].firstObject;
+                char *endPtr = NULL;
+                unsigned long long size = strtoull(sizeStr.UTF8String, &endPtr, 16);
+                if (sizeStr.length == 0 || (endPtr && *endPtr != '\0')) {
+                    [self finishTask:task error:LJSocketError(NSURLErrorBadServerResponse, task.currentRequest.URL, 0)];
+                    return;
+                }
+                if (size == 0) {
+                    task.state = LJSocketParseStateTrailer;
+                } else {
+                    task.state = LJSocketParseStateChunkData;
+                    task.remaining = (long long)size;
+                }
+                break;
+            }
+            case LJSocketParseStateDone:
+                // 响应之后还有多余的数据，这个连接不能再复用
+                task.keepAlive = NO;
+                return;
+        }
+    }
+}
+
+- (BOOL)task:(LJSocketTask *)task parseHeader:(NSData *)header {
+    NSString *string = [[NSString alloc] initWithData:header encoding:NSISOLatin1StringEncoding];
+    NSArray<NSString *> *lines = [string componentsSeparatedByString:@"\r\n"];
+    NSArray<NSString *> *statusParts = [lines.firstObject componentsSeparatedByString:@" "];
+    if (statusParts.count < 2 || ![statusParts[0] hasPrefix:@"HTTP/"]) {
+        return NO;
+    }
+    NSString *version = statusParts[0];
+    NSInteger statusCode = [statusParts[1] integerValue];
+    // 100 Continue之类的临时响应，跳过后继续读真正的响应头
+    if (statusCode >= 100 && statusCode < 200) {
+        return YES;
+    }
+    NSMutableDictionary<NSString *, NSString *> *headers = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 1; i < lines.count; i++) {
+        NSRange colon = [lines[i] rangeOfString:@":"];
+        if (colon.location == NSNotFound) {
+            continue;
+        }
+        NSString *name = LJSocketCanonicalHeaderName([[lines[i] substringToIndex:colon.location] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]]);
+        NSString *value = [[lines[i] substringFromIndex:NSMaxRange(colon)] stringByTrimmingCharactersInSet:[NSCharacterSet whitespaceCharacterSet]];
+        // 重复的头用逗号合并
+        headers[name] = headers[name] ? [NSString stringWithFormat:@"%@, %@", headers[name], value] : value;
+    }
+    // 重定向的响应体不能当成文件内容交给代理，换到Location重新请求
+    NSString *location = headers[@"Location"];
+    if ((statusCode == 301 || statusCode == 302 || statusCode == 303 || statusCode == 307 || statusCode == 308) && location.length > 0) {
+        [self task:task redirectToLocation:location statusCode:statusCode];
+        return YES;
+    }
+    NSString *connection = [headers[@"Connection"] lowercaseString];
+    if ([version isEqualToString:@"HTTP/1.0"]) {
+        task.keepAlive = [connection containsString:@"keep-alive"];
+    } else {
+        task.keepAlive = ![connection containsString:@"close"];
+    }
+    NSString *transferEncoding = [headers[@"Transfer-Encoding"] lowercaseString];
+    NSString *contentLength = headers[@"Content-Length"];
+    BOOL noBody = [task.currentRequest.HTTPMethod isEqualToString:@"HEAD"] || statusCode == 204 || statusCode == 304;
+    if (noBody) {
+        task.bodyState = LJSocketParseStateDone;
+    } else if ([transferEncoding containsString:@"chunked"]) {
+        task.bodyState = LJSocketParseStateChunkSize;
+    } else if (contentLength) {
+        task.remaining = contentLength.longLongValue;
+        task.bodyState = task.remaining > 0 ? LJSocketParseStateIdentity : LJSocketParseStateDone;
+    } else {
+        task.bodyState = LJSocketParseStateUntilClose;
+        task.keepAlive = NO;
+    }
+    task.lineBuffer = [NSMutableData data];
+    task.pendingData = [NSMutableData data];
+    task.state = LJSocketParseStateWaitingAllow;
+    // 等代理决定之前先不读，代理取消时不用白白收数据
+    [self setConnection:task.connection reading:NO];
+
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:task.currentRequest.URL statusCode:statusCode HTTPVersion:version headerFields:headers];
+    [task.delegateQueue addOperationWithBlock:^{
+        [task.delegate transportTask:task didReceiveResponse:response completionHandler:^(BOOL allow) {
+            dispatch_async(self.ioQueue, ^{
+                [self task:task didAllow:allow];
+            });
+        }];
+    }];
+    return YES;
+}
+
+// 响应体没有读完，连接不能复用，关掉后用新的地址重新解析和连接
+- (void)task:(LJSocketTask *)task redirectToLocation:(NSString *)location statusCode:(NSInteger)statusCode {
+    NSURL *url = [[NSURL URLWithString:location relativeToURL:task.currentRequest.URL] absoluteURL];
+    if (!url) {
+        [self finishTask:task error:LJSocketError(NSURLErrorBadServerResponse, task.currentRequest.URL, 0)];
+        return;
+    }
+    if (task.redirectCount >= kLJSocketMaxRedirects) {
+        [self finishTask:task error:LJSocketError(NSURLErrorHTTPTooManyRedirects, url, 0)];
+        return;
+    }
+    if (![[url.scheme lowercaseString] isEqualToString:@"http"] || url.host.length == 0) {
+        [self finishTask:task error:LJSocketError(NSURLErrorUnsupportedURL, url, 0)];
+        return;
+    }
+    task.redirectCount++;
+    NSMutableURLRequest *request = [task.currentRequest mutableCopy];
+    request.URL = url;
+    // 303要求改用GET，请求体不再发送
+    if (statusCode == 303) {
+        request.HTTPMethod = @"GET";
+        request.HTTPBody = nil;
+    }
+    task.currentRequest = request;
+    LJSocketConnection *connection = task.connection;
+    task.connection = nil;
+    connection.task = nil;
+    [self closeConnection:connection];
+    task.state = LJSocketParseStateHeader;
+    task.headerBuffer = [NSMutableData data];
+    task.retried = NO;
+    task.addresses = nil;
+    LJSocketConnection *idleConnection = [self dequeueIdleConnectionForKey:[self keyForURL:url]];
+    if (idleConnection) {
+        [self attachTask:task toConnection:idleConnection];
+        return;
+    }
+    [self resolveAndConnectTask:task];
+}
+
+- (void)task:(LJSocketTask *)task didAllow:(BOOL)allow {
+    if (task.finished || task.state != LJSocketParseStateWaitingAllow) {
+        return;
+    }
+    if (!allow) {
+        [self finishTask:task error:LJSocketError(NSURLErrorCancelled, task.currentRequest.URL, 0)];
+        return;
+    }
+    task.lastActivity = CFAbsoluteTimeGetCurrent();
+    task.state = task.bodyState;
+    NSData *pending = task.pendingData;
+    task.pendingData = nil;
+    if (task.state == LJSocketParseStateDone) {
+        if (pending.length > 0) {
+            task.keepAlive = NO;
+        }
+        [self finishTask:task error:nil];
+        return;
+    }
+    if (pending.length > 0) {
+        [self task:task consumeData:pending];
+    }
+    if (!task.finished && !task.suspended) {
+        [self setConnection:task.connection reading:YES];
+    }
+}
+
+- (void)task:(LJSocketTask *)task deliverData:(NSData *)data {
+    if (data.length == 0) {
+        return;
+    }
+    [task.delegateQueue addOperationWithBlock:^{
+        [task.delegate transportTask:task didReceiveData:data];
+    }];
+}
+@end
@@ -0,0 +1,31 @@
+//
+//  LJURLSessionTransport.h
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/14.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "LJDownLoadTransport.h"
+
+/**
+ 基于NSURLSession的传输层
+ 所有任务共用一个session，同一个host的连接可以复用
+ */
+@interface LJURLSessionTransport : NSObject <LJDownLoadTransport>
+
+/** 共享的传输层，使用defaultSessionConfiguration */
++ (instancetype)defaultTransport;
+
+/**
+ 用指定的配置创建传输层
+
+ @param configuration session配置
+ @return 传输层
+ */
+- (instancetype)initWithConfiguration:(NSURLSessionConfiguration *)configuration;
+
+@property (nonatomic, strong, readonly) NSURLSession *session;
+
+@end
@@ -0,0 +1,149 @@
+//
+//  LJURLSessionTransport.m
+//  LJSourceTranslation
+//
+//  Created by liang on 17/4/14.
+//  Copyright © 2017年 liang. All rights reserved.
+//
+
+#import "LJURLSessionTransport.h"
+
+// 同一个host:port在这段时间内只预连接一次，和NSURLSession保留空闲连接的时间差不多
+static const NSTimeInterval kLJPreconnectInterval = 30;
+
+@interface LJURLSessionTransportTask : NSObject <LJDownLoadTransportTask>
+@property (nonatomic, strong) NSURLSessionDataTask *dataTask;
+// 任务结束前持有，和NSURLSession持有delegate一样
+@property (nonatomic, strong) id<LJDownLoadTransportDelegate> delegate;
+@property (nonatomic, strong) NSOperationQueue *delegateQueue;
+@end
+
+@implementation LJURLSessionTransportTask
+- (NSURLRequest *)originalRequest {
+    return self.dataTask.originalRequest;
+}
+
+- (void)resume {
+    [self.dataTask resume];
+}
+
+- (void)suspend {
+    [self.dataTask suspend];
+}
+
+- (void)cancel {
+    [self.dataTask cancel];
+}
+@end
+
+@interface LJURLSessionTransport()<NSURLSessionDataDelegate>
+@property (nonatomic, strong, readwrite) NSURLSession *session;
+// taskIdentifier -> 包装的任务
+@property (nonatomic, strong) NSMutableDictionary<NSNumber *, LJURLSessionTransportTask *> *tasks;
+// scheme://host:port -> 上次预连接的时间
+@property (nonatomic, strong) NSMutableDictionary<NSString *, NSNumber *> *preconnectTimes;
+@end
+
+@implementation LJURLSessionTransport
++ (instancetype)defaultTransport {
+    static LJURLSessionTransport *_transport;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        _transport = [[self alloc] initWithConfiguration:[NSURLSessionConfiguration defaultSessionConfiguration]];
+    });
+    return _transport;
+}
+
+- (instancetype)init {
+    return [self initWithConfiguration:[NSURLSessionConfiguration defaultSessionConfiguration]];
+}
+
+- (instancetype)initWithConfiguration:(NSURLSessionConfiguration *)configuration {
+    if (self = [super init]) {
+        _tasks = [NSMutableDictionary dictionary];
+        _preconnectTimes = [NSMutableDictionary dictionary];
+        // session的代理队列是串行的，再按顺序转发到每个任务自己的队列，回调顺序不会乱
+        NSOperationQueue *queue = [[NSOperationQueue alloc] init];
+        queue.maxConcurrentOperationCount = 1;
+        _session = [NSURLSession sessionWithConfiguration:configuration delegate:self delegateQueue:queue];
+    }
+    return self;
+}
+
+- (id<LJDownLoadTransportTask>)dataTaskWithRequest:(NSURLRequest *)request delegate:(id<LJDownLoadTransportDelegate>)delegate delegateQueue:(NSOperationQueue *)delegateQueue {
+    LJURLSessionTransportTask *task = [[LJURLSessionTransportTask alloc] init];
+    task.dataTask = [self.session dataTaskWithRequest:request];
+    task.delegate = delegate;
+    task.delegateQueue = delegateQueue;
+    @synchronized (self.tasks) {
+        self.tasks[@(task.dataTask.taskIdentifier)] = task;
+    }
+    return task;
+}
+
+- (void)preconnectToURL:(NSURL *)url {
+    if (url.host.length == 0) {
+        return;
+    }
+    NSString *key = [NSString stringWithFormat:@"%@://%@:%@", [url.scheme lowercaseString], [url.host lowercaseString], url.port ?: @""];
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    @synchronized (self.preconnectTimes) {
+        if (now - self.preconnectTimes[key].doubleValue < kLJPreconnectInterval) {
+            return;
+        }
+        self.preconnectTimes[key] = @(now);
+    }
+    // NSURLSession没有单独建连接的接口，发一个HEAD请求，连接(包括TLS)完成后留在session的连接池里
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:url];
+    request.HTTPMethod = @"HEAD";
+    NSURLSessionDataTask *dataTask = [self.session dataTaskWithRequest:request completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+    }];
+    // 带completionHandler的任务不在tasks里，代理方法会直接忽略它
+    dataTask.priority = NSURLSessionTaskPriorityLow;
+    [dataTask resume];
+}
+
+- (LJURLSessionTransportTask *)taskForSessionTask:(NSURLSessionTask *)sessionTask {
+    @synchronized (self.tasks) {
+        return self.tasks[@(sessionTask.taskIdentifier)];
+    }
+}
+
+#pragma mark - NSURLSessionDataDelegate
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveResponse:(NSURLResponse *)response completionHandler:(void (^)(NSURLSessionResponseDisposition))completionHandler {
+    LJURLSessionTransportTask *task = [self taskForSessionTask:dataTask];
+    if (!task || ![response isKindOfClass:[NSHTTPURLResponse class]]) {
+        completionHandler(NSURLSessionResponseCancel);
+        return;
+    }
+    [task.delegateQueue addOperationWithBlock:^{
+        [task.delegate transportTask:task didReceiveResponse:(NSHTTPURLResponse *)response completionHandler:^(BOOL allow) {
+            completionHandler(allow ? NSURLSessionResponseAllow : NSURLSessionResponseCancel);
+        }];
+    }];
+}
+
+- (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data {
+    LJURLSessionTransportTask *task = [self taskForSessionTask:dataTask];
+    if (!task) {
+        return;
+    }
+    [task.delegateQueue addOperationWithBlock:^{
+        [task.delegate transportTask:task didReceiveData:data];
+    }];
+}
+
+- (void)URLSession:(NSURLSession *)session task:(NSURLSessionTask *)sessionTask didCompleteWithError:(NSError *)error {
+    LJURLSessionTransportTask *task = [self taskForSessionTask:sessionTask];
+    if (!task) {
+        return;
+    }
+    @synchronized (self.tasks) {
+        [self.tasks removeObjectForKey:@(sessionTask.taskIdentifier)];
+    }
+    [task.delegateQueue addOperationWithBlock:^{
+        [task.delegate transportTask:task didCompleteWithError:error];
+        task.delegate = nil;
+    }];
+}
+@end
@@ -19,6 +19,24 @@ typedef NS_ENUM(NSInteger, SDImageFormat) {
     SDImageFormatWebP
 };
 
+/**
+ * What the header of an image file says, read without decoding and without allocating.
+ * 不解码、不分配内存，从图片文件头部读出的信息
+ */
+typedef struct SDImageHeaderInfo {
+    SDImageFormat format;
+    // 0 when the size is not in the bytes given
+    // 给出的数据中没有尺寸时为0
+    NSUInteger pixelWidth;
+    NSUInteger pixelHeight;
+    // Frames found in the bytes given, at least 1 for a known format; a prefix of an animated GIF may count fewer
+    // 给出的数据中找到的帧数，格式已知时至少为1；只给出GIF的开头时可能比实际少
+    NSUInteger frameCount;
+    // EXIF orientation, 1 to 8, 1 when the header doesn't say
+    // EXIF方向，1到8，头部中没有时为1
+    NSUInteger orientation;
+} SDImageHeaderInfo;
+
 @interface NSData (ImageContentType)
 
 /**
@@ -31,4 +49,17 @@ typedef NS_ENUM(NSInteger, SDImageFormat) {
  */
 + (SDImageFormat)sd_imageFormatForImageData:(nullable NSData *)data;
 
+/**
+ *  Parse the JPEG SOF, PNG IHDR/acTL, GIF logical screen, WebP VP8/VP8L/VP8X and TIFF IFD headers
+ *  for the format, the size in pixels, the frame count and the EXIF orientation, before any decode.
+ *  The first few hundred bytes of the file are usually enough.
+ *  在解码之前解析JPEG的SOF、PNG的IHDR/acTL、GIF的逻辑屏幕、WebP的VP8/VP8L/VP8X和TIFF的IFD，
+ *  得到格式、像素尺寸、帧数和EXIF方向，一般只需要文件开头的几百个字节
+ *
+ *  @param data the image data, or only its first bytes
+ *
+ *  @return the header info, with pixelWidth and pixelHeight 0 when the size was not found
+ */
++ (SDImageHeaderInfo)sd_imageHeaderInfoForImageData:(nullable NSData *)data;
+
 @end
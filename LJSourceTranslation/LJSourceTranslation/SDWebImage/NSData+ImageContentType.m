@@ -8,19 +8,34 @@
  */
 
 #import "NSData+ImageContentType.h"
+#import <string.h>
 
+FOUNDATION_STATIC_INLINE uint16_t SDReadBE16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
 
-@implementation NSData (ImageContentType)
-// NSData+ImageContentType
-// 每张图片的开头会存储图片的类型信息
-+ (SDImageFormat)sd_imageFormatForImageData:(nullable NSData *)data {
-    if (!data) {
+FOUNDATION_STATIC_INLINE uint32_t SDReadBE32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+FOUNDATION_STATIC_INLINE uint16_t SDReadLE16(const uint8_t *p) {
+    return (uint16_t)(p[1] << 8 | p[0]);
+}
+
+FOUNDATION_STATIC_INLINE uint32_t SDReadLE24(const uint8_t *p) {
+    return (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+FOUNDATION_STATIC_INLINE uint32_t SDReadLE32(const uint8_t *p) {
+    return (uint32_t)p[3] << 24 | SDReadLE24(p);
+}
+
+// 只看开头的几个字节判断格式，不分配内存
+static SDImageFormat SDImageFormatForBytes(const uint8_t *bytes, size_t length) {
+    if (length < 1) {
         return SDImageFormatUndefined;
     }
-    
-    uint8_t c;
-    [data getBytes:&c length:1];
-    switch (c) {
+    switch (bytes[0]) {
         case 0xFF:
             return SDImageFormatJPEG;
         case 0x89:
@@ -32,16 +47,272 @@
             return SDImageFormatTIFF;
         case 0x52:
             // R as RIFF for WEBP
-            if (data.length < 12) {
-                return SDImageFormatUndefined;
-            }
-            
-            NSString *testString = [[NSString alloc] initWithData:[data subdataWithRange:NSMakeRange(0, 12)] encoding:NSASCIIStringEncoding];
-            if ([testString hasPrefix:@"RIFF"] && [testString hasSuffix:@"WEBP"]) {
+            if (length >= 12 && memcmp(bytes, "RIFF", 4) == 0 && memcmp(bytes + 8, "WEBP", 4) == 0) {
                 return SDImageFormatWebP;
             }
     }
     return SDImageFormatUndefined;
 }
 
+// TIFF文件本身以及JPEG和WebP的EXIF都是TIFF结构，从第一个IFD中读尺寸和方向
+static void SDProbeTIFF(const uint8_t *tiff, size_t length, BOOL readSize, SDImageHeaderInfo *info) {
+    if (length < 8) {
+        return;
+    }
+    BOOL littleEndian;
+    if (tiff[0] == 'I' && tiff[1] == 'I') {
+        littleEndian = YES;
+    } else if (tiff[0] == 'M' && tiff[1] == 'M') {
+        littleEndian = NO;
+    } else {
+        return;
+    }
+    uint16_t (*read16)(const uint8_t *) = littleEndian ? SDReadLE16 : SDReadBE16;
+    uint32_t (*read32)(const uint8_t *) = littleEndian ? SDReadLE32 : SDReadBE32;
+    if (read16(tiff + 2) != 42) {
+        return;
+    }
+    size_t ifd = read32(tiff + 4);
+    if (ifd > length - 2) {
+        return;
+    }
+    size_t count = read16(tiff + ifd);
+    for (size_t i = 0; i < count; i++) {
+        size_t entry = ifd + 2 + i * 12;
+        if (entry + 12 > length) {
+            break;
+        }
+        uint16_t tag = read16(tiff + entry);
+        uint16_t type = read16(tiff + entry + 2);
+        uint32_t value;
+        if (type == 3) {
+            // SHORT
+            value = read16(tiff + entry + 8);
+        } else if (type == 4) {
+            // LONG
+            value = read32(tiff + entry + 8);
+        } else {
+            continue;
+        }
+        if (tag == 0x0100 && readSize) {
+            info->pixelWidth = value;
+        } else if (tag == 0x0101 && readSize) {
+            info->pixelHeight = value;
+        } else if (tag == 0x0112 && value >= 1 && value <= 8) {
+            info->orientation = value;
+        }
+    }
+}
+
+// 按段长度逐段跳过，只在段之间的填充中用memchr找下一个0xFF，遇到SOF就结束
+// 方向在APP1的EXIF中，总是在SOF之前
+static void SDProbeJPEG(const uint8_t *bytes, size_t length, SDImageHeaderInfo *info) {
+    if (length < 4 || bytes[0] != 0xFF || bytes[1] != 0xD8) {
+        return;
+    }
+    size_t pos = 2;
+    while (pos + 4 <= length) {
+        if (bytes[pos] != 0xFF) {
+            const uint8_t *next = memchr(bytes + pos, 0xFF, length - pos);
+            if (!next) {
+                break;
+            }
+            pos = next - bytes;
+            continue;
+        }
+        uint8_t marker = bytes[pos + 1];
+        if (marker == 0xFF) {
+            // 标记前的填充字节
+            pos++;
+            continue;
+        }
+        if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            // 没有长度的标记
+            pos += 2;
+            continue;
+        }
+        if (marker == 0xD9 || marker == 0xDA) {
+            // 到了图像数据还没有SOF，读不到尺寸
+            break;
+        }
+        size_t segmentLength = SDReadBE16(bytes + pos + 2);
+        if (segmentLength < 2) {
+            break;
+        }
+        size_t segment = pos + 4;
+        size_t segmentEnd = MIN(length, pos + 2 + segmentLength);
+        if (marker == 0xE1 && segment + 6 <= segmentEnd && memcmp(bytes + segment, "Exif\0\0", 6) == 0) {
+            SDProbeTIFF(bytes + segment + 6, segmentEnd - segment - 6, NO, info);
+        } else if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            // SOF0到SOF15，C4、C8、CC是DHT、JPG和DAC
+            if (segment + 5 <= length) {
+                info->pixelHeight = SDReadBE16(bytes + segment + 1);
+                info->pixelWidth = SDReadBE16(bytes + segment + 3);
+            }
+            break;
+        }
+        pos += 2 + segmentLength;
+    }
+}
+
+// IHDR总是第一个块，动画PNG的acTL在第一个IDAT之前
+static void SDProbePNG(const uint8_t *bytes, size_t length, SDImageHeaderInfo *info) {
+    if (length < 24 || memcmp(bytes, "\x89PNG\r\n\x1a\n", 8) != 0 || memcmp(bytes + 12, "IHDR", 4) != 0) {
+        return;
+    }
+    info->pixelWidth = SDReadBE32(bytes + 16);
+    info->pixelHeight = SDReadBE32(bytes + 20);
+    size_t pos = 8;
+    while (pos + 8 <= length) {
+        size_t chunkLength = SDReadBE32(bytes + pos);
+        const uint8_t *type = bytes + pos + 4;
+        if (memcmp(type, "acTL", 4) == 0) {
+            if (pos + 12 <= length) {
+                info->frameCount = MAX(SDReadBE32(bytes + pos + 8), 1);
+            }
+            break;
+        }
+        if (memcmp(type, "IDAT", 4) == 0 || chunkLength > length - pos - 8) {
+            break;
+        }
+        // 长度、类型、数据、CRC
+        pos += 12 + chunkLength;
+    }
+}
+
+// 跳过GIF的数据子块，返回结束符之后的位置
+static size_t SDSkipGIFSubBlocks(const uint8_t *bytes, size_t length, size_t pos) {
+    while (pos < length && bytes[pos] != 0) {
+        pos += bytes[pos] + 1;
+    }
+    return pos + 1;
+}
+
+// 逻辑屏幕描述符在最前面，帧数要按块长度一块块跳过去数，不解压图像数据
+static void SDProbeGIF(const uint8_t *bytes, size_t length, SDImageHeaderInfo *info) {
+    if (length < 13 || (memcmp(bytes, "GIF87a", 6) != 0 && memcmp(bytes, "GIF89a", 6) != 0)) {
+        return;
+    }
+    info->pixelWidth = SDReadLE16(bytes + 6);
+    info->pixelHeight = SDReadLE16(bytes + 8);
+    size_t pos = 13;
+    if (bytes[10] & 0x80) {
+        // 全局颜色表
+        pos += 3 * (1 << ((bytes[10] & 0x07) + 1));
+    }
+    NSUInteger frames = 0;
+    while (pos < length) {
+        uint8_t introducer = bytes[pos];
+        if (introducer == 0x2C) {
+            // 图像描述符
+            frames++;
+            if (pos + 10 > length) {
+                break;
+            }
+            uint8_t flags = bytes[pos + 9];
+            pos += 10;
+            if (flags & 0x80) {
+                // 局部颜色表
+                pos += 3 * (1 << ((flags & 0x07) + 1));
+            }
+            // LZW最小码长，之后是图像数据子块
+            pos = SDSkipGIFSubBlocks(bytes, length, pos + 1);
+        } else if (introducer == 0x21) {
+            // 扩展块
+            pos = SDSkipGIFSubBlocks(bytes, length, pos + 2);
+        } else {
+            // 0x3B是结束符，其他值说明数据损坏
+            break;
+        }
+    }
+    info->frameCount = MAX(frames, 1);
+}
+
+// RIFF头之后第一个块决定WebP的种类，扩展格式(VP8X)的动画帧和EXIF在后面的块中
+static void SDProbeWebP(const uint8_t *bytes, size_t length, SDImageHeaderInfo *info) {
+    if (length < 20) {
+        return;
+    }
+    const uint8_t *chunk = bytes + 12;
+    const uint8_t *data = bytes + 20;
+    if (memcmp(chunk, "VP8 ", 4) == 0) {
+        // 有损：3字节帧标记之后是起始码9D 01 2A，再之后是14位的宽高
+        if (length >= 30 && data[3] == 0x9D && data[4] == 0x01 && data[5] == 0x2A) {
+            info->pixelWidth = SDReadLE16(data + 6) & 0x3FFF;
+            info->pixelHeight = SDReadLE16(data + 8) & 0x3FFF;
+        }
+    } else if (memcmp(chunk, "VP8L", 4) == 0) {
+        // 无损：签名0x2F之后是14位的宽减1和14位的高减1
+        if (length >= 25 && data[0] == 0x2F) {
+            uint32_t bits = SDReadLE32(data + 1);
+            info->pixelWidth = (bits & 0x3FFF) + 1;
+            info->pixelHeight = ((bits >> 14) & 0x3FFF) + 1;
+        }
+    } else if (memcmp(chunk, "VP8X", 4) == 0) {
+        if (length < 30) {
+            return;
+        }
+        // 24位的画布宽减1和高减1
+        info->pixelWidth = SDReadLE24(data + 4) + 1;
+        info->pixelHeight = SDReadLE24(data + 7) + 1;
+        NSUInteger frames = 0;
+        size_t pos = 12;
+        while (pos + 8 <= length) {
+            size_t chunkLength = SDReadLE32(bytes + pos + 4);
+            size_t available = MIN(chunkLength, length - pos - 8);
+            if (memcmp(bytes + pos, "ANMF", 4) == 0) {
+                frames++;
+            } else if (memcmp(bytes + pos, "EXIF", 4) == 0) {
+                SDProbeTIFF(bytes + pos + 8, available, NO, info);
+            }
+            if (chunkLength > length - pos - 8) {
+                break;
+            }
+            // 块数据按偶数字节对齐
+            pos += 8 + chunkLength + (chunkLength & 1);
+        }
+        info->frameCount = MAX(frames, 1);
+    }
+}
+
+@implementation NSData (ImageContentType)
+// NSData+ImageContentType
+// 每张图片的开头会存储图片的类型信息
++ (SDImageFormat)sd_imageFormatForImageData:(nullable NSData *)data {
+    if (!data) {
+        return SDImageFormatUndefined;
+    }
+    return SDImageFormatForBytes(data.bytes, data.length);
+}
+
++ (SDImageHeaderInfo)sd_imageHeaderInfoForImageData:(nullable NSData *)data {
+    SDImageHeaderInfo info = {SDImageFormatUndefined, 0, 0, 0, 1};
+    const uint8_t *bytes = data.bytes;
+    size_t length = data.length;
+    info.format = SDImageFormatForBytes(bytes, length);
+    switch (info.format) {
+        case SDImageFormatJPEG:
+            SDProbeJPEG(bytes, length, &info);
+            break;
+        case SDImageFormatPNG:
+            SDProbePNG(bytes, length, &info);
+            break;
+        case SDImageFormatGIF:
+            SDProbeGIF(bytes, length, &info);
+            break;
+        case SDImageFormatTIFF:
+            SDProbeTIFF(bytes, length, YES, &info);
+            break;
+        case SDImageFormatWebP:
+            SDProbeWebP(bytes, length, &info);
+            break;
+        case SDImageFormatUndefined:
+            break;
+    }
+    if (info.format != SDImageFormatUndefined) {
+        info.frameCount = MAX(info.frameCount, 1);
+    }
+    return info;
+}
+
 @end
@@ -0,0 +1,72 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import <CoreGraphics/CoreGraphics.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * A pool of pixel buffers for decoded bitmaps. Buffers are grouped in size classes (bytes per row × height rounded up
+ * to steps of a quarter of a power of two, at least 16KB), an image made from a pooled context keeps its buffer
+ * until the image is released, for example when it is evicted from the memory cache, then the buffer goes back
+ * to the pool for the next decode of the same class instead of being freed.
+ * All methods are thread-safe.
+ *
+ * 解码位图用的像素缓冲区池。缓冲区按大小分级(每行字节数×高度，向上取整到2的幂的四分之一的倍数，至少16KB)，
+ * 用池中的上下文生成的图片一直持有它的缓冲区，直到图片被释放(例如从内存缓存中淘汰)，之后缓冲区回到池中，
+ * 给下一个同级别的解码使用，不再释放。所有方法都是线程安全的
+ */
+@interface SDBitmapBufferPool : NSObject
+
++ (nonnull instancetype)sharedPool;
+
+/**
+ * The maximum number of bytes kept in the pool, buffers coming back beyond it are freed [defaults to 32MB]
+ * 池中最多保留的字节数，超过时回来的缓冲区直接释放，默认是32MB
+ */
+@property (assign, nonatomic) NSUInteger maxPooledBytes;
+
+/**
+ * Bytes currently waiting in the pool.
+ * 池中正在等待复用的字节数
+ */
+@property (assign, nonatomic, readonly) NSUInteger pooledBytes;
+
+/**
+ * Buffers allocated because the pool had none of the right class, and buffers taken from the pool.
+ * 因为池中没有对应级别而新分配的缓冲区个数，以及从池中取出复用的个数
+ */
+@property (assign, nonatomic, readonly) NSUInteger allocationCount;
+@property (assign, nonatomic, readonly) NSUInteger reuseCount;
+
+/**
+ * Same as CGBitmapContextCreate with a pooled buffer. The buffer is not cleared, clear the context
+ * unless the drawing covers all of it.
+ * 和CGBitmapContextCreate一样，但是使用池中的缓冲区。缓冲区不会清零，绘制覆盖不了整个上下文时要先清空
+ */
+- (nullable CGContextRef)createBitmapContextWithWidth:(size_t)width
+                                               height:(size_t)height
+                                     bitsPerComponent:(size_t)bitsPerComponent
+                                          bytesPerRow:(size_t)bytesPerRow
+                                           colorSpace:(nonnull CGColorSpaceRef)colorSpace
+                                           bitmapInfo:(CGBitmapInfo)bitmapInfo CF_RETURNS_RETAINED;
+
+/**
+ * Make an image sharing the buffer of a context created by this pool, without copying the pixels.
+ * Don't draw into the context afterwards, release it.
+ * 生成一个和池中的上下文共用缓冲区的图片，不复制像素。之后不要再往上下文中绘制，直接释放它
+ */
+- (nullable CGImageRef)createImageFromBitmapContext:(nonnull CGContextRef)context CF_RETURNS_RETAINED;
+
+/**
+ * Free every buffer waiting in the pool, called on memory warnings.
+ * 释放池中所有等待复用的缓冲区，收到内存警告时调用
+ */
+- (void)removeAllBuffers;
+
+@end
@@ -0,0 +1,274 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDBitmapBufferPool.h"
+#import <os/lock.h>
+#import <stdatomic.h>
+#import <stdlib.h>
+#import <strings.h>
+
+// 池中最多保留32MB
+static const NSUInteger kDefaultMaxPooledBytes = 32 * 1024 * 1024;
+// 最小的级别是16KB(4 << 12)，每个2的幂分成4级，一共覆盖到2的40次方
+static const NSUInteger kSDBitmapBufferMinimumShift = 12;
+static const NSUInteger kSDBitmapBufferClassCount = 4 * (40 - 12);
+// 缓冲区前面放头部，像素数据按64字节对齐
+static const size_t kSDBitmapBufferHeaderSize = 64;
+static const uint32_t kSDBitmapBufferMagic = 0x5344424D; // "SDBM"
+
+// 放在每个缓冲区像素数据之前，上下文和图片各持有一次引用，都释放后回到池中
+// 在池中等待时用next串成每个级别的链表，池本身不再分配内存
+typedef struct SDBitmapBufferHeader {
+    uint32_t magic;
+    _Atomic(uint32_t) references;
+    size_t capacity;
+    // 级别序号，太大不进池的为NSNotFound
+    NSUInteger sizeClass;
+    struct SDBitmapBufferHeader *next;
+} SDBitmapBufferHeader;
+
+_Static_assert(sizeof(SDBitmapBufferHeader) <= 64, "the header must fit before the pixel data");
+
+FOUNDATION_STATIC_INLINE void *SDBitmapBufferData(SDBitmapBufferHeader *header) {
+    return (uint8_t *)header + kSDBitmapBufferHeaderSize;
+}
+
+FOUNDATION_STATIC_INLINE SDBitmapBufferHeader *SDBitmapBufferHeaderForData(const void *data) {
+    return (SDBitmapBufferHeader *)((uint8_t *)data - kSDBitmapBufferHeaderSize);
+}
+
+// 长度向上取整到m * 2^k(m为4到7)，浪费不超过25%
+static NSUInteger SDBitmapBufferSizeClass(size_t length, size_t *capacity) {
+    if (length <= ((size_t)4 << kSDBitmapBufferMinimumShift)) {
+        *capacity = (size_t)4 << kSDBitmapBufferMinimumShift;
+        return 0;
+    }
+    size_t shift = flsl((long)length) - 1 - 2;
+    size_t multiple = (length + ((size_t)1 << shift) - 1) >> shift;
+    if (multiple == 8) {
+        multiple = 4;
+        shift++;
+    }
+    NSUInteger sizeClass = (shift - kSDBitmapBufferMinimumShift) * 4 + (multiple - 4);
+    if (sizeClass >= kSDBitmapBufferClassCount) {
+        *capacity = length;
+        return NSNotFound;
+    }
+    *capacity = multiple << shift;
+    return sizeClass;
+}
+
+@interface SDBitmapBufferPool ()
+
+- (void)recycleBuffer:(SDBitmapBufferHeader *)header;
+
+@end
+
+// 上下文和图片的数据提供者都用它释放，最后一个引用释放时缓冲区回到池中
+static void SDBitmapBufferRelease(void *info, const void *data) {
+    SDBitmapBufferPool *pool = (__bridge_transfer SDBitmapBufferPool *)info;
+    SDBitmapBufferHeader *header = SDBitmapBufferHeaderForData(data);
+    if (atomic_fetch_sub_explicit(&header->references, 1, memory_order_acq_rel) == 1) {
+        [pool recycleBuffer:header];
+    }
+}
+
+static void SDBitmapBufferContextRelease(void *releaseInfo, void *data) {
+    SDBitmapBufferRelease(releaseInfo, data);
+}
+
+static void SDBitmapBufferProviderRelease(void *info, const void *data, size_t size) {
+    SDBitmapBufferRelease(info, data);
+}
+
+@implementation SDBitmapBufferPool {
+    os_unfair_lock _lock;
+    SDBitmapBufferHeader *_freeLists[kSDBitmapBufferClassCount];
+    NSUInteger _pooledBytes;
+    NSUInteger _allocationCount;
+    NSUInteger _reuseCount;
+}
+
++ (nonnull instancetype)sharedPool {
+    static dispatch_once_t once;
+    static id instance;
+    dispatch_once(&once, ^{
+        instance = [self new];
+    });
+    return instance;
+}
+
+- (nonnull instancetype)init {
+    if ((self = [super init])) {
+        _lock = OS_UNFAIR_LOCK_INIT;
+        _maxPooledBytes = kDefaultMaxPooledBytes;
+#if SD_UIKIT
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(removeAllBuffers)
+                                                     name:UIApplicationDidReceiveMemoryWarningNotification
+                                                   object:nil];
+#endif
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    [self removeAllBuffers];
+}
+
+- (NSUInteger)pooledBytes {
+    os_unfair_lock_lock(&_lock);
+    NSUInteger pooledBytes = _pooledBytes;
+    os_unfair_lock_unlock(&_lock);
+    return pooledBytes;
+}
+
+- (NSUInteger)allocationCount {
+    os_unfair_lock_lock(&_lock);
+    NSUInteger allocationCount = _allocationCount;
+    os_unfair_lock_unlock(&_lock);
+    return allocationCount;
+}
+
+- (NSUInteger)reuseCount {
+    os_unfair_lock_lock(&_lock);
+    NSUInteger reuseCount = _reuseCount;
+    os_unfair_lock_unlock(&_lock);
+    return reuseCount;
+}
+
+#pragma mark - Buffers
+
+// 先从对应级别的链表取，没有时再分配
+- (nullable SDBitmapBufferHeader *)bufferWithLength:(size_t)length {
+    size_t capacity = 0;
+    NSUInteger sizeClass = SDBitmapBufferSizeClass(length, &capacity);
+    SDBitmapBufferHeader *header = NULL;
+    os_unfair_lock_lock(&_lock);
+    if (sizeClass != NSNotFound && _freeLists[sizeClass]) {
+        header = _freeLists[sizeClass];
+        _freeLists[sizeClass] = header->next;
+        _pooledBytes -= header->capacity;
+        _reuseCount++;
+    } else {
+        _allocationCount++;
+    }
+    os_unfair_lock_unlock(&_lock);
+
+    if (!header) {
+        void *base = NULL;
+        if (posix_memalign(&base, kSDBitmapBufferHeaderSize, kSDBitmapBufferHeaderSize + capacity) != 0) {
+            return NULL;
+        }
+        header = base;
+        header->magic = kSDBitmapBufferMagic;
+        header->capacity = capacity;
+        header->sizeClass = sizeClass;
+    }
+    header->next = NULL;
+    atomic_init(&header->references, 0);
+    return header;
+}
+
+// 没有超过上限时放回对应级别的链表，否则释放
+- (void)recycleBuffer:(SDBitmapBufferHeader *)header {
+    BOOL pooled = NO;
+    os_unfair_lock_lock(&_lock);
+    if (header->sizeClass != NSNotFound && _pooledBytes + header->capacity <= _maxPooledBytes) {
+        header->next = _freeLists[header->sizeClass];
+        _freeLists[header->sizeClass] = header;
+        _pooledBytes += header->capacity;
+        pooled = YES;
+    }
+    os_unfair_lock_unlock(&_lock);
+    if (!pooled) {
+        free(header);
+    }
+}
+
+- (void)removeAllBuffers {
+    SDBitmapBufferHeader *freeLists[kSDBitmapBufferClassCount];
+    os_unfair_lock_lock(&_lock);
+    memcpy(freeLists, _freeLists, sizeof(freeLists));
+    memset(_freeLists, 0, sizeof(_freeLists));
+    _pooledBytes = 0;
+    os_unfair_lock_unlock(&_lock);
+
+    // 在锁外释放
+    for (NSUInteger i = 0; i < kSDBitmapBufferClassCount; i++) {
+        SDBitmapBufferHeader *header = freeLists[i];
+        while (header) {
+            SDBitmapBufferHeader *next = header->next;
+            free(header);
+            header = next;
+        }
+    }
+}
+
+#pragma mark - Contexts and images
+
+- (nullable CGContextRef)createBitmapContextWithWidth:(size_t)width
+                                               height:(size_t)height
+                                     bitsPerComponent:(size_t)bitsPerComponent
+                                          bytesPerRow:(size_t)bytesPerRow
+                                           colorSpace:(nonnull CGColorSpaceRef)colorSpace
+                                           bitmapInfo:(CGBitmapInfo)bitmapInfo {
+    if (width == 0 || height == 0 || bytesPerRow == 0 || height > SIZE_MAX / bytesPerRow) {
+        return NULL;
+    }
+    SDBitmapBufferHeader *header = [self bufferWithLength:bytesPerRow * height];
+    if (!header) {
+        return NULL;
+    }
+    // 上下文持有一次引用，上下文释放时通过回调放回
+    atomic_store_explicit(&header->references, 1, memory_order_relaxed);
+    CGContextRef context = CGBitmapContextCreateWithData(SDBitmapBufferData(header), width, height, bitsPerComponent, bytesPerRow, colorSpace, bitmapInfo, SDBitmapBufferContextRelease, (__bridge_retained void *)self);
+    if (!context) {
+        // 创建失败时不会调用回调
+        CFRelease((__bridge CFTypeRef)self);
+        [self recycleBuffer:header];
+    }
+    return context;
+}
+
+- (nullable CGImageRef)createImageFromBitmapContext:(nonnull CGContextRef)context {
+    void *data = CGBitmapContextGetData(context);
+    if (!data) {
+        return NULL;
+    }
+    SDBitmapBufferHeader *header = SDBitmapBufferHeaderForData(data);
+    NSAssert(header->magic == kSDBitmapBufferMagic, @"The context was not created by SDBitmapBufferPool");
+
+    size_t height = CGBitmapContextGetHeight(context);
+    size_t bytesPerRow = CGBitmapContextGetBytesPerRow(context);
+    // 图片的数据提供者再持有一次引用，上下文释放之后像素仍然有效
+    atomic_fetch_add_explicit(&header->references, 1, memory_order_relaxed);
+    CGDataProviderRef provider = CGDataProviderCreateWithData((__bridge_retained void *)self, data, bytesPerRow * height, SDBitmapBufferProviderRelease);
+    if (!provider) {
+        // 上下文还持有引用，这里减掉不会回到池中
+        CFRelease((__bridge CFTypeRef)self);
+        atomic_fetch_sub_explicit(&header->references, 1, memory_order_relaxed);
+        return NULL;
+    }
+    CGImageRef imageRef = CGImageCreate(CGBitmapContextGetWidth(context),
+                                        height,
+                                        CGBitmapContextGetBitsPerComponent(context),
+                                        CGBitmapContextGetBitsPerPixel(context),
+                                        bytesPerRow,
+                                        CGBitmapContextGetColorSpace(context),
+                                        CGBitmapContextGetBitmapInfo(context),
+                                        provider,
+                                        NULL,
+                                        YES,
+                                        kCGRenderingIntentDefault);
+    CGDataProviderRelease(provider);
+    return imageRef;
+}
+
+@end
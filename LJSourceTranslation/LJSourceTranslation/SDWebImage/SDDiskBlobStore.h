@@ -0,0 +1,88 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * A log-structured store for small cache files. Blobs are appended to segment files of a few MB
+ * together with their name and a CRC, removals append a tombstone. An in-memory map name -> (segment, offset, length)
+ * is rebuilt at open by scanning the segments; a record torn by a crash at the end of the last segment is cut off.
+ * Segments that are mostly dead are compacted on a background queue by copying their live blobs to the active segment.
+ * All methods are thread-safe.
+ *
+ * 小缓存文件的日志结构存储。数据连同名字和CRC追加到几MB大小的段文件中，删除时追加一条删除记录
+ * 内存中名字到(段、偏移、长度)的映射在打开时扫描段文件重建，最后一个段末尾因为崩溃没写完的记录会被截掉
+ * 大部分空间已经失效的段在后台队列中压缩：把其中还有效的数据复制到当前段，然后删除旧段。所有方法都是线程安全的
+ */
+@interface SDDiskBlobStore : NSObject
+
+/**
+ * Create a store in the given directory, nothing is read until open is called.
+ * 在指定目录创建存储，调用open之前不读文件
+ */
+- (nonnull instancetype)initWithDirectory:(nonnull NSString *)directory NS_DESIGNATED_INITIALIZER;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+@property (strong, nonatomic, readonly, nonnull) NSString *directory;
+
+/**
+ * Total size of the live blobs and of the segment files, the difference is dead space waiting for compaction.
+ * 有效数据的总大小和段文件的总大小，差值是等待压缩的失效空间
+ */
+@property (assign, nonatomic, readonly) NSUInteger liveSize;
+@property (assign, nonatomic, readonly) NSUInteger segmentSize;
+
+/**
+ * Scan the segment files and rebuild the map. Does nothing when the directory does not exist yet.
+ * 扫描段文件重建映射，目录还不存在时什么也不做
+ */
+- (void)open;
+
+/**
+ * Names and sizes of all the blobs, used to rebuild the disk cache index.
+ * 所有数据的名字和大小，重建磁盘缓存索引时使用
+ */
+- (nonnull NSDictionary<NSString *, NSNumber *> *)allBlobSizes;
+
+- (BOOL)containsDataForName:(nonnull NSString *)name;
+
+- (nullable NSData *)dataForName:(nonnull NSString *)name;
+
+/**
+ * The names that are in the store, ordered by segment and offset, so reading them in turn walks each segment forward.
+ * 在存储中的名字，按段和偏移排序，依次读取时每个段都是顺序向后读
+ */
+- (nonnull NSArray<NSString *> *)namesSortedByLocation:(nonnull NSArray<NSString *> *)names;
+
+/**
+ * Append the data, replacing any blob stored with the same name.
+ * 追加数据，替换同名的旧数据
+ */
+- (BOOL)storeData:(nonnull NSData *)data forName:(nonnull NSString *)name;
+
+/**
+ * Remove the blobs with a single write of tombstones, returns the names that were in the store.
+ * 一次写入所有删除记录，返回确实在存储中的名字
+ */
+- (nonnull NSSet<NSString *> *)removeDataForNames:(nonnull NSArray<NSString *> *)names;
+
+/**
+ * Close every segment and delete the directory.
+ * 关闭所有段并删除目录
+ */
+- (void)removeAll;
+
+/**
+ * Compact on a background queue if enough space is dead.
+ * 失效空间足够多时在后台队列中压缩
+ */
+- (void)compactIfNeeded;
+
+@end
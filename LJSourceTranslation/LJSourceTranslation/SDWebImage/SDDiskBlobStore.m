@@ -0,0 +1,591 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDDiskBlobStore.h"
+#import <os/lock.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import <zlib.h>
+
+static const uint32_t kSDDiskBlobMagic = 0x4C424453; // "SDBL"
+static const uint16_t kSDDiskBlobFlagTombstone = 1;
+// 段文件写到这个大小之后换一个新的段
+static const uint64_t kSDDiskBlobSegmentMaxSize = 4 * 1024 * 1024;
+// 段中失效的空间超过一半时压缩
+static const double kSDDiskBlobCompactRatio = 0.5;
+static NSString * const kSDDiskBlobSegmentExtension = @"seg";
+// 封存的段最多同时打开这么多个，超过时关掉最久没读过的
+static const NSUInteger kSDDiskBlobMaxOpenSegments = 8;
+
+// 段中每条记录的头部，后面是名字(UTF-8)和数据，checksum是名字和数据的crc32
+typedef struct {
+    uint32_t magic;
+    uint16_t nameLength;
+    uint16_t flags;
+    uint32_t dataLength;
+    uint32_t checksum;
+} SDDiskBlobHeader;
+
+FOUNDATION_STATIC_INLINE uint32_t SDDiskBlobChecksum(const void *name, NSUInteger nameLength, const void *data, NSUInteger dataLength) {
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, name, (uInt)nameLength);
+    if (dataLength > 0) {
+        crc = crc32(crc, data, (uInt)dataLength);
+    }
+    return (uint32_t)crc;
+}
+
+// 打开的段文件，fd在释放时关闭，正在读的线程持有它时段被关掉或者被压缩删掉也还能读完
+@interface _SDDiskBlobFile : NSObject {
+    @package
+    int _fd;
+}
+@end
+
+@implementation _SDDiskBlobFile
+
+- (void)dealloc {
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+@end
+
+static _SDDiskBlobFile *SDDiskBlobOpenFile(NSString *path, int flags) {
+    int fd = open(path.fileSystemRepresentation, flags | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return nil;
+    }
+    _SDDiskBlobFile *file = [_SDDiskBlobFile new];
+    file->_fd = fd;
+    return file;
+}
+
+// 一个段文件，当前段一直打开，封存的段读的时候才打开，_file为nil表示没有打开
+@interface _SDDiskBlobSegment : NSObject {
+    @package
+    uint32_t _identifier;
+    _SDDiskBlobFile *_file;
+    uint64_t _length;
+    uint64_t _liveBytes;
+}
+@end
+
+@implementation _SDDiskBlobSegment
+@end
+
+// 一条有效数据的位置，offset是记录(从头部开始)在段中的偏移
+@interface _SDDiskBlobLocation : NSObject {
+    @package
+    uint32_t _segment;
+    uint64_t _offset;
+    uint32_t _recordLength;
+    uint32_t _dataLength;
+}
+@end
+
+@implementation _SDDiskBlobLocation
+@end
+
+@implementation SDDiskBlobStore {
+    os_unfair_lock _lock;
+    NSMutableDictionary<NSString *, _SDDiskBlobLocation *> *_locations;
+    NSMutableDictionary<NSNumber *, _SDDiskBlobSegment *> *_segments;
+    // 正在追加的段
+    _SDDiskBlobSegment *_activeSegment;
+    // 打开了文件的封存段，最近读过的在最后
+    NSMutableArray<_SDDiskBlobSegment *> *_openSegments;
+    uint32_t _lastIdentifier;
+    BOOL _compactionScheduled;
+    dispatch_queue_t _compactionQueue;
+}
+
+- (nonnull instancetype)initWithDirectory:(nonnull NSString *)directory {
+    if ((self = [super init])) {
+        _directory = [directory copy];
+        _lock = OS_UNFAIR_LOCK_INIT;
+        _locations = [NSMutableDictionary dictionary];
+        _segments = [NSMutableDictionary dictionary];
+        _openSegments = [NSMutableArray array];
+        _compactionQueue = dispatch_queue_create("com.hackemist.SDDiskBlobStore.compaction", dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_BACKGROUND, 0));
+    }
+    return self;
+}
+
+- (NSString *)pathForSegment:(uint32_t)identifier {
+    return [self.directory stringByAppendingPathComponent:[NSString stringWithFormat:@"%08x.%@", identifier, kSDDiskBlobSegmentExtension]];
+}
+
+#pragma mark - Info
+
+- (NSUInteger)liveSize {
+    os_unfair_lock_lock(&_lock);
+    uint64_t size = 0;
+    for (_SDDiskBlobSegment *segment in _segments.objectEnumerator) {
+        size += segment->_liveBytes;
+    }
+    os_unfair_lock_unlock(&_lock);
+    return (NSUInteger)size;
+}
+
+- (NSUInteger)segmentSize {
+    os_unfair_lock_lock(&_lock);
+    uint64_t size = 0;
+    for (_SDDiskBlobSegment *segment in _segments.objectEnumerator) {
+        size += segment->_length;
+    }
+    os_unfair_lock_unlock(&_lock);
+    return (NSUInteger)size;
+}
+
+- (nonnull NSDictionary<NSString *, NSNumber *> *)allBlobSizes {
+    os_unfair_lock_lock(&_lock);
+    NSMutableDictionary<NSString *, NSNumber *> *sizes = [NSMutableDictionary dictionaryWithCapacity:_locations.count];
+    [_locations enumerateKeysAndObjectsUsingBlock:^(NSString *name, _SDDiskBlobLocation *location, BOOL *stop) {
+        sizes[name] = @(location->_dataLength);
+    }];
+    os_unfair_lock_unlock(&_lock);
+    return sizes;
+}
+
+- (BOOL)containsDataForName:(nonnull NSString *)name {
+    os_unfair_lock_lock(&_lock);
+    BOOL contains = _locations[name] != nil;
+    os_unfair_lock_unlock(&_lock);
+    return contains;
+}
+
+- (nonnull NSArray<NSString *> *)namesSortedByLocation:(nonnull NSArray<NSString *> *)names {
+    NSMutableArray<NSString *> *storedNames = [NSMutableArray arrayWithCapacity:names.count];
+    NSMutableArray<_SDDiskBlobLocation *> *locations = [NSMutableArray arrayWithCapacity:names.count];
+    os_unfair_lock_lock(&_lock);
+    for (NSString *name in names) {
+        _SDDiskBlobLocation *location = _locations[name];
+        if (location) {
+            [storedNames addObject:name];
+            [locations addObject:location];
+        }
+    }
+    os_unfair_lock_unlock(&_lock);
+
+    // 位置对象创建后不再修改，排序不用持有锁
+    NSMutableArray<NSNumber *> *order = [NSMutableArray arrayWithCapacity:storedNames.count];
+    for (NSUInteger i = 0; i < storedNames.count; i++) {
+        [order addObject:@(i)];
+    }
+    [order sortUsingComparator:^NSComparisonResult(NSNumber *index1, NSNumber *index2) {
+        _SDDiskBlobLocation *location1 = locations[index1.unsignedIntegerValue];
+        _SDDiskBlobLocation *location2 = locations[index2.unsignedIntegerValue];
+        if (location1->_segment != location2->_segment) {
+            return location1->_segment < location2->_segment ? NSOrderedAscending : NSOrderedDescending;
+        }
+        if (location1->_offset != location2->_offset) {
+            return location1->_offset < location2->_offset ? NSOrderedAscending : NSOrderedDescending;
+        }
+        return NSOrderedSame;
+    }];
+    NSMutableArray<NSString *> *sortedNames = [NSMutableArray arrayWithCapacity:order.count];
+    for (NSNumber *index in order) {
+        [sortedNames addObject:storedNames[index.unsignedIntegerValue]];
+    }
+    return sortedNames;
+}
+
+#pragma mark - Recovery
+
+- (void)open {
+    NSArray<NSString *> *fileNames = [[NSFileManager new] contentsOfDirectoryAtPath:self.directory error:nil];
+    NSMutableArray<NSNumber *> *identifiers = [NSMutableArray array];
+    for (NSString *fileName in fileNames) {
+        if (![fileName.pathExtension isEqualToString:kSDDiskBlobSegmentExtension]) {
+            continue;
+        }
+        unsigned int identifier = 0;
+        if ([[NSScanner scannerWithString:fileName.stringByDeletingPathExtension] scanHexInt:&identifier] && identifier > 0) {
+            [identifiers addObject:@(identifier)];
+        }
+    }
+    [identifiers sortUsingSelector:@selector(compare:)];
+
+    os_unfair_lock_lock(&_lock);
+    [_locations removeAllObjects];
+    [_segments removeAllObjects];
+    [_openSegments removeAllObjects];
+    _activeSegment = nil;
+    _lastIdentifier = 0;
+    // 按段的先后重放，后面的记录覆盖前面的
+    for (NSUInteger i = 0; i < identifiers.count; i++) {
+        [self recoverSegment:identifiers[i].unsignedIntValue isLast:(i == identifiers.count - 1)];
+    }
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (void)recoverSegment:(uint32_t)identifier isLast:(BOOL)isLast {
+    NSString *path = [self pathForSegment:identifier];
+    // 只有最后一个段要继续追加，保持打开；其他段读的时候再打开
+    _SDDiskBlobFile *file = nil;
+    if (isLast) {
+        file = SDDiskBlobOpenFile(path, O_RDWR);
+        if (!file) {
+            return;
+        }
+    }
+    NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:nil];
+    if (!data) {
+        return;
+    }
+    _SDDiskBlobSegment *segment = [_SDDiskBlobSegment new];
+    segment->_identifier = identifier;
+    segment->_file = file;
+    _segments[@(identifier)] = segment;
+    _lastIdentifier = MAX(_lastIdentifier, identifier);
+
+    const uint8_t *bytes = data.bytes;
+    NSUInteger length = data.length;
+    uint64_t offset = 0;
+    while (offset + sizeof(SDDiskBlobHeader) <= length) {
+        SDDiskBlobHeader header;
+        memcpy(&header, bytes + offset, sizeof(header));
+        uint64_t recordLength = sizeof(header) + header.nameLength + header.dataLength;
+        if (header.magic != kSDDiskBlobMagic || offset + recordLength > length) {
+            break;
+        }
+        const uint8_t *nameBytes = bytes + offset + sizeof(header);
+        // 只有最后一个段可能有写到一半的记录，只在这里校验数据
+        if (isLast && SDDiskBlobChecksum(nameBytes, header.nameLength, nameBytes + header.nameLength, header.dataLength) != header.checksum) {
+            break;
+        }
+        NSString *name = [[NSString alloc] initWithBytes:nameBytes length:header.nameLength encoding:NSUTF8StringEncoding];
+        if (!name) {
+            break;
+        }
+        if (header.flags & kSDDiskBlobFlagTombstone) {
+            [self removeLocationForName:name];
+        } else {
+            _SDDiskBlobLocation *location = [_SDDiskBlobLocation new];
+            location->_segment = identifier;
+            location->_offset = offset;
+            location->_recordLength = (uint32_t)recordLength;
+            location->_dataLength = header.dataLength;
+            [self setLocation:location forName:name];
+        }
+        offset += recordLength;
+    }
+    if (isLast) {
+        // 截掉崩溃时没写完的记录，之后从这里继续追加
+        if (offset < length) {
+            ftruncate(file->_fd, offset);
+        }
+        segment->_length = offset;
+        _activeSegment = segment;
+    } else {
+        // 中间的段损坏时后面的部分当作失效空间，压缩时丢掉
+        segment->_length = length;
+    }
+}
+
+#pragma mark - Locations, called with the lock held
+
+- (void)setLocation:(_SDDiskBlobLocation *)location forName:(NSString *)name {
+    [self removeLocationForName:name];
+    _locations[name] = location;
+    _SDDiskBlobSegment *segment = _segments[@(location->_segment)];
+    if (segment) {
+        segment->_liveBytes += location->_recordLength;
+    }
+}
+
+- (void)removeLocationForName:(NSString *)name {
+    _SDDiskBlobLocation *location = _locations[name];
+    if (location) {
+        _SDDiskBlobSegment *segment = _segments[@(location->_segment)];
+        if (segment) {
+            segment->_liveBytes -= location->_recordLength;
+        }
+        [_locations removeObjectForKey:name];
+    }
+}
+
+// 当前段放不下时换一个新段
+- (_SDDiskBlobSegment *)activeSegmentForLength:(uint64_t)length {
+    if (_activeSegment && (_activeSegment->_length == 0 || _activeSegment->_length + length <= kSDDiskBlobSegmentMaxSize)) {
+        return _activeSegment;
+    }
+    [[NSFileManager new] createDirectoryAtPath:self.directory withIntermediateDirectories:YES attributes:nil error:NULL];
+    uint32_t identifier = _lastIdentifier + 1;
+    _SDDiskBlobFile *file = SDDiskBlobOpenFile([self pathForSegment:identifier], O_RDWR | O_CREAT | O_TRUNC);
+    if (!file) {
+        return nil;
+    }
+    _SDDiskBlobSegment *segment = [_SDDiskBlobSegment new];
+    segment->_identifier = identifier;
+    segment->_file = file;
+    _segments[@(identifier)] = segment;
+    _lastIdentifier = identifier;
+    // 之前的段封存，和其他封存段一起按最近使用关闭
+    if (_activeSegment) {
+        [_openSegments addObject:_activeSegment];
+        [self trimOpenSegments];
+    }
+    _activeSegment = segment;
+    return segment;
+}
+
+// 段的文件，封存的段没打开时打开，打开的封存段超过上限时关掉最久没读过的
+- (_SDDiskBlobFile *)fileForSegment:(_SDDiskBlobSegment *)segment {
+    if (segment == _activeSegment) {
+        return segment->_file;
+    }
+    if (segment->_file) {
+        [_openSegments removeObjectIdenticalTo:segment];
+    } else {
+        segment->_file = SDDiskBlobOpenFile([self pathForSegment:segment->_identifier], O_RDONLY);
+        if (!segment->_file) {
+            return nil;
+        }
+    }
+    [_openSegments addObject:segment];
+    [self trimOpenSegments];
+    return segment->_file;
+}
+
+- (void)trimOpenSegments {
+    while (_openSegments.count > kSDDiskBlobMaxOpenSegments) {
+        // 正在读的线程还持有文件对象，读完才真正关闭
+        _openSegments.firstObject->_file = nil;
+        [_openSegments removeObjectAtIndex:0];
+    }
+}
+
+// 把完整的记录追加到当前段，返回写入的段，*offset是写入的位置
+// 写失败时不移动段的末尾，下一次追加会覆盖写了一半的部分
+- (_SDDiskBlobSegment *)appendRecords:(NSData *)records offset:(uint64_t *)offset {
+    _SDDiskBlobSegment *segment = [self activeSegmentForLength:records.length];
+    if (!segment) {
+        return nil;
+    }
+    if (pwrite(segment->_file->_fd, records.bytes, records.length, (off_t)segment->_length) != (ssize_t)records.length) {
+        return nil;
+    }
+    *offset = segment->_length;
+    segment->_length += records.length;
+    return segment;
+}
+
+- (void)appendRecordWithName:(NSData *)name bytes:(const void *)bytes length:(NSUInteger)length flags:(uint16_t)flags toData:(NSMutableData *)data {
+    SDDiskBlobHeader header = {kSDDiskBlobMagic, (uint16_t)name.length, flags, (uint32_t)length, SDDiskBlobChecksum(name.bytes, name.length, bytes, length)};
+    [data appendBytes:&header length:sizeof(header)];
+    [data appendData:name];
+    if (length > 0) {
+        [data appendBytes:bytes length:length];
+    }
+}
+
+#pragma mark - Access
+
+- (nullable NSData *)dataForName:(nonnull NSString *)name {
+    os_unfair_lock_lock(&_lock);
+    _SDDiskBlobLocation *location = _locations[name];
+    _SDDiskBlobSegment *segment = location ? _segments[@(location->_segment)] : nil;
+    _SDDiskBlobFile *file = segment ? [self fileForSegment:segment] : nil;
+    os_unfair_lock_unlock(&_lock);
+    if (!file) {
+        return nil;
+    }
+    // 段已经封存或者只会在末尾追加，读的时候不用持有锁
+    NSMutableData *record = [NSMutableData dataWithLength:location->_recordLength];
+    if (pread(file->_fd, record.mutableBytes, location->_recordLength, (off_t)location->_offset) != (ssize_t)location->_recordLength) {
+        return nil;
+    }
+    SDDiskBlobHeader header;
+    memcpy(&header, record.bytes, sizeof(header));
+    const uint8_t *nameBytes = (const uint8_t *)record.bytes + sizeof(header);
+    if (header.magic != kSDDiskBlobMagic || header.dataLength != location->_dataLength ||
+        SDDiskBlobChecksum(nameBytes, header.nameLength, nameBytes + header.nameLength, header.dataLength) != header.checksum) {
+        return nil;
+    }
+    return [record subdataWithRange:NSMakeRange(sizeof(header) + header.nameLength, header.dataLength)];
+}
+
+- (BOOL)storeData:(nonnull NSData *)data forName:(nonnull NSString *)name {
+    NSData *nameData = [name dataUsingEncoding:NSUTF8StringEncoding];
+    if (nameData.length > UINT16_MAX || data.length > kSDDiskBlobSegmentMaxSize) {
+        return NO;
+    }
+    NSMutableData *record = [NSMutableData dataWithCapacity:sizeof(SDDiskBlobHeader) + nameData.length + data.length];
+    [self appendRecordWithName:nameData bytes:data.bytes length:data.length flags:0 toData:record];
+
+    os_unfair_lock_lock(&_lock);
+    uint64_t offset = 0;
+    _SDDiskBlobSegment *segment = [self appendRecords:record offset:&offset];
+    if (segment) {
+        _SDDiskBlobLocation *location = [_SDDiskBlobLocation new];
+        location->_segment = segment->_identifier;
+        location->_offset = offset;
+        location->_recordLength = (uint32_t)record.length;
+        location->_dataLength = (uint32_t)data.length;
+        [self setLocation:location forName:name];
+    }
+    os_unfair_lock_unlock(&_lock);
+    return segment != nil;
+}
+
+- (nonnull NSSet<NSString *> *)removeDataForNames:(nonnull NSArray<NSString *> *)names {
+    NSMutableSet<NSString *> *removed = [NSMutableSet set];
+    NSMutableData *tombstones = [NSMutableData data];
+    os_unfair_lock_lock(&_lock);
+    for (NSString *name in names) {
+        if (!_locations[name]) {
+            continue;
+        }
+        [self appendRecordWithName:[name dataUsingEncoding:NSUTF8StringEncoding] bytes:NULL length:0 flags:kSDDiskBlobFlagTombstone toData:tombstones];
+        [self removeLocationForName:name];
+        [removed addObject:name];
+    }
+    if (tombstones.length > 0) {
+        uint64_t offset;
+        [self appendRecords:tombstones offset:&offset];
+    }
+    os_unfair_lock_unlock(&_lock);
+    if (removed.count > 0) {
+        [self compactIfNeeded];
+    }
+    return removed;
+}
+
+- (void)removeAll {
+    os_unfair_lock_lock(&_lock);
+    [_locations removeAllObjects];
+    [_segments removeAllObjects];
+    [_openSegments removeAllObjects];
+    _activeSegment = nil;
+    // _lastIdentifier不归零，正在压缩的旧段和之后新建的段不会同名
+    [[NSFileManager new] removeItemAtPath:self.directory error:nil];
+    os_unfair_lock_unlock(&_lock);
+}
+
+#pragma mark - Compaction
+
+- (void)compactIfNeeded {
+    os_unfair_lock_lock(&_lock);
+    BOOL schedule = !_compactionScheduled && [self segmentToCompact:NULL] != nil;
+    if (schedule) {
+        _compactionScheduled = YES;
+    }
+    os_unfair_lock_unlock(&_lock);
+    if (schedule) {
+        dispatch_async(_compactionQueue, ^{
+            [self compact];
+        });
+    }
+}
+
+// 失效空间最多的封存段，调用时持有锁，*oldest是现存最早的段
+- (_SDDiskBlobSegment *)segmentToCompact:(uint32_t *)oldest {
+    _SDDiskBlobSegment *candidate = nil;
+    uint64_t candidateDead = 0;
+    uint32_t oldestIdentifier = UINT32_MAX;
+    for (_SDDiskBlobSegment *segment in _segments.objectEnumerator) {
+        oldestIdentifier = MIN(oldestIdentifier, segment->_identifier);
+        if (segment == _activeSegment) {
+            continue;
+        }
+        uint64_t dead = segment->_length - segment->_liveBytes;
+        if (dead > segment->_length * kSDDiskBlobCompactRatio && dead > candidateDead) {
+            candidate = segment;
+            candidateDead = dead;
+        }
+    }
+    if (oldest) {
+        *oldest = oldestIdentifier;
+    }
+    return candidate;
+}
+
+- (void)compact {
+    while (YES) {
+        uint32_t oldest = 0;
+        os_unfair_lock_lock(&_lock);
+        _SDDiskBlobSegment *segment = [self segmentToCompact:&oldest];
+        if (!segment) {
+            _compactionScheduled = NO;
+        }
+        os_unfair_lock_unlock(&_lock);
+        if (!segment) {
+            return;
+        }
+        uint32_t identifier = segment->_identifier;
+        NSString *path = [self pathForSegment:identifier];
+        // 封存的段不会再改变，读的时候不用持有锁；逐条记录加锁，不长时间挡住读写
+        NSData *data = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedIfSafe error:nil];
+        const uint8_t *bytes = data.bytes;
+        NSUInteger length = MIN(data.length, segment->_length);
+        uint64_t offset = 0;
+        BOOL failed = NO;
+        while (!failed && offset + sizeof(SDDiskBlobHeader) <= length) {
+            SDDiskBlobHeader header;
+            memcpy(&header, bytes + offset, sizeof(header));
+            uint64_t recordLength = sizeof(header) + header.nameLength + header.dataLength;
+            if (header.magic != kSDDiskBlobMagic || offset + recordLength > length) {
+                break;
+            }
+            NSString *name = [[NSString alloc] initWithBytes:bytes + offset + sizeof(header) length:header.nameLength encoding:NSUTF8StringEncoding];
+            os_unfair_lock_lock(&_lock);
+            // 压缩过程中整个存储被清空了
+            if (_segments[@(identifier)] != segment) {
+                os_unfair_lock_unlock(&_lock);
+                failed = YES;
+                break;
+            }
+            _SDDiskBlobLocation *location = name ? _locations[name] : nil;
+            BOOL tombstone = (header.flags & kSDDiskBlobFlagTombstone) != 0;
+            // 仍然有效的数据复制到当前段；删除记录只在更早的段中可能还有旧数据时保留，而且这个名字之后没有再存过
+            BOOL live = !tombstone && location && location->_segment == identifier && location->_offset == offset;
+            BOOL keepTombstone = tombstone && name && !location && identifier != oldest;
+            if (live || keepTombstone) {
+                uint64_t newOffset = 0;
+                NSData *record = [NSData dataWithBytesNoCopy:(void *)(bytes + offset) length:(NSUInteger)recordLength freeWhenDone:NO];
+                _SDDiskBlobSegment *target = [self appendRecords:record offset:&newOffset];
+                failed = (target == nil);
+                if (live && target) {
+                    _SDDiskBlobLocation *newLocation = [_SDDiskBlobLocation new];
+                    newLocation->_segment = target->_identifier;
+                    newLocation->_offset = newOffset;
+                    newLocation->_recordLength = location->_recordLength;
+                    newLocation->_dataLength = location->_dataLength;
+                    [self setLocation:newLocation forName:name];
+                }
+            }
+            os_unfair_lock_unlock(&_lock);
+            offset += recordLength;
+        }
+
+        os_unfair_lock_lock(&_lock);
+        if (failed) {
+            // 写不进去(比如磁盘满了)或者已经被清空，保留旧段，等下次再压缩
+            _compactionScheduled = NO;
+            os_unfair_lock_unlock(&_lock);
+            return;
+        }
+        // 段损坏的部分之后的数据读不出来，只能丢掉
+        NSMutableArray<NSString *> *lost = [NSMutableArray array];
+        [_locations enumerateKeysAndObjectsUsingBlock:^(NSString *name, _SDDiskBlobLocation *location, BOOL *stop) {
+            if (location->_segment == identifier) {
+                [lost addObject:name];
+            }
+        }];
+        [_locations removeObjectsForKeys:lost];
+        [_segments removeObjectForKey:@(identifier)];
+        [_openSegments removeObjectIdenticalTo:segment];
+        unlink(path.fileSystemRepresentation);
+        os_unfair_lock_unlock(&_lock);
+    }
+}
+
+@end
@@ -0,0 +1,111 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+/**
+ * A persistent index of the files in the disk cache: for every cache file name (md5 of the key plus extension)
+ * it keeps the size, the store time and the last access time, so the size, the count and the files to clean up
+ * can be answered without enumerating the directory.
+ * The index is a snapshot file plus an append-only journal in the cache directory (both hidden files).
+ * Store and remove append one fixed-size record to the journal; access times only live in memory until the next save.
+ * All methods are thread-safe.
+ *
+ * 磁盘缓存的持久化索引：以缓存文件名(key的md5加扩展名)为键，记录大小、存入时间和最后访问时间，
+ * 磁盘缓存的大小、个数以及需要清理的文件都直接从索引得到，不用遍历目录
+ * 索引由缓存目录中的快照文件和只追加的日志组成(都是隐藏文件)，存入和删除时往日志追加一条定长记录，
+ * 访问时间只保存在内存中，下次保存快照时才写入。所有方法都是线程安全的
+ */
+@interface SDDiskCacheIndex : NSObject
+
+/**
+ * Create an index for the given cache directory, nothing is read until load is called.
+ * 创建缓存目录的索引，调用load之前不读文件
+ */
+- (nonnull instancetype)initWithDirectory:(nonnull NSString *)directory NS_DESIGNATED_INITIALIZER;
+
+- (nonnull instancetype)init NS_UNAVAILABLE;
+
+@property (strong, nonatomic, readonly, nonnull) NSString *directory;
+
+/**
+ * YES once load or rebuild has completed.
+ * load或者rebuild完成之后为YES
+ */
+@property (assign, nonatomic, readonly, getter=isLoaded) BOOL loaded;
+
+/**
+ * Total size in bytes and number of the indexed files.
+ * 索引中文件的总字节数和个数
+ */
+@property (assign, nonatomic, readonly) NSUInteger totalSize;
+@property (assign, nonatomic, readonly) NSUInteger count;
+
+/**
+ * Read the snapshot and replay the journal. Returns NO when there is no index yet or it is damaged, call rebuild then.
+ * 读取快照并重放日志。还没有索引或者索引损坏时返回NO，这时要调用rebuild
+ */
+- (BOOL)load;
+
+/**
+ * Build the index by enumerating the cache directory once, then save it.
+ * 遍历一次缓存目录重建索引，然后保存
+ */
+- (void)rebuild;
+
+/**
+ * Write a new snapshot, including the access times, and empty the journal.
+ * 写入新的快照(包括访问时间)，并清空日志
+ */
+- (void)save;
+
+/**
+ * Record that a file was written, or overwritten, with the given size.
+ * 记录写入(或者覆盖)了一个文件
+ */
+- (void)recordStoreForFileName:(nonnull NSString *)fileName size:(NSUInteger)size;
+
+/**
+ * Record a read, used to pick the least recently used files when the cache is over maxCacheSize.
+ * 记录一次读取，超过maxCacheSize时按它选出最久没有使用的文件
+ */
+- (void)recordAccessForFileName:(nonnull NSString *)fileName;
+
+- (void)recordRemovalForFileName:(nonnull NSString *)fileName;
+
+/**
+ * Record many removals with a single journal write, used by the cleanup.
+ * 一次记录很多文件的删除，日志只写一次，清理时使用
+ */
+- (void)recordRemovalForFileNames:(nonnull NSArray<NSString *> *)fileNames;
+
+/**
+ * Forget every file and delete the index files, used when the whole cache directory is removed.
+ * 清空索引并删除索引文件，整个缓存目录被删除时使用
+ */
+- (void)removeAll;
+
+/**
+ * The files to delete: every file stored before the expiration date, then, if the rest is still larger than maxSize,
+ * the least recently used files until the rest is smaller than targetSize. Pass 0 as maxSize for no size limit.
+ * 需要删除的文件：先是存入时间早于expirationDate的文件，剩下的仍然大于maxSize时，再按最后访问时间从早到晚
+ * 选出文件，直到剩下的小于targetSize。maxSize为0表示不限制大小
+ */
+- (nonnull NSArray<NSString *> *)fileNamesToEvictWithExpirationDate:(nonnull NSDate *)expirationDate
+                                                            maxSize:(NSUInteger)maxSize
+                                                         targetSize:(NSUInteger)targetSize;
+
+/**
+ * Keep only the files still in the index and stored before the given date. The cleanup calls it right before deleting,
+ * so a file stored again after it was picked is not deleted.
+ * 只保留仍在索引中并且存入时间早于date的文件。清理在删除之前调用，被选出之后又重新存入的文件不会被删除
+ */
+- (nonnull NSArray<NSString *> *)fileNames:(nonnull NSArray<NSString *> *)fileNames storedBeforeDate:(nonnull NSDate *)date;
+
+@end
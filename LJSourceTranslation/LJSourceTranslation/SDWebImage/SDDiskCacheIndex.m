@@ -0,0 +1,621 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDDiskCacheIndex.h"
+#import <os/lock.h>
+#import <fcntl.h>
+#import <unistd.h>
+
+static NSString * const kSDDiskCacheIndexFileName = @".sdindex";
+static NSString * const kSDDiskCacheJournalFileName = @".sdjournal";
+static const uint32_t kSDDiskCacheIndexMagic = 0x58494453; // "SDIX"
+static const uint32_t kSDDiskCacheIndexVersion = 1;
+// md5的16个字节，文件名是32个十六进制字符
+static const NSUInteger kSDDiskCacheDigestLength = 16;
+// 日志中的记录超过这个数时，load之后马上保存一次快照
+static const NSUInteger kSDDiskCacheJournalCompactThreshold = 4096;
+
+// 一个文件的索引记录，快照中直接按这个结构连续存放，32个字节
+typedef struct {
+    uint8_t digest[16];
+    uint32_t size;
+    // 从2001年开始的秒数
+    uint32_t storeTime;
+    uint32_t accessTime;
+    uint16_t extension;
+    uint16_t flags;
+} SDDiskCacheIndexRecord;
+
+// 快照：header，扩展名表(每个是1字节长度加内容)，recordCount条记录
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordCount;
+    uint32_t extensionCount;
+} SDDiskCacheIndexHeader;
+
+// 日志中每条记录的开头，后面是一条SDDiskCacheIndexRecord和extensionLength个字节的扩展名
+// 日志里直接写扩展名，不依赖快照中扩展名表的序号
+typedef struct {
+    uint8_t op;
+    uint8_t extensionLength;
+} SDDiskCacheJournalEntryHeader;
+
+typedef NS_ENUM(uint8_t, SDDiskCacheJournalOp) {
+    SDDiskCacheJournalOpStore = 'S',
+    SDDiskCacheJournalOpRemove = 'R'
+};
+
+typedef struct {
+    uint32_t accessTime;
+    uint32_t index;
+} SDDiskCacheAccessOrder;
+
+static int SDDiskCacheCompareAccessOrder(const void *a, const void *b) {
+    uint32_t timeA = ((const SDDiskCacheAccessOrder *)a)->accessTime;
+    uint32_t timeB = ((const SDDiskCacheAccessOrder *)b)->accessTime;
+    return timeA < timeB ? -1 : (timeA > timeB ? 1 : 0);
+}
+
+FOUNDATION_STATIC_INLINE uint32_t SDDiskCacheTimeFromDate(NSDate *date) {
+    NSTimeInterval interval = date ? date.timeIntervalSinceReferenceDate : CFAbsoluteTimeGetCurrent();
+    return (uint32_t)MIN(MAX(interval, 0), UINT32_MAX);
+}
+
+FOUNDATION_STATIC_INLINE uint64_t SDDiskCacheDigestHash(const uint8_t *digest) {
+    // md5本身已经是均匀分布的，直接取前8个字节
+    uint64_t hash;
+    memcpy(&hash, digest, sizeof(hash));
+    return hash;
+}
+
+FOUNDATION_STATIC_INLINE int SDDiskCacheHexValue(unichar c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// 把缓存文件名拆成md5和扩展名(不带点)，不是缓存文件时返回NO
+static BOOL SDDiskCacheParseFileName(NSString *fileName, uint8_t *digest, NSString **extension) {
+    NSUInteger length = fileName.length;
+    if (length < kSDDiskCacheDigestLength * 2) {
+        return NO;
+    }
+    unichar characters[kSDDiskCacheDigestLength * 2];
+    [fileName getCharacters:characters range:NSMakeRange(0, kSDDiskCacheDigestLength * 2)];
+    for (NSUInteger i = 0; i < kSDDiskCacheDigestLength; i++) {
+        int high = SDDiskCacheHexValue(characters[i * 2]);
+        int low = SDDiskCacheHexValue(characters[i * 2 + 1]);
+        if (high < 0 || low < 0) {
+            return NO;
+        }
+        digest[i] = (uint8_t)(high << 4 | low);
+    }
+    if (length == kSDDiskCacheDigestLength * 2) {
+        *extension = @"";
+        return YES;
+    }
+    if ([fileName characterAtIndex:kSDDiskCacheDigestLength * 2] != '.') {
+        return NO;
+    }
+    *extension = [fileName substringFromIndex:kSDDiskCacheDigestLength * 2 + 1];
+    // 日志中扩展名的长度只有1个字节
+    return [*extension lengthOfBytesUsingEncoding:NSUTF8StringEncoding] <= UINT8_MAX;
+}
+
+@implementation SDDiskCacheIndex {
+    os_unfair_lock _lock;
+    BOOL _loaded;
+    NSString *_indexPath;
+    NSString *_journalPath;
+    int _journalFD;
+    NSUInteger _journalRecordCount;
+
+    // 记录连续存放，删除时用最后一条填补空位
+    SDDiskCacheIndexRecord *_records;
+    NSUInteger _recordCount;
+    NSUInteger _recordCapacity;
+    // 开放寻址的hash表，存的是记录下标加1，0表示空位
+    uint32_t *_slots;
+    NSUInteger _slotMask;
+    uint64_t _totalSize;
+
+    NSMutableArray<NSString *> *_extensions;
+    NSMutableDictionary<NSString *, NSNumber *> *_extensionIndexes;
+}
+
+- (nonnull instancetype)initWithDirectory:(nonnull NSString *)directory {
+    if ((self = [super init])) {
+        _directory = [directory copy];
+        _lock = OS_UNFAIR_LOCK_INIT;
+        _indexPath = [directory stringByAppendingPathComponent:kSDDiskCacheIndexFileName];
+        _journalPath = [directory stringByAppendingPathComponent:kSDDiskCacheJournalFileName];
+        _journalFD = -1;
+        [self resetRecords];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    if (_journalFD >= 0) {
+        close(_journalFD);
+    }
+    free(_records);
+    free(_slots);
+}
+
+#pragma mark - Info
+
+- (BOOL)isLoaded {
+    os_unfair_lock_lock(&_lock);
+    BOOL loaded = _loaded;
+    os_unfair_lock_unlock(&_lock);
+    return loaded;
+}
+
+- (NSUInteger)totalSize {
+    os_unfair_lock_lock(&_lock);
+    NSUInteger totalSize = (NSUInteger)_totalSize;
+    os_unfair_lock_unlock(&_lock);
+    return totalSize;
+}
+
+- (NSUInteger)count {
+    os_unfair_lock_lock(&_lock);
+    NSUInteger count = _recordCount;
+    os_unfair_lock_unlock(&_lock);
+    return count;
+}
+
+#pragma mark - Records, called with the lock held
+
+- (void)resetRecords {
+    free(_records);
+    free(_slots);
+    _recordCapacity = 64;
+    _records = malloc(_recordCapacity * sizeof(SDDiskCacheIndexRecord));
+    _recordCount = 0;
+    _slotMask = 127;
+    _slots = calloc(_slotMask + 1, sizeof(uint32_t));
+    _totalSize = 0;
+    _extensions = [NSMutableArray arrayWithObject:@""];
+    _extensionIndexes = [NSMutableDictionary dictionaryWithObject:@0 forKey:@""];
+}
+
+- (uint16_t)indexOfExtension:(NSString *)extension {
+    NSNumber *index = _extensionIndexes[extension];
+    if (index) {
+        return index.unsignedShortValue;
+    }
+    if (_extensions.count > UINT16_MAX) {
+        return 0;
+    }
+    uint16_t newIndex = (uint16_t)_extensions.count;
+    [_extensions addObject:extension];
+    _extensionIndexes[extension] = @(newIndex);
+    return newIndex;
+}
+
+// 找到digest所在的槽位，没有时返回应该插入的空槽位，*recordIndex为NSNotFound
+- (NSUInteger)slotForDigest:(const uint8_t *)digest recordIndex:(NSUInteger *)recordIndex {
+    NSUInteger slot = (NSUInteger)SDDiskCacheDigestHash(digest) & _slotMask;
+    while (_slots[slot] != 0) {
+        NSUInteger index = _slots[slot] - 1;
+        if (memcmp(_records[index].digest, digest, kSDDiskCacheDigestLength) == 0) {
+            *recordIndex = index;
+            return slot;
+        }
+        slot = (slot + 1) & _slotMask;
+    }
+    *recordIndex = NSNotFound;
+    return slot;
+}
+
+- (void)growSlots {
+    free(_slots);
+    _slotMask = (_slotMask << 1) | 1;
+    _slots = calloc(_slotMask + 1, sizeof(uint32_t));
+    for (NSUInteger i = 0; i < _recordCount; i++) {
+        NSUInteger slot = (NSUInteger)SDDiskCacheDigestHash(_records[i].digest) & _slotMask;
+        while (_slots[slot] != 0) {
+            slot = (slot + 1) & _slotMask;
+        }
+        _slots[slot] = (uint32_t)(i + 1);
+    }
+}
+
+// 有同样md5的记录时覆盖
+- (void)insertRecord:(const SDDiskCacheIndexRecord *)record {
+    NSUInteger index;
+    NSUInteger slot = [self slotForDigest:record->digest recordIndex:&index];
+    if (index != NSNotFound) {
+        _totalSize = _totalSize - _records[index].size + record->size;
+        _records[index] = *record;
+        return;
+    }
+    // hash表最多用一半
+    if ((_recordCount + 1) * 2 > _slotMask + 1) {
+        [self growSlots];
+        slot = [self slotForDigest:record->digest recordIndex:&index];
+    }
+    if (_recordCount == _recordCapacity) {
+        _recordCapacity *= 2;
+        _records = realloc(_records, _recordCapacity * sizeof(SDDiskCacheIndexRecord));
+    }
+    _records[_recordCount] = *record;
+    _slots[slot] = (uint32_t)(_recordCount + 1);
+    _recordCount++;
+    _totalSize += record->size;
+}
+
+- (void)removeRecordWithDigest:(const uint8_t *)digest {
+    NSUInteger index;
+    NSUInteger slot = [self slotForDigest:digest recordIndex:&index];
+    if (index == NSNotFound) {
+        return;
+    }
+    _totalSize -= _records[index].size;
+
+    // 线性探测的删除：把后面因为冲突排过来的记录往前挪，保证查找不会在空位处提前结束
+    _slots[slot] = 0;
+    NSUInteger hole = slot;
+    NSUInteger next = (slot + 1) & _slotMask;
+    while (_slots[next] != 0) {
+        NSUInteger home = (NSUInteger)SDDiskCacheDigestHash(_records[_slots[next] - 1].digest) & _slotMask;
+        // home不在(hole, next]之间时，这条记录可以挪到hole
+        BOOL movable = hole <= next ? (home <= hole || home > next) : (home <= hole && home > next);
+        if (movable) {
+            _slots[hole] = _slots[next];
+            _slots[next] = 0;
+            hole = next;
+        }
+        next = (next + 1) & _slotMask;
+    }
+
+    // 用最后一条记录填补空位，并更新指向它的槽位
+    NSUInteger last = _recordCount - 1;
+    if (index != last) {
+        NSUInteger lastIndex;
+        NSUInteger lastSlot = [self slotForDigest:_records[last].digest recordIndex:&lastIndex];
+        _records[index] = _records[last];
+        _slots[lastSlot] = (uint32_t)(index + 1);
+    }
+    _recordCount--;
+}
+
+- (NSString *)fileNameForRecord:(const SDDiskCacheIndexRecord *)record {
+    const uint8_t *d = record->digest;
+    NSString *extension = record->extension < _extensions.count ? _extensions[record->extension] : @"";
+    return [NSString stringWithFormat:@"%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%@",
+            d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7], d[8], d[9], d[10],
+            d[11], d[12], d[13], d[14], d[15], extension.length > 0 ? [@"." stringByAppendingString:extension] : @""];
+}
+
+#pragma mark - Journal, called with the lock held
+
+- (int)journalDescriptor {
+    if (_journalFD < 0) {
+        _journalFD = open(_journalPath.fileSystemRepresentation, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    }
+    return _journalFD;
+}
+
+- (void)appendJournalData:(NSData *)data records:(NSUInteger)count {
+    int fd = [self journalDescriptor];
+    if (fd < 0) {
+        return;
+    }
+    // 追加失败时索引只在内存中生效，下次load发现日志不完整时丢掉不完整的部分
+    if (write(fd, data.bytes, data.length) == (ssize_t)data.length) {
+        _journalRecordCount += count;
+    }
+}
+
+- (void)appendJournalOp:(SDDiskCacheJournalOp)op record:(const SDDiskCacheIndexRecord *)record extension:(NSString *)extension toData:(NSMutableData *)data {
+    NSData *extensionData = [extension dataUsingEncoding:NSUTF8StringEncoding];
+    SDDiskCacheJournalEntryHeader header = {op, (uint8_t)extensionData.length};
+    [data appendBytes:&header length:sizeof(header)];
+    [data appendBytes:record length:sizeof(*record)];
+    if (extensionData) {
+        [data appendData:extensionData];
+    }
+}
+
+// 重放日志，返回完整的记录占用的长度，之后的部分是写到一半的记录
+- (NSUInteger)replayJournalData:(NSData *)data {
+    const uint8_t *bytes = data.bytes;
+    NSUInteger length = data.length;
+    NSUInteger offset = 0;
+    _journalRecordCount = 0;
+    while (offset + sizeof(SDDiskCacheJournalEntryHeader) + sizeof(SDDiskCacheIndexRecord) <= length) {
+        SDDiskCacheJournalEntryHeader header;
+        memcpy(&header, bytes + offset, sizeof(header));
+        NSUInteger entryLength = sizeof(header) + sizeof(SDDiskCacheIndexRecord) + header.extensionLength;
+        if (offset + entryLength > length) {
+            break;
+        }
+        SDDiskCacheIndexRecord record;
+        memcpy(&record, bytes + offset + sizeof(header), sizeof(record));
+        if (header.op == SDDiskCacheJournalOpStore) {
+            NSString *extension = [[NSString alloc] initWithBytes:bytes + offset + sizeof(header) + sizeof(record)
+                                                           length:header.extensionLength
+                                                         encoding:NSUTF8StringEncoding];
+            record.extension = [self indexOfExtension:extension ?: @""];
+            [self insertRecord:&record];
+        } else if (header.op == SDDiskCacheJournalOpRemove) {
+            [self removeRecordWithDigest:record.digest];
+        } else {
+            break;
+        }
+        offset += entryLength;
+        _journalRecordCount++;
+    }
+    return offset;
+}
+
+#pragma mark - Load and save
+
+- (BOOL)load {
+    os_unfair_lock_lock(&_lock);
+    BOOL loaded = [self loadSnapshot];
+    if (loaded) {
+        NSData *journal = [NSData dataWithContentsOfFile:_journalPath options:NSDataReadingMappedIfSafe error:nil];
+        NSUInteger validLength = [self replayJournalData:journal];
+        int fd = [self journalDescriptor];
+        if (fd >= 0 && validLength < journal.length) {
+            ftruncate(fd, validLength);
+        }
+        _loaded = YES;
+        if (_journalRecordCount > MAX(kSDDiskCacheJournalCompactThreshold, _recordCount)) {
+            [self saveSnapshot];
+        }
+    } else {
+        [self resetRecords];
+    }
+    os_unfair_lock_unlock(&_lock);
+    return loaded;
+}
+
+- (BOOL)loadSnapshot {
+    NSData *data = [NSData dataWithContentsOfFile:_indexPath options:NSDataReadingMappedIfSafe error:nil];
+    if (data.length < sizeof(SDDiskCacheIndexHeader)) {
+        return NO;
+    }
+    const uint8_t *bytes = data.bytes;
+    NSUInteger length = data.length;
+    SDDiskCacheIndexHeader header;
+    memcpy(&header, bytes, sizeof(header));
+    if (header.magic != kSDDiskCacheIndexMagic || header.version != kSDDiskCacheIndexVersion) {
+        return NO;
+    }
+    [self resetRecords];
+    NSUInteger offset = sizeof(header);
+    // 快照中扩展名的序号到内存中序号的映射
+    uint16_t *extensionMap = calloc(MAX(header.extensionCount, 1), sizeof(uint16_t));
+    for (uint32_t i = 0; i < header.extensionCount; i++) {
+        if (offset + 1 > length || offset + 1 + bytes[offset] > length) {
+            free(extensionMap);
+            return NO;
+        }
+        NSString *extension = [[NSString alloc] initWithBytes:bytes + offset + 1 length:bytes[offset] encoding:NSUTF8StringEncoding];
+        extensionMap[i] = [self indexOfExtension:extension ?: @""];
+        offset += 1 + bytes[offset];
+    }
+    if (length - offset != (NSUInteger)header.recordCount * sizeof(SDDiskCacheIndexRecord)) {
+        free(extensionMap);
+        return NO;
+    }
+    for (uint32_t i = 0; i < header.recordCount; i++) {
+        SDDiskCacheIndexRecord record;
+        memcpy(&record, bytes + offset + i * sizeof(record), sizeof(record));
+        record.extension = record.extension < header.extensionCount ? extensionMap[record.extension] : 0;
+        [self insertRecord:&record];
+    }
+    free(extensionMap);
+    return YES;
+}
+
+- (void)save {
+    os_unfair_lock_lock(&_lock);
+    [self saveSnapshot];
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (void)saveSnapshot {
+    SDDiskCacheIndexHeader header = {kSDDiskCacheIndexMagic, kSDDiskCacheIndexVersion, (uint32_t)_recordCount, (uint32_t)_extensions.count};
+    NSMutableData *data = [NSMutableData dataWithCapacity:sizeof(header) + _recordCount * sizeof(SDDiskCacheIndexRecord) + 256];
+    [data appendBytes:&header length:sizeof(header)];
+    for (NSString *extension in _extensions) {
+        NSData *extensionData = [extension dataUsingEncoding:NSUTF8StringEncoding];
+        uint8_t extensionLength = (uint8_t)MIN(extensionData.length, UINT8_MAX);
+        [data appendBytes:&extensionLength length:1];
+        [data appendBytes:extensionData.bytes length:extensionLength];
+    }
+    [data appendBytes:_records length:_recordCount * sizeof(SDDiskCacheIndexRecord)];
+    // 先换掉快照再清空日志，中间被打断时重放日志也只是重复同样的修改
+    if ([data writeToFile:_indexPath atomically:YES]) {
+        int fd = [self journalDescriptor];
+        if (fd >= 0) {
+            ftruncate(fd, 0);
+        }
+        _journalRecordCount = 0;
+    }
+}
+
+- (void)rebuild {
+    // 遍历目录比较慢，不持有锁，最后一次换进去
+    NSMutableArray<NSString *> *fileNames = [NSMutableArray array];
+    NSMutableData *sizes = [NSMutableData data];
+    NSMutableData *times = [NSMutableData data];
+    NSArray<NSString *> *resourceKeys = @[NSURLIsDirectoryKey, NSURLFileSizeKey, NSURLContentModificationDateKey];
+    NSDirectoryEnumerator *fileEnumerator = [[NSFileManager new] enumeratorAtURL:[NSURL fileURLWithPath:self.directory isDirectory:YES]
+                                                      includingPropertiesForKeys:resourceKeys
+                                                                         options:NSDirectoryEnumerationSkipsHiddenFiles
+                                                                    errorHandler:NULL];
+    for (NSURL *fileURL in fileEnumerator) {
+        NSDictionary<NSString *, id> *resourceValues = [fileURL resourceValuesForKeys:resourceKeys error:nil];
+        if (!resourceValues || [resourceValues[NSURLIsDirectoryKey] boolValue]) {
+            continue;
+        }
+        uint32_t size = (uint32_t)MIN([resourceValues[NSURLFileSizeKey] unsignedLongLongValue], UINT32_MAX);
+        uint32_t time = SDDiskCacheTimeFromDate(resourceValues[NSURLContentModificationDateKey]);
+        [fileNames addObject:fileURL.lastPathComponent];
+        [sizes appendBytes:&size length:sizeof(size)];
+        [times appendBytes:&time length:sizeof(time)];
+    }
+
+    os_unfair_lock_lock(&_lock);
+    [self resetRecords];
+    const uint32_t *sizeValues = sizes.bytes;
+    const uint32_t *timeValues = times.bytes;
+    for (NSUInteger i = 0; i < fileNames.count; i++) {
+        SDDiskCacheIndexRecord record = {{0}, sizeValues[i], timeValues[i], timeValues[i], 0, 0};
+        NSString *extension;
+        if (SDDiskCacheParseFileName(fileNames[i], record.digest, &extension)) {
+            record.extension = [self indexOfExtension:extension];
+            [self insertRecord:&record];
+        }
+    }
+    [self saveSnapshot];
+    _loaded = YES;
+    os_unfair_lock_unlock(&_lock);
+}
+
+#pragma mark - Updates
+
+- (void)recordStoreForFileName:(nonnull NSString *)fileName size:(NSUInteger)size {
+    SDDiskCacheIndexRecord record = {{0}, (uint32_t)MIN(size, UINT32_MAX), 0, 0, 0, 0};
+    NSString *extension;
+    if (!SDDiskCacheParseFileName(fileName, record.digest, &extension)) {
+        return;
+    }
+    record.storeTime = SDDiskCacheTimeFromDate(nil);
+    record.accessTime = record.storeTime;
+    NSMutableData *entry = [NSMutableData dataWithCapacity:64];
+    [self appendJournalOp:SDDiskCacheJournalOpStore record:&record extension:extension toData:entry];
+
+    os_unfair_lock_lock(&_lock);
+    record.extension = [self indexOfExtension:extension];
+    [self insertRecord:&record];
+    [self appendJournalData:entry records:1];
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (void)recordAccessForFileName:(nonnull NSString *)fileName {
+    uint8_t digest[kSDDiskCacheDigestLength];
+    NSString *extension;
+    if (!SDDiskCacheParseFileName(fileName, digest, &extension)) {
+        return;
+    }
+    uint32_t now = SDDiskCacheTimeFromDate(nil);
+    os_unfair_lock_lock(&_lock);
+    NSUInteger index;
+    [self slotForDigest:digest recordIndex:&index];
+    if (index != NSNotFound) {
+        _records[index].accessTime = now;
+    }
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (void)recordRemovalForFileName:(nonnull NSString *)fileName {
+    [self recordRemovalForFileNames:@[fileName]];
+}
+
+// 清理时一次删除很多文件，日志只写一次
+- (void)recordRemovalForFileNames:(nonnull NSArray<NSString *> *)fileNames {
+    NSMutableData *entries = [NSMutableData dataWithCapacity:fileNames.count * (sizeof(SDDiskCacheJournalEntryHeader) + sizeof(SDDiskCacheIndexRecord))];
+    NSMutableData *digests = [NSMutableData dataWithCapacity:fileNames.count * kSDDiskCacheDigestLength];
+    for (NSString *fileName in fileNames) {
+        SDDiskCacheIndexRecord record = {{0}, 0, 0, 0, 0, 0};
+        NSString *extension;
+        if (SDDiskCacheParseFileName(fileName, record.digest, &extension)) {
+            [self appendJournalOp:SDDiskCacheJournalOpRemove record:&record extension:nil toData:entries];
+            [digests appendBytes:record.digest length:kSDDiskCacheDigestLength];
+        }
+    }
+    NSUInteger count = digests.length / kSDDiskCacheDigestLength;
+    if (count == 0) {
+        return;
+    }
+    os_unfair_lock_lock(&_lock);
+    const uint8_t *digestBytes = digests.bytes;
+    for (NSUInteger i = 0; i < count; i++) {
+        [self removeRecordWithDigest:digestBytes + i * kSDDiskCacheDigestLength];
+    }
+    [self appendJournalData:entries records:count];
+    os_unfair_lock_unlock(&_lock);
+}
+
+- (void)removeAll {
+    os_unfair_lock_lock(&_lock);
+    [self resetRecords];
+    if (_journalFD >= 0) {
+        close(_journalFD);
+        _journalFD = -1;
+    }
+    _journalRecordCount = 0;
+    unlink(_indexPath.fileSystemRepresentation);
+    unlink(_journalPath.fileSystemRepresentation);
+    os_unfair_lock_unlock(&_lock);
+}
+
+#pragma mark - Eviction
+
+- (nonnull NSArray<NSString *> *)fileNamesToEvictWithExpirationDate:(nonnull NSDate *)expirationDate
+                                                            maxSize:(NSUInteger)maxSize
+                                                         targetSize:(NSUInteger)targetSize {
+    uint32_t expirationTime = SDDiskCacheTimeFromDate(expirationDate);
+    NSMutableArray<NSString *> *fileNames = [NSMutableArray array];
+    os_unfair_lock_lock(&_lock);
+    uint64_t remainingSize = _totalSize;
+    SDDiskCacheAccessOrder *order = malloc(MAX(_recordCount, 1) * sizeof(SDDiskCacheAccessOrder));
+    NSUInteger orderCount = 0;
+    for (NSUInteger i = 0; i < _recordCount; i++) {
+        if (_records[i].storeTime < expirationTime) {
+            [fileNames addObject:[self fileNameForRecord:&_records[i]]];
+            remainingSize -= _records[i].size;
+        } else {
+            order[orderCount++] = (SDDiskCacheAccessOrder){_records[i].accessTime, (uint32_t)i};
+        }
+    }
+    if (maxSize > 0 && remainingSize > maxSize) {
+        qsort(order, orderCount, sizeof(SDDiskCacheAccessOrder), SDDiskCacheCompareAccessOrder);
+        for (NSUInteger i = 0; i < orderCount && remainingSize >= targetSize; i++) {
+            const SDDiskCacheIndexRecord *record = &_records[order[i].index];
+            [fileNames addObject:[self fileNameForRecord:record]];
+            remainingSize -= record->size;
+        }
+    }
+    free(order);
+    os_unfair_lock_unlock(&_lock);
+    return fileNames;
+}
+
+- (nonnull NSArray<NSString *> *)fileNames:(nonnull NSArray<NSString *> *)fileNames storedBeforeDate:(nonnull NSDate *)date {
+    uint32_t time = SDDiskCacheTimeFromDate(date);
+    NSMutableArray<NSString *> *storedFileNames = [NSMutableArray arrayWithCapacity:fileNames.count];
+    for (NSString *fileName in fileNames) {
+        uint8_t digest[kSDDiskCacheDigestLength];
+        NSString *extension;
+        if (!SDDiskCacheParseFileName(fileName, digest, &extension)) {
+            continue;
+        }
+        os_unfair_lock_lock(&_lock);
+        NSUInteger index;
+        [self slotForDigest:digest recordIndex:&index];
+        BOOL stored = index != NSNotFound && _records[index].storeTime < time;
+        os_unfair_lock_unlock(&_lock);
+        if (stored) {
+            [storedFileNames addObject:fileName];
+        }
+    }
+    return storedFileNames;
+}
+
+@end
@@ -30,6 +30,9 @@ typedef NS_ENUM(NSInteger, SDImageCacheType) {
 
 typedef void(^SDCacheQueryCompletedBlock)(UIImage * _Nullable image, NSData * _Nullable data, SDImageCacheType cacheType);
 
+// images只包含找到的key，cacheTypes包含每个查询的key
+typedef void(^SDCacheBatchQueryCompletedBlock)(NSDictionary<NSString *, UIImage *> * _Nonnull images, NSDictionary<NSString *, NSNumber *> * _Nonnull cacheTypes);
+
 typedef void(^SDWebImageCheckCacheCompletionBlock)(BOOL isInCache);
 
 typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger totalSize);
@@ -51,8 +54,8 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
 @property (nonatomic, nonnull, readonly) SDImageCacheConfig *config;
 
 /**
- * The maximum "total cost" of the in-memory image cache. The cost function is the number of pixels held in memory.
- * LJMARK:内存中图像缓存的最大“总成本”。 成本函数是存储器中保存的像素数。
+ * The maximum "total cost" of the in-memory image cache. The cost function is the number of bytes of the decoded bitmaps held in memory. 0 means no limit.
+ * LJMARK:内存中图像缓存的最大“总成本”。 成本函数是存储器中保存的解码后位图的字节数，0表示不限制。
  */
 @property (assign, nonatomic) NSUInteger maxMemoryCost;
 
@@ -62,6 +65,18 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 @property (assign, nonatomic) NSUInteger maxMemoryCountLimit;
 
+/**
+ * The share of memory cache lookups that found an image since the cache was created or the statistics were reset.
+ * 内存缓存的命中率，从创建缓存或者上次清零统计开始计算
+ */
+@property (assign, nonatomic, readonly) double memoryCacheHitRatio;
+
+/**
+ * Reset the hit, miss and eviction counters of the memory cache, e.g. before measuring a scroll.
+ * 清零内存缓存的命中、未命中和淘汰次数，比如在统计一次滚动之前
+ */
+- (void)resetMemoryCacheStatistics;
+
 #pragma mark - Singleton and initialization
 
 /**
@@ -154,11 +169,27 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
             toDisk:(BOOL)toDisk
         completion:(nullable SDWebImageNoParamsBlock)completionBlock;
 
+/**
+ * Same as storeImage:imageData:forKey:toDisk:completion:, for an image decoded at a reduced size. The image goes to
+ * the memory cache under the key for that size, the image data to disk under the key itself, so every size can be
+ * decoded again from the same file. Nothing is written to disk when imageData is nil.
+ * 和storeImage:imageData:forKey:toDisk:completion:一样，用于缩小解码的图片。图片按这个大小的key存到内存缓存，
+ * 图像数据按key本身存到磁盘，每种大小都可以从同一个文件重新解码。imageData为nil时不写磁盘
+ * @param targetPixelSize The size the image was decoded for, CGSizeZero for the full size
+ *                        图片解码时的目标大小，CGSizeZero表示原尺寸
+ */
+- (void)storeImage:(nullable UIImage *)image
+         imageData:(nullable NSData *)imageData
+            forKey:(nullable NSString *)key
+   targetPixelSize:(CGSize)targetPixelSize
+            toDisk:(BOOL)toDisk
+        completion:(nullable SDWebImageNoParamsBlock)completionBlock;
+
 /**
  * Synchronously store image NSData into disk cache at the given key.
  * 通过给定的key同步存储图像数据到磁盘缓存
- * @warning This method is synchronous, make sure to call it from the ioQueue
- * 警告，这个方法时同步的，确认调用在写入写出队列
+ * @warning This method is synchronous, make sure to call it from the write queue of the key's cache file
+ * 警告，这个方法时同步的，确认调用在这个key的缓存文件对应的写队列
  * @param imageData  The image data to store
  * @param key        The unique image cache key, usually it's image absolute URL
  */
@@ -190,6 +221,37 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
  */
 - (nullable NSOperation *)queryCacheOperationForKey:(nullable NSString *)key done:(nullable SDCacheQueryCompletedBlock)doneBlock;
 
+/**
+ * Same as queryCacheOperationForKey:done:, but the image is decoded straight at a reduced size that fills targetPixelSize
+ * and kept in the memory cache per (key, size), so a grid of thumbnails never holds the full size bitmaps.
+ * 和queryCacheOperationForKey:done:一样，但是图片直接按铺满targetPixelSize的缩小尺寸解码，
+ * 内存缓存中按(key, 大小)分别保存，缩略图网格不会持有原尺寸的位图
+ * @param targetPixelSize The size in pixels the image is displayed at, CGSizeZero for the full size
+ *                        图片显示的像素大小，CGSizeZero表示原尺寸
+ */
+- (nullable NSOperation *)queryCacheOperationForKey:(nullable NSString *)key targetPixelSize:(CGSize)targetPixelSize done:(nullable SDCacheQueryCompletedBlock)doneBlock;
+
+/**
+ * The memory cache key of the image decoded for targetPixelSize, the key itself for CGSizeZero.
+ * 按targetPixelSize解码的图片在内存缓存中的key，CGSizeZero时就是key本身
+ */
+- (nullable NSString *)memoryCacheKeyForKey:(nullable NSString *)key targetPixelSize:(CGSize)targetPixelSize;
+
+/**
+ * Query many keys at once, for lists and grids. Memory hits are resolved synchronously in one pass; the disk misses
+ * are read in one batch on the I/O queue, ordered by location on disk, decoded in parallel, and reported together
+ * with the memory hits in a single main queue callback. The image data is not returned, use queryCacheOperationForKey:done: for that.
+ * 一次查询很多key，用于列表和网格。内存命中在一次遍历中同步得到；内存中没有的在IO队列中作为一批读取，
+ * 按磁盘上的位置排序，并行解码，最后和内存命中一起在主队列中一次回调。不返回图像数据，需要时使用queryCacheOperationForKey:done:
+ * @param keys      The keys to query, duplicates are queried once
+ *                  要查询的key，重复的只查一次
+ * @param doneBlock Called synchronously when every key is in memory. Will not get called if the operation is cancelled
+ *                  所有的key都在内存中时同步调用，operation取消的话将不会调用
+ * @return a NSOperation instance when the disk is queried, nil otherwise
+ *                  需要查询磁盘时返回一个NSOperation实例，否则返回nil
+ */
+- (nullable NSOperation *)queryCacheOperationsForKeys:(nonnull NSArray<NSString *> *)keys done:(nullable SDCacheBatchQueryCompletedBlock)doneBlock;
+
 /**
  * Query the memory cache synchronously.
  * 同步的查询内存缓存
@@ -265,14 +327,14 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
 #pragma mark - Cache Info
 
 /**
- * Get the size used by the disk cache
- * 获取到磁盘缓存的大小
+ * Get the size used by the disk cache, read from the disk cache index
+ * 获取到磁盘缓存的大小，直接从磁盘缓存的索引读取
  */
 - (NSUInteger)getSize;
 
 /**
- * Get the number of images in the disk cache
- * 获得磁盘缓存的图像数
+ * Get the number of images in the disk cache, read from the disk cache index
+ * 获得磁盘缓存的图像数，直接从磁盘缓存的索引读取
  */
 - (NSUInteger)getDiskCount;
 
@@ -297,8 +359,8 @@ typedef void(^SDWebImageCalculateSizeBlock)(NSUInteger fileCount, NSUInteger tot
 - (nullable NSString *)cachePathForKey:(nullable NSString *)key inPath:(nonnull NSString *)path;
 
 /**
- *  Get the default cache path for a certain key
- *  通过一个确定的key获得默认的缓存地址
+ *  Get the default cache path for a certain key, sharded into two directory levels by the file name
+ *  通过一个确定的key获得默认的缓存地址，按文件名分在两级子目录里
  *  @param key the key (can be obtained from url using cacheKeyForURL)
  *  能够使用cacheKeyForURL从中获得的url
  *  @return the default cache path
@@ -10,57 +10,74 @@
 #import "SDWebImageDecoder.h"
 #import "UIImage+MultiFormat.h"
 #import <CommonCrypto/CommonDigest.h>
+#import <fcntl.h>
+#import <unistd.h>
+#import <sys/mman.h>
+#import <sys/stat.h>
+#import <stdatomic.h>
+#import <os/lock.h>
 #import "UIImage+GIF.h"
 #import "NSData+ImageContentType.h"
 #import "NSImage+WebCache.h"
-
-// See https://github.com/rs/SDWebImage/pull/1141 for discussion
-@interface AutoPurgeCache : NSCache
-@end
-
-@implementation AutoPurgeCache
-
-- (nonnull instancetype)init {
-    self = [super init];
-    if (self) {
-#if SD_UIKIT
-        [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(removeAllObjects) name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
-#endif
-    }
-    return self;
-}
-
-- (void)dealloc {
-#if SD_UIKIT
-    [[NSNotificationCenter defaultCenter] removeObserver:self name:UIApplicationDidReceiveMemoryWarningNotification object:nil];
-#endif
-}
-
-@end
+#import "SDMemoryCache.h"
+#import "SDDiskCacheIndex.h"
+#import "SDDiskBlobStore.h"
 
 // C语言函数
 // FOUNDATION_STATIC_INLINE表示static __inline__，属于runtime范畴
+// 成本是解码后位图占用的字节数，动图按所有帧计算
 FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 #if SD_MAC
-    return image.size.height * image.size.width;
+    return image.size.height * image.size.width * 4;
 #elif SD_UIKIT || SD_WATCH
-    return image.size.height * image.size.width * image.scale * image.scale;
+    CGImageRef imageRef = image.CGImage;
+    NSUInteger frameCost = imageRef ? CGImageGetBytesPerRow(imageRef) * CGImageGetHeight(imageRef)
+                                    : image.size.height * image.size.width * image.scale * image.scale * 4;
+    return frameCost * MAX(image.images.count, 1);
 #endif
 }
 
+// 小于这个大小的文件直接读，映射一页再加上mmap/munmap的开销比复制还大
+static const NSUInteger kSDMinimumMappedFileSize = 16 * 1024;
+// 所有缓存当前映射的总字节数，超过config.maxMappedBytes时改为复制读取
+static _Atomic(NSUInteger) SDMappedBytes = 0;
+// 写入和删除按文件名分到这么多个串行队列，同一个文件的操作保持顺序
+static const NSUInteger kSDWriteQueueCount = 8;
+// 清理时每次删除这么多个文件，删完一批再排下一批，中间的写入不用等整个清理结束
+static const NSUInteger kSDCleanupBatchSize = 128;
+// 标记这个缓存的写队列和清理队列，值是缓存对象本身
+static void *SDImageCacheQueueKey = &SDImageCacheQueueKey;
+
 @interface SDImageCache ()
 
 #pragma mark - Properties
-@property (strong, nonatomic, nonnull) NSCache *memCache;
+@property (strong, nonatomic, nonnull) SDMemoryCache<NSString *, UIImage *> *memCache;
 @property (strong, nonatomic, nonnull) NSString *diskCachePath;
 @property (strong, nonatomic, nullable) NSMutableArray<NSString *> *customPaths;
+// 读取的并发队列
 @property (SDDispatchQueueSetterSementics, nonatomic, nullable) dispatch_queue_t ioQueue;
+// 低优先级的清理队列，启动后把旧版本的文件迁移到分片目录也在这里
+@property (SDDispatchQueueSetterSementics, nonatomic, nullable) dispatch_queue_t cleanupQueue;
 
 @end
 
 
 @implementation SDImageCache {
     NSFileManager *_fileManager;
+    // 旧版本平铺在diskCachePath下的文件是否已经移到分片目录，移完之前查找时还要看一下旧路径
+    // 在清理队列中写，在读队列和写队列中读
+    _Atomic(BOOL) _legacyLayoutMigrated;
+    // 磁盘缓存的索引，大小、个数和清理都从它得到，不再遍历目录
+    SDDiskCacheIndex *_diskIndex;
+    // 小图片的段文件存储，文件名和单独存放时相同
+    SDDiskBlobStore *_blobStore;
+    // 按文件名hash分片的写队列
+    NSArray<dispatch_queue_t> *_writeQueues;
+    // 启动时加载索引完成后离开
+    dispatch_group_t _setupGroup;
+    // 每个key在内存缓存中按不同大小缩小的图片的key(key#WxH)，删除和更新原图时一起去掉
+    NSMutableDictionary<NSString *, NSMutableSet<NSString *> *> *_memoryVariantKeys;
+    os_unfair_lock _memoryVariantLock;
 }
 
 #pragma mark - Singleton, init, dealloc
@@ -92,17 +109,27 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
         // 最终可能获得的diskCachePath可能为
         NSString *fullNamespace = [@"com.hackemist.SDWebImageCache." stringByAppendingString:ns];
         
-        // Create IO serial queue
-        // 创建名为com.hackemist.SDWebImageCache的IO的串行队列
-        _ioQueue = dispatch_queue_create("com.hackemist.SDWebImageCache", DISPATCH_QUEUE_SERIAL);
+        // Create IO queues
+        // 读取在名为com.hackemist.SDWebImageCache的并发队列中执行，多个读取可以同时进行
+        // 写入和删除按文件名分到几个串行队列，清理在低优先级的串行队列中分批执行，都不会挡住读取
+        _ioQueue = dispatch_queue_create("com.hackemist.SDWebImageCache", DISPATCH_QUEUE_CONCURRENT);
+        NSMutableArray<dispatch_queue_t> *writeQueues = [NSMutableArray arrayWithCapacity:kSDWriteQueueCount];
+        for (NSUInteger i = 0; i < kSDWriteQueueCount; i++) {
+            dispatch_queue_t writeQueue = dispatch_queue_create("com.hackemist.SDWebImageCache.write", DISPATCH_QUEUE_SERIAL);
+            dispatch_queue_set_specific(writeQueue, SDImageCacheQueueKey, (__bridge void *)self, NULL);
+            [writeQueues addObject:writeQueue];
+        }
+        _writeQueues = writeQueues;
+        _cleanupQueue = dispatch_queue_create("com.hackemist.SDWebImageCache.cleanup", dispatch_queue_attr_make_with_qos_class(DISPATCH_QUEUE_SERIAL, QOS_CLASS_BACKGROUND, 0));
+        dispatch_queue_set_specific(_cleanupQueue, SDImageCacheQueueKey, (__bridge void *)self, NULL);
         
-        // 注意此处不是直接使用[[NSCache alloc] init]进行初始化的，而是使用了一个AutoPurgeCache
-        // AutoPurgeCache和NSCache不同之处在于，如果AutoPurgeCache收到一个内存警告，就会自动释放内存，调用NSCache的removeAllObjects
         _config = [[SDImageCacheConfig alloc] init];
         
         // Init the memory cache
-        _memCache = [[AutoPurgeCache alloc] init];
-        _memCache.name = fullNamespace;
+        // 内存缓存使用分片的LRU缓存，淘汰顺序确定，按config决定是否使用频率准入；收到内存警告时由下面注册的clearMemory清空
+        _memCache = [[SDMemoryCache alloc] initWithConfig:_config];
+        _memoryVariantKeys = [NSMutableDictionary dictionary];
+        _memoryVariantLock = OS_UNFAIR_LOCK_INIT;
 
         // Init the disk cache
         // 初始化disk cache，一般情况下directory，除非你把Caches删除了
@@ -114,8 +141,37 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
             _diskCachePath = path;
         }
 
-        dispatch_sync(_ioQueue, ^{
-            _fileManager = [NSFileManager new];
+        _fileManager = [NSFileManager new];
+        _diskIndex = [[SDDiskCacheIndex alloc] initWithDirectory:_diskCachePath];
+        _blobStore = [[SDDiskBlobStore alloc] initWithDirectory:[_diskCachePath stringByAppendingPathComponent:@".blobs"]];
+        // 扫描段文件，再加载索引，没有索引(第一次运行或者索引损坏)时遍历一次目录重建
+        // 段文件在隐藏目录中，重建时不会遍历到，单独加进索引；重建会遍历到还没迁移的旧文件，索引只看文件名，迁移后不用更新
+        // 在读队列中以barrier执行，完成之前写队列和清理队列先挂起，之后排进去的读写看到的都是加载好的索引
+        // getSize会在调用线程等待它，不能放到低优先级的清理队列
+        // 旧版本的文件可能有很多，迁移放到之后的清理队列，迁移完之前查找时看一下旧路径
+        _setupGroup = dispatch_group_create();
+        dispatch_group_enter(_setupGroup);
+        for (dispatch_queue_t writeQueue in _writeQueues) {
+            dispatch_suspend(writeQueue);
+        }
+        dispatch_suspend(_cleanupQueue);
+        dispatch_barrier_async(_ioQueue, ^{
+            [_blobStore open];
+            if (![_diskIndex load]) {
+                [_diskIndex rebuild];
+                [[_blobStore allBlobSizes] enumerateKeysAndObjectsUsingBlock:^(NSString *fileName, NSNumber *size, BOOL *stop) {
+                    [_diskIndex recordStoreForFileName:fileName size:size.unsignedIntegerValue];
+                }];
+                [_diskIndex save];
+            }
+            dispatch_async(_cleanupQueue, ^{
+                [self migrateLegacyLayout];
+            });
+            for (dispatch_queue_t writeQueue in _writeQueues) {
+                dispatch_resume(writeQueue);
+            }
+            dispatch_resume(_cleanupQueue);
+            dispatch_group_leave(_setupGroup);
         });
 
 #if SD_UIKIT
@@ -145,20 +201,22 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 - (void)dealloc {
     [[NSNotificationCenter defaultCenter] removeObserver:self];
     SDDispatchQueueRelease(_ioQueue);
+    SDDispatchQueueRelease(_cleanupQueue);
 }
 
-// 先检查当前队列是否为io队列
+// 先检查当前队列是否为这个缓存的写队列或者清理队列
 - (void)checkIfQueueIsIOQueue {
-    // 获取当前队列的队列名称
-    const char *currentQueueLabel = dispatch_queue_get_label(DISPATCH_CURRENT_QUEUE_LABEL);
-    // 获取io队列的名称
-    const char *ioQueueLabel = dispatch_queue_get_label(self.ioQueue);
-    // 比较这两个队列名，不一样的话打印
-    if (strcmp(currentQueueLabel, ioQueueLabel) != 0) {
+    // 写队列和清理队列都用SDImageCacheQueueKey标记了缓存对象本身
+    if (dispatch_get_specific(SDImageCacheQueueKey) != (__bridge void *)self) {
         NSLog(@"This method should be called from the ioQueue");
     }
 }
 
+// 同一个文件的写入和删除都在同一个串行队列中
+- (nonnull dispatch_queue_t)writeQueueForFileName:(nonnull NSString *)fileName {
+    return _writeQueues[fileName.hash % _writeQueues.count];
+}
+
 #pragma mark - Cache paths
 // 添加只读路径
 - (void)addReadOnlyCachePath:(nonnull NSString *)path {
@@ -178,10 +236,60 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 }
 
 // 根据对应的url来生成缓存文件名1
+// 默认目录按文件名(md5)分成两级，diskCachePath/a/bc/abc...，十几万张图时单个目录里的文件也不会太多
 - (nullable NSString *)defaultCachePathForKey:(nullable NSString *)key {
+    return [self shardedCachePathForFileName:[self cachedFileNameForKey:key] inPath:self.diskCachePath];
+}
+
+// 第一级取文件名第1个字符，第二级取第2、3个字符，一共16 * 256个目录
+- (nonnull NSString *)shardedCachePathForFileName:(nonnull NSString *)filename inPath:(nonnull NSString *)path {
+    return [NSString pathWithComponents:@[path, [filename substringWithRange:NSMakeRange(0, 1)], [filename substringWithRange:NSMakeRange(1, 2)], filename]];
+}
+
+// 旧版本平铺的路径，还没迁移完时返回nil以外的值
+- (nullable NSString *)legacyCachePathForKey:(nullable NSString *)key {
+    if (atomic_load(&_legacyLayoutMigrated)) {
+        return nil;
+    }
     return [self cachePathForKey:key inPath:self.diskCachePath];
 }
 
+// 把diskCachePath第一层md5命名的文件移到分片目录，只在启动后的清理队列中调用
+// 和清理一样分批，每个文件在它的写队列中移动，不会和同一个文件的写入、删除交错
+- (void)migrateLegacyLayout {
+    NSMutableArray<NSString *> *fileNames = [NSMutableArray array];
+    for (NSString *fileName in [_fileManager contentsOfDirectoryAtPath:self.diskCachePath error:nil]) {
+        // 分片目录本身只有1个字符，md5文件名至少32个字符
+        if (fileName.length >= 32) {
+            [fileNames addObject:fileName];
+        }
+    }
+    for (NSUInteger start = 0; start < fileNames.count; start += kSDCleanupBatchSize) {
+        NSArray<NSString *> *batch = [fileNames subarrayWithRange:NSMakeRange(start, MIN(kSDCleanupBatchSize, fileNames.count - start))];
+        dispatch_group_t group = dispatch_group_create();
+        for (NSString *fileName in batch) {
+            dispatch_group_async(group, [self writeQueueForFileName:fileName], ^{
+                [self migrateLegacyFileWithName:fileName];
+            });
+        }
+        dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    }
+    atomic_store(&_legacyLayoutMigrated, YES);
+}
+
+// 在文件的写队列中调用
+- (void)migrateLegacyFileWithName:(nonnull NSString *)fileName {
+    NSString *fromPath = [self.diskCachePath stringByAppendingPathComponent:fileName];
+    NSString *toPath = [self shardedCachePathForFileName:fileName inPath:self.diskCachePath];
+    if (![_fileManager moveItemAtPath:fromPath toPath:toPath error:nil]) {
+        [_fileManager createDirectoryAtPath:toPath.stringByDeletingLastPathComponent withIntermediateDirectories:YES attributes:nil error:NULL];
+        if (![_fileManager moveItemAtPath:fromPath toPath:toPath error:nil]) {
+            // 分片目录里已经有新版本，或者旧文件已经被删除，旧的不要了
+            [_fileManager removeItemAtPath:fromPath error:nil];
+        }
+    }
+}
+
 // 根据对应的url来生成缓存文件名3
 - (nullable NSString *)cachedFileNameForKey:(nullable NSString *)key {
     const char *str = key.UTF8String;
@@ -233,6 +341,16 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
             forKey:(nullable NSString *)key
             toDisk:(BOOL)toDisk
         completion:(nullable SDWebImageNoParamsBlock)completionBlock {
+    [self storeImage:image imageData:imageData forKey:key targetPixelSize:CGSizeZero toDisk:toDisk completion:completionBlock];
+}
+
+// 内存中按(key, 大小)存缩小后的图片，磁盘上按key存原始数据
+- (void)storeImage:(nullable UIImage *)image
+         imageData:(nullable NSData *)imageData
+            forKey:(nullable NSString *)key
+   targetPixelSize:(CGSize)targetPixelSize
+            toDisk:(BOOL)toDisk
+        completion:(nullable SDWebImageNoParamsBlock)completionBlock {
     if (!image || !key) {
         if (completionBlock) {
             completionBlock();
@@ -242,12 +360,23 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     // if memory cache is enabled
     // 如果内存缓存可用
     if (self.config.shouldCacheImagesInMemory) {
+        // 图片换了，之前按其他大小缩小的图片都已经过期
+        [self removeMemoryVariantsForKey:key];
+        NSString *memoryCacheKey = [self memoryCacheKeyForKey:key targetPixelSize:targetPixelSize];
+        if (imageData && ![memoryCacheKey isEqualToString:key]) {
+            // 磁盘上的原始数据也换了，内存中的原尺寸图片同样过期
+            [self.memCache removeObjectForKey:key];
+        }
         NSUInteger cost = SDCacheCostForImage(image);
-        [self.memCache setObject:image forKey:key cost:cost];
+        [self setMemoryImage:image forMemoryCacheKey:memoryCacheKey key:key cost:cost];
+    }
+    // 缩小后的图片没有原始数据时不存磁盘，否则原尺寸的查询会读到小图
+    if (!imageData && targetPixelSize.width > 0 && targetPixelSize.height > 0) {
+        toDisk = NO;
     }
     // 存到磁盘
     if (toDisk) {
-        dispatch_async(self.ioQueue, ^{
+        dispatch_async([self writeQueueForFileName:[self cachedFileNameForKey:key]], ^{
             NSData *data = imageData;
             
             if (!data && image) {
@@ -287,12 +416,30 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     // 上面那个生成的文件路径只是一个文件目录，就跟/cache/images/img1.png和cache/images/的区别一样
     // defaultCachePathForKey后面会详解
     NSString *cachePathForKey = [self defaultCachePathForKey:key];
+    NSString *fileName = cachePathForKey.lastPathComponent;
+    // 小图片追加到段文件，不再单独创建文件；同名的旧文件删掉，读的时候不会读到旧版本
+    if (self.config.shouldUseBlobStore && imageData.length <= self.config.maxBlobSize) {
+        if ([_blobStore storeData:imageData forName:fileName]) {
+            [_fileManager removeItemAtPath:cachePathForKey error:nil];
+            [_diskIndex recordStoreForFileName:fileName size:imageData.length];
+            return;
+        }
+    }
     // transform to NSUrl
     // 这个url可不是网络端的url，而是file在系统路径下的url
     // 比如/foo/bar/baz --------> file:///foo/bar/baz
     NSURL *fileURL = [NSURL fileURLWithPath:cachePathForKey];
     // 根据存储的路径(cachePathForKey)和存储的数据(data)将其存放到iOS的文件系统
-    [_fileManager createFileAtPath:cachePathForKey contents:imageData attributes:nil];
+    // 分片目录第一次用到时还不存在，创建后再写一次
+    BOOL stored = [_fileManager createFileAtPath:cachePathForKey contents:imageData attributes:nil];
+    if (!stored) {
+        [_fileManager createDirectoryAtPath:cachePathForKey.stringByDeletingLastPathComponent withIntermediateDirectories:YES attributes:nil error:NULL];
+        stored = [_fileManager createFileAtPath:cachePathForKey contents:imageData attributes:nil];
+    }
+    if (stored) {
+        [_blobStore removeDataForNames:@[fileName]];
+        [_diskIndex recordStoreForFileName:fileName size:imageData.length];
+    }
     
     // disable iCloud backup
     // 如果不使用iCloud进行备份，就使用NSURLIsExcludedFromBackupKey
@@ -306,7 +453,8 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 - (void)diskImageExistsWithKey:(nullable NSString *)key completion:(nullable SDWebImageCheckCacheCompletionBlock)completionBlock {
     dispatch_async(_ioQueue, ^{
         
-        BOOL exists = [_fileManager fileExistsAtPath:[self defaultCachePathForKey:key]];
+        NSString *defaultPath = [self defaultCachePathForKey:key];
+        BOOL exists = [_blobStore containsDataForName:defaultPath.lastPathComponent] || [_fileManager fileExistsAtPath:defaultPath];
 
         // fallback because of https://github.com/rs/SDWebImage/pull/976 that added the extension to the disk file name
         // checking the key with and without the extension
@@ -314,6 +462,11 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
             exists = [_fileManager fileExistsAtPath:[self defaultCachePathForKey:key].stringByDeletingPathExtension];
         }
 
+        NSString *legacyPath = [self legacyCachePathForKey:key];
+        if (!exists && legacyPath) {
+            exists = [_fileManager fileExistsAtPath:legacyPath] || [_fileManager fileExistsAtPath:legacyPath.stringByDeletingPathExtension];
+        }
+
         if (completionBlock) {
             dispatch_async(dispatch_get_main_queue(), ^{
                 completionBlock(exists);
@@ -349,27 +502,93 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     return image;
 }
 
+// 读取缓存文件：大文件映射到内存，交给解码器的NSData不复制文件内容，释放时munmap
+// 缓存自己写的文件只会被整体替换或者删除，不会被截断，映射之后访问不会出错
+// customPaths中的只读文件可能被别人原地截断，映射后访问会SIGBUS，只复制读取
+- (nullable NSData *)dataWithContentsOfFile:(nonnull NSString *)path {
+    BOOL mappable = [path hasPrefix:[self.diskCachePath stringByAppendingString:@"/"]];
+    int fd = open(path.fileSystemRepresentation, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nil;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || !S_ISREG(fileStat.st_mode)) {
+        close(fd);
+        return nil;
+    }
+    NSUInteger length = (NSUInteger)fileStat.st_size;
+    if (mappable && length >= kSDMinimumMappedFileSize && [self reserveMappedBytes:length]) {
+        void *bytes = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (bytes != MAP_FAILED) {
+            close(fd);
+            // 解码器从头到尾读一遍，提前预读
+            madvise(bytes, length, MADV_SEQUENTIAL);
+            madvise(bytes, length, MADV_WILLNEED);
+            return [[NSData alloc] initWithBytesNoCopy:bytes length:length deallocator:^(void *mappedBytes, NSUInteger mappedLength) {
+                munmap(mappedBytes, mappedLength);
+                atomic_fetch_sub_explicit(&SDMappedBytes, mappedLength, memory_order_relaxed);
+            }];
+        }
+        atomic_fetch_sub_explicit(&SDMappedBytes, length, memory_order_relaxed);
+    }
+    NSMutableData *data = [NSMutableData dataWithLength:length];
+    NSUInteger offset = 0;
+    while (offset < length) {
+        ssize_t count = pread(fd, (uint8_t *)data.mutableBytes + offset, length - offset, (off_t)offset);
+        if (count <= 0) {
+            break;
+        }
+        offset += count;
+    }
+    close(fd);
+    return offset == length ? data : nil;
+}
+
+// 映射的总字节数不超过config.maxMappedBytes，0表示不映射
+- (BOOL)reserveMappedBytes:(NSUInteger)length {
+    NSUInteger maxMappedBytes = self.config.maxMappedBytes;
+    NSUInteger current = atomic_load_explicit(&SDMappedBytes, memory_order_relaxed);
+    do {
+        if (current + length > maxMappedBytes) {
+            return NO;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&SDMappedBytes, &current, current + length, memory_order_relaxed, memory_order_relaxed));
+    return YES;
+}
+
 // 根据对应的key来获取到对应的图像磁盘数据
 - (nullable NSData *)diskImageDataBySearchingAllPathsForKey:(nullable NSString *)key {
     NSString *defaultPath = [self defaultCachePathForKey:key];
-    NSData *data = [NSData dataWithContentsOfFile:defaultPath];
+    // 先查段文件，只是一次字典查找，找不到时再读单独的文件
+    NSData *data = [_blobStore dataForName:defaultPath.lastPathComponent] ?: [self dataWithContentsOfFile:defaultPath];
     if (data) {
+        // 记录访问时间，超过maxCacheSize时先清理最久没有用过的文件
+        [_diskIndex recordAccessForFileName:defaultPath.lastPathComponent];
         return data;
     }
 
     // fallback because of https://github.com/rs/SDWebImage/pull/976 that added the extension to the disk file name
     // checking the key with and without the extension
     // 无论是对应key返回的磁盘文件有没有拓展名，我们这里都再次检查一下
-    data = [NSData dataWithContentsOfFile:defaultPath.stringByDeletingPathExtension];
+    data = [self dataWithContentsOfFile:defaultPath.stringByDeletingPathExtension];
     if (data) {
         return data;
     }
+
+    // 还没迁移到分片目录的旧文件
+    NSString *legacyPath = [self legacyCachePathForKey:key];
+    if (legacyPath) {
+        data = [self dataWithContentsOfFile:legacyPath] ?: [self dataWithContentsOfFile:legacyPath.stringByDeletingPathExtension];
+        if (data) {
+            return data;
+        }
+    }
     
     // LJMARK:这里是对应的一些只读文件的操作
     NSArray<NSString *> *customPaths = [self.customPaths copy];
     for (NSString *path in customPaths) {
         NSString *filePath = [self cachePathForKey:key inPath:path];
-        NSData *imageData = [NSData dataWithContentsOfFile:filePath];
+        NSData *imageData = [self dataWithContentsOfFile:filePath];
         if (imageData) {
             return imageData;
         }
@@ -377,7 +596,7 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
         // fallback because of https://github.com/rs/SDWebImage/pull/976 that added the extension to the disk file name
         // checking the key with and without the extension
         // 无论是对应key返回的磁盘文件有没有拓展名，我们这里都再次检查一下
-        imageData = [NSData dataWithContentsOfFile:filePath.stringByDeletingPathExtension];
+        imageData = [self dataWithContentsOfFile:filePath.stringByDeletingPathExtension];
         if (imageData) {
             return imageData;
         }
@@ -386,8 +605,55 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     return nil;
 }
 
+// 缩小后的图片存进内存缓存时记下它属于哪个key
+- (void)setMemoryImage:(nonnull UIImage *)image forMemoryCacheKey:(nonnull NSString *)memoryCacheKey key:(nonnull NSString *)key cost:(NSUInteger)cost {
+    [self.memCache setObject:image forKey:memoryCacheKey cost:cost];
+    if ([memoryCacheKey isEqualToString:key]) {
+        return;
+    }
+    os_unfair_lock_lock(&_memoryVariantLock);
+    NSMutableSet<NSString *> *variantKeys = _memoryVariantKeys[key];
+    if (!variantKeys) {
+        variantKeys = [NSMutableSet set];
+        _memoryVariantKeys[key] = variantKeys;
+    }
+    [variantKeys addObject:memoryCacheKey];
+    os_unfair_lock_unlock(&_memoryVariantLock);
+}
+
+// 从内存缓存中去掉这个key所有缩小后的图片，已经被淘汰的key再删一次也没有影响
+- (void)removeMemoryVariantsForKey:(nonnull NSString *)key {
+    os_unfair_lock_lock(&_memoryVariantLock);
+    NSSet<NSString *> *variantKeys = _memoryVariantKeys[key];
+    [_memoryVariantKeys removeObjectForKey:key];
+    os_unfair_lock_unlock(&_memoryVariantLock);
+    for (NSString *variantKey in variantKeys) {
+        [self.memCache removeObjectForKey:variantKey];
+    }
+}
+
+- (nullable NSString *)memoryCacheKeyForKey:(nullable NSString *)key targetPixelSize:(CGSize)targetPixelSize {
+    if (!key || targetPixelSize.width <= 0 || targetPixelSize.height <= 0) {
+        return key;
+    }
+    return [NSString stringWithFormat:@"%@#%.0fx%.0f", key, targetPixelSize.width, targetPixelSize.height];
+}
+
 - (nullable UIImage *)diskImageForKey:(nullable NSString *)key {
-    NSData *data = [self diskImageDataBySearchingAllPathsForKey:key];
+    return [self diskImageForKey:key data:[self diskImageDataBySearchingAllPathsForKey:key]];
+}
+
+// 用已经读出来的数据解码，不再读一遍文件
+- (nullable UIImage *)diskImageForKey:(nullable NSString *)key data:(nullable NSData *)data {
+    return [self diskImageForKey:key data:data targetPixelSize:CGSizeZero];
+}
+
+// 有目标大小时直接解码出小图，缩小不了的按原尺寸解码
+- (nullable UIImage *)diskImageForKey:(nullable NSString *)key data:(nullable NSData *)data targetPixelSize:(CGSize)targetPixelSize {
+    UIImage *downsampledImage = [UIImage decodedImageWithData:data targetPixelSize:targetPixelSize];
+    if (downsampledImage) {
+        return [self scaledImageForKey:key image:downsampledImage];
+    }
     if (data) {
         UIImage *image = [UIImage sd_imageWithData:data];
         image = [self scaledImageForKey:key image:image];
@@ -406,6 +672,10 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 }
 
 - (nullable NSOperation *)queryCacheOperationForKey:(nullable NSString *)key done:(nullable SDCacheQueryCompletedBlock)doneBlock {
+    return [self queryCacheOperationForKey:key targetPixelSize:CGSizeZero done:doneBlock];
+}
+
+- (nullable NSOperation *)queryCacheOperationForKey:(nullable NSString *)key targetPixelSize:(CGSize)targetPixelSize done:(nullable SDCacheQueryCompletedBlock)doneBlock {
     // 如果对应的key为nil，直接执行回调函数
     // 如果key为nil，说明cache中没有该image。所以doneBlock中传入SDImageCacheTypeNone，表示cache中没有图片，要从网络重新获取。
     if (!key) {
@@ -416,8 +686,9 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     }
 
     // First check the in-memory cache...
-    // 检查内存中key对应的缓存，返回图像
-    UIImage *image = [self imageFromMemoryCacheForKey:key];
+    // 检查内存中key对应的缓存，返回图像；有目标大小时查这个大小的图片
+    NSString *memoryCacheKey = [self memoryCacheKeyForKey:key targetPixelSize:targetPixelSize];
+    UIImage *image = [self imageFromMemoryCacheForKey:memoryCacheKey];
     if (image) {
         NSData *diskData = nil;
         if ([image isGIF]) {
@@ -443,10 +714,10 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
         @autoreleasepool {
             // 搜索磁盘缓存，将磁盘缓存加入内存缓存
             NSData *diskData = [self diskImageDataBySearchingAllPathsForKey:key];
-            UIImage *diskImage = [self diskImageForKey:key];
+            UIImage *diskImage = [self diskImageForKey:key data:diskData targetPixelSize:targetPixelSize];
             if (diskImage && self.config.shouldCacheImagesInMemory) {
                 NSUInteger cost = SDCacheCostForImage(diskImage);
-                [self.memCache setObject:diskImage forKey:key cost:cost];
+                [self setMemoryImage:diskImage forMemoryCacheKey:memoryCacheKey key:key cost:cost];
             }
             // 在主线程执行对应的回调，这里的缓存类型是磁盘缓存
             if (doneBlock) {
@@ -460,6 +731,96 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     return operation;
 }
 
+- (nullable NSOperation *)queryCacheOperationsForKeys:(nonnull NSArray<NSString *> *)keys done:(nullable SDCacheBatchQueryCompletedBlock)doneBlock {
+    // 先在一次遍历中查完内存缓存
+    NSMutableDictionary<NSString *, UIImage *> *images = [NSMutableDictionary dictionaryWithCapacity:keys.count];
+    NSMutableDictionary<NSString *, NSNumber *> *cacheTypes = [NSMutableDictionary dictionaryWithCapacity:keys.count];
+    NSMutableArray<NSString *> *missingKeys = [NSMutableArray array];
+    for (NSString *key in keys) {
+        if (cacheTypes[key]) {
+            continue;
+        }
+        UIImage *image = [self imageFromMemoryCacheForKey:key];
+        if (image) {
+            images[key] = image;
+            cacheTypes[key] = @(SDImageCacheTypeMemory);
+        } else {
+            cacheTypes[key] = @(SDImageCacheTypeNone);
+            [missingKeys addObject:key];
+        }
+    }
+    if (missingKeys.count == 0) {
+        if (doneBlock) {
+            doneBlock(images, cacheTypes);
+        }
+        return nil;
+    }
+
+    // 内存中没有的作为一批，在IO队列中只排一次
+    NSOperation *operation = [NSOperation new];
+    dispatch_async(self.ioQueue, ^{
+        if (operation.isCancelled) {
+            return;
+        }
+
+        @autoreleasepool {
+            // 按磁盘上的位置读取：段文件中的按段和偏移顺序读，其余的按分片目录的路径顺序读
+            NSMutableDictionary<NSString *, NSString *> *keysByFileName = [NSMutableDictionary dictionaryWithCapacity:missingKeys.count];
+            for (NSString *key in missingKeys) {
+                keysByFileName[[self cachedFileNameForKey:key]] = key;
+            }
+            NSArray<NSString *> *blobFileNames = [_blobStore namesSortedByLocation:keysByFileName.allKeys];
+            NSMutableArray<NSString *> *orderedKeys = [NSMutableArray arrayWithCapacity:missingKeys.count];
+            for (NSString *fileName in blobFileNames) {
+                [orderedKeys addObject:keysByFileName[fileName]];
+            }
+            [keysByFileName removeObjectsForKeys:blobFileNames];
+            // 分片目录取自文件名的前三个字符，按文件名排序就是按路径排序
+            for (NSString *fileName in [keysByFileName.allKeys sortedArrayUsingSelector:@selector(compare:)]) {
+                [orderedKeys addObject:keysByFileName[fileName]];
+            }
+
+            NSMutableArray<NSString *> *foundKeys = [NSMutableArray arrayWithCapacity:orderedKeys.count];
+            NSMutableArray<NSData *> *foundData = [NSMutableArray arrayWithCapacity:orderedKeys.count];
+            for (NSString *key in orderedKeys) {
+                NSData *diskData = [self diskImageDataBySearchingAllPathsForKey:key];
+                if (diskData) {
+                    [foundKeys addObject:key];
+                    [foundData addObject:diskData];
+                }
+            }
+
+            // 读完之后并行解码
+            dispatch_apply(foundKeys.count, dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0), ^(size_t i) {
+                @autoreleasepool {
+                    NSString *key = foundKeys[i];
+                    UIImage *diskImage = [self diskImageForKey:key data:foundData[i]];
+                    if (!diskImage) {
+                        return;
+                    }
+                    if (self.config.shouldCacheImagesInMemory) {
+                        [self.memCache setObject:diskImage forKey:key cost:SDCacheCostForImage(diskImage)];
+                    }
+                    @synchronized (images) {
+                        images[key] = diskImage;
+                        cacheTypes[key] = @(SDImageCacheTypeDisk);
+                    }
+                }
+            });
+
+            if (doneBlock) {
+                dispatch_async(dispatch_get_main_queue(), ^{
+                    if (!operation.isCancelled) {
+                        doneBlock(images, cacheTypes);
+                    }
+                });
+            }
+        }
+    });
+
+    return operation;
+}
+
 #pragma mark - Remove Ops
 
 - (void)removeImageForKey:(nullable NSString *)key withCompletion:(nullable SDWebImageNoParamsBlock)completion {
@@ -472,16 +833,25 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     }
     // shouldCacheImagesInMemory为YES表示该图片会缓存到了内存
     // 既然缓存到了内存，就要先将内存缓存中的image移除
-    // 使用的是NSCache的removeObjectForKey:
+    // 使用的是SDMemoryCache的removeObjectForKey:
     if (self.config.shouldCacheImagesInMemory) {
         [self.memCache removeObjectForKey:key];
+        [self removeMemoryVariantsForKey:key];
     }
     // 如果要删除磁盘缓存中的image
     if (fromDisk) {
-        // 有关io的部分，都要放在ioQueue中
-        dispatch_async(self.ioQueue, ^{
+        // 删除和同一个文件的写入放在同一个写队列中，保持先后顺序
+        dispatch_async([self writeQueueForFileName:[self cachedFileNameForKey:key]], ^{
             // 磁盘缓存移除使用的是NSFileManager的removeItemAtPath:error
-            [_fileManager removeItemAtPath:[self defaultCachePathForKey:key] error:nil];
+            NSString *defaultPath = [self defaultCachePathForKey:key];
+            if ([_blobStore removeDataForNames:@[defaultPath.lastPathComponent]].count == 0) {
+                [_fileManager removeItemAtPath:defaultPath error:nil];
+            }
+            [_diskIndex recordRemovalForFileName:defaultPath.lastPathComponent];
+            NSString *legacyPath = [self legacyCachePathForKey:key];
+            if (legacyPath) {
+                [_fileManager removeItemAtPath:legacyPath error:nil];
+            }
             
             if (completion) {
                 // 如果用户实现了completion了，就在主线程调用completion()
@@ -515,20 +885,51 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     self.memCache.countLimit = maxCountLimit;
 }
 
+- (double)memoryCacheHitRatio {
+    return self.memCache.hitRatio;
+}
+
+- (void)resetMemoryCacheStatistics {
+    [self.memCache resetStatistics];
+}
+
 #pragma mark - Cache clean Ops
 
 - (void)clearMemory {
     [self.memCache removeAllObjects];
+    os_unfair_lock_lock(&_memoryVariantLock);
+    [_memoryVariantKeys removeAllObjects];
+    os_unfair_lock_unlock(&_memoryVariantLock);
+}
+
+// 在清理队列中调用：每个写队列执行完已经排着的写入后挂起自己，block执行期间不会有写入，之后再恢复
+- (void)performBarrierOnWriteQueues:(nonnull dispatch_block_t)block {
+    dispatch_group_t group = dispatch_group_create();
+    for (dispatch_queue_t writeQueue in _writeQueues) {
+        dispatch_group_async(group, writeQueue, ^{
+            dispatch_suspend(writeQueue);
+        });
+    }
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    block();
+    for (dispatch_queue_t writeQueue in _writeQueues) {
+        dispatch_resume(writeQueue);
+    }
 }
 
 - (void)clearDiskOnCompletion:(nullable SDWebImageNoParamsBlock)completion {
-    dispatch_async(self.ioQueue, ^{
+    dispatch_async(self.cleanupQueue, ^{
         // 先将存储在diskCachePath中缓存全部移除，然后新建一个空的diskCachePath
-        [_fileManager removeItemAtPath:self.diskCachePath error:nil];
-        [_fileManager createDirectoryAtPath:self.diskCachePath
-                withIntermediateDirectories:YES
-                                 attributes:nil
-                                      error:NULL];
+        // 删除目录和正在进行的写入交错时，索引和磁盘上的文件会对不上
+        [self performBarrierOnWriteQueues:^{
+            [_diskIndex removeAll];
+            [_blobStore removeAll];
+            [_fileManager removeItemAtPath:self.diskCachePath error:nil];
+            [_fileManager createDirectoryAtPath:self.diskCachePath
+                    withIntermediateDirectories:YES
+                                     attributes:nil
+                                          error:NULL];
+        }];
 
         if (completion) {
             // 如果实现了completion，就在主线程中调用
@@ -542,104 +943,49 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 - (void)deleteOldFiles {
     [self deleteOldFilesWithCompletionBlock:nil];
 }
-// 实现了一个简单的缓存清除策略：清除修改时间最早的file
+// 实现了一个简单的缓存清除策略：先清除过期的file，还超过maxCacheSize时清除最久没有访问的file
+// 需要清除的文件直接从索引中选出，不再遍历目录、逐个读取文件属性
 - (void)deleteOldFilesWithCompletionBlock:(nullable SDWebImageNoParamsBlock)completionBlock {
-    dispatch_async(self.ioQueue, ^{
-        // 这两个变量主要是为了下面生成NSDirectoryEnumerator准备的
-        // 一个是记录遍历的文件目录，一个是记录遍历需要预先获取文件的哪些属性
-        NSURL *diskCacheURL = [NSURL fileURLWithPath:self.diskCachePath isDirectory:YES];
-        NSArray<NSString *> *resourceKeys = @[NSURLIsDirectoryKey, NSURLContentModificationDateKey, NSURLTotalFileAllocatedSizeKey];
-        
-        // 递归地遍历diskCachePath这个文件夹中的所有目录，此处不是直接使用diskCachePath，而是使用其生成的NSURL
-        // 此处使用includingPropertiesForKeys:resourceKeys，这样每个file的resourceKeys对应的属性也会在遍历时预先获取到
-        // NSDirectoryEnumerationSkipsHiddenFiles表示不遍历隐藏文件
-        // This enumerator prefetches useful properties for our cache files.
-        NSDirectoryEnumerator *fileEnumerator = [_fileManager enumeratorAtURL:diskCacheURL
-                                                   includingPropertiesForKeys:resourceKeys
-                                                                      options:NSDirectoryEnumerationSkipsHiddenFiles
-                                                                 errorHandler:NULL];
+    dispatch_async(self.cleanupQueue, ^{
         // 获取文件的过期时间，SDWebImage中默认是一个星期
-        // 不过这里虽然称*expirationDate为过期时间，但是实质上并不是这样。
-        // 其实是这样的，比如在2015/12/12/00:00:00最后一次修改文件，对应的过期时间应该是
-        // 2015/12/19/00:00:00，不过现在时间是2015/12/27/00:00:00，我先将当前时间减去1个星期，得到
-        // 2015/12/20/00:00:00，这个时间才是我们函数中的expirationDate。
-        // 用这个expirationDate和最后一次修改时间modificationDate比较看谁更晚就行
+        // 当前时间减去maxCacheAge，存入时间比它更早的文件就是过期的
         NSDate *expirationDate = [NSDate dateWithTimeIntervalSinceNow:-self.config.maxCacheAge];
-        NSMutableDictionary<NSURL *, NSDictionary<NSString *, id> *> *cacheFiles = [NSMutableDictionary dictionary];
-        NSUInteger currentCacheSize = 0;
-
-        // Enumerate all of the files in the cache directory.  This loop has two purposes:
-        //
-        //  1. Removing files that are older than the expiration date.
-        //  2. Storing file attributes for the size-based cleanup pass.
-        // 在缓存的目录开始遍历文件.  此次遍历有两个目的:
-        //
-        //  1. 移除过期的文件
-        //  2. 同时存储每个文件的属性（比如该file是否是文件夹、该file所需磁盘大小，修改时间）
-        NSMutableArray<NSURL *> *urlsToDelete = [[NSMutableArray alloc] init];
-        for (NSURL *fileURL in fileEnumerator) {
-            NSError *error;
-            NSDictionary<NSString *, id> *resourceValues = [fileURL resourceValuesForKeys:resourceKeys error:&error];
-
-            // Skip directories and errors.
-             // 当前扫描的是目录，就跳过
-            if (error || !resourceValues || [resourceValues[NSURLIsDirectoryKey] boolValue]) {
-                continue;
-            }
-
-            // Remove files that are older than the expiration date;
-            // 移除过期文件
-            // 这里判断过期的方式：对比文件的最后一次修改日期和expirationDate谁更晚，如果expirationDate更晚，就认为该文件已经过期，具体解释见上面
-            NSDate *modificationDate = resourceValues[NSURLContentModificationDateKey];
-            if ([[modificationDate laterDate:expirationDate] isEqualToDate:expirationDate]) {
-                [urlsToDelete addObject:fileURL];
-                continue;
-            }
-
-            // Store a reference to this file and account for its total size.
-            // 计算当前已经使用的cache大小，
-            // 并将对应file的属性存到cacheFiles中
-            NSNumber *totalAllocatedSize = resourceValues[NSURLTotalFileAllocatedSizeKey];
-            currentCacheSize += totalAllocatedSize.unsignedIntegerValue;
-            cacheFiles[fileURL] = resourceValues;
-        }
-        
-        for (NSURL *fileURL in urlsToDelete) {
-            // 根据需要移除文件的url来移除对应file
-            [_fileManager removeItemAtURL:fileURL error:nil];
-        }
 
         // If our remaining disk cache exceeds a configured maximum size, perform a second
-        // size-based cleanup pass.  We delete the oldest files first.
-        // 如果我们当前cache的大小已经超过了允许配置的缓存大小，那就删除已经缓存的文件。
-        // 删除策略就是，首先删除修改时间更早的缓存文件
-        if (self.config.maxCacheSize > 0 && currentCacheSize > self.config.maxCacheSize) {
-            // Target half of our maximum cache size for this cleanup pass.
-            // 直接将当前cache大小降到允许最大的cache大小的一半
-            const NSUInteger desiredCacheSize = self.config.maxCacheSize / 2;
-            // 根据文件修改时间来给所有缓存文件排序，按照修改时间越早越在前的规则排序
-            // Sort the remaining cache files by their last modification time (oldest first).
-            NSArray<NSURL *> *sortedFiles = [cacheFiles keysSortedByValueWithOptions:NSSortConcurrent
-                                                                     usingComparator:^NSComparisonResult(id obj1, id obj2) {
-                                                                         return [obj1[NSURLContentModificationDateKey] compare:obj2[NSURLContentModificationDateKey]];
-                                                                     }];
-            // 每次删除file后，就计算此时的cache的大小
-            // 如果此时的cache大小已经降到期望的大小了，就停止删除文件了
-            // Delete files until we fall below our desired cache size.
-            for (NSURL *fileURL in sortedFiles) {
-                if ([_fileManager removeItemAtURL:fileURL error:nil]) {
-                    // 根据resourceValues获取该文件所需磁盘空间大小
-                    NSDictionary<NSString *, id> *resourceValues = cacheFiles[fileURL];
-                    // 计算当前cache大小
-                    NSNumber *totalAllocatedSize = resourceValues[NSURLTotalFileAllocatedSizeKey];
-                    currentCacheSize -= totalAllocatedSize.unsignedIntegerValue;
-
-                    if (currentCacheSize < desiredCacheSize) {
-                        break;
-                    }
+        // size-based cleanup pass.  We delete the least recently used files first.
+        // 如果除去过期文件后cache的大小仍然超过了允许配置的缓存大小，就直接降到允许最大的cache大小的一半
+        NSUInteger maxCacheSize = self.config.maxCacheSize;
+        NSDate *selectionDate = [NSDate date];
+        NSArray<NSString *> *fileNames = [_diskIndex fileNamesToEvictWithExpirationDate:expirationDate
+                                                                                 maxSize:maxCacheSize
+                                                                              targetSize:maxCacheSize / 2];
+        // 分批删除，每批按文件名分到对应的写队列，和同一个文件的写入保持顺序
+        // 一批删完再排下一批，写队列中不会一下子堆满删除
+        for (NSUInteger start = 0; start < fileNames.count; start += kSDCleanupBatchSize) {
+            NSArray<NSString *> *batch = [fileNames subarrayWithRange:NSMakeRange(start, MIN(kSDCleanupBatchSize, fileNames.count - start))];
+            NSMutableDictionary<NSNumber *, NSMutableArray<NSString *> *> *batchesByQueue = [NSMutableDictionary dictionary];
+            for (NSString *fileName in batch) {
+                NSNumber *queueIndex = @(fileName.hash % _writeQueues.count);
+                if (!batchesByQueue[queueIndex]) {
+                    batchesByQueue[queueIndex] = [NSMutableArray array];
                 }
+                [batchesByQueue[queueIndex] addObject:fileName];
             }
+            dispatch_group_t group = dispatch_group_create();
+            [batchesByQueue enumerateKeysAndObjectsUsingBlock:^(NSNumber *queueIndex, NSMutableArray<NSString *> *queueFileNames, BOOL *stop) {
+                dispatch_group_async(group, _writeQueues[queueIndex.unsignedIntegerValue], ^{
+                    // 选出之后到轮到这一批之间重新存入的文件不删
+                    NSArray<NSString *> *storedFileNames = [_diskIndex fileNames:queueFileNames storedBeforeDate:selectionDate];
+                    if (storedFileNames.count > 0) {
+                        [self removeDiskFilesWithNames:storedFileNames];
+                    }
+                });
+            }];
+            dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
         }
+        // 把内存中的访问时间写进快照，同时清空日志
+        [_diskIndex save];
+
         // 如果有completionBlock，就在主线程中调用
         if (completionBlock) {
             dispatch_async(dispatch_get_main_queue(), ^{
@@ -649,6 +995,17 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
     });
 }
 
+// 在段文件中的只追加删除记录，失效的空间由段文件存储在后台压缩，在写队列中调用
+- (void)removeDiskFilesWithNames:(nonnull NSArray<NSString *> *)fileNames {
+    NSSet<NSString *> *blobFileNames = [_blobStore removeDataForNames:fileNames];
+    for (NSString *fileName in fileNames) {
+        if (![blobFileNames containsObject:fileName]) {
+            [_fileManager removeItemAtPath:[self shardedCachePathForFileName:fileName inPath:self.diskCachePath] error:nil];
+        }
+    }
+    [_diskIndex recordRemovalForFileNames:fileNames];
+}
+
 #if SD_UIKIT
 - (void)backgroundDeleteOldFiles {
     Class UIApplicationClass = NSClassFromString(@"UIApplication");
@@ -673,46 +1030,25 @@ FOUNDATION_STATIC_INLINE NSUInteger SDCacheCostForImage(UIImage *image) {
 
 #pragma mark - Cache Info
 
+// 索引还在启动时加载时，等它加载完
+- (void)waitForDiskIndex {
+    dispatch_group_wait(_setupGroup, DISPATCH_TIME_FOREVER);
+}
+
 - (NSUInteger)getSize {
-    __block NSUInteger size = 0;
-    dispatch_sync(self.ioQueue, ^{
-        NSDirectoryEnumerator *fileEnumerator = [_fileManager enumeratorAtPath:self.diskCachePath];
-        for (NSString *fileName in fileEnumerator) {
-            NSString *filePath = [self.diskCachePath stringByAppendingPathComponent:fileName];
-            NSDictionary<NSString *, id> *attrs = [[NSFileManager defaultManager] attributesOfItemAtPath:filePath error:nil];
-            size += [attrs fileSize];
-        }
-    });
-    return size;
+    [self waitForDiskIndex];
+    return _diskIndex.totalSize;
 }
 
 - (NSUInteger)getDiskCount {
-    __block NSUInteger count = 0;
-    dispatch_sync(self.ioQueue, ^{
-        NSDirectoryEnumerator *fileEnumerator = [_fileManager enumeratorAtPath:self.diskCachePath];
-        count = fileEnumerator.allObjects.count;
-    });
-    return count;
+    [self waitForDiskIndex];
+    return _diskIndex.count;
 }
 
 - (void)calculateSizeWithCompletionBlock:(nullable SDWebImageCalculateSizeBlock)completionBlock {
-    NSURL *diskCacheURL = [NSURL fileURLWithPath:self.diskCachePath isDirectory:YES];
-
     dispatch_async(self.ioQueue, ^{
-        NSUInteger fileCount = 0;
-        NSUInteger totalSize = 0;
-
-        NSDirectoryEnumerator *fileEnumerator = [_fileManager enumeratorAtURL:diskCacheURL
-                                                   includingPropertiesForKeys:@[NSFileSize]
-                                                                      options:NSDirectoryEnumerationSkipsHiddenFiles
-                                                                 errorHandler:NULL];
-
-        for (NSURL *fileURL in fileEnumerator) {
-            NSNumber *fileSize;
-            [fileURL getResourceValue:&fileSize forKey:NSURLFileSizeKey error:NULL];
-            totalSize += fileSize.unsignedIntegerValue;
-            fileCount += 1;
-        }
+        NSUInteger fileCount = _diskIndex.count;
+        NSUInteger totalSize = _diskIndex.totalSize;
 
         if (completionBlock) {
             dispatch_async(dispatch_get_main_queue(), ^{
@@ -31,6 +31,41 @@
  */
 @property (assign, nonatomic) BOOL shouldCacheImagesInMemory;
 
+/**
+ * Only let an image into the memory cache when it is used more often than the one it would evict (W-TinyLFU) [defaults to YES]
+ * 内存缓存满了之后，新图片的访问频率比要淘汰的图片高才能进入(W-TinyLFU)，默认是YES
+ * Only takes effect when maxMemoryCost or maxMemoryCountLimit of SDImageCache is set.
+ * 只有设置了SDImageCache的maxMemoryCost或者maxMemoryCountLimit时才起作用
+ */
+@property (assign, nonatomic) BOOL shouldUseMemoryCacheAdmission;
+
+/**
+ * The share of the memory cache limits used by the admission window, new images stay there before being filtered [defaults to 0.01]
+ * 准入窗口占内存缓存上限的比例，新图片先在窗口中停留再经过筛选，默认是0.01
+ */
+@property (assign, nonatomic) double memoryCacheWindowRatio;
+
+/**
+ * Append small images to large segment files instead of writing one file per image [defaults to NO]
+ * 小图片追加到大的段文件中，不再每张图片一个文件，默认是NO
+ * Saves the per-file space rounding and open/close calls for thumbnails; images already in the segments stay readable when turned off.
+ * 省去缩略图每个文件的空间对齐和打开关闭的开销；关闭后已经存入段文件的图片仍然可以读取
+ */
+@property (assign, nonatomic) BOOL shouldUseBlobStore;
+
+/**
+ * Images up to this size, in bytes, go to the segment files when shouldUseBlobStore is YES [defaults to 32KB]
+ * shouldUseBlobStore为YES时，不超过这个大小(字节)的图片存入段文件，默认是32KB
+ */
+@property (assign, nonatomic) NSUInteger maxBlobSize;
+
+/**
+ * Disk cache files of 16KB or more are memory-mapped instead of copied into the heap, as long as the mapped files
+ * stay under this size in bytes; set to 0 to always copy [defaults to 64MB]
+ * 不小于16KB的磁盘缓存文件映射到内存，不再复制到堆上，所有映射的文件总共不超过这个字节数；设为0时总是复制，默认是64MB
+ */
+@property (assign, nonatomic) NSUInteger maxMappedBytes;
+
 /**
  * The maximum length of time to keep an image in the cache, in seconds
  * 保持一个图像缓存的最大时间长度，单位是秒
@@ -9,6 +9,12 @@
 #import "SDImageCacheConfig.h"
 // 默认情况下缓存一周
 static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
+// 准入窗口默认占内存缓存的1%
+static const double kDefaultMemoryCacheWindowRatio = 0.01;
+// 不超过32KB的图片存入段文件
+static const NSUInteger kDefaultMaxBlobSize = 32 * 1024;
+// 最多同时映射64MB的缓存文件
+static const NSUInteger kDefaultMaxMappedBytes = 64 * 1024 * 1024;
 
 @implementation SDImageCacheConfig
 
@@ -18,6 +24,11 @@ static const NSInteger kDefaultCacheMaxCacheAge = 60 * 60 * 24 * 7; // 1 week
         _shouldDecompressImages = YES;
         _shouldDisableiCloud = YES;
         _shouldCacheImagesInMemory = YES;
+        _shouldUseMemoryCacheAdmission = YES;
+        _memoryCacheWindowRatio = kDefaultMemoryCacheWindowRatio;
+        _shouldUseBlobStore = NO;
+        _maxBlobSize = kDefaultMaxBlobSize;
+        _maxMappedBytes = kDefaultMaxMappedBytes;
         _maxCacheAge = kDefaultCacheMaxCacheAge;
         _maxCacheSize = 0;
     }
@@ -0,0 +1,119 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import <Foundation/Foundation.h>
+#import "SDWebImageCompat.h"
+
+@class SDImageCacheConfig;
+
+/**
+ * A thread-safe, cost-aware LRU memory cache used by SDImageCache in place of NSCache.
+ * Keys are spread over a fixed number of shards by hash, every shard has its own lock and its own LRU list,
+ * so lookups for different keys rarely contend. Get, set and remove are O(1).
+ *
+ * Eviction order: when the total cost or count goes over the limit, shards are visited round-robin starting
+ * from the shard after the one trimmed last, and each shard gives up its least recently used entries first.
+ * The entry that was just stored is never the one evicted to make room for itself.
+ *
+ * When created with a config whose shouldUseMemoryCacheAdmission is YES, new objects enter a small window LRU first
+ * and have to beat the least recently used object of the main LRU on access frequency (W-TinyLFU) to stay,
+ * so a scan over one-off images does not flush the frequently used ones.
+ *
+ * 线程安全、按成本计算的LRU内存缓存，SDImageCache用它代替NSCache
+ * key按hash分到固定个数的分片，每个分片有自己的锁和LRU链表，不同key的查找很少互相等锁，存取和删除都是O(1)
+ * 淘汰顺序：总成本或者总个数超过上限时，从上次淘汰的下一个分片开始轮流处理，每个分片先淘汰最久没有访问的对象，
+ * 刚存进去的对象不会为了给自己腾位置被淘汰
+ * 使用shouldUseMemoryCacheAdmission为YES的配置创建时，新对象先进入一个小的窗口LRU，从窗口出来时访问频率要比主区
+ * 最久没有访问的对象高才能留下(W-TinyLFU)，一遍扫过的一次性图片不会把经常使用的图片挤出去
+ */
+@interface SDMemoryCache<KeyType, ObjectType> : NSObject
+
+/**
+ * Create a cache with the given number of shards, rounded up to a power of two.
+ * 创建指定分片个数的缓存，分片个数向上取整为2的幂
+ */
+- (nonnull instancetype)initWithShardCount:(NSUInteger)shardCount NS_DESIGNATED_INITIALIZER;
+
+/**
+ * Create a cache with the default number of shards, taking the admission settings from the config.
+ * 使用默认的分片个数创建缓存，准入相关的设置从config中读取
+ */
+- (nonnull instancetype)initWithConfig:(nullable SDImageCacheConfig *)config;
+
+/**
+ * Create a cache with the default number of shards (16).
+ * 使用默认的16个分片创建缓存
+ */
+- (nonnull instancetype)init;
+
+@property (strong, nonatomic, readonly, nullable) SDImageCacheConfig *config;
+
+/**
+ * The maximum total cost, 0 means no limit. The cost passed by SDImageCache is the decoded bitmap size in bytes.
+ * 总成本上限，0表示不限制。SDImageCache传入的成本是解码后位图的字节数
+ */
+@property (assign, nonatomic) NSUInteger totalCostLimit;
+
+/**
+ * The maximum number of objects, 0 means no limit.
+ * 对象个数上限，0表示不限制
+ */
+@property (assign, nonatomic) NSUInteger countLimit;
+
+/**
+ * Current total cost and number of objects.
+ * 当前的总成本和对象个数
+ */
+@property (assign, nonatomic, readonly) NSUInteger totalCost;
+@property (assign, nonatomic, readonly) NSUInteger totalCount;
+
+/**
+ * Lookups that found / did not find an object, and objects evicted because of the limits (not counting explicit removals).
+ * 命中和未命中的次数，以及因为超过上限被淘汰的个数(不包括主动删除)
+ */
+@property (assign, nonatomic, readonly) NSUInteger hitCount;
+@property (assign, nonatomic, readonly) NSUInteger missCount;
+@property (assign, nonatomic, readonly) NSUInteger evictionCount;
+
+/**
+ * Objects dropped by the admission filter because they were used less often than the object they would replace.
+ * 因为访问频率不如要替换的对象而没能进入主区的个数
+ */
+@property (assign, nonatomic, readonly) NSUInteger rejectionCount;
+
+/**
+ * hitCount / (hitCount + missCount), 0 before the first lookup.
+ * 命中率，还没有查找过时为0
+ */
+@property (assign, nonatomic, readonly) double hitRatio;
+
+/**
+ * Return the object for the key and mark it as most recently used.
+ * 取出key对应的对象，并把它标记为最近使用
+ */
+- (nullable ObjectType)objectForKey:(nullable KeyType)key;
+
+/**
+ * Store an object, replacing any object already stored for the key. An object costing more than totalCostLimit is not stored.
+ * 存入对象，替换key原来的对象。成本超过totalCostLimit的对象不会存入
+ */
+- (void)setObject:(nullable ObjectType)object forKey:(nullable KeyType)key cost:(NSUInteger)cost;
+
+- (void)setObject:(nullable ObjectType)object forKey:(nullable KeyType)key;
+
+- (void)removeObjectForKey:(nullable KeyType)key;
+
+- (void)removeAllObjects;
+
+/**
+ * Reset hitCount, missCount, evictionCount and rejectionCount to 0.
+ * 把命中、未命中、淘汰和拒绝次数清零
+ */
+- (void)resetStatistics;
+
+@end
@@ -0,0 +1,496 @@
+/*
+ * This file is part of the SDWebImage package.
+ * (c) Olivier Poitrey <rs@dailymotion.com>
+ *
+ * For the full copyright and license information, please view the LICENSE
+ * file that was distributed with this source code.
+ */
+
+#import "SDMemoryCache.h"
+#import "SDImageCacheConfig.h"
+#import <os/lock.h>
+#import <stdatomic.h>
+
+static const NSUInteger kSDMemoryCacheDefaultShardCount = 16;
+static const NSUInteger kSDMemoryCacheMaxShardCount = 256;
+
+// 每个分片的频率草图：4行，每行512个计数器，计数到15为止
+#define SD_SKETCH_DEPTH 4
+#define SD_SKETCH_WIDTH 512
+static const uint8_t kSDSketchMaxCount = 15;
+// 记录次数达到宽度的10倍时所有计数器减半，旧的热度慢慢衰减
+static const NSUInteger kSDSketchSampleFactor = 10;
+
+// 链表节点，被分片的字典持有，prev/next不持有
+@interface _SDMemoryCacheNode : NSObject {
+    @package
+    id _key;
+    id _object;
+    NSUInteger _cost;
+    uint64_t _hash;
+    BOOL _inWindow;
+    __unsafe_unretained _SDMemoryCacheNode *_prev;
+    __unsafe_unretained _SDMemoryCacheNode *_next;
+}
+@end
+
+@implementation _SDMemoryCacheNode
+@end
+
+// LRU链表，head是最近使用的，tail最久没有使用
+typedef struct {
+    __unsafe_unretained _SDMemoryCacheNode *head;
+    __unsafe_unretained _SDMemoryCacheNode *tail;
+} SDMemoryCacheList;
+
+// 一个分片：一把锁、一个key到节点的字典、窗口和主区两条LRU链表，以及这个分片的key的频率草图
+typedef struct {
+    os_unfair_lock lock;
+    CFMutableDictionaryRef map;
+    SDMemoryCacheList window;
+    SDMemoryCacheList main;
+    NSUInteger windowCost;
+    NSUInteger windowCount;
+    NSUInteger sketchAdditions;
+    uint8_t sketch[SD_SKETCH_DEPTH * SD_SKETCH_WIDTH];
+} SDMemoryCacheShard;
+
+FOUNDATION_STATIC_INLINE CFMutableDictionaryRef SDMemoryCacheCreateMap(void) {
+    return CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+}
+
+FOUNDATION_STATIC_INLINE void SDMemoryCacheUnlink(SDMemoryCacheList *list, _SDMemoryCacheNode *node) {
+    if (node->_prev) {
+        node->_prev->_next = node->_next;
+    } else {
+        list->head = node->_next;
+    }
+    if (node->_next) {
+        node->_next->_prev = node->_prev;
+    } else {
+        list->tail = node->_prev;
+    }
+    node->_prev = nil;
+    node->_next = nil;
+}
+
+FOUNDATION_STATIC_INLINE void SDMemoryCacheInsertAtHead(SDMemoryCacheList *list, _SDMemoryCacheNode *node) {
+    node->_prev = nil;
+    node->_next = list->head;
+    if (list->head) {
+        list->head->_prev = node;
+    } else {
+        list->tail = node;
+    }
+    list->head = node;
+}
+
+FOUNDATION_STATIC_INLINE uint64_t SDMemoryCacheHash(id key) {
+    // NSString的hash低位分布不均匀，乘一个常数，分片用高位
+    return (uint64_t)[key hash] * 0x9E3779B97F4A7C15ULL;
+}
+
+// 草图每一行的下标，和分片用的高位错开，再混合一次
+FOUNDATION_STATIC_INLINE NSUInteger SDSketchIndex(uint64_t hash, NSUInteger row) {
+    uint64_t h = (hash + row * 0x632BE59BD9B4E019ULL) ^ (hash >> 31);
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 27;
+    return row * SD_SKETCH_WIDTH + (NSUInteger)(h & (SD_SKETCH_WIDTH - 1));
+}
+
+FOUNDATION_STATIC_INLINE uint8_t SDSketchFrequency(SDMemoryCacheShard *shard, uint64_t hash) {
+    uint8_t frequency = kSDSketchMaxCount;
+    for (NSUInteger row = 0; row < SD_SKETCH_DEPTH; row++) {
+        frequency = MIN(frequency, shard->sketch[SDSketchIndex(hash, row)]);
+    }
+    return frequency;
+}
+
+FOUNDATION_STATIC_INLINE void SDSketchIncrement(SDMemoryCacheShard *shard, uint64_t hash) {
+    BOOL added = NO;
+    for (NSUInteger row = 0; row < SD_SKETCH_DEPTH; row++) {
+        uint8_t *counter = &shard->sketch[SDSketchIndex(hash, row)];
+        if (*counter < kSDSketchMaxCount) {
+            (*counter)++;
+            added = YES;
+        }
+    }
+    if (added && ++shard->sketchAdditions >= SD_SKETCH_WIDTH * kSDSketchSampleFactor) {
+        for (NSUInteger i = 0; i < SD_SKETCH_DEPTH * SD_SKETCH_WIDTH; i++) {
+            shard->sketch[i] >>= 1;
+        }
+        shard->sketchAdditions /= 2;
+    }
+}
+
+@implementation SDMemoryCache {
+    SDMemoryCacheShard *_shards;
+    NSUInteger _shardMask;
+    unsigned int _shardShift;
+
+    _Atomic(NSUInteger) _totalCostLimit;
+    _Atomic(NSUInteger) _countLimit;
+    _Atomic(NSUInteger) _totalCost;
+    _Atomic(NSUInteger) _totalCount;
+    _Atomic(NSUInteger) _hitCount;
+    _Atomic(NSUInteger) _missCount;
+    _Atomic(NSUInteger) _evictionCount;
+    _Atomic(NSUInteger) _rejectionCount;
+    // 下次淘汰从哪个分片开始
+    _Atomic(NSUInteger) _trimCursor;
+}
+
+- (nonnull instancetype)init {
+    return [self initWithShardCount:kSDMemoryCacheDefaultShardCount];
+}
+
+- (nonnull instancetype)initWithConfig:(nullable SDImageCacheConfig *)config {
+    if ((self = [self initWithShardCount:kSDMemoryCacheDefaultShardCount])) {
+        _config = config;
+    }
+    return self;
+}
+
+- (nonnull instancetype)initWithShardCount:(NSUInteger)shardCount {
+    if ((self = [super init])) {
+        NSUInteger count = 1;
+        unsigned int bits = 0;
+        shardCount = MIN(MAX(shardCount, 1), kSDMemoryCacheMaxShardCount);
+        while (count < shardCount) {
+            count <<= 1;
+            bits++;
+        }
+        _shardMask = count - 1;
+        _shardShift = 64 - bits;
+        _shards = calloc(count, sizeof(SDMemoryCacheShard));
+        for (NSUInteger i = 0; i < count; i++) {
+            _shards[i].lock = OS_UNFAIR_LOCK_INIT;
+            _shards[i].map = SDMemoryCacheCreateMap();
+        }
+    }
+    return self;
+}
+
+- (void)dealloc {
+    for (NSUInteger i = 0; i <= _shardMask; i++) {
+        CFRelease(_shards[i].map);
+    }
+    free(_shards);
+}
+
+- (SDMemoryCacheShard *)shardForHash:(uint64_t)hash {
+    if (_shardMask == 0) {
+        return _shards;
+    }
+    return &_shards[(NSUInteger)(hash >> _shardShift) & _shardMask];
+}
+
+#pragma mark - Limits
+
+- (NSUInteger)totalCostLimit {
+    return atomic_load_explicit(&_totalCostLimit, memory_order_relaxed);
+}
+
+- (void)setTotalCostLimit:(NSUInteger)totalCostLimit {
+    atomic_store_explicit(&_totalCostLimit, totalCostLimit, memory_order_relaxed);
+    [self trimExceptNode:NULL];
+}
+
+- (NSUInteger)countLimit {
+    return atomic_load_explicit(&_countLimit, memory_order_relaxed);
+}
+
+- (void)setCountLimit:(NSUInteger)countLimit {
+    atomic_store_explicit(&_countLimit, countLimit, memory_order_relaxed);
+    [self trimExceptNode:NULL];
+}
+
+- (NSUInteger)totalCost {
+    return atomic_load_explicit(&_totalCost, memory_order_relaxed);
+}
+
+- (NSUInteger)totalCount {
+    return atomic_load_explicit(&_totalCount, memory_order_relaxed);
+}
+
+- (NSUInteger)hitCount {
+    return atomic_load_explicit(&_hitCount, memory_order_relaxed);
+}
+
+- (NSUInteger)missCount {
+    return atomic_load_explicit(&_missCount, memory_order_relaxed);
+}
+
+- (NSUInteger)evictionCount {
+    return atomic_load_explicit(&_evictionCount, memory_order_relaxed);
+}
+
+- (NSUInteger)rejectionCount {
+    return atomic_load_explicit(&_rejectionCount, memory_order_relaxed);
+}
+
+- (double)hitRatio {
+    NSUInteger hits = self.hitCount;
+    NSUInteger lookups = hits + self.missCount;
+    return lookups > 0 ? (double)hits / lookups : 0;
+}
+
+- (void)resetStatistics {
+    atomic_store_explicit(&_hitCount, 0, memory_order_relaxed);
+    atomic_store_explicit(&_missCount, 0, memory_order_relaxed);
+    atomic_store_explicit(&_evictionCount, 0, memory_order_relaxed);
+    atomic_store_explicit(&_rejectionCount, 0, memory_order_relaxed);
+}
+
+- (BOOL)isOverLimit {
+    NSUInteger costLimit = atomic_load_explicit(&_totalCostLimit, memory_order_relaxed);
+    NSUInteger countLimit = atomic_load_explicit(&_countLimit, memory_order_relaxed);
+    return (costLimit > 0 && atomic_load_explicit(&_totalCost, memory_order_relaxed) > costLimit) ||
+           (countLimit > 0 && atomic_load_explicit(&_totalCount, memory_order_relaxed) > countLimit);
+}
+
+- (BOOL)isAdmissionEnabled {
+    return _config && _config.shouldUseMemoryCacheAdmission;
+}
+
+#pragma mark - Access
+
+- (nullable id)objectForKey:(nullable id)key {
+    if (!key) {
+        return nil;
+    }
+    uint64_t hash = SDMemoryCacheHash(key);
+    SDMemoryCacheShard *shard = [self shardForHash:hash];
+    id object = nil;
+    os_unfair_lock_lock(&shard->lock);
+    // 没有命中也要记录，一直被请求的key下次存入时更容易通过准入
+    SDSketchIncrement(shard, hash);
+    _SDMemoryCacheNode *node = (__bridge _SDMemoryCacheNode *)CFDictionaryGetValue(shard->map, (__bridge const void *)key);
+    if (node) {
+        SDMemoryCacheList *list = node->_inWindow ? &shard->window : &shard->main;
+        if (list->head != node) {
+            SDMemoryCacheUnlink(list, node);
+            SDMemoryCacheInsertAtHead(list, node);
+        }
+        object = node->_object;
+    }
+    os_unfair_lock_unlock(&shard->lock);
+    atomic_fetch_add_explicit(object ? &_hitCount : &_missCount, 1, memory_order_relaxed);
+    return object;
+}
+
+- (void)setObject:(nullable id)object forKey:(nullable id)key {
+    [self setObject:object forKey:key cost:0];
+}
+
+- (void)setObject:(nullable id)object forKey:(nullable id)key cost:(NSUInteger)cost {
+    if (!key) {
+        return;
+    }
+    NSUInteger costLimit = atomic_load_explicit(&_totalCostLimit, memory_order_relaxed);
+    if (!object || (costLimit > 0 && cost > costLimit)) {
+        [self removeObjectForKey:key];
+        return;
+    }
+    uint64_t hash = SDMemoryCacheHash(key);
+    SDMemoryCacheShard *shard = [self shardForHash:hash];
+    // 被替换的旧对象和被淘汰的节点在解锁之后才释放，图片的释放可能比较慢，不放在锁里
+    id oldObject = nil;
+    NSMutableArray<_SDMemoryCacheNode *> *evicted = nil;
+    os_unfair_lock_lock(&shard->lock);
+    SDSketchIncrement(shard, hash);
+    _SDMemoryCacheNode *node = (__bridge _SDMemoryCacheNode *)CFDictionaryGetValue(shard->map, (__bridge const void *)key);
+    if (node) {
+        oldObject = node->_object;
+        node->_object = object;
+        atomic_fetch_sub_explicit(&_totalCost, node->_cost, memory_order_relaxed);
+        atomic_fetch_add_explicit(&_totalCost, cost, memory_order_relaxed);
+        if (node->_inWindow) {
+            shard->windowCost = shard->windowCost - node->_cost + cost;
+        }
+        node->_cost = cost;
+        SDMemoryCacheList *list = node->_inWindow ? &shard->window : &shard->main;
+        if (list->head != node) {
+            SDMemoryCacheUnlink(list, node);
+            SDMemoryCacheInsertAtHead(list, node);
+        }
+    } else {
+        // 新的对象先进窗口，从窗口出来时再决定能不能进主区
+        node = [_SDMemoryCacheNode new];
+        node->_key = [key copy];
+        node->_object = object;
+        node->_cost = cost;
+        node->_hash = hash;
+        node->_inWindow = YES;
+        CFDictionarySetValue(shard->map, (__bridge const void *)node->_key, (__bridge const void *)node);
+        SDMemoryCacheInsertAtHead(&shard->window, node);
+        shard->windowCost += cost;
+        shard->windowCount++;
+        atomic_fetch_add_explicit(&_totalCost, cost, memory_order_relaxed);
+        atomic_fetch_add_explicit(&_totalCount, 1, memory_order_relaxed);
+        evicted = [self drainWindowOfShard:shard];
+    }
+    const void *keep = (__bridge const void *)node;
+    os_unfair_lock_unlock(&shard->lock);
+
+    if ([self isOverLimit]) {
+        [self trimExceptNode:keep];
+    }
+}
+
+- (void)removeObjectForKey:(nullable id)key {
+    if (!key) {
+        return;
+    }
+    uint64_t hash = SDMemoryCacheHash(key);
+    SDMemoryCacheShard *shard = [self shardForHash:hash];
+    _SDMemoryCacheNode *removed = nil;
+    os_unfair_lock_lock(&shard->lock);
+    _SDMemoryCacheNode *node = (__bridge _SDMemoryCacheNode *)CFDictionaryGetValue(shard->map, (__bridge const void *)key);
+    if (node) {
+        removed = node;
+        [self removeNode:node fromShard:shard];
+    }
+    os_unfair_lock_unlock(&shard->lock);
+    // removed在这里释放，在锁外面
+}
+
+- (void)removeAllObjects {
+    for (NSUInteger i = 0; i <= _shardMask; i++) {
+        SDMemoryCacheShard *shard = &_shards[i];
+        CFMutableDictionaryRef emptyMap = SDMemoryCacheCreateMap();
+        os_unfair_lock_lock(&shard->lock);
+        CFMutableDictionaryRef oldMap = shard->map;
+        NSUInteger cost = shard->windowCost;
+        for (_SDMemoryCacheNode *node = shard->main.head; node; node = node->_next) {
+            cost += node->_cost;
+        }
+        NSUInteger count = CFDictionaryGetCount(oldMap);
+        shard->map = emptyMap;
+        shard->window = (SDMemoryCacheList){nil, nil};
+        shard->main = (SDMemoryCacheList){nil, nil};
+        shard->windowCost = 0;
+        shard->windowCount = 0;
+        atomic_fetch_sub_explicit(&_totalCost, cost, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&_totalCount, count, memory_order_relaxed);
+        os_unfair_lock_unlock(&shard->lock);
+        // 频率草图保留，清空之后热门的key依然能优先回到缓存
+        CFRelease(oldMap);
+    }
+}
+
+#pragma mark - Admission and eviction
+
+// 调用时持有分片的锁，调用者要先持有node，字典删除后node才不会马上释放
+- (void)removeNode:(_SDMemoryCacheNode *)node fromShard:(SDMemoryCacheShard *)shard {
+    if (node->_inWindow) {
+        SDMemoryCacheUnlink(&shard->window, node);
+        shard->windowCost -= node->_cost;
+        shard->windowCount--;
+    } else {
+        SDMemoryCacheUnlink(&shard->main, node);
+    }
+    CFDictionaryRemoveValue(shard->map, (__bridge const void *)node->_key);
+    atomic_fetch_sub_explicit(&_totalCost, node->_cost, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&_totalCount, 1, memory_order_relaxed);
+}
+
+- (BOOL)isWindowOverflowedInShard:(SDMemoryCacheShard *)shard ratio:(double)ratio {
+    // 窗口至少留下最新的一个对象
+    if (shard->windowCount <= 1) {
+        return NO;
+    }
+    NSUInteger shardCount = _shardMask + 1;
+    NSUInteger costLimit = atomic_load_explicit(&_totalCostLimit, memory_order_relaxed);
+    NSUInteger countLimit = atomic_load_explicit(&_countLimit, memory_order_relaxed);
+    return (costLimit > 0 && shard->windowCost > costLimit * ratio / shardCount) ||
+           (countLimit > 0 && shard->windowCount > countLimit * ratio / shardCount) ||
+           (costLimit == 0 && countLimit == 0);
+}
+
+/**
+ * W-TinyLFU：窗口超出配额时，窗口最久没有访问的对象是候选者
+ * 缓存没有超过上限时候选者直接进入主区；超过上限时和主区最久没有访问的对象比较频率，
+ * 候选者更频繁才进入主区并淘汰对方，否则淘汰候选者。一遍扫过的一次性图片因此挤不掉主区里经常访问的图片
+ * 调用时持有分片的锁，返回被淘汰的节点，由调用者在解锁之后释放
+ */
+- (nullable NSMutableArray<_SDMemoryCacheNode *> *)drainWindowOfShard:(SDMemoryCacheShard *)shard {
+    BOOL admission = [self isAdmissionEnabled];
+    double ratio = admission ? MIN(MAX(_config.memoryCacheWindowRatio, 0), 1) : 0;
+    NSMutableArray<_SDMemoryCacheNode *> *evicted = nil;
+    while ([self isWindowOverflowedInShard:shard ratio:ratio]) {
+        _SDMemoryCacheNode *candidate = shard->window.tail;
+        SDMemoryCacheUnlink(&shard->window, candidate);
+        shard->windowCost -= candidate->_cost;
+        shard->windowCount--;
+        candidate->_inWindow = NO;
+
+        BOOL admitted = YES;
+        if (admission) {
+            uint8_t candidateFrequency = SDSketchFrequency(shard, candidate->_hash);
+            while ([self isOverLimit]) {
+                _SDMemoryCacheNode *victim = shard->main.tail;
+                if (!victim) {
+                    break;
+                }
+                if (SDSketchFrequency(shard, victim->_hash) >= candidateFrequency) {
+                    admitted = NO;
+                    break;
+                }
+                if (!evicted) {
+                    evicted = [NSMutableArray array];
+                }
+                [evicted addObject:victim];
+                [self removeNode:victim fromShard:shard];
+                atomic_fetch_add_explicit(&_evictionCount, 1, memory_order_relaxed);
+            }
+        }
+        SDMemoryCacheInsertAtHead(&shard->main, candidate);
+        if (!admitted) {
+            if (!evicted) {
+                evicted = [NSMutableArray array];
+            }
+            [evicted addObject:candidate];
+            [self removeNode:candidate fromShard:shard];
+            atomic_fetch_add_explicit(&_rejectionCount, 1, memory_order_relaxed);
+        }
+    }
+    return evicted;
+}
+
+/**
+ * 从游标所在的分片开始轮流淘汰，每个分片先淘汰主区的tail，再淘汰窗口的tail，直到不再超过上限
+ * keep是刚存进去的节点，只比较指针不访问，不会被淘汰
+ */
+- (void)trimExceptNode:(const void *)keep {
+    if (![self isOverLimit]) {
+        return;
+    }
+    NSMutableArray<_SDMemoryCacheNode *> *evicted = [NSMutableArray array];
+    NSUInteger start = atomic_load_explicit(&_trimCursor, memory_order_relaxed);
+    NSUInteger index = start;
+    BOOL overLimit = YES;
+    for (NSUInteger i = 0; i <= _shardMask && overLimit; i++) {
+        index = (start + i) & _shardMask;
+        SDMemoryCacheShard *shard = &_shards[index];
+        os_unfair_lock_lock(&shard->lock);
+        SDMemoryCacheList *lists[] = {&shard->main, &shard->window};
+        for (NSUInteger l = 0; l < 2 && overLimit; l++) {
+            _SDMemoryCacheNode *node = lists[l]->tail;
+            while (node && (overLimit = [self isOverLimit])) {
+                _SDMemoryCacheNode *prev = node->_prev;
+                if ((__bridge const void *)node != keep) {
+                    [evicted addObject:node];
+                    [self removeNode:node fromShard:shard];
+                    atomic_fetch_add_explicit(&_evictionCount, 1, memory_order_relaxed);
+                }
+                node = prev;
+            }
+        }
+        os_unfair_lock_unlock(&shard->lock);
+    }
+    atomic_store_explicit(&_trimCursor, (index + 1) & _shardMask, memory_order_relaxed);
+    // evicted在这里释放，被淘汰的对象不在任何锁里释放
+}
+
+@end
@@ -16,4 +16,12 @@
 
 + (nullable UIImage *)decodedAndScaledDownImageWithImage:(nullable UIImage *)image;
 
+/**
+ * Decode the data straight at a reduced size that still fills targetPixelSize, without ever holding the full bitmap.
+ * Returns nil when the image is not larger than the target, is animated, or can't be read by ImageIO; decode it normally then.
+ * 直接按缩小后的大小解码数据(仍然铺满targetPixelSize)，不会生成原尺寸的位图。
+ * 图片不比目标大、是动图或者ImageIO读不了时返回nil，这时按原来的方式解码
+ */
++ (nullable UIImage *)decodedImageWithData:(nullable NSData *)data targetPixelSize:(CGSize)targetPixelSize;
+
 @end
@@ -8,6 +8,9 @@
  */
 
 #import "SDWebImageDecoder.h"
+#import "NSData+ImageContentType.h"
+#import "SDBitmapBufferPool.h"
+#import <ImageIO/ImageIO.h>
 
 @implementation UIImage (ForceDecode)
 
@@ -45,13 +48,14 @@ static const size_t kBitsPerComponent = 8;
         // 当你向上下文中绘制信息时，Quartz把你要绘制的信息作为位图数据绘制到指定的内存块。
         // 一个新的位图上下文的像素格式由三个参数决定：
         // 每个组件的位数，颜色空间，alpha选项。alpha值决定了绘制像素的透明性。
-        CGContextRef context = CGBitmapContextCreate(NULL,
-                                                     width,
-                                                     height,
-                                                     kBitsPerComponent,
-                                                     bytesPerRow,
-                                                     colorspaceRef,
-                                                     kCGBitmapByteOrderDefault|kCGImageAlphaNoneSkipLast);
+        // 像素缓冲区从池中取，图片释放(比如从内存缓存中淘汰)后回到池中，滑动列表时不会反复分配和释放大块内存
+        // 图片没有alpha，下面的绘制会覆盖整个上下文，缓冲区不用清零
+        CGContextRef context = [[SDBitmapBufferPool sharedPool] createBitmapContextWithWidth:width
+                                                                                      height:height
+                                                                            bitsPerComponent:kBitsPerComponent
+                                                                                 bytesPerRow:bytesPerRow
+                                                                                  colorSpace:colorspaceRef
+                                                                                  bitmapInfo:kCGBitmapByteOrderDefault|kCGImageAlphaNoneSkipLast];
         if (context == NULL) {
             return image;
         }
@@ -59,7 +63,8 @@ static const size_t kBitsPerComponent = 8;
         // Draw the image into the context and retrieve the new bitmap image without alpha
         // 在上面创建的context绘制image，并以此获取image，而该image也将拥有alpha通道
         CGContextDrawImage(context, CGRectMake(0, 0, width, height), imageRef);
-        CGImageRef imageRefWithoutAlpha = CGBitmapContextCreateImage(context);
+        // 图片和上下文共用缓冲区，不再复制一遍像素
+        CGImageRef imageRefWithoutAlpha = [[SDBitmapBufferPool sharedPool] createImageFromBitmapContext:context];
         UIImage *imageWithoutAlpha = [UIImage imageWithCGImage:imageRefWithoutAlpha
                                                          scale:image.scale
                                                    orientation:image.imageOrientation];
@@ -223,6 +228,60 @@ static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to over
     }
 }
 
++ (nullable UIImage *)decodedImageWithData:(nullable NSData *)data targetPixelSize:(CGSize)targetPixelSize {
+    if (data.length == 0 || targetPixelSize.width <= 0 || targetPixelSize.height <= 0) {
+        return nil;
+    }
+    // 先只读文件头，动图、WebP(ImageIO读不了)和不比目标大的图片不用创建CGImageSource
+    SDImageHeaderInfo header = [NSData sd_imageHeaderInfoForImageData:data];
+    if (header.format == SDImageFormatWebP || header.frameCount > 1) {
+        return nil;
+    }
+    if (header.pixelWidth > 0 && header.pixelHeight > 0) {
+        BOOL rotated = header.orientation >= 5;
+        CGFloat headerWidth = rotated ? header.pixelHeight : header.pixelWidth;
+        CGFloat headerHeight = rotated ? header.pixelWidth : header.pixelHeight;
+        if (MAX(targetPixelSize.width / headerWidth, targetPixelSize.height / headerHeight) >= 1) {
+            return nil;
+        }
+    }
+    CGImageSourceRef source = CGImageSourceCreateWithData((__bridge CFDataRef)data, (__bridge CFDictionaryRef)@{(__bridge NSString *)kCGImageSourceShouldCache : @NO});
+    if (!source) {
+        return nil;
+    }
+    
+    UIImage *image = nil;
+    // 动图要保留所有帧，按原来的方式解码
+    if (CGImageSourceGetCount(source) == 1) {
+        NSDictionary *properties = (__bridge_transfer NSDictionary *)CGImageSourceCopyPropertiesAtIndex(source, 0, NULL);
+        CGFloat pixelWidth = [properties[(__bridge NSString *)kCGImagePropertyPixelWidth] doubleValue];
+        CGFloat pixelHeight = [properties[(__bridge NSString *)kCGImagePropertyPixelHeight] doubleValue];
+        // EXIF方向5到8的图片显示时要旋转90度，宽高互换
+        if ([properties[(__bridge NSString *)kCGImagePropertyOrientation] integerValue] >= 5) {
+            CGFloat swap = pixelWidth;
+            pixelWidth = pixelHeight;
+            pixelHeight = swap;
+        }
+        // 缩小到刚好铺满目标大小，只有比目标大的图片才缩小
+        CGFloat ratio = MAX(targetPixelSize.width / pixelWidth, targetPixelSize.height / pixelHeight);
+        if (pixelWidth > 0 && pixelHeight > 0 && ratio < 1) {
+            // JPEG由解码器按比例跳过像素直接解码出小图，不经过原尺寸的位图
+            // ShouldCacheImmediately让解码在这里完成，不用再调用decodedImageWithImage
+            NSDictionary *options = @{(__bridge NSString *)kCGImageSourceCreateThumbnailFromImageAlways : @YES,
+                                      (__bridge NSString *)kCGImageSourceThumbnailMaxPixelSize : @(ceil(MAX(pixelWidth, pixelHeight) * ratio)),
+                                      (__bridge NSString *)kCGImageSourceCreateThumbnailWithTransform : @YES,
+                                      (__bridge NSString *)kCGImageSourceShouldCacheImmediately : @YES};
+            CGImageRef imageRef = CGImageSourceCreateThumbnailAtIndex(source, 0, (__bridge CFDictionaryRef)options);
+            if (imageRef) {
+                image = [UIImage imageWithCGImage:imageRef];
+                CGImageRelease(imageRef);
+            }
+        }
+    }
+    CFRelease(source);
+    return image;
+}
+
 + (BOOL)shouldDecodeImage:(nullable UIImage *)image {
     // Prevent "CGBitmapContextCreateImage: invalid context 0x0" error
     if (image == nil) {
@@ -294,6 +353,10 @@ static const CGFloat kDestSeemOverlap = 2.0f;   // the numbers of pixels to over
 + (nullable UIImage *)decodedAndScaledDownImageWithImage:(nullable UIImage *)image {
     return image;
 }
+
++ (nullable UIImage *)decodedImageWithData:(nullable NSData *)data targetPixelSize:(CGSize)targetPixelSize {
+    return nil;
+}
 #endif
 
 @end
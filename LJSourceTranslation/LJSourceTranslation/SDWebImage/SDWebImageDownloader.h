@@ -247,6 +247,19 @@ typedef SDHTTPHeadersDictionary * _Nullable (^SDWebImageDownloaderHeadersFilterB
                                                   progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
                                                  completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock;
 
+/**
+ * Same as downloadImageWithURL:options:progress:completed:, but the image is decoded straight at a reduced size that
+ * fills targetPixelSize. Downloads of the same URL are still shared, each handler gets the image for its own size.
+ * 和downloadImageWithURL:options:progress:completed:一样，但是图片直接按铺满targetPixelSize的缩小尺寸解码。
+ * 同一个URL的下载仍然共用，每个回调收到自己大小的图片
+ * @param targetPixelSize The size in pixels the image is displayed at, CGSizeZero for the full size
+ */
+- (nullable SDWebImageDownloadToken *)downloadImageWithURL:(nullable NSURL *)url
+                                                   options:(SDWebImageDownloaderOptions)options
+                                           targetPixelSize:(CGSize)targetPixelSize
+                                                  progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                                                 completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock;
+
 /**
  * Cancels a download that was previously queued using -downloadImageWithURL:options:progress:completed:
  * 取消一个下载，之前使用-downloadImageWithURL:options:progress:completed:
@@ -147,10 +147,18 @@
                                                    options:(SDWebImageDownloaderOptions)options
                                                   progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
                                                  completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock {
+    return [self downloadImageWithURL:url options:options targetPixelSize:CGSizeZero progress:progressBlock completed:completedBlock];
+}
+
+- (nullable SDWebImageDownloadToken *)downloadImageWithURL:(nullable NSURL *)url
+                                                   options:(SDWebImageDownloaderOptions)options
+                                           targetPixelSize:(CGSize)targetPixelSize
+                                                  progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                                                 completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock {
     __weak SDWebImageDownloader *wself = self;
     
     // 这里返回一个SDWebImageDownloadToken对象
-    return [self addProgressCallback:progressBlock completedBlock:completedBlock forURL:url createCallback:^SDWebImageDownloaderOperation *{
+    return [self addProgressCallback:progressBlock completedBlock:completedBlock targetPixelSize:targetPixelSize forURL:url createCallback:^SDWebImageDownloaderOperation *{
         __strong __typeof (wself) sself = wself;
         NSTimeInterval timeoutInterval = sself.downloadTimeout;
         if (timeoutInterval == 0.0) {
@@ -233,6 +241,7 @@
 
 - (nullable SDWebImageDownloadToken *)addProgressCallback:(SDWebImageDownloaderProgressBlock)progressBlock
                                            completedBlock:(SDWebImageDownloaderCompletedBlock)completedBlock
+                                          targetPixelSize:(CGSize)targetPixelSize
                                                    forURL:(nullable NSURL *)url
                                            createCallback:(SDWebImageDownloaderOperation *(^)())createCallback {
     // The URL will be used as the key to the callbacks dictionary so it cannot be nil. If it is nil immediately call the completed block with no image or data.
@@ -267,7 +276,13 @@
               };
             };
         }
-        id downloadOperationCancelToken = [operation addHandlersForProgress:progressBlock completed:completedBlock];
+        // 同一个URL的下载共用一个operation，每个回调带着自己的目标大小
+        id downloadOperationCancelToken = nil;
+        if ([operation respondsToSelector:@selector(addHandlersForProgress:completed:targetPixelSize:)]) {
+            downloadOperationCancelToken = [operation addHandlersForProgress:progressBlock completed:completedBlock targetPixelSize:targetPixelSize];
+        } else {
+            downloadOperationCancelToken = [operation addHandlersForProgress:progressBlock completed:completedBlock];
+        }
 
         token = [SDWebImageDownloadToken new];
         token.url = url;
@@ -36,6 +36,13 @@ extern NSString * _Nonnull const SDWebImageDownloadFinishNotification;
 - (nullable NSURLCredential *)credential;
 - (void)setCredential:(nullable NSURLCredential *)value;
 
+@optional
+
+// 完成的回调收到按targetPixelSize缩小解码的图片，没有实现时下载器退回到原尺寸
+- (nullable id)addHandlersForProgress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                            completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock
+                      targetPixelSize:(CGSize)targetPixelSize;
+
 @end
 
 
@@ -119,6 +126,18 @@ extern NSString * _Nonnull const SDWebImageDownloadFinishNotification;
 - (nullable id)addHandlersForProgress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
                             completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock;
 
+/**
+ *  Same as addHandlersForProgress:completed:, but the completed block gets the image decoded straight at a reduced size
+ *  that fills targetPixelSize. The data is decoded once per distinct size among the handlers, the image data passed
+ *  to every handler is the original one.
+ *  和addHandlersForProgress:completed:一样，但是完成的回调收到直接按铺满targetPixelSize的缩小尺寸解码的图片。
+ *  所有回调中每种大小只解码一次，传给每个回调的图像数据都是原始数据
+ *  @param targetPixelSize the size in pixels the image is displayed at, CGSizeZero for the full size
+ */
+- (nullable id)addHandlersForProgress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                            completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock
+                      targetPixelSize:(CGSize)targetPixelSize;
+
 /**
  *  Cancels a set of callbacks. Once all callbacks are canceled, the operation is cancelled.
  *  取消一组回调。 一旦所有回调被取消，操作被取消。
@@ -12,6 +12,7 @@
 #import <ImageIO/ImageIO.h>
 #import "SDWebImageManager.h"
 #import "NSImage+WebCache.h"
+#import "SDBitmapBufferPool.h"
 
 NSString *const SDWebImageDownloadStartNotification = @"SDWebImageDownloadStartNotification";
 NSString *const SDWebImageDownloadReceiveResponseNotification = @"SDWebImageDownloadReceiveResponseNotification";
@@ -20,6 +21,7 @@ NSString *const SDWebImageDownloadFinishNotification = @"SDWebImageDownloadFinis
 
 static NSString *const kProgressCallbackKey = @"progress";
 static NSString *const kCompletedCallbackKey = @"completed";
+static NSString *const kTargetPixelSizeCallbackKey = @"targetPixelSize";
 
 typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
 
@@ -29,7 +31,12 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
 
 @property (assign, nonatomic, getter = isExecuting) BOOL executing;
 @property (assign, nonatomic, getter = isFinished) BOOL finished;
+// Progressive decoding needs contiguous bytes, so only that path accumulates into a growing buffer
+// 渐进式解码需要连续的内存，只有这种情况才会拼到一块NSMutableData中
 @property (strong, nonatomic, nullable) NSMutableData *imageData;
+// Otherwise the received segments are only retained (not copied) and mapped once when the download completes
+// 其他情况下收到的数据段只持有不拷贝，下载完成时再一次性map成连续内存
+@property (strong, nonatomic, nullable) dispatch_data_t receivedData;
 
 // This is weak because it is injected by whoever manages this session. If this gets nil-ed out, we won't be able to run
 // the task associated with this operation
@@ -89,9 +96,18 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
 // 添加处理程序进度和完成的回调。 返回可传递到-cancel：以取消此回调集合的令牌。
 - (nullable id)addHandlersForProgress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
                             completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock {
+    return [self addHandlersForProgress:progressBlock completed:completedBlock targetPixelSize:CGSizeZero];
+}
+
+- (nullable id)addHandlersForProgress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                            completed:(nullable SDWebImageDownloaderCompletedBlock)completedBlock
+                      targetPixelSize:(CGSize)targetPixelSize {
     SDCallbacksDictionary *callbacks = [NSMutableDictionary new];
     if (progressBlock) callbacks[kProgressCallbackKey] = [progressBlock copy];
     if (completedBlock) callbacks[kCompletedCallbackKey] = [completedBlock copy];
+    if (targetPixelSize.width > 0 && targetPixelSize.height > 0) {
+        callbacks[kTargetPixelSizeCallbackKey] = [NSValue valueWithBytes:&targetPixelSize objCType:@encode(CGSize)];
+    }
     dispatch_barrier_async(self.barrierQueue, ^{
         [self.callbackBlocks addObject:callbacks];
     });
@@ -249,6 +265,7 @@ typedef NSMutableDictionary<NSString *, id> SDCallbacksDictionary;
     });
     self.dataTask = nil;
     self.imageData = nil;
+    self.receivedData = nil;
     if (self.ownedSession) {
         [self.ownedSession invalidateAndCancel];
         self.ownedSession = nil;
@@ -292,7 +309,11 @@ didReceiveResponse:(NSURLResponse *)response
             progressBlock(0, expected, self.request.URL);
         }
         
-        self.imageData = [[NSMutableData alloc] initWithCapacity:expected];
+        if (self.options & SDWebImageDownloaderProgressiveDownload) {
+            self.imageData = [[NSMutableData alloc] initWithCapacity:expected];
+        } else {
+            self.receivedData = dispatch_data_empty;
+        }
         self.response = response;
         // 不过好像SDWebImage中并没有addObserver这个SDWebImageDownloadReceiveResponseNotification
         // 可能需要用户自己去使用addObserver
@@ -330,7 +351,16 @@ didReceiveResponse:(NSURLResponse *)response
 
 - (void)URLSession:(NSURLSession *)session dataTask:(NSURLSessionDataTask *)dataTask didReceiveData:(NSData *)data {
     // 如果image比较大的话，会多次调用didReceiveData，这样一个image就分成很多块了，所以每次receive到data，就串起来
-    [self.imageData appendData:data];
+    if (self.receivedData) {
+        // Retain the segment instead of copying it into a growing buffer
+        // 只持有这段数据，不再拷贝到不断增长的缓冲区中
+        dispatch_data_t segment = dispatch_data_create(data.bytes, data.length, NULL, ^{
+            (void)data;
+        });
+        self.receivedData = dispatch_data_create_concat(self.receivedData, segment);
+    } else {
+        [self.imageData appendData:data];
+    }
     
     // 单独处理SDWebImageDownloaderProgressiveDownload
     // SDWebImageProgressiveDownload表示image的显示过程是随着下载的进度一点点进行的，而不是下载完成后，一次显示完成。这就可以理解了，因为要随着下载进度显示，所以每接收到新的data，就要显示一下。为什么还需要completedBlock呢？因为在didReceiveData中只是获取到了imageData，但是还需要显示在imageView上呢？那就得使用completedBlock来进行处理。所以SDWebImageProgressiveDownload默认的图片显示是交给用户进行处理的
@@ -394,12 +424,16 @@ didReceiveResponse:(NSURLResponse *)response
             if (partialImageRef) {
                 const size_t partialHeight = CGImageGetHeight(partialImageRef);
                 CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
-                CGContextRef bmContext = CGBitmapContextCreate(NULL, width, height, 8, width * 4, colorSpace, kCGBitmapByteOrderDefault | kCGImageAlphaPremultipliedFirst);
+                // 每收到一段数据都要画一张完整大小的图，缓冲区从池中取，上一张部分图片释放后这里直接复用
+                SDBitmapBufferPool *bufferPool = [SDBitmapBufferPool sharedPool];
+                CGContextRef bmContext = [bufferPool createBitmapContextWithWidth:width height:height bitsPerComponent:8 bytesPerRow:width * 4 colorSpace:colorSpace bitmapInfo:kCGBitmapByteOrderDefault | kCGImageAlphaPremultipliedFirst];
                 CGColorSpaceRelease(colorSpace);
                 if (bmContext) {
+                    // 复用的缓冲区没有清零，还没下载到的部分要透明
+                    CGContextClearRect(bmContext, CGRectMake(0, 0, width, height));
                     CGContextDrawImage(bmContext, (CGRect){.origin.x = 0.0f, .origin.y = 0.0f, .size.width = width, .size.height = partialHeight}, partialImageRef);
                     CGImageRelease(partialImageRef);
-                    partialImageRef = CGBitmapContextCreateImage(bmContext);
+                    partialImageRef = [bufferPool createImageFromBitmapContext:bmContext];
                     CGContextRelease(bmContext);
                 }
                 else {
@@ -439,8 +473,9 @@ didReceiveResponse:(NSURLResponse *)response
         CFRelease(imageSource);
     }
 
+    NSInteger receivedSize = self.receivedData ? (NSInteger)dispatch_data_get_size(self.receivedData) : (NSInteger)self.imageData.length;
     for (SDWebImageDownloaderProgressBlock progressBlock in [self callbacksForKey:kProgressCallbackKey]) {
-        progressBlock(self.imageData.length, self.expectedSize, self.request.URL);
+        progressBlock(receivedSize, self.expectedSize, self.request.URL);
     }
 }
 
@@ -489,9 +524,22 @@ didReceiveResponse:(NSURLResponse *)response
              *  `SDWebImageDownloaderIgnoreCachedResponse`，响应数据将是nil。
              *  因此我们不需要检查缓存选项在这里，因为系统将服从缓存选项
              */
-            if (self.imageData) {
-                UIImage *image = [UIImage sd_imageWithData:self.imageData];
+            // Single copy at most: mapping a one-segment chain doesn't copy at all
+            // 最多拷贝一次，只有一个数据段时map不会拷贝
+            NSData *imageData = self.imageData;
+            if (self.receivedData) {
+                imageData = (NSData *)dispatch_data_create_map(self.receivedData, NULL, NULL);
+            }
+            if (imageData) {
                 NSString *key = [[SDWebImageManager sharedManager] cacheKeyForURL:self.request.URL];
+                // 有回调要缩小的图片时，每种大小直接从数据解码一次
+                NSDictionary<NSValue *, UIImage *> *downsampledImages = [self downsampledImagesWithData:imageData key:key];
+                if (downsampledImages.count > 0 && ![self needsFullSizeImageWithDownsampledImages:downsampledImages]) {
+                    [self callCompletionBlocksWithDownsampledImages:downsampledImages image:nil imageData:imageData];
+                    [self done];
+                    return;
+                }
+                UIImage *image = [UIImage sd_imageWithData:imageData];
                 image = [self scaledImageForKey:key image:image];
                 // 不解压gif
                 // Do not force decoding animated GIFs
@@ -500,7 +548,7 @@ didReceiveResponse:(NSURLResponse *)response
                         if (self.options & SDWebImageDownloaderScaleDownLargeImages) {
 #if SD_UIKIT || SD_WATCH
                             image = [UIImage decodedAndScaledDownImageWithImage:image];
-                            [self.imageData setData:UIImagePNGRepresentation(image)];
+                            imageData = UIImagePNGRepresentation(image);
 #endif
                         } else {
                             image = [UIImage decodedImageWithImage:image];
@@ -510,8 +558,10 @@ didReceiveResponse:(NSURLResponse *)response
                 if (CGSizeEqualToSize(image.size, CGSizeZero)) {
                     // 图片大小为0，报错
                     [self callCompletionBlocksWithError:[NSError errorWithDomain:SDWebImageErrorDomain code:0 userInfo:@{NSLocalizedDescriptionKey : @"Downloaded image has 0 pixels"}]];
+                } else if (downsampledImages.count > 0) {
+                    [self callCompletionBlocksWithDownsampledImages:downsampledImages image:image imageData:imageData];
                 } else {
-                    [self callCompletionBlocksWithImage:image imageData:self.imageData error:nil finished:YES];
+                    [self callCompletionBlocksWithImage:image imageData:imageData error:nil finished:YES];
                 }
             } else {
                 // image为空，报错
@@ -602,6 +652,60 @@ didReceiveResponse:(NSURLResponse *)response
     [self callCompletionBlocksWithImage:nil imageData:nil error:error finished:YES];
 }
 
+// 按回调要求的大小缩小解码，缩小不了的大小不在返回的字典中
+- (nonnull NSDictionary<NSValue *, UIImage *> *)downsampledImagesWithData:(nonnull NSData *)imageData key:(nullable NSString *)key {
+    __block NSArray<NSValue *> *targetPixelSizes = nil;
+    dispatch_sync(self.barrierQueue, ^{
+        targetPixelSizes = [self.callbackBlocks valueForKey:kTargetPixelSizeCallbackKey];
+    });
+    NSMutableDictionary<NSValue *, UIImage *> *downsampledImages = [NSMutableDictionary dictionary];
+    for (NSValue *targetPixelSize in [NSSet setWithArray:targetPixelSizes]) {
+        if ([targetPixelSize isKindOfClass:[NSValue class]]) {
+            CGSize size = CGSizeZero;
+            [targetPixelSize getValue:&size];
+            UIImage *image = [UIImage decodedImageWithData:imageData targetPixelSize:size];
+            if (image) {
+                downsampledImages[targetPixelSize] = [self scaledImageForKey:key image:image];
+            }
+        }
+    }
+    return downsampledImages;
+}
+
+// 有回调不要缩小(或者它的大小缩小不了)时，还要按原尺寸解码
+- (BOOL)needsFullSizeImageWithDownsampledImages:(nonnull NSDictionary<NSValue *, UIImage *> *)downsampledImages {
+    __block BOOL needsFullSizeImage = NO;
+    dispatch_sync(self.barrierQueue, ^{
+        for (SDCallbacksDictionary *callbacks in self.callbackBlocks) {
+            NSValue *targetPixelSize = callbacks[kTargetPixelSizeCallbackKey];
+            if (callbacks[kCompletedCallbackKey] && (!targetPixelSize || !downsampledImages[targetPixelSize])) {
+                needsFullSizeImage = YES;
+                break;
+            }
+        }
+    });
+    return needsFullSizeImage;
+}
+
+// 每个回调收到自己大小的图片，没有缩小的收到原尺寸的image
+- (void)callCompletionBlocksWithDownsampledImages:(nonnull NSDictionary<NSValue *, UIImage *> *)downsampledImages
+                                            image:(nullable UIImage *)image
+                                        imageData:(nullable NSData *)imageData {
+    __block NSArray<SDCallbacksDictionary *> *callbackBlocks = nil;
+    dispatch_sync(self.barrierQueue, ^{
+        callbackBlocks = [self.callbackBlocks copy];
+    });
+    dispatch_main_async_safe(^{
+        for (SDCallbacksDictionary *callbacks in callbackBlocks) {
+            SDWebImageDownloaderCompletedBlock completedBlock = callbacks[kCompletedCallbackKey];
+            if (completedBlock) {
+                NSValue *targetPixelSize = callbacks[kTargetPixelSizeCallbackKey];
+                completedBlock((targetPixelSize ? downsampledImages[targetPixelSize] : nil) ?: image, imageData, nil, YES);
+            }
+        }
+    });
+}
+
 - (void)callCompletionBlocksWithImage:(nullable UIImage *)image
                             imageData:(nullable NSData *)imageData
                                 error:(nullable NSError *)error
@@ -270,6 +270,23 @@ SDWebImageManager *manager = [SDWebImageManager sharedManager];
                                              progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
                                             completed:(nullable SDInternalCompletionBlock)completedBlock;
 
+/**
+ * Same as loadImageWithURL:options:progress:completed:, for an image displayed at targetPixelSize (the view size
+ * multiplied by the screen scale). Cached and downloaded images are decoded straight at a reduced size that fills
+ * the target instead of at full resolution, and kept in the memory cache per (URL, size). The disk cache still
+ * holds the original image data, so other sizes are decoded from the same file.
+ * 和loadImageWithURL:options:progress:completed:一样，用于按targetPixelSize(视图大小乘以屏幕scale)显示的图片。
+ * 缓存中和下载的图片直接按铺满目标的缩小尺寸解码，不再按原分辨率解码，内存缓存中按(URL, 大小)分别保存。
+ * 磁盘缓存中仍然是原始图像数据，其他大小从同一个文件解码
+ * @param targetPixelSize The size in pixels the image is displayed at, CGSizeZero for the full size
+ *                        图片显示的像素大小，CGSizeZero表示原尺寸
+ */
+- (nullable id <SDWebImageOperation>)loadImageWithURL:(nullable NSURL *)url
+                                              options:(SDWebImageOptions)options
+                                      targetPixelSize:(CGSize)targetPixelSize
+                                             progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                                            completed:(nullable SDInternalCompletionBlock)completedBlock;
+
 /**
  * Saves image to cache for given URL
  *
@@ -127,6 +127,14 @@
                                      options:(SDWebImageOptions)options
                                     progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
                                    completed:(nullable SDInternalCompletionBlock)completedBlock {
+    return [self loadImageWithURL:url options:options targetPixelSize:CGSizeZero progress:progressBlock completed:completedBlock];
+}
+
+- (id <SDWebImageOperation>)loadImageWithURL:(nullable NSURL *)url
+                                     options:(SDWebImageOptions)options
+                             targetPixelSize:(CGSize)targetPixelSize
+                                    progress:(nullable SDWebImageDownloaderProgressBlock)progressBlock
+                                   completed:(nullable SDInternalCompletionBlock)completedBlock {
     // Invoking this method without a completedBlock is pointless
     // 如果没有设置completedBlock来调用这个方法是没有意义的
     NSAssert(completedBlock != nil, @"If you mean to prefetch the image, use -[SDWebImagePrefetcher prefetchURLs] instead");
@@ -174,7 +182,8 @@
     
     // 这里设定了operation的缓存队列，通过上面获取到的cacheKey来查询缓存
     // queryCacheOperationForKey是通过key来获取缓存，无论是从内存，从磁盘中还是从网络
-    operation.cacheOperation = [self.imageCache queryCacheOperationForKey:key done:^(UIImage *cachedImage, NSData *cachedData, SDImageCacheType cacheType) {
+    // 有目标大小时，缓存中按(key, 大小)查找缩小解码的图片
+    operation.cacheOperation = [self.imageCache queryCacheOperationForKey:key targetPixelSize:targetPixelSize done:^(UIImage *cachedImage, NSData *cachedData, SDImageCacheType cacheType) {
         // 如果对当前operation进行了取消操作，在SDWebImageManager的runningOperations移除operation
         if (operation.isCancelled) {
             [self safelyRemoveOperationFromRunning:operation];
@@ -223,7 +232,7 @@
             
             // 创建一个下载的TOKEN
             // 调用imageDownloader去下载image
-            SDWebImageDownloadToken *subOperationToken = [self.imageDownloader downloadImageWithURL:url options:downloaderOptions progress:progressBlock completed:^(UIImage *downloadedImage, NSData *downloadedData, NSError *error, BOOL finished) {
+            SDWebImageDownloadToken *subOperationToken = [self.imageDownloader downloadImageWithURL:url options:downloaderOptions targetPixelSize:targetPixelSize progress:progressBlock completed:^(UIImage *downloadedImage, NSData *downloadedData, NSError *error, BOOL finished) {
                 
                 // strong可以参考这个文章
                 // http://www.jianshu.com/p/bb63aabdb2db
@@ -283,7 +292,7 @@
                                 BOOL imageWasTransformed = ![transformedImage isEqual:downloadedImage];
                                 // pass nil if the image was transformed, so we can recalculate the data from the image
                                 // 如果图像被转换，则给imageData传入nil，因此我们可以从图像重新计算数据
-                                [self.imageCache storeImage:transformedImage imageData:(imageWasTransformed ? nil : downloadedData) forKey:key toDisk:cacheOnDisk completion:nil];
+                                [self.imageCache storeImage:transformedImage imageData:(imageWasTransformed ? nil : downloadedData) forKey:key targetPixelSize:targetPixelSize toDisk:cacheOnDisk completion:nil];
                             }
                             
                             [self callCompletionBlockForOperation:strongOperation completion:completedBlock image:transformedImage data:downloadedData error:nil cacheType:SDImageCacheTypeNone finished:finished url:url];
@@ -291,7 +300,7 @@
                     } else {
                         // 下载好了图片且完成了
                         if (downloadedImage && finished) {
-                            [self.imageCache storeImage:downloadedImage imageData:downloadedData forKey:key toDisk:cacheOnDisk completion:nil];
+                            [self.imageCache storeImage:downloadedImage imageData:downloadedData forKey:key targetPixelSize:targetPixelSize toDisk:cacheOnDisk completion:nil];
                         }
                         [self callCompletionBlockForOperation:strongOperation completion:completedBlock image:downloadedImage data:downloadedData error:nil cacheType:SDImageCacheTypeNone finished:finished url:url];
                     }